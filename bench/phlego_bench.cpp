@@ -0,0 +1,154 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "block_engine.h"
+#include "cpu.h"
+#include "logger.h"
+#include "memory.h"
+#include "workloads.h"
+
+namespace {
+
+/**
+ * @brief Measurements for one workload on one engine.
+ */
+struct Result {
+    uint64_t instructions = 0; ///< Guest instructions retired.
+    double seconds = 0.0;      ///< Wall time of the run.
+    uint64_t cycles = 0;       ///< Host timestamp-counter ticks, 0 if unavailable.
+    uint32_t checksum = 0;     ///< Value of a0 at the end of the run.
+};
+
+/**
+ * @brief Read the host cycle counter.
+ *
+ * @return uint64_t The counter value, or 0 on hosts without one.
+ */
+uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Run a workload once on a fresh machine.
+ *
+ * @param workload The workload to run.
+ * @param engine "pipeline" or "block".
+ * @return Result The measurements.
+ */
+Result run_once(const Workload& workload, const std::string& engine) {
+    Memory memory;
+    for (size_t i = 0; i < workload.code.size(); ++i) {
+        memory.store_word(bench_layout::CODE_BASE + static_cast<uint32_t>(i * 4), workload.code[i]);
+    }
+    CPU cpu(memory);
+    cpu.set_pc(bench_layout::CODE_BASE);
+    cpu.set_sp(bench_layout::STACK_TOP);
+
+    Result result;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t start_cycles = read_cycles();
+    if (engine == "block") {
+        BlockEngine block_engine(cpu);
+        block_engine.run();
+        result.instructions = block_engine.get_instructions_retired();
+    } else {
+        cpu.run();
+        result.instructions = cpu.get_instructions_retired();
+    }
+    result.cycles = read_cycles() - start_cycles;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.checksum = cpu.get_register(10);
+    return result;
+}
+
+} // namespace
+
+/**
+ * @brief Run the benchmark workloads on each engine and report throughput.
+ *
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return int 0 on success, 1 on bad usage or if the engines disagree.
+ */
+int main(int argc, char* argv[]) {
+    std::vector<std::string> engines = {"pipeline", "block"};
+    std::string only;
+    uint32_t scale = 1;
+    int repeat = 3;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--engine=", 0) == 0 && (arg.substr(9) == "pipeline" || arg.substr(9) == "block")) {
+            engines = {arg.substr(9)};
+        } else if (arg.rfind("--workload=", 0) == 0) {
+            only = arg.substr(11);
+        } else if (arg.rfind("--scale=", 0) == 0 && std::stoul(arg.substr(8)) > 0) {
+            scale = static_cast<uint32_t>(std::stoul(arg.substr(8)));
+        } else if (arg.rfind("--repeat=", 0) == 0 && std::stoi(arg.substr(9)) > 0) {
+            repeat = std::stoi(arg.substr(9));
+        } else {
+            LOG_ERROR("Usage: phlego_bench [--engine=pipeline|block] [--workload=<name>] [--scale=<n>] [--repeat=<n>]");
+            return 1;
+        }
+    }
+
+    // Keep per-run logging out of the measurements
+    Logger::set_level(LOG_LEVEL_ERROR);
+
+    std::printf("%-8s %-9s %14s %10s %9s %12s  %s\n",
+                "workload", "engine", "instructions", "time(ms)", "MIPS", "cycles/inst", "checksum");
+
+    bool consistent = true;
+    bool found = false;
+    for (const Workload& workload : make_workloads(scale)) {
+        if (!only.empty() && workload.name != only) {
+            continue;
+        }
+        found = true;
+
+        std::vector<uint32_t> checksums;
+        for (const std::string& engine : engines) {
+            // Report the fastest of the repeated runs
+            Result best;
+            for (int run = 0; run < repeat; ++run) {
+                Result result = run_once(workload, engine);
+                if (run == 0 || result.seconds < best.seconds) {
+                    best = result;
+                }
+            }
+            checksums.push_back(best.checksum);
+
+            double mips = best.seconds > 0.0 ? static_cast<double>(best.instructions) / best.seconds / 1e6 : 0.0;
+            char cycles[32] = "-";
+            if (best.cycles != 0 && best.instructions != 0) {
+                std::snprintf(cycles, sizeof(cycles), "%.1f",
+                              static_cast<double>(best.cycles) / static_cast<double>(best.instructions));
+            }
+            std::printf("%-8s %-9s %14llu %10.2f %9.2f %12s  0x%08x\n",
+                        workload.name.c_str(), engine.c_str(), static_cast<unsigned long long>(best.instructions),
+                        best.seconds * 1e3, mips, cycles, best.checksum);
+        }
+
+        for (uint32_t checksum : checksums) {
+            if (checksum != checksums.front()) {
+                LOG_ERROR("Engines disagree on workload: " + workload.name);
+                consistent = false;
+                break;
+            }
+        }
+    }
+
+    if (!found) {
+        LOG_ERROR("Unknown workload: " + only);
+        return 1;
+    }
+    return consistent ? 0 : 1;
+}
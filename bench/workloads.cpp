@@ -0,0 +1,485 @@
+#include "workloads.h"
+#include <stdexcept>
+
+namespace
+{
+    // Integer register numbers by ABI name
+    constexpr uint32_t ZERO = 0, RA = 1, SP = 2, T0 = 5, T1 = 6, T2 = 7, S0 = 8, S1 = 9;
+    constexpr uint32_t A0 = 10, A1 = 11, A2 = 12, A3 = 13, A4 = 14, A5 = 15, A6 = 16, A7 = 17;
+    constexpr uint32_t S2 = 18, S3 = 19, S4 = 20, T3 = 28, T4 = 29, T5 = 30, T6 = 31;
+
+    constexpr Assembler::Label UNBOUND = static_cast<Assembler::Label>(-1);
+
+    /**
+     * @brief Emit one xorshift32 step on a register.
+     *
+     * @param as The assembler.
+     * @param x The state register.
+     * @param scratch A scratch register.
+     */
+    void xorshift(Assembler &as, uint32_t x, uint32_t scratch)
+    {
+        as.slli(scratch, x, 13);
+        as.xor_(x, x, scratch);
+        as.srli(scratch, x, 17);
+        as.xor_(x, x, scratch);
+        as.slli(scratch, x, 5);
+        as.xor_(x, x, scratch);
+    }
+
+    /**
+     * @brief Tight ALU loop with no memory traffic.
+     */
+    Workload alu_loop(uint32_t iterations)
+    {
+        Assembler as;
+        as.li(A0, 1);
+        as.li(A1, 0x9E3779B9);
+        as.li(A5, 3);
+        as.li(S0, iterations);
+        Assembler::Label loop = as.new_label();
+        as.bind(loop);
+        as.add(A2, A0, A1);
+        as.xor_(A3, A2, A0);
+        as.sll(A4, A3, A5);
+        as.srl(A6, A4, A5);
+        as.or_(A0, A6, A2);
+        as.and_(A7, A0, A3);
+        as.sub(A1, A1, A7);
+        as.addi(A1, A1, 7);
+        as.addi(S0, S0, -1);
+        as.bne(S0, ZERO, loop);
+        as.jalr(ZERO, RA, 0);
+        return {"alu", "dependent add/xor/shift chain", as.finish()};
+    }
+
+    /**
+     * @brief Word and byte load/store stream over a 16 KiB array.
+     */
+    Workload load_store_stream(uint32_t passes)
+    {
+        constexpr uint32_t ARRAY_SIZE = 0x4000;
+        Assembler as;
+        as.li(S0, passes);
+        as.li(S1, bench_layout::DATA_BASE);
+        as.li(S2, bench_layout::DATA_BASE + ARRAY_SIZE);
+        as.li(A0, 0);
+        Assembler::Label pass = as.new_label();
+        Assembler::Label element = as.new_label();
+        as.bind(pass);
+        as.addi(T0, S1, 0);
+        as.bind(element);
+        as.lw(T1, T0, 0);
+        as.lw(T2, T0, 4);
+        as.lw(T3, T0, 8);
+        as.lb(T4, T0, 12);
+        as.add(T1, T1, S0);
+        as.add(T2, T2, T1);
+        as.add(T3, T3, T2);
+        as.add(A0, A0, T4);
+        as.sw(T1, T0, 0);
+        as.sw(T2, T0, 4);
+        as.sw(T3, T0, 8);
+        as.sb(T3, T0, 12);
+        as.addi(T0, T0, 16);
+        as.bne(T0, S2, element);
+        as.addi(S0, S0, -1);
+        as.bne(S0, ZERO, pass);
+        as.jalr(ZERO, RA, 0);
+        return {"stream", "lw/lb/sw/sb stream over a 16 KiB array", as.finish()};
+    }
+
+    /**
+     * @brief Data-dependent branches driven by a xorshift generator.
+     */
+    Workload branchy(uint32_t iterations)
+    {
+        Assembler as;
+        as.li(A0, 0x2545F491);
+        as.li(A1, 0);
+        as.li(A2, 0);
+        as.li(A3, 0);
+        as.li(S0, iterations);
+        Assembler::Label loop = as.new_label();
+        as.bind(loop);
+        xorshift(as, A0, T0);
+        for (int bit = 0; bit < 4; ++bit)
+        {
+            Assembler::Label skip = as.new_label();
+            as.andi(T1, A0, 1 << (bit * 3));
+            if (bit & 1)
+            {
+                as.bne(T1, ZERO, skip);
+                as.addi(A1, A1, 1);
+            }
+            else
+            {
+                as.beq(T1, ZERO, skip);
+                as.xor_(A2, A2, A0);
+            }
+            as.bind(skip);
+        }
+        as.andi(T1, A0, 0x700);
+        Assembler::Label next = as.new_label();
+        as.bne(T1, ZERO, next);
+        as.addi(A3, A3, 1); // Reached one time in eight
+        as.bind(next);
+        as.addi(S0, S0, -1);
+        as.bne(S0, ZERO, loop);
+        as.jalr(ZERO, RA, 0);
+        return {"branchy", "unpredictable beq/bne on random bits", as.finish()};
+    }
+
+    /**
+     * @brief Multiply and divide heavy kernel.
+     */
+    Workload mul_div(uint32_t iterations)
+    {
+        Assembler as;
+        as.li(A0, 0x12345679);
+        as.li(A1, 0);
+        as.li(A2, 0);
+        as.li(S0, iterations);
+        Assembler::Label loop = as.new_label();
+        as.bind(loop);
+        xorshift(as, A0, T0);
+        as.andi(T1, A0, 0x7FF);
+        as.addi(T1, T1, 1); // Divisor is never zero
+        as.mul(T2, A0, A0);
+        as.mulhu(T3, A0, T2);
+        as.div(T4, T2, T1);
+        as.rem(T5, T3, T1);
+        as.remu(T6, A0, T1);
+        as.add(A1, A1, T4);
+        as.add(A1, A1, T5);
+        as.mul(A2, A2, T6);
+        as.add(A2, A2, T3);
+        as.addi(S0, S0, -1);
+        as.bne(S0, ZERO, loop);
+        as.jalr(ZERO, RA, 0);
+        return {"muldiv", "mul/mulhu/div/rem/remu kernel", as.finish()};
+    }
+
+    /**
+     * @brief CoreMark-style mix of list walking, a CRC and a dot product.
+     *
+     * The kernels are called with JAL and return through t0, so ra keeps the
+     * zero return address that ends the program.
+     */
+    Workload coremark_mix(uint32_t iterations)
+    {
+        constexpr uint32_t NODES = 128;
+        constexpr uint32_t NODE_SIZE = 8;
+        constexpr uint32_t MATRIX = bench_layout::DATA_BASE + 0x4000;
+        constexpr uint32_t ROW = 16;
+
+        Assembler as;
+        Assembler::Label list_sum = as.new_label();
+        Assembler::Label crc = as.new_label();
+        Assembler::Label dot = as.new_label();
+
+        // Build a linked list of nodes {next, value} terminated by a null node
+        as.li(S1, bench_layout::DATA_BASE);
+        as.li(T1, NODES - 1);
+        as.addi(T0, S1, 0);
+        Assembler::Label build = as.new_label();
+        as.bind(build);
+        as.addi(T2, T0, NODE_SIZE);
+        as.sw(T2, T0, 0);
+        as.sw(T1, T0, 4);
+        as.addi(T0, T2, 0);
+        as.addi(T1, T1, -1);
+        as.bne(T1, ZERO, build);
+        as.sw(ZERO, T0, 0);
+        as.sw(ZERO, T0, 4);
+
+        // Fill the matrix row with small values
+        as.li(S2, MATRIX);
+        as.li(T1, ROW);
+        as.addi(T0, S2, 0);
+        Assembler::Label fill = as.new_label();
+        as.bind(fill);
+        as.sw(T1, T0, 0);
+        as.addi(T0, T0, 4);
+        as.addi(T1, T1, -1);
+        as.bne(T1, ZERO, fill);
+
+        as.li(S0, iterations);
+        as.li(S3, 0xFFFF);
+        as.li(S4, 0);
+        Assembler::Label loop = as.new_label();
+        as.bind(loop);
+        as.jal(T0, list_sum);
+        as.add(S4, S4, A0);
+        as.jal(T0, crc);
+        as.jal(T0, dot);
+        as.add(S4, S4, A0);
+        as.sw(S4, SP, -4);
+        as.lw(S4, SP, -4);
+        as.addi(S0, S0, -1);
+        as.bne(S0, ZERO, loop);
+        as.addi(A0, S4, 0);
+        as.add(A1, S3, ZERO);
+        as.jalr(ZERO, RA, 0);
+
+        // a0 = sum of the list values
+        as.bind(list_sum);
+        as.li(A0, 0);
+        as.addi(T1, S1, 0);
+        Assembler::Label walk = as.new_label();
+        as.bind(walk);
+        as.lw(T2, T1, 4);
+        as.add(A0, A0, T2);
+        as.lw(T1, T1, 0);
+        as.bne(T1, ZERO, walk);
+        as.jalr(ZERO, T0, 0);
+
+        // s3 = crc16 step over the low byte of s4
+        as.bind(crc);
+        as.andi(T1, S4, 0xFF);
+        as.xor_(S3, S3, T1);
+        as.li(T2, 8);
+        as.li(T4, 0xA001);
+        Assembler::Label bit = as.new_label();
+        Assembler::Label no_poly = as.new_label();
+        as.bind(bit);
+        as.andi(T3, S3, 1);
+        as.srli(S3, S3, 1);
+        as.beq(T3, ZERO, no_poly);
+        as.xor_(S3, S3, T4);
+        as.bind(no_poly);
+        as.addi(T2, T2, -1);
+        as.bne(T2, ZERO, bit);
+        as.jalr(ZERO, T0, 0);
+
+        // a0 = dot product of the matrix row with itself scaled by s3
+        as.bind(dot);
+        as.li(A0, 0);
+        as.addi(T1, S2, 0);
+        as.li(T2, ROW);
+        Assembler::Label element = as.new_label();
+        as.bind(element);
+        as.lw(T3, T1, 0);
+        as.mul(T4, T3, T3);
+        as.mul(T4, T4, S3);
+        as.add(A0, A0, T4);
+        as.addi(T1, T1, 4);
+        as.addi(T2, T2, -1);
+        as.bne(T2, ZERO, element);
+        as.jalr(ZERO, T0, 0);
+
+        return {"mix", "CoreMark-style list walk, crc16 and dot product", as.finish()};
+    }
+
+    /**
+     * @brief 16-tap single-precision FIR filter over 256 samples.
+     */
+    Workload fir_filter(uint32_t passes)
+    {
+        constexpr uint32_t TAPS = 16;
+        constexpr uint32_t SAMPLES = 256;
+        constexpr uint32_t COEFFICIENTS = bench_layout::DATA_BASE;
+        constexpr uint32_t INPUT = COEFFICIENTS + TAPS * 4;
+        constexpr uint32_t OUTPUT = INPUT + SAMPLES * 4;
+        // Floating-point registers
+        constexpr uint32_t FT0 = 0, FT1 = 1, FT2 = 2, FS0 = 8, FS1 = 9;
+
+        Assembler as;
+        // c[k] = (k + 1) / 16 and x[i] = (i & 63) / 16, converted by the guest
+        as.li(T0, 0x3D800000); // 1 / 16
+        as.fmv_w_x(FS0, T0);
+        as.li(T1, COEFFICIENTS);
+        as.li(T2, 1);
+        as.li(T3, TAPS + 1);
+        Assembler::Label coefficient = as.new_label();
+        as.bind(coefficient);
+        as.fcvt_s_w(FT0, T2);
+        as.fmul_s(FT0, FT0, FS0);
+        as.fsw(FT0, T1, 0);
+        as.addi(T1, T1, 4);
+        as.addi(T2, T2, 1);
+        as.bne(T2, T3, coefficient);
+        as.li(T2, 0);
+        as.li(T3, SAMPLES);
+        Assembler::Label sample = as.new_label();
+        as.bind(sample);
+        as.andi(T4, T2, 63);
+        as.fcvt_s_w(FT0, T4);
+        as.fmul_s(FT0, FT0, FS0);
+        as.fsw(FT0, T1, 0);
+        as.addi(T1, T1, 4);
+        as.addi(T2, T2, 1);
+        as.bne(T2, T3, sample);
+
+        as.li(S0, passes);
+        as.fmv_w_x(FS1, ZERO);
+        Assembler::Label pass = as.new_label();
+        Assembler::Label output = as.new_label();
+        Assembler::Label tap = as.new_label();
+        as.bind(pass);
+        as.li(S1, INPUT + (TAPS - 1) * 4);
+        as.li(S2, OUTPUT + (TAPS - 1) * 4);
+        as.li(S3, INPUT + SAMPLES * 4);
+        as.bind(output);
+        as.fmv_w_x(FT2, ZERO);
+        as.li(T1, COEFFICIENTS);
+        as.addi(T2, S1, 0);
+        as.li(T3, TAPS);
+        as.bind(tap);
+        as.flw(FT0, T1, 0);
+        as.flw(FT1, T2, 0);
+        as.fmadd_s(FT2, FT0, FT1, FT2);
+        as.addi(T1, T1, 4);
+        as.addi(T2, T2, -4);
+        as.addi(T3, T3, -1);
+        as.bne(T3, ZERO, tap);
+        as.fsw(FT2, S2, 0);
+        as.fadd_s(FS1, FS1, FT2);
+        as.addi(S1, S1, 4);
+        as.addi(S2, S2, 4);
+        as.bne(S1, S3, output);
+        as.addi(S0, S0, -1);
+        as.bne(S0, ZERO, pass);
+        as.fmv_x_w(A0, FS1);
+        as.jalr(ZERO, RA, 0);
+        return {"fir", "16-tap single-precision FIR filter", as.finish()};
+    }
+}
+
+/**
+ * @brief Create a label that is not bound to an address yet.
+ *
+ * @return Label The new label.
+ */
+Assembler::Label Assembler::new_label()
+{
+    labels.push_back(UNBOUND);
+    return labels.size() - 1;
+}
+
+/**
+ * @brief Bind a label to the next instruction.
+ *
+ * @param label The label to bind.
+ */
+void Assembler::bind(Label label)
+{
+    labels[label] = code.size();
+}
+
+void Assembler::r_type(Operation operation, uint32_t rd, uint32_t rs1, uint32_t rs2)
+{
+    code.push_back(Isa::encoding(operation) | (rs2 << 20) | (rs1 << 15) | (rd << 7));
+}
+
+void Assembler::i_type(Operation operation, uint32_t rd, uint32_t rs1, int32_t imm)
+{
+    code.push_back(Isa::encoding(operation) | (static_cast<uint32_t>(imm & 0xFFF) << 20) | (rs1 << 15) | (rd << 7));
+}
+
+void Assembler::s_type(Operation operation, uint32_t rs1, uint32_t rs2, int32_t imm)
+{
+    uint32_t bits = static_cast<uint32_t>(imm & 0xFFF);
+    code.push_back(Isa::encoding(operation) | ((bits >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | ((bits & 0x1F) << 7));
+}
+
+/**
+ * @brief Emit an FMADD.S, rounding to nearest even.
+ *
+ * @param rd The destination register.
+ * @param rs1 The first factor.
+ * @param rs2 The second factor.
+ * @param rs3 The addend.
+ */
+void Assembler::fmadd_s(uint32_t rd, uint32_t rs1, uint32_t rs2, uint32_t rs3)
+{
+    code.push_back(Isa::encoding(Operation::FMADD_S) | (rs3 << 27) | (rs2 << 20) | (rs1 << 15) | (rd << 7));
+}
+
+void Assembler::b_type(Operation operation, uint32_t rs1, uint32_t rs2, Label target)
+{
+    fixups.push_back({code.size(), target});
+    code.push_back(Isa::encoding(operation) | (rs2 << 20) | (rs1 << 15));
+}
+
+/**
+ * @brief Emit a JAL to a label.
+ *
+ * @param rd The link register.
+ * @param target The jump target.
+ */
+void Assembler::jal(uint32_t rd, Label target)
+{
+    fixups.push_back({code.size(), target});
+    code.push_back(Isa::encoding(Operation::JAL) | (rd << 7));
+}
+
+/**
+ * @brief Load a constant into a register using ADDI and SLLI only.
+ *
+ * @param rd The destination register.
+ * @param value The constant.
+ */
+void Assembler::li(uint32_t rd, uint32_t value)
+{
+    if (value < 0x800)
+    {
+        addi(rd, ZERO, static_cast<int32_t>(value));
+        return;
+    }
+    li(rd, value >> 11);
+    slli(rd, rd, 11);
+    if (value & 0x7FF)
+    {
+        addi(rd, rd, static_cast<int32_t>(value & 0x7FF));
+    }
+}
+
+/**
+ * @brief Resolve branch targets and return the encoded program.
+ *
+ * @return std::vector<uint32_t> The instruction words.
+ */
+std::vector<uint32_t> Assembler::finish()
+{
+    for (const Fixup &fixup : fixups)
+    {
+        if (labels[fixup.label] == UNBOUND)
+        {
+            throw std::logic_error("Branch to an unbound label");
+        }
+
+        uint32_t offset = static_cast<uint32_t>((labels[fixup.label] - fixup.index) * 4);
+        uint32_t &word = code[fixup.index];
+        if ((word & 0x7F) == static_cast<uint32_t>(Opcode::J_TYPE))
+        {
+            word |= (((offset >> 20) & 0x1) << 31) | (((offset >> 1) & 0x3FF) << 21) |
+                    (((offset >> 11) & 0x1) << 20) | (((offset >> 12) & 0xFF) << 12);
+        }
+        else
+        {
+            word |= (((offset >> 12) & 0x1) << 31) | (((offset >> 5) & 0x3F) << 25) |
+                    (((offset >> 1) & 0xF) << 8) | (((offset >> 11) & 0x1) << 7);
+        }
+    }
+    fixups.clear();
+    return code;
+}
+
+/**
+ * @brief Build the benchmark workloads.
+ *
+ * @param scale Multiplier applied to every iteration count.
+ * @return std::vector<Workload> The workloads.
+ */
+std::vector<Workload> make_workloads(uint32_t scale)
+{
+    std::vector<Workload> workloads;
+    workloads.push_back(alu_loop(2000000 * scale));
+    workloads.push_back(load_store_stream(400 * scale));
+    workloads.push_back(branchy(1000000 * scale));
+    workloads.push_back(mul_div(1000000 * scale));
+    workloads.push_back(coremark_mix(20000 * scale));
+    workloads.push_back(fir_filter(100 * scale));
+    return workloads;
+}
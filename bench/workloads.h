@@ -0,0 +1,157 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include "isa.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Minimal RV32IMF encoder for building benchmark guests in memory.
+ *
+ * Only the instructions the emulator executes are provided. Branch and jump
+ * targets are labels that are resolved when the program is finished, so
+ * loops can be written top to bottom.
+ */
+class Assembler
+{
+public:
+    using Label = size_t; ///< Index of a branch target.
+
+    /**
+     * @brief Create a label that is not bound to an address yet.
+     *
+     * @return Label The new label.
+     */
+    Label new_label();
+
+    /**
+     * @brief Bind a label to the next instruction.
+     *
+     * @param label The label to bind.
+     */
+    void bind(Label label);
+
+    void add(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::ADD, rd, rs1, rs2); }
+    void sub(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::SUB, rd, rs1, rs2); }
+    void sll(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::SLL, rd, rs1, rs2); }
+    void srl(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::SRL, rd, rs1, rs2); }
+    void xor_(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::XOR, rd, rs1, rs2); }
+    void or_(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::OR, rd, rs1, rs2); }
+    void and_(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::AND, rd, rs1, rs2); }
+    void sltu(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::SLTU, rd, rs1, rs2); }
+    void mul(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::MUL, rd, rs1, rs2); }
+    void mulhu(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::MULHU, rd, rs1, rs2); }
+    void div(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::DIV, rd, rs1, rs2); }
+    void rem(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::REM, rd, rs1, rs2); }
+    void remu(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::REMU, rd, rs1, rs2); }
+
+    void addi(uint32_t rd, uint32_t rs1, int32_t imm) { i_type(Operation::ADDI, rd, rs1, imm); }
+    void xori(uint32_t rd, uint32_t rs1, int32_t imm) { i_type(Operation::XORI, rd, rs1, imm); }
+    void andi(uint32_t rd, uint32_t rs1, int32_t imm) { i_type(Operation::ANDI, rd, rs1, imm); }
+    void slli(uint32_t rd, uint32_t rs1, int32_t shamt) { i_type(Operation::SLLI, rd, rs1, shamt); }
+    void srli(uint32_t rd, uint32_t rs1, int32_t shamt) { i_type(Operation::SRLI, rd, rs1, shamt); }
+    void lw(uint32_t rd, uint32_t rs1, int32_t imm) { i_type(Operation::LW, rd, rs1, imm); }
+    void lb(uint32_t rd, uint32_t rs1, int32_t imm) { i_type(Operation::LB, rd, rs1, imm); }
+    void sw(uint32_t rs2, uint32_t rs1, int32_t imm) { s_type(Operation::SW, rs1, rs2, imm); }
+    void sb(uint32_t rs2, uint32_t rs1, int32_t imm) { s_type(Operation::SB, rs1, rs2, imm); }
+
+    // Single precision, rounding to nearest even
+    void flw(uint32_t rd, uint32_t rs1, int32_t imm) { i_type(Operation::FLW, rd, rs1, imm); }
+    void fsw(uint32_t rs2, uint32_t rs1, int32_t imm) { s_type(Operation::FSW, rs1, rs2, imm); }
+    void fadd_s(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::FADD_S, rd, rs1, rs2); }
+    void fmul_s(uint32_t rd, uint32_t rs1, uint32_t rs2) { r_type(Operation::FMUL_S, rd, rs1, rs2); }
+    void fcvt_s_w(uint32_t rd, uint32_t rs1) { r_type(Operation::FCVT_S_W, rd, rs1, 0); }
+    void fmv_x_w(uint32_t rd, uint32_t rs1) { r_type(Operation::FMV_X_W, rd, rs1, 0); }
+    void fmv_w_x(uint32_t rd, uint32_t rs1) { r_type(Operation::FMV_W_X, rd, rs1, 0); }
+    void fmadd_s(uint32_t rd, uint32_t rs1, uint32_t rs2, uint32_t rs3);
+
+    void beq(uint32_t rs1, uint32_t rs2, Label target) { b_type(Operation::BEQ, rs1, rs2, target); }
+    void bne(uint32_t rs1, uint32_t rs2, Label target) { b_type(Operation::BNE, rs1, rs2, target); }
+
+    /**
+     * @brief Emit a JAL to a label.
+     *
+     * @param rd The link register.
+     * @param target The jump target.
+     */
+    void jal(uint32_t rd, Label target);
+
+    /**
+     * @brief Emit a JALR.
+     *
+     * @param rd The link register.
+     * @param rs1 The base register.
+     * @param imm The offset.
+     */
+    void jalr(uint32_t rd, uint32_t rs1, int32_t imm) { i_type(Operation::JALR, rd, rs1, imm); }
+
+    /**
+     * @brief Load a constant into a register using ADDI and SLLI only.
+     *
+     * @param rd The destination register.
+     * @param value The constant.
+     */
+    void li(uint32_t rd, uint32_t value);
+
+    /**
+     * @brief Resolve branch targets and return the encoded program.
+     *
+     * @return std::vector<uint32_t> The instruction words.
+     */
+    std::vector<uint32_t> finish();
+
+private:
+    /**
+     * @brief Branch or jump waiting for its label to be bound.
+     */
+    struct Fixup
+    {
+        size_t index; ///< Index of the instruction word.
+        Label label;  ///< Target label.
+    };
+
+    // Each ORs the register and immediate fields into the table encoding of the operation
+    void r_type(Operation operation, uint32_t rd, uint32_t rs1, uint32_t rs2);
+    void i_type(Operation operation, uint32_t rd, uint32_t rs1, int32_t imm);
+    void s_type(Operation operation, uint32_t rs1, uint32_t rs2, int32_t imm);
+    void b_type(Operation operation, uint32_t rs1, uint32_t rs2, Label target);
+
+    std::vector<uint32_t> code;  ///< Instruction words.
+    std::vector<size_t> labels;  ///< Instruction index by label.
+    std::vector<Fixup> fixups;   ///< Unresolved branches and jumps.
+};
+
+/**
+ * @brief Guest program run by the benchmark.
+ */
+struct Workload
+{
+    std::string name;           ///< Short name used on the command line.
+    std::string description;    ///< One-line description.
+    std::vector<uint32_t> code; ///< Instruction words, loaded at CODE_BASE.
+};
+
+/**
+ * @brief Guest address layout shared by every workload.
+ *
+ * Code, data and stack live on separate pages so stores never hit a page
+ * holding translated code.
+ */
+namespace bench_layout
+{
+    constexpr uint32_t CODE_BASE = 0x00010000;  ///< Load address of the program.
+    constexpr uint32_t DATA_BASE = 0x00100000;  ///< Start of the data region.
+    constexpr uint32_t DATA_SIZE = 0x00010000;  ///< Size of the data region.
+    constexpr uint32_t STACK_TOP = 0x00200000;  ///< Initial stack pointer.
+}
+
+/**
+ * @brief Build the benchmark workloads.
+ *
+ * @param scale Multiplier applied to every iteration count.
+ * @return std::vector<Workload> The workloads.
+ */
+std::vector<Workload> make_workloads(uint32_t scale);
+
+#endif
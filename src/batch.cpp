@@ -0,0 +1,509 @@
+#include "batch.h"
+#include "logger.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <unordered_map>
+
+namespace
+{
+
+/**
+ * @brief Get the result status of a halted run.
+ *
+ * @param reason Why the run halted.
+ * @return const char* The status written to the results.
+ */
+const char *status_name(HaltReason reason)
+{
+    switch (reason)
+    {
+    case HaltReason::EXIT:
+        return "exit";
+    case HaltReason::TOHOST:
+        return "tohost";
+    case HaltReason::RETURN:
+        return "return";
+    case HaltReason::LIMIT:
+        return "limit";
+    case HaltReason::STOPPED:
+        return "stopped";
+    case HaltReason::TRAP:
+        return "trap";
+    default:
+        return "running";
+    }
+}
+
+} // namespace
+
+/**
+ * @brief Construct a new BatchRunner object.
+ *
+ * @param engine The execution engine used for every job.
+ * @param max_instructions Default instruction limit, 0 for none.
+ */
+BatchRunner::BatchRunner(Engine engine, uint64_t max_instructions)
+    : engine(engine), max_instructions(max_instructions)
+{
+}
+
+/**
+ * @brief Parse one manifest line.
+ *
+ * @param line The line.
+ * @param job Receives the job.
+ * @return true if successful, false otherwise.
+ */
+bool BatchRunner::parse_job(const std::string &line, BatchJob &job) const
+{
+    std::istringstream fields(line);
+    fields >> job.elf_path;
+    job.max_instructions = max_instructions;
+
+    std::string field;
+    try
+    {
+        while (fields >> field)
+        {
+            if (field.rfind("name=", 0) == 0)
+            {
+                job.name = field.substr(5);
+            }
+            else if (field.rfind("args=", 0) == 0)
+            {
+                std::istringstream values(field.substr(5));
+                std::string value;
+                while (std::getline(values, value, ','))
+                {
+                    job.args.push_back(static_cast<uint32_t>(std::stoul(value, nullptr, 0)));
+                }
+                if (job.args.size() > 8)
+                {
+                    return false;
+                }
+            }
+            else if (field.rfind("input=", 0) == 0)
+            {
+                size_t at = field.rfind('@');
+                if (at == std::string::npos || at <= 6)
+                {
+                    return false;
+                }
+                job.input_path = field.substr(6, at - 6);
+                job.input_address = static_cast<uint32_t>(std::stoul(field.substr(at + 1), nullptr, 0));
+            }
+            else if (field.rfind("max-instructions=", 0) == 0)
+            {
+                job.max_instructions = std::stoull(field.substr(17));
+            }
+            else if (field.rfind("expect=", 0) == 0)
+            {
+                job.has_expected_exit = true;
+                job.expected_exit = std::stoi(field.substr(7), nullptr, 0);
+            }
+            else
+            {
+                return false;
+            }
+        }
+    }
+    catch (const std::exception &)
+    {
+        // stoul rejected a number
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Read jobs from a manifest file.
+ *
+ * @param filename Path to the manifest.
+ * @return true if successful, false otherwise.
+ */
+bool BatchRunner::load_manifest(const std::string &filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open manifest: " + filename);
+        return false;
+    }
+
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line))
+    {
+        ++line_number;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+        {
+            continue;
+        }
+
+        if (!add_job(line, std::to_string(line_number)))
+        {
+            LOG_ERROR("Error: Invalid manifest line " + std::to_string(line_number) + ": " + line);
+            return false;
+        }
+    }
+
+    LOG_INFO("Loaded " + std::to_string(jobs.size()) + " jobs from manifest: " + filename);
+    return true;
+}
+
+/**
+ * @brief Add one job in manifest syntax.
+ *
+ * @param line The manifest line.
+ * @param name Name of the job unless the line gives one.
+ * @return true if successful, false otherwise.
+ */
+bool BatchRunner::add_job(const std::string &line, const std::string &name)
+{
+    BatchJob job;
+    if (!parse_job(line, job) || job.elf_path.empty())
+    {
+        return false;
+    }
+    if (job.name.empty())
+    {
+        job.name = name;
+    }
+    jobs.push_back(std::move(job));
+    return true;
+}
+
+/**
+ * @brief Format a job as a manifest line that reads back as the same job.
+ *
+ * @param job The job.
+ * @return std::string The manifest line, without a newline.
+ */
+std::string BatchRunner::format_job(const BatchJob &job)
+{
+    std::string line = job.elf_path + " name=" + job.name;
+    for (size_t i = 0; i < job.args.size(); ++i)
+    {
+        line += (i == 0 ? " args=" : ",") + std::to_string(job.args[i]);
+    }
+    if (!job.input_path.empty())
+    {
+        line += " input=" + job.input_path + "@" + std::to_string(job.input_address);
+    }
+    if (job.max_instructions)
+    {
+        line += " max-instructions=" + std::to_string(job.max_instructions);
+    }
+    if (job.has_expected_exit)
+    {
+        line += " expect=" + std::to_string(job.expected_exit);
+    }
+    return line;
+}
+
+/**
+ * @brief Parse every distinct ELF named by the jobs.
+ */
+void BatchRunner::load_images()
+{
+    std::unordered_map<std::string, size_t> index_by_path;
+    std::vector<std::string> paths;
+    for (const BatchJob &job : jobs)
+    {
+        if (index_by_path.emplace(job.elf_path, paths.size()).second)
+        {
+            paths.push_back(job.elf_path);
+        }
+    }
+
+    // Parsing is independent per file, so it shares the pool with the runs
+    std::vector<std::shared_ptr<const Memory>> loaded(paths.size());
+    WorkStealingPool pool(0);
+    pool.run(paths.size(), [&paths, &loaded](size_t i)
+    {
+        auto image = std::make_shared<Memory>();
+        if (image->load_from_elf(paths[i]))
+        {
+            loaded[i] = std::move(image);
+        }
+    });
+
+    images.clear();
+    images.reserve(jobs.size());
+    for (const BatchJob &job : jobs)
+    {
+        images.push_back(loaded[index_by_path[job.elf_path]]);
+    }
+}
+
+/**
+ * @brief Run one job to completion.
+ *
+ * @param index The job index.
+ */
+void BatchRunner::run_job(size_t index)
+{
+    const BatchJob &job = jobs[index];
+    BatchResult &result = results[index];
+
+    if (!images[index])
+    {
+        result.error = "failed to load ELF file";
+        return;
+    }
+
+    try
+    {
+        // Pages of the image are only copied when this job stores to them
+        Memory memory;
+        memory.load_from_image(*images[index]);
+
+        if (!job.input_path.empty())
+        {
+            std::ifstream input(job.input_path, std::ios::binary);
+            if (!input.is_open())
+            {
+                result.error = "cannot open input file " + job.input_path;
+                return;
+            }
+            std::vector<char> bytes((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+            memory.store_bytes(job.input_address, bytes.data(), bytes.size());
+        }
+
+        Machine machine(memory, 1);
+        CPU &cpu = machine.get_hart(0);
+        MemoryLayout layout = memory.get_memory_layout();
+        cpu.set_sp(layout.stack_start + layout.stack_size);
+        cpu.set_pc(memory.get_initial_address());
+        cpu.set_tohost(memory.get_tohost_address());
+        cpu.set_instruction_limit(job.max_instructions);
+        for (size_t i = 0; i < job.args.size(); ++i)
+        {
+            cpu.set_register(static_cast<uint32_t>(10 + i), job.args[i]);
+        }
+
+        // Jobs of one ELF share its symbol index, which is built by whichever profile needs it first
+        std::unique_ptr<Profiler> profiler;
+        if (profiling)
+        {
+            profiler = std::make_unique<Profiler>();
+            profiler->set_symbols(memory.get_symbols());
+            cpu.set_profiler(profiler.get());
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        machine.run(engine);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        result.status = status_name(machine.get_halt_reason());
+        result.exit_code = machine.get_exit_code();
+        result.instructions = cpu.get_instructions_retired();
+        if (profiler)
+        {
+            result.profile = profiler->get_folded(cpu.get_decode_cache());
+        }
+    }
+    catch (const std::exception &e)
+    {
+        result.status = "error";
+        result.error = e.what();
+    }
+}
+
+/**
+ * @brief Run every job.
+ *
+ * @param worker_count Number of host threads, 0 for one per host core.
+ */
+void BatchRunner::run(size_t worker_count)
+{
+    load_images();
+    results.assign(jobs.size(), BatchResult());
+
+    WorkStealingPool pool(worker_count);
+    auto start = std::chrono::steady_clock::now();
+    pool.run(jobs.size(), [this](size_t index)
+    {
+        run_job(index);
+        if (on_result)
+        {
+            on_result(index);
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    LOG_INFO("Ran " + std::to_string(jobs.size()) + " jobs on " + std::to_string(pool.get_worker_count()) +
+             " threads in " + std::to_string(seconds) + " s, " + std::to_string(pool.get_steal_count()) + " stolen");
+}
+
+/**
+ * @brief Check whether a job failed.
+ *
+ * @param index The job index.
+ * @return true if it raised an error or missed its expected exit code, false otherwise.
+ */
+bool BatchRunner::is_failed(size_t index) const
+{
+    const BatchResult &result = results[index];
+    if (result.status == "error")
+    {
+        return true;
+    }
+    // A run cut short by its limit has no exit code to compare
+    const BatchJob &job = jobs[index];
+    return job.has_expected_exit &&
+           (result.status == "limit" || static_cast<int32_t>(result.exit_code) != job.expected_exit);
+}
+
+/**
+ * @brief Get the number of jobs that failed.
+ *
+ * @return size_t The count of jobs that raised an error or missed their expected exit code.
+ */
+size_t BatchRunner::get_failed_count() const
+{
+    size_t failed = 0;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        failed += is_failed(i);
+    }
+    return failed;
+}
+
+/**
+ * @brief Write one result record per job, in manifest order.
+ *
+ * @param filename Path of the results file, "-" for stdout.
+ * @return true if successful, false otherwise.
+ */
+bool BatchRunner::write_results(const std::string &filename) const
+{
+    std::ofstream file;
+    if (filename != "-")
+    {
+        file.open(filename);
+        if (!file.is_open())
+        {
+            LOG_ERROR("Error: Cannot open results file: " + filename);
+            return false;
+        }
+    }
+    std::ostream &out = filename == "-" ? std::cout : file;
+
+    // Tab separated, one header line and one record per job
+    out << "job\telf\tstatus\texit_code\tinstructions\tseconds\terror\texpected\n";
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const BatchResult &result = results[i];
+        out << jobs[i].name << '\t' << jobs[i].elf_path << '\t' << result.status << '\t'
+            << static_cast<int32_t>(result.exit_code) << '\t' << result.instructions << '\t'
+            << std::fixed << std::setprecision(6) << result.seconds << '\t' << result.error << '\t';
+        if (jobs[i].has_expected_exit)
+        {
+            out << jobs[i].expected_exit << (is_failed(i) ? " mismatch" : "");
+        }
+        out << '\n';
+    }
+    return true;
+}
+
+/**
+ * @brief Sum the folded-stack counts of every job.
+ *
+ * @return std::map<std::string, uint64_t> Count by "symbol;mnemonic".
+ */
+std::map<std::string, uint64_t> BatchRunner::merge_profiles() const
+{
+    std::map<std::string, uint64_t> merged;
+    for (const BatchResult &result : results)
+    {
+        for (const auto &entry : result.profile)
+        {
+            merged[entry.first] += entry.second;
+        }
+    }
+    return merged;
+}
+
+/**
+ * @brief Write the instruction mix and function totals of all jobs together.
+ *
+ * @param filename Path to the report file.
+ * @return true if successful, false otherwise.
+ */
+bool BatchRunner::write_profile(const std::string &filename) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open profile report: " + filename);
+        return false;
+    }
+
+    // A folded stack is "symbol;mnemonic", so both totals come from the same counts
+    uint64_t total = 0;
+    std::map<std::string, uint64_t> mix;
+    std::map<std::string, uint64_t> functions;
+    for (const auto &entry : merge_profiles())
+    {
+        size_t split = entry.first.rfind(';');
+        total += entry.second;
+        functions[entry.first.substr(0, split)] += entry.second;
+        mix[entry.first.substr(split + 1)] += entry.second;
+    }
+
+    auto percent = [total](uint64_t value)
+    { return total ? 100.0 * static_cast<double>(value) / static_cast<double>(total) : 0.0; };
+    auto write_sorted = [&file, &percent](const std::map<std::string, uint64_t> &counts, int width)
+    {
+        std::vector<std::pair<std::string, uint64_t>> sorted(counts.begin(), counts.end());
+        std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b)
+                         { return a.second > b.second; });
+        for (const auto &entry : sorted)
+        {
+            file << "  " << std::left << std::setw(width) << entry.first << std::right << std::setw(14) << entry.second
+                 << std::setw(9) << std::fixed << std::setprecision(2) << percent(entry.second) << "%\n";
+        }
+    };
+
+    file << "Jobs: " << jobs.size() << "\n";
+    file << "Instructions executed: " << total << "\n\n";
+    file << "Instruction mix:\n";
+    write_sorted(mix, 8);
+    file << "\nFunctions:\n";
+    write_sorted(functions, 32);
+
+    LOG_INFO("Profile report written to: " + filename);
+    return true;
+}
+
+/**
+ * @brief Write the folded stacks of all jobs summed into one file.
+ *
+ * @param filename Path to the folded-stack file.
+ * @return true if successful, false otherwise.
+ */
+bool BatchRunner::write_folded(const std::string &filename) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open folded-stack file: " + filename);
+        return false;
+    }
+    for (const auto &entry : merge_profiles())
+    {
+        file << entry.first << ' ' << entry.second << '\n';
+    }
+    LOG_INFO("Folded stacks written to: " + filename);
+    return true;
+}
@@ -0,0 +1,226 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "cpu.h"
+#include "machine.h"
+#include "memory.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One guest run described by a manifest line.
+ */
+struct BatchJob
+{
+    std::string name;               ///< Job name, the line number unless given.
+    std::string elf_path;           ///< ELF file to run.
+    std::vector<uint32_t> args;     ///< Initial values of a0, a1, ...
+    std::string input_path;         ///< File copied into guest memory before the run, if any.
+    uint32_t input_address = 0;     ///< Guest address of the input file.
+    uint64_t max_instructions = 0;  ///< Instruction limit, 0 for none.
+    bool has_expected_exit = false; ///< Whether the exit code is checked.
+    int32_t expected_exit = 0;      ///< Exit code the program must halt with.
+};
+
+/**
+ * @brief Outcome of one job.
+ */
+struct BatchResult
+{
+    std::string status = "error";   ///< How the run halted, or "error".
+    uint32_t exit_code = 0;         ///< Exit code of the program.
+    uint64_t instructions = 0;      ///< Instructions retired.
+    double seconds = 0.0;           ///< Wall time of the run, loading excluded.
+    std::string error;              ///< Error message when the job failed.
+    std::map<std::string, uint64_t> profile; ///< Folded-stack counts when profiling.
+};
+
+/**
+ * @brief Runs a manifest of independent guest programs on a thread pool.
+ *
+ * Every ELF named by the manifest is parsed once into an image shared by all
+ * of its jobs; each job gets its own Memory that maps the image
+ * copy-on-write, so a job costs a few page-table entries instead of a
+ * process start and an ELF parse.
+ *
+ * A manifest has one job per line: the ELF path followed by optional
+ * `key=value` fields. Blank lines and lines starting with `#` are skipped.
+ *
+ * - `name=<name>` names the job in the results.
+ * - `args=<v0>,<v1>,...` sets a0, a1, ... before the run.
+ * - `input=<file>@<address>` copies a file into guest memory.
+ * - `max-instructions=<n>` bounds the run.
+ * - `expect=<code>` fails the job unless the program exits with that code.
+ *
+ * Jobs can also be added one line at a time and their results set from
+ * elsewhere, which is how ShardCoordinator merges the runs of its workers.
+ */
+class BatchRunner
+{
+public:
+    /**
+     * @brief Construct a new BatchRunner object.
+     *
+     * @param engine The execution engine used for every job.
+     * @param max_instructions Default instruction limit, 0 for none.
+     */
+    BatchRunner(Engine engine, uint64_t max_instructions);
+
+    /**
+     * @brief Read jobs from a manifest file.
+     *
+     * @param filename Path to the manifest.
+     * @return true if successful, false otherwise.
+     */
+    bool load_manifest(const std::string &filename);
+
+    /**
+     * @brief Add one job in manifest syntax.
+     *
+     * @param line The manifest line.
+     * @param name Name of the job unless the line gives one.
+     * @return true if successful, false otherwise.
+     */
+    bool add_job(const std::string &line, const std::string &name);
+
+    /**
+     * @brief Format a job as a manifest line that reads back as the same job.
+     *
+     * @param job The job.
+     * @return std::string The manifest line, without a newline.
+     */
+    static std::string format_job(const BatchJob &job);
+
+    /**
+     * @brief Collect a folded-stack profile of every job.
+     *
+     * @param enabled Whether jobs are profiled.
+     */
+    void set_profiling(bool enabled) { profiling = enabled; }
+
+    /**
+     * @brief Get whether jobs are profiled.
+     *
+     * @return true if jobs collect folded-stack counts, false otherwise.
+     */
+    bool is_profiling() const { return profiling; }
+
+    /**
+     * @brief Set a function called as each job finishes.
+     *
+     * The function runs on the pool thread that ran the job, so it must be thread safe.
+     *
+     * @param callback Called with the job index once its result is final.
+     */
+    void set_result_callback(std::function<void(size_t)> callback) { on_result = std::move(callback); }
+
+    /**
+     * @brief Run every job.
+     *
+     * @param worker_count Number of host threads, 0 for one per host core.
+     */
+    void run(size_t worker_count);
+
+    /**
+     * @brief Write one result record per job, in manifest order.
+     *
+     * @param filename Path of the results file, "-" for stdout.
+     * @return true if successful, false otherwise.
+     */
+    bool write_results(const std::string &filename) const;
+
+    /**
+     * @brief Write the instruction mix and function totals of all jobs together.
+     *
+     * @param filename Path to the report file.
+     * @return true if successful, false otherwise.
+     */
+    bool write_profile(const std::string &filename) const;
+
+    /**
+     * @brief Write the folded stacks of all jobs summed into one file.
+     *
+     * @param filename Path to the folded-stack file.
+     * @return true if successful, false otherwise.
+     */
+    bool write_folded(const std::string &filename) const;
+
+    /**
+     * @brief Get the jobs.
+     *
+     * @return const std::vector<BatchJob>& The jobs in manifest order.
+     */
+    const std::vector<BatchJob> &get_jobs() const { return jobs; }
+
+    /**
+     * @brief Get the results.
+     *
+     * @return const std::vector<BatchResult>& The result of each job.
+     */
+    const std::vector<BatchResult> &get_results() const { return results; }
+
+    /**
+     * @brief Replace the results, e.g. with those gathered from other processes.
+     *
+     * @param merged The result of each job, in manifest order.
+     */
+    void set_results(std::vector<BatchResult> merged) { results = std::move(merged); }
+
+    /**
+     * @brief Check whether a job failed.
+     *
+     * @param index The job index.
+     * @return true if it raised an error or missed its expected exit code, false otherwise.
+     */
+    bool is_failed(size_t index) const;
+
+    /**
+     * @brief Get the number of jobs that failed.
+     *
+     * @return size_t The count of jobs that raised an error or missed their expected exit code.
+     */
+    size_t get_failed_count() const;
+
+private:
+    /**
+     * @brief Parse one manifest line.
+     *
+     * @param line The line.
+     * @param job Receives the job.
+     * @return true if successful, false otherwise.
+     */
+    bool parse_job(const std::string &line, BatchJob &job) const;
+
+    /**
+     * @brief Sum the folded-stack counts of every job.
+     *
+     * @return std::map<std::string, uint64_t> Count by "symbol;mnemonic".
+     */
+    std::map<std::string, uint64_t> merge_profiles() const;
+
+    /**
+     * @brief Parse every distinct ELF named by the jobs.
+     */
+    void load_images();
+
+    /**
+     * @brief Run one job to completion.
+     *
+     * @param index The job index.
+     */
+    void run_job(size_t index);
+
+    Engine engine;                                         ///< Execution engine.
+    uint64_t max_instructions;                             ///< Default instruction limit.
+    std::vector<BatchJob> jobs;                            ///< Jobs in manifest order.
+    std::vector<BatchResult> results;                      ///< Result by job.
+    std::vector<std::shared_ptr<const Memory>> images;     ///< Parsed ELF by job, null if it failed to load.
+    bool profiling = false;                                ///< Whether jobs are profiled.
+    std::function<void(size_t)> on_result;                 ///< Called as each job finishes, if set.
+};
+
+#endif
@@ -0,0 +1,619 @@
+#include "block_engine.h"
+#include "logger.h"
+#include "metrics.h"
+#include "profiler.h"
+#include <algorithm>
+
+/**
+ * @brief Construct a new BlockEngine object.
+ *
+ * @param cpu Reference to the CPU whose state is executed.
+ */
+BlockEngine::BlockEngine(CPU &cpu) : cpu(cpu)
+{
+}
+
+/**
+ * @brief Execute blocks until the program halts or reaches the instruction limit.
+ */
+void BlockEngine::run()
+{
+    // Pages may have been replaced since the last run
+    cpu.memory.flush();
+
+    // A hart the pipelined model left mid-run finishes its instructions in flight first
+    if (!cpu.is_pipeline_empty())
+    {
+        cpu.drain_pipeline();
+    }
+
+    // Dump CPU registers before starting execution
+    if (Logger::is_trace_enabled())
+    {
+        LOG_INFO("CPU state at start:");
+        cpu.print_registers();
+    }
+
+    // Halting, the instruction limit and interrupts are only checked between
+    // blocks, so a limit can be overshot by at most one block
+    do
+    {
+        while (cpu.instructions_retired < cpu.run_limit.load(std::memory_order_relaxed))
+        {
+            auto it = blocks.find(cpu.pc);
+            const Block &block = it != blocks.end() ? it->second : translate(cpu.pc);
+
+            // Each handler tells whether to go on, the last one always leaves
+            const Op *first = block.ops.data();
+            const Op *op = first;
+            while (op->handler(*this, *op))
+            {
+                ++op;
+            }
+            cpu.instructions_retired += (op - first) + (op->handler == &op_fallthrough ? 0 : 1);
+
+            if (cpu.profiler)
+            {
+                // An instruction that trapped did not retire
+                const Op *end = trapped ? op : op + 1;
+                for (const Op *executed = first; executed < end && executed->handler != &op_fallthrough &&
+                                                 executed->handler != &op_breakpoint; ++executed)
+                {
+                    cpu.profiler->count(executed->slot);
+                }
+                trapped = false;
+            }
+
+            if (pending_invalidation)
+            {
+                // The block may be dropped here, so it must not be touched afterwards
+                pending_invalidation = false;
+                invalidate(pending_address, pending_size);
+            }
+            else if (pending_flush)
+            {
+                // FENCE.I: code may have changed anywhere
+                pending_flush = false;
+                flush();
+            }
+        }
+    } while (cpu.service_events());
+
+    if (!cpu.is_halted() && cpu.take_break())
+    {
+        // The debugger runs the hart again later
+        return;
+    }
+    if (!cpu.is_halted())
+    {
+        bool limited = cpu.instruction_limit && cpu.instructions_retired >= cpu.instruction_limit;
+        cpu.halt(limited ? HaltReason::LIMIT : HaltReason::STOPPED, 0);
+    }
+
+    // Dump CPU registers after the program terminates
+    if (Logger::is_enabled(LOG_LEVEL_INFO))
+    {
+        LOG_INFO("CPU state at end:");
+        cpu.print_registers();
+    }
+}
+
+/**
+ * @brief Drop every translated block.
+ */
+void BlockEngine::flush()
+{
+    for (const auto &page : page_blocks)
+    {
+        code_pages.reset(page.first);
+    }
+    page_blocks.clear();
+    blocks.clear();
+}
+
+/**
+ * @brief Limit the instructions per block, dropping blocks translated with another limit.
+ *
+ * @param limit Instructions per block, from 1 to MAX_BLOCK_SIZE.
+ */
+void BlockEngine::set_block_limit(size_t limit)
+{
+    limit = std::min(std::max<size_t>(limit, 1), MAX_BLOCK_SIZE);
+    if (limit != block_limit)
+    {
+        block_limit = limit;
+        flush();
+    }
+}
+
+/**
+ * @brief Drop the translated blocks covering any byte written by a store.
+ *
+ * @param address Start address of the store.
+ * @param size Size of the store in bytes.
+ * @return true if any translated code was dropped, false otherwise.
+ */
+bool BlockEngine::invalidate(uint32_t address, uint32_t size)
+{
+    uint32_t first_page = address >> DecodeCache::PAGE_SHIFT;
+    uint32_t last_page = (address + size - 1) >> DecodeCache::PAGE_SHIFT;
+    uint32_t end = address + size;
+
+    // Dropping a block edits the lists of its pages, so collect first
+    std::vector<uint32_t> starts;
+    for (uint32_t page = first_page;; ++page)
+    {
+        if (code_pages.test(page))
+        {
+            for (uint32_t start : page_blocks[page])
+            {
+                const Block &block = blocks.at(start);
+                if (block.start < end && block.end > address &&
+                    std::find(starts.begin(), starts.end(), start) == starts.end())
+                {
+                    starts.push_back(start);
+                }
+            }
+        }
+        if (page == last_page)
+        {
+            break;
+        }
+    }
+
+    for (uint32_t start : starts)
+    {
+        drop(start);
+    }
+    cpu.decode_cache.count_blocks_invalidated(starts.size());
+    return !starts.empty();
+}
+
+/**
+ * @brief Check whether a store writes a byte of any translated block.
+ *
+ * @param address Start address of the store.
+ * @param size Size of the store in bytes.
+ * @return true if it does, false otherwise.
+ */
+bool BlockEngine::covers_code(uint32_t address, uint32_t size) const
+{
+    uint32_t end = address + size;
+    for (uint32_t page : {address >> DecodeCache::PAGE_SHIFT, (end - 1) >> DecodeCache::PAGE_SHIFT})
+    {
+        auto listed = page_blocks.find(page);
+        if (listed == page_blocks.end())
+        {
+            continue;
+        }
+        for (uint32_t start : listed->second)
+        {
+            const Block &block = blocks.at(start);
+            if (block.start < end && block.end > address)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Drop one translated block and take it off the lists of its pages.
+ *
+ * @param start Address of the first instruction of the block.
+ */
+void BlockEngine::drop(uint32_t start)
+{
+    auto it = blocks.find(start);
+    uint32_t last = (it->second.end - 1) >> DecodeCache::PAGE_SHIFT;
+    for (uint32_t page = start >> DecodeCache::PAGE_SHIFT;; ++page)
+    {
+        auto listed = page_blocks.find(page);
+        std::vector<uint32_t> &starts = listed->second;
+        starts.erase(std::find(starts.begin(), starts.end(), start));
+        if (starts.empty())
+        {
+            page_blocks.erase(listed);
+            code_pages.reset(page);
+        }
+        if (page == last)
+        {
+            break;
+        }
+    }
+    LOG_DEBUG("Dropped translated block at: 0x" + Memory::to_hex_string(start));
+    blocks.erase(it);
+}
+
+/**
+ * @brief Translate the basic block starting at an address.
+ *
+ * @param pc Address of the first instruction.
+ * @return const BlockEngine::Block& The translated block.
+ */
+const BlockEngine::Block &BlockEngine::translate(uint32_t pc)
+{
+    Block block;
+    block.start = pc;
+
+    uint32_t address = pc;
+    bool terminated = false;
+    while (block.ops.size() < block_limit)
+    {
+        // Both engines share the decode cache, and with it the profiler slots
+        const CachedInstruction *cached = cpu.decode_cache.lookup(address);
+        if (!cached)
+        {
+            uint32_t instruction = cpu.fetch_instruction(address); // A TLB hit after the first one
+            DecodedInstruction decoded;
+            if (!CPU::try_decode_instruction(instruction, decoded))
+            {
+                // The trap is only taken if execution actually gets there
+                if (block.ops.empty())
+                {
+                    block.ops.push_back({&op_illegal, decoded, address, 0, CPU::ZERO_SINK});
+                    address += Isa::instruction_length(instruction);
+                    terminated = true;
+                }
+                break;
+            }
+            cached = &cpu.decode_cache.insert(address, decoded);
+            if (cpu.profiler)
+            {
+                cpu.profiler->ensure_slot(cached->slot);
+            }
+        }
+
+        const DecodedInstruction &decoded = cached->decoded;
+        if (decoded.opcode == Opcode::DEBUG_BREAK)
+        {
+            // A breakpoint is a block of its own, so the code before it runs at full speed
+            if (block.ops.empty())
+            {
+                block.ops.push_back({&op_breakpoint, decoded, address, cached->slot, CPU::ZERO_SINK});
+                address += decoded.length;
+                terminated = true;
+            }
+            break;
+        }
+        block.ops.push_back({select_handler(decoded), decoded, address, cached->slot, sink(decoded)});
+        address += decoded.length;
+
+        // CSR instructions share the SYSTEM opcode but only ECALL, EBREAK, MRET and WFI leave the block
+        if (decoded.opcode == Opcode::B_TYPE || decoded.opcode == Opcode::J_TYPE || decoded.opcode == Opcode::JALR ||
+            (decoded.opcode == Opcode::SYSTEM && Isa::format(decoded.operation) == IsaFormat::EXACT))
+        {
+            terminated = true;
+            break;
+        }
+    }
+
+    if (!terminated)
+    {
+        block.ops.push_back({&op_fallthrough, DecodedInstruction{}, address, 0, CPU::ZERO_SINK});
+    }
+    block.end = address;
+
+    for (uint32_t page = pc >> DecodeCache::PAGE_SHIFT;; ++page)
+    {
+        page_blocks[page].push_back(pc);
+        code_pages.set(page);
+        if (page == (address - 1) >> DecodeCache::PAGE_SHIFT)
+        {
+            break;
+        }
+    }
+
+    ++blocks_translated;
+    if (cpu.metrics)
+    {
+        cpu.metrics->blocks_translated.store(blocks_translated, std::memory_order_relaxed);
+    }
+    LOG_DEBUG("Translated block at: 0x" + Memory::to_hex_string(pc) + " with " + std::to_string(block.ops.size()) + " operations");
+    return blocks.emplace(pc, std::move(block)).first->second;
+}
+
+/**
+ * @brief Select the handler for a decoded instruction.
+ *
+ * @param decoded The decoded instruction.
+ * @return BlockEngine::Handler The handler.
+ */
+BlockEngine::Handler BlockEngine::select_handler(const DecodedInstruction &decoded)
+{
+    Handler handler = HANDLERS[static_cast<size_t>(decoded.operation)];
+    if (!handler)
+    {
+        LOG_ERROR("Unsupported opcode in block: 0x" + Memory::to_hex_string(static_cast<uint8_t>(decoded.opcode)));
+        throw std::runtime_error("Unsupported opcode in block!");
+    }
+    return handler;
+}
+
+/**
+ * @brief Select the integer register an operation writes.
+ *
+ * Results for x0 go to a register nobody reads, so the handlers store
+ * unconditionally and x0 stays zero.
+ *
+ * @param decoded The decoded instruction.
+ * @return uint8_t The register, CPU::ZERO_SINK for x0.
+ */
+uint8_t BlockEngine::sink(const DecodedInstruction &decoded)
+{
+    return decoded.rd != 0 ? decoded.rd : static_cast<uint8_t>(CPU::ZERO_SINK);
+}
+
+template <Operation OP>
+bool BlockEngine::op_alu(BlockEngine &engine, const Op &op)
+{
+    CPU &cpu = engine.cpu;
+    cpu.registers[op.rd] = Isa::alu<OP>(cpu.registers[op.decoded.rs1], cpu.registers[op.decoded.rs2]);
+    return true;
+}
+
+template <Operation OP>
+bool BlockEngine::op_alu_imm(BlockEngine &engine, const Op &op)
+{
+    CPU &cpu = engine.cpu;
+    cpu.registers[op.rd] = Isa::alu<OP>(cpu.registers[op.decoded.rs1], static_cast<uint32_t>(op.decoded.imm));
+    return true;
+}
+
+template <Operation OP>
+bool BlockEngine::op_load(BlockEngine &engine, const Op &op)
+{
+    uint32_t address = engine.cpu.registers[op.decoded.rs1] + op.decoded.imm;
+    engine.cpu.registers[op.rd] = engine.cpu.load<OP>(address);
+    return true;
+}
+
+bool BlockEngine::op_lui(BlockEngine &engine, const Op &op)
+{
+    engine.cpu.registers[op.rd] = static_cast<uint32_t>(op.decoded.imm);
+    return true;
+}
+
+bool BlockEngine::op_auipc(BlockEngine &engine, const Op &op)
+{
+    engine.cpu.registers[op.rd] = op.pc + static_cast<uint32_t>(op.decoded.imm);
+    return true;
+}
+
+/**
+ * @brief Take the exception an operation raised and leave the block.
+ *
+ * @param op The operation, which does not retire.
+ * @return false, to leave the block.
+ */
+bool BlockEngine::trap(const Op &op)
+{
+    // The run loop counts the last operation as retired
+    --cpu.instructions_retired;
+    cpu.take_exception(op.pc);
+    trapped = true;
+    return false;
+}
+
+/**
+ * @brief Check whether a store hit translated code and must end the block.
+ *
+ * @param op The storing operation.
+ * @param address Start address of the store.
+ * @param size Size of the store in bytes.
+ * @return true to continue with the next operation, false to leave the block.
+ */
+bool BlockEngine::after_store(const Op &op, uint32_t address, uint32_t size)
+{
+    // A store to tohost halts at once
+    if (cpu.is_halted())
+    {
+        cpu.pc = op.pc + op.decoded.length;
+        return false;
+    }
+
+    // A store into translated code ends the block so it can be dropped safely
+    if ((code_pages.test(address >> DecodeCache::PAGE_SHIFT) ||
+         code_pages.test((address + size - 1) >> DecodeCache::PAGE_SHIFT)) &&
+        covers_code(address, size))
+    {
+        pending_invalidation = true;
+        pending_address = address;
+        pending_size = size;
+        cpu.pc = op.pc + op.decoded.length;
+        return false;
+    }
+    return true;
+}
+
+template <Operation OP>
+bool BlockEngine::op_store(BlockEngine &engine, const Op &op)
+{
+    uint32_t address = engine.cpu.registers[op.decoded.rs1] + op.decoded.imm;
+    engine.cpu.store<OP>(address, engine.cpu.registers[op.decoded.rs2]);
+    return engine.after_store(op, address, sizeof(typename Isa::Access<OP>::type));
+}
+
+bool BlockEngine::op_amo(BlockEngine &engine, const Op &op)
+{
+    uint32_t address = engine.cpu.registers[op.decoded.rs1];
+    bool stored = false;
+    uint32_t value = engine.cpu.execute_amo(op.decoded.operation, op.decoded, stored);
+    if (engine.cpu.is_exception_raised())
+    {
+        return engine.trap(op);
+    }
+    engine.cpu.registers[op.rd] = value;
+
+    // LR and a failed SC leave memory alone
+    return !stored || engine.after_store(op, address, 4);
+}
+
+template <Operation OP>
+bool BlockEngine::op_fp_load(BlockEngine &engine, const Op &op)
+{
+    uint32_t address = engine.cpu.registers[op.decoded.rs1] + op.decoded.imm;
+    engine.cpu.float_registers[op.decoded.rd] = engine.cpu.load<OP>(address);
+    return true;
+}
+
+template <Operation OP>
+bool BlockEngine::op_fp_store(BlockEngine &engine, const Op &op)
+{
+    uint32_t address = engine.cpu.registers[op.decoded.rs1] + op.decoded.imm;
+    engine.cpu.store<OP>(address, engine.cpu.float_registers[op.decoded.rs2]);
+    return engine.after_store(op, address, sizeof(typename Isa::Access<OP>::type));
+}
+
+template <Operation OP>
+bool BlockEngine::op_fp(BlockEngine &engine, const Op &op)
+{
+    CPU &cpu = engine.cpu;
+    if (!cpu.valid_rounding_mode(op.decoded.funct3))
+    {
+        cpu.raise_exception(TrapCause::ILLEGAL_INSTRUCTION, cpu.fetch_instruction(op.pc));
+        return engine.trap(op);
+    }
+    uint32_t a = Isa::float_source(OP) ? cpu.float_registers[op.decoded.rs1] : cpu.registers[op.decoded.rs1];
+    uint32_t flags = 0;
+    uint32_t result = Isa::fp<OP>(a, cpu.float_registers[op.decoded.rs2], cpu.float_registers[op.decoded.rs3],
+                                  cpu.rounding_mode(op.decoded.funct3), flags);
+    cpu.fcsr |= flags;
+    if constexpr (Isa::float_destination(OP))
+    {
+        cpu.float_registers[op.decoded.rd] = result;
+    }
+    else
+    {
+        cpu.registers[op.rd] = result;
+    }
+    return true;
+}
+
+bool BlockEngine::op_csr(BlockEngine &engine, const Op &op)
+{
+    uint32_t value = engine.cpu.execute_csr(op.decoded.operation, op.decoded, engine.cpu.registers[op.decoded.rs1]);
+    if (engine.cpu.is_exception_raised())
+    {
+        return engine.trap(op);
+    }
+    engine.cpu.registers[op.rd] = value;
+    return true;
+}
+
+bool BlockEngine::op_fence(BlockEngine &engine, const Op &op)
+{
+    engine.cpu.execute_fence(op.decoded);
+    if (op.decoded.operation == Operation::FENCE_I)
+    {
+        engine.pending_flush = true;
+        engine.cpu.pc = op.pc + op.decoded.length;
+        return false;
+    }
+    return true;
+}
+
+template <Operation OP>
+bool BlockEngine::op_branch(BlockEngine &engine, const Op &op)
+{
+    if (Isa::branch<OP>(engine.cpu.registers[op.decoded.rs1], engine.cpu.registers[op.decoded.rs2]))
+    {
+        engine.cpu.pc = op.pc + op.decoded.imm;
+        if (engine.cpu.profiler)
+        {
+            engine.cpu.profiler->count_taken(op.slot);
+        }
+    }
+    else
+    {
+        engine.cpu.pc = op.pc + op.decoded.length;
+    }
+    return false;
+}
+
+bool BlockEngine::op_j_type(BlockEngine &engine, const Op &op)
+{
+    engine.cpu.pc = op.pc + op.decoded.length;
+    engine.cpu.execute_j_type(op.decoded, op.pc);
+    return false;
+}
+
+bool BlockEngine::op_jalr(BlockEngine &engine, const Op &op)
+{
+    engine.cpu.pc = op.pc + op.decoded.length;
+    engine.cpu.execute_jalr(op.decoded);
+    return false;
+}
+
+bool BlockEngine::op_system(BlockEngine &engine, const Op &op)
+{
+    engine.cpu.pc = op.pc + op.decoded.length;
+    engine.cpu.execute_system(op.decoded.operation, op.pc);
+    if (engine.cpu.is_exception_raised())
+    {
+        return engine.trap(op);
+    }
+    return false;
+}
+
+bool BlockEngine::op_illegal(BlockEngine &engine, const Op &op)
+{
+    engine.cpu.raise_exception(TrapCause::ILLEGAL_INSTRUCTION, engine.cpu.fetch_instruction(op.pc));
+    return engine.trap(op);
+}
+
+bool BlockEngine::op_fallthrough(BlockEngine &engine, const Op &op)
+{
+    engine.cpu.pc = op.pc;
+    return false;
+}
+
+bool BlockEngine::op_breakpoint(BlockEngine &engine, const Op &op)
+{
+    // The run loop counts the last operation as retired; this one never executes
+    --engine.cpu.instructions_retired;
+    engine.cpu.pc = op.pc;
+    engine.cpu.request_break();
+    return false;
+}
+
+// Generated from the ISA table, in the order of the Operation enum
+const BlockEngine::Handler BlockEngine::HANDLERS[] = {
+    nullptr,
+#define PHLEGO_ISA_ALU_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_alu<Operation::NAME>,
+#define PHLEGO_ISA_ALU_IMM_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_alu_imm<Operation::NAME>,
+#define PHLEGO_ISA_LOAD_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_load<Operation::NAME>,
+#define PHLEGO_ISA_STORE_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_store<Operation::NAME>,
+#define PHLEGO_ISA_BRANCH_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_branch<Operation::NAME>,
+#define PHLEGO_ISA_AMO_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_amo,
+#define PHLEGO_ISA_FP_LOAD_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_fp_load<Operation::NAME>,
+#define PHLEGO_ISA_FP_STORE_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_fp_store<Operation::NAME>,
+#define PHLEGO_ISA_FP_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_fp<Operation::NAME>,
+#define PHLEGO_ISA_CSR_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_csr,
+#define PHLEGO_ISA_CONTROL_HANDLER(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) &op_##SEMANTICS,
+    PHLEGO_ISA_ALU(PHLEGO_ISA_ALU_HANDLER)
+    PHLEGO_ISA_ALU_IMM(PHLEGO_ISA_ALU_IMM_HANDLER)
+    PHLEGO_ISA_LOAD(PHLEGO_ISA_LOAD_HANDLER)
+    PHLEGO_ISA_STORE(PHLEGO_ISA_STORE_HANDLER)
+    PHLEGO_ISA_BRANCH(PHLEGO_ISA_BRANCH_HANDLER)
+    PHLEGO_ISA_AMO(PHLEGO_ISA_AMO_HANDLER)
+    PHLEGO_ISA_FP_LOAD(PHLEGO_ISA_FP_LOAD_HANDLER)
+    PHLEGO_ISA_FP_STORE(PHLEGO_ISA_FP_STORE_HANDLER)
+    PHLEGO_ISA_FP(PHLEGO_ISA_FP_HANDLER)
+    PHLEGO_ISA_FP_TO_INT(PHLEGO_ISA_FP_HANDLER)
+    PHLEGO_ISA_FP_FROM_INT(PHLEGO_ISA_FP_HANDLER)
+    PHLEGO_ISA_CSR(PHLEGO_ISA_CSR_HANDLER)
+    PHLEGO_ISA_CONTROL(PHLEGO_ISA_CONTROL_HANDLER)
+#undef PHLEGO_ISA_ALU_HANDLER
+#undef PHLEGO_ISA_ALU_IMM_HANDLER
+#undef PHLEGO_ISA_LOAD_HANDLER
+#undef PHLEGO_ISA_STORE_HANDLER
+#undef PHLEGO_ISA_BRANCH_HANDLER
+#undef PHLEGO_ISA_AMO_HANDLER
+#undef PHLEGO_ISA_FP_LOAD_HANDLER
+#undef PHLEGO_ISA_FP_STORE_HANDLER
+#undef PHLEGO_ISA_FP_HANDLER
+#undef PHLEGO_ISA_CSR_HANDLER
+#undef PHLEGO_ISA_CONTROL_HANDLER
+};
@@ -0,0 +1,170 @@
+#ifndef BLOCK_ENGINE_H
+#define BLOCK_ENGINE_H
+
+#include "cpu.h"
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Functional execution engine that runs translated basic blocks.
+ *
+ * A basic block is a straight-line run of instructions ending at a branch,
+ * JAL, JALR, ECALL, EBREAK, MRET or WFI. Each block is translated once into a list of operations with
+ * pre-bound handlers and then executed as a whole, bypassing the pipeline
+ * latches used by CPU::run(). Each instruction of the ISA table has a handler
+ * specialized for it, so the handler does no decoding of its own; the
+ * semantics come from the same table and CPU helpers the pipelined model
+ * uses, so both engines produce the same architectural results.
+ *
+ * Blocks end in front of a breakpoint patched into the decode cache, and a
+ * block starting at one holds only the breakpoint, so a breakpoint costs
+ * nothing until it is reached. An undecodable instruction is handled the
+ * same way and raises an illegal instruction exception when it is reached.
+ * An operation that raises an exception leaves the block without retiring,
+ * and interrupts are taken between blocks.
+ *
+ * A bitmap marks the pages holding translated code, so a store to data pays
+ * a bit test. A store to such a page drops only the blocks covering the
+ * bytes it writes, found through the blocks listed for the page, and ends
+ * the running block if it dropped any, so code a bootloader copies next to
+ * itself does not retranslate the loader.
+ */
+class BlockEngine
+{
+public:
+    static constexpr size_t MAX_BLOCK_SIZE = 64; ///< Upper bound on instructions per block.
+
+    /**
+     * @brief Construct a new BlockEngine object.
+     *
+     * @param cpu Reference to the CPU whose state is executed.
+     */
+    BlockEngine(CPU &cpu);
+
+    /**
+     * @brief Execute blocks until the program halts or reaches the instruction limit.
+     */
+    void run();
+
+    /**
+     * @brief Drop the translated blocks covering any byte written by a store.
+     *
+     * @param address Start address of the store.
+     * @param size Size of the store in bytes.
+     * @return true if any translated code was dropped, false otherwise.
+     */
+    bool invalidate(uint32_t address, uint32_t size);
+
+    /**
+     * @brief Drop every translated block.
+     */
+    void flush();
+
+    /**
+     * @brief Limit the instructions per block, dropping blocks translated with another limit.
+     *
+     * A limit of one stops the hart right after the instruction that asked
+     * for a break, which watchpoints need.
+     *
+     * @param limit Instructions per block, from 1 to MAX_BLOCK_SIZE.
+     */
+    void set_block_limit(size_t limit);
+
+    /**
+     * @brief Get the number of instructions retired.
+     *
+     * @return uint64_t The retired instruction count.
+     */
+    uint64_t get_instructions_retired() const { return cpu.get_instructions_retired(); }
+
+    /**
+     * @brief Get the number of blocks translated.
+     *
+     * @return uint64_t The translation count.
+     */
+    uint64_t get_blocks_translated() const { return blocks_translated; }
+
+private:
+    struct Op;
+
+    /**
+     * @brief Handler bound to an operation at translation time.
+     *
+     * @return true to continue with the next operation, false to leave the block.
+     */
+    using Handler = bool (*)(BlockEngine &engine, const Op &op);
+
+    /**
+     * @brief Single translated instruction.
+     */
+    struct Op
+    {
+        Handler handler;            ///< Pre-bound handler.
+        DecodedInstruction decoded; ///< Decoded instruction.
+        uint32_t pc;                ///< Address of the instruction.
+        uint32_t slot;              ///< Decode cache slot, used by the profiler.
+        uint8_t rd;                 ///< Integer register written, CPU::ZERO_SINK in place of x0.
+    };
+
+    /**
+     * @brief Translated basic block.
+     */
+    struct Block
+    {
+        std::vector<Op> ops; ///< Operations, the last one always leaves the block.
+        uint32_t start;      ///< Address of the first instruction.
+        uint32_t end;        ///< Address past the last instruction.
+    };
+
+    const Block &translate(uint32_t pc);
+    static Handler select_handler(const DecodedInstruction &decoded);
+    static uint8_t sink(const DecodedInstruction &decoded);
+    bool after_store(const Op &op, uint32_t address, uint32_t size);
+    bool covers_code(uint32_t address, uint32_t size) const;
+    void drop(uint32_t start);
+    bool trap(const Op &op);
+
+    template <Operation OP>
+    static bool op_alu(BlockEngine &engine, const Op &op);
+    template <Operation OP>
+    static bool op_alu_imm(BlockEngine &engine, const Op &op);
+    template <Operation OP>
+    static bool op_load(BlockEngine &engine, const Op &op);
+    template <Operation OP>
+    static bool op_store(BlockEngine &engine, const Op &op);
+    template <Operation OP>
+    static bool op_branch(BlockEngine &engine, const Op &op);
+    static bool op_lui(BlockEngine &engine, const Op &op);
+    static bool op_auipc(BlockEngine &engine, const Op &op);
+    static bool op_amo(BlockEngine &engine, const Op &op);
+    template <Operation OP>
+    static bool op_fp_load(BlockEngine &engine, const Op &op);
+    template <Operation OP>
+    static bool op_fp_store(BlockEngine &engine, const Op &op);
+    template <Operation OP>
+    static bool op_fp(BlockEngine &engine, const Op &op);
+    static bool op_csr(BlockEngine &engine, const Op &op);
+    static bool op_fence(BlockEngine &engine, const Op &op);
+    static bool op_j_type(BlockEngine &engine, const Op &op);
+    static bool op_jalr(BlockEngine &engine, const Op &op);
+    static bool op_system(BlockEngine &engine, const Op &op);
+    static bool op_fallthrough(BlockEngine &engine, const Op &op);
+    static bool op_breakpoint(BlockEngine &engine, const Op &op);
+    static bool op_illegal(BlockEngine &engine, const Op &op);
+
+    static const Handler HANDLERS[static_cast<size_t>(Operation::COUNT)]; ///< Handlers by operation.
+
+    CPU &cpu;                                                        ///< CPU whose state is executed.
+    std::unordered_map<uint32_t, Block> blocks;                      ///< Translated blocks by start address.
+    PageBitmap code_pages{DecodeCache::PAGE_SHIFT};                  ///< Pages holding translated code.
+    std::unordered_map<uint32_t, std::vector<uint32_t>> page_blocks; ///< Start addresses of the blocks on each page.
+    bool pending_invalidation = false;                               ///< A store hit translated code.
+    uint32_t pending_address = 0;                                    ///< Address of that store.
+    uint32_t pending_size = 0;                                       ///< Size of that store.
+    bool pending_flush = false;                                      ///< A FENCE.I asked to drop every block.
+    bool trapped = false;                                            ///< The last operation run took an exception.
+    uint64_t blocks_translated = 0;                                  ///< Blocks translated.
+    size_t block_limit = MAX_BLOCK_SIZE;                             ///< Instructions per block.
+};
+
+#endif
@@ -0,0 +1,359 @@
+#include "branch_predictor.h"
+#include "isa.h"
+#include "logger.h"
+#include "memory.h"
+#include "profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+namespace
+{
+
+constexpr uint32_t TABLE_MASK = (1u << BranchPredictor::TABLE_BITS) - 1;
+
+/**
+ * @brief Check whether a register is one of the link registers ra and t0.
+ *
+ * @param reg The register number.
+ * @return true for x1 and x5, false otherwise.
+ */
+bool is_link(uint32_t reg)
+{
+    return reg == 1 || reg == 5;
+}
+
+/**
+ * @brief Classify a control-flow instruction from its fields.
+ *
+ * @param opcode The opcode.
+ * @param rd The destination register.
+ * @param rs1 The base register of a JALR.
+ * @return BranchKind The control-flow class.
+ */
+BranchKind classify_fields(Opcode opcode, uint32_t rd, uint32_t rs1)
+{
+    switch (opcode)
+    {
+    case Opcode::B_TYPE:
+        return BranchKind::CONDITIONAL;
+    case Opcode::J_TYPE:
+        return is_link(rd) ? BranchKind::CALL : BranchKind::JUMP;
+    case Opcode::JALR:
+        if (is_link(rd))
+            return BranchKind::CALL;
+        return rd == 0 && is_link(rs1) ? BranchKind::RETURN : BranchKind::INDIRECT;
+    default:
+        return BranchKind::NONE;
+    }
+}
+
+/**
+ * @brief Classify a decoded instruction.
+ *
+ * @param decoded The decoded instruction.
+ * @return BranchKind The control-flow class.
+ */
+BranchKind classify_decoded(const DecodedInstruction &decoded)
+{
+    return classify_fields(decoded.opcode, decoded.rd, decoded.rs1);
+}
+
+const char *const KIND_NAMES[] = {"other", "conditional", "jump", "call", "return", "indirect"};
+
+} // namespace
+
+/**
+ * @brief Create a predictor by name.
+ *
+ * @param name "static", "bimodal" or "gshare".
+ * @return std::unique_ptr<BranchPredictor> The predictor, or nullptr for an unknown name.
+ */
+std::unique_ptr<BranchPredictor> BranchPredictor::create(const std::string &name)
+{
+    if (name == "static")
+        return std::make_unique<StaticPredictor>();
+    if (name == "bimodal")
+        return std::make_unique<BimodalPredictor>();
+    if (name == "gshare")
+        return std::make_unique<GsharePredictor>();
+    return nullptr;
+}
+
+/**
+ * @brief Classify an instruction word.
+ *
+ * @param instruction The raw instruction word, with a compressed instruction in the low half word.
+ * @return BranchKind The control-flow class.
+ */
+BranchKind BranchPredictor::classify(uint32_t instruction)
+{
+    if (Isa::instruction_length(instruction) == 2)
+    {
+        instruction = Isa::expand_compressed(instruction);
+    }
+    return classify_fields(static_cast<Opcode>(instruction & 0x7F), (instruction >> 7) & 0x1F, (instruction >> 15) & 0x1F);
+}
+
+BranchPredictor::BranchPredictor()
+    : btb_tags(BTB_ENTRIES, 0), btb_targets(BTB_ENTRIES, 0)
+{
+}
+
+/**
+ * @brief Predict the address to fetch after an instruction.
+ *
+ * @param pc Address of the fetched instruction.
+ * @param instruction The fetched instruction word.
+ * @param index Receives the counter index to pass back to update().
+ * @return uint32_t The predicted next fetch address.
+ */
+uint32_t BranchPredictor::predict(uint32_t pc, uint32_t instruction, uint32_t &index)
+{
+    BranchKind kind = classify(instruction);
+    uint32_t next_pc = pc + Isa::instruction_length(instruction);
+    index = 0;
+    if (kind == BranchKind::NONE)
+    {
+        return next_pc;
+    }
+
+    // A conditional branch predicted not taken needs no target
+    if (kind == BranchKind::CONDITIONAL && !predict_taken(pc, index))
+    {
+        return next_pc;
+    }
+
+    // Calls push their return address as they are fetched, returns pop it
+    if (kind == BranchKind::CALL)
+    {
+        ras[ras_top] = next_pc;
+        ras_top = (ras_top + 1) % RAS_ENTRIES;
+        ras_depth = std::min(ras_depth + 1, RAS_ENTRIES);
+    }
+    else if (kind == BranchKind::RETURN && ras_depth > 0)
+    {
+        ras_top = (ras_top + RAS_ENTRIES - 1) % RAS_ENTRIES;
+        --ras_depth;
+        return ras[ras_top];
+    }
+
+    // Without a BTB hit the target is unknown until EX
+    uint32_t entry = (pc >> 2) % BTB_ENTRIES;
+    return btb_tags[entry] == (pc | 1) ? btb_targets[entry] : next_pc;
+}
+
+/**
+ * @brief Train the tables with a resolved branch or jump and count its outcome.
+ *
+ * @param slot The decode cache slot of the instruction.
+ * @param pc Address of the instruction.
+ * @param instruction The instruction word.
+ * @param index The counter index returned by predict().
+ * @param taken Whether control left the fall-through path.
+ * @param target The resolved target address.
+ * @param penalty Cycles lost to a misprediction, 0 if the fetch address was right.
+ */
+void BranchPredictor::update(uint32_t slot, uint32_t pc, uint32_t instruction, uint32_t index, bool taken,
+                             uint32_t target, uint32_t penalty)
+{
+    if (classify(instruction) == BranchKind::CONDITIONAL)
+    {
+        train(index, taken);
+    }
+    if (taken)
+    {
+        uint32_t entry = (pc >> 2) % BTB_ENTRIES;
+        btb_tags[entry] = pc | 1;
+        btb_targets[entry] = target;
+    }
+
+    if (slot >= stats.size())
+    {
+        stats.resize(slot + 1);
+    }
+    Stats &branch = stats[slot];
+    ++branch.executed;
+    branch.taken += taken;
+    if (penalty != 0)
+    {
+        ++branch.mispredicted;
+        branch.penalty_cycles += penalty;
+    }
+}
+
+/**
+ * @brief Write the misprediction report.
+ *
+ * @param filename Path to the report file.
+ * @param cache The decode cache the slots refer to.
+ * @return true if successful, false otherwise.
+ */
+bool BranchPredictor::write_report(const std::string &filename, const DecodeCache &cache) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open branch report: " + filename);
+        return false;
+    }
+
+    /**
+     * @brief Outcomes of one static branch with where it lives.
+     */
+    struct Branch
+    {
+        const DecodedInstruction *decoded = nullptr;
+        Stats stats;
+    };
+
+    Stats total;
+    Stats by_kind[6];
+    std::map<uint32_t, Branch> by_pc;
+    uint32_t slots = std::min<uint32_t>(cache.get_slot_count(), static_cast<uint32_t>(stats.size()));
+    for (uint32_t slot = 0; slot < slots; ++slot)
+    {
+        const Stats &branch = stats[slot];
+        if (branch.executed == 0)
+        {
+            continue;
+        }
+
+        // Several slots map to the same PC once code has been invalidated
+        const DecodedInstruction &decoded = cache.get_slot_instruction(slot);
+        Branch &by_address = by_pc[cache.get_slot_pc(slot)];
+        by_address.decoded = &decoded;
+        for (Stats *sum : {&total, &by_kind[static_cast<size_t>(classify_decoded(decoded))], &by_address.stats})
+        {
+            sum->executed += branch.executed;
+            sum->taken += branch.taken;
+            sum->mispredicted += branch.mispredicted;
+            sum->penalty_cycles += branch.penalty_cycles;
+        }
+    }
+
+    auto rate = [](const Stats &branch)
+    { return branch.executed ? 100.0 * static_cast<double>(branch.mispredicted) / static_cast<double>(branch.executed) : 0.0; };
+
+    file << "Predictor: " << get_name() << "  BTB entries: " << BTB_ENTRIES << "  RAS entries: " << RAS_ENTRIES << '\n';
+    file << "Branches and jumps: " << total.executed << "  Mispredicted: " << total.mispredicted << " ("
+         << std::fixed << std::setprecision(2) << rate(total) << "%)  Penalty cycles: " << total.penalty_cycles << "\n\n";
+
+    file << "By kind:\n";
+    for (size_t kind = 1; kind < 6; ++kind)
+    {
+        if (by_kind[kind].executed == 0)
+        {
+            continue;
+        }
+        file << "  " << std::left << std::setw(12) << KIND_NAMES[kind] << std::right << std::setw(14) << by_kind[kind].executed
+             << std::setw(14) << by_kind[kind].mispredicted << std::setw(9) << rate(by_kind[kind]) << "%"
+             << std::setw(14) << by_kind[kind].penalty_cycles << " cycles\n";
+    }
+
+    // Worst offenders first, by the cycles they cost
+    std::vector<std::pair<uint32_t, Branch>> branches(by_pc.begin(), by_pc.end());
+    std::stable_sort(branches.begin(), branches.end(), [](const auto &a, const auto &b)
+                     { return a.second.stats.penalty_cycles > b.second.stats.penalty_cycles; });
+    if (branches.size() > HOT_BRANCH_COUNT)
+    {
+        branches.resize(HOT_BRANCH_COUNT);
+    }
+    file << "\nMispredicted branches:\n";
+    for (const auto &entry : branches)
+    {
+        const Branch &branch = entry.second;
+        if (branch.stats.mispredicted == 0)
+        {
+            break;
+        }
+        file << "  0x" << std::left << std::setw(10) << Memory::to_hex_string(entry.first)
+             << std::setw(8) << Profiler::mnemonic(*branch.decoded) << std::right << std::setw(14) << branch.stats.executed
+             << std::setw(14) << branch.stats.mispredicted << std::setw(9) << rate(branch.stats) << "%"
+             << std::setw(14) << branch.stats.penalty_cycles << " cycles  taken " << branch.stats.taken << "/"
+             << branch.stats.executed << '\n';
+    }
+
+    LOG_INFO("Branch report written to: " + filename);
+    return true;
+}
+
+/**
+ * @brief Guess the direction of a conditional branch.
+ *
+ * @param pc Address of the branch.
+ * @param index Receives the counter index used for the guess.
+ * @return false, always.
+ */
+bool StaticPredictor::predict_taken(uint32_t, uint32_t &index)
+{
+    index = 0;
+    return false;
+}
+
+/**
+ * @brief Train the direction model, which has nothing to learn.
+ */
+void StaticPredictor::train(uint32_t, bool)
+{
+}
+
+BimodalPredictor::BimodalPredictor()
+    : counters(TABLE_MASK + 1, 1)
+{
+}
+
+/**
+ * @brief Guess the direction of a conditional branch from its counter.
+ *
+ * @param pc Address of the branch.
+ * @param index Receives the counter index used for the guess.
+ * @return true if predicted taken, false otherwise.
+ */
+bool BimodalPredictor::predict_taken(uint32_t pc, uint32_t &index)
+{
+    index = (pc >> 2) & TABLE_MASK;
+    return counters[index] >= 2;
+}
+
+/**
+ * @brief Train the counter of a resolved conditional branch.
+ *
+ * @param index The counter index used for the guess.
+ * @param taken Whether the branch was taken.
+ */
+void BimodalPredictor::train(uint32_t index, bool taken)
+{
+    train_counter(counters[index], taken);
+}
+
+GsharePredictor::GsharePredictor()
+    : counters(TABLE_MASK + 1, 1)
+{
+}
+
+/**
+ * @brief Guess the direction of a conditional branch from its address and the global history.
+ *
+ * @param pc Address of the branch.
+ * @param index Receives the counter index used for the guess.
+ * @return true if predicted taken, false otherwise.
+ */
+bool GsharePredictor::predict_taken(uint32_t pc, uint32_t &index)
+{
+    index = ((pc >> 2) ^ history) & TABLE_MASK;
+    return counters[index] >= 2;
+}
+
+/**
+ * @brief Train the counter used for the guess and shift the outcome into the history.
+ *
+ * @param index The counter index used for the guess.
+ * @param taken Whether the branch was taken.
+ */
+void GsharePredictor::train(uint32_t index, bool taken)
+{
+    train_counter(counters[index], taken);
+    history = ((history << 1) | (taken ? 1u : 0u)) & TABLE_MASK;
+}
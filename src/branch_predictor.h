@@ -0,0 +1,216 @@
+#ifndef BRANCH_PREDICTOR_H
+#define BRANCH_PREDICTOR_H
+
+#include "decode_cache.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Control-flow class of an instruction word, found by predecoding it in IF.
+ */
+enum class BranchKind : uint8_t
+{
+    NONE,        ///< Not a control-flow instruction.
+    CONDITIONAL, ///< B-Type branch.
+    JUMP,        ///< JAL without a link register.
+    CALL,        ///< JAL or JALR linking through ra or t0.
+    RETURN,      ///< JALR through ra or t0 that links nothing.
+    INDIRECT     ///< Any other JALR.
+};
+
+/**
+ * @brief Branch prediction model for the fetch stage of the pipelined model.
+ *
+ * IF asks the predictor for the next fetch address and EX reports the
+ * resolved outcome; only a wrong guess costs the flush cycles. Targets come
+ * from a direct-mapped branch target buffer and, for returns, from a
+ * return-address stack, both shared by every model. Models differ in how
+ * they guess the direction of conditional branches.
+ *
+ * All tables are flat arrays sized at construction, and outcomes are counted
+ * by decode cache slot like the profiler does, so prediction adds a few
+ * array accesses per cycle.
+ */
+class BranchPredictor
+{
+public:
+    static constexpr uint32_t BTB_ENTRIES = 512;    ///< Branch target buffer entries.
+    static constexpr uint32_t RAS_ENTRIES = 16;     ///< Return-address stack depth.
+    static constexpr uint32_t TABLE_BITS = 12;      ///< log2 of the counter table size.
+    static constexpr size_t HOT_BRANCH_COUNT = 50;  ///< Number of branches listed in the report.
+
+    /**
+     * @brief Resolved outcomes of one static branch.
+     */
+    struct Stats
+    {
+        uint64_t executed = 0;       ///< Times resolved in EX.
+        uint64_t taken = 0;          ///< Times taken.
+        uint64_t mispredicted = 0;   ///< Times the fetch address was wrong.
+        uint64_t penalty_cycles = 0; ///< Cycles lost to its mispredictions.
+    };
+
+    virtual ~BranchPredictor() = default;
+
+    /**
+     * @brief Create a predictor by name.
+     *
+     * @param name "static", "bimodal" or "gshare".
+     * @return std::unique_ptr<BranchPredictor> The predictor, or nullptr for an unknown name.
+     */
+    static std::unique_ptr<BranchPredictor> create(const std::string &name);
+
+    /**
+     * @brief Classify an instruction word.
+     *
+     * @param instruction The raw instruction word, with a compressed instruction in the low half word.
+     * @return BranchKind The control-flow class.
+     */
+    static BranchKind classify(uint32_t instruction);
+
+    /**
+     * @brief Predict the address to fetch after an instruction.
+     *
+     * @param pc Address of the fetched instruction.
+     * @param instruction The fetched instruction word.
+     * @param index Receives the counter index to pass back to update().
+     * @return uint32_t The predicted next fetch address.
+     */
+    uint32_t predict(uint32_t pc, uint32_t instruction, uint32_t &index);
+
+    /**
+     * @brief Train the tables with a resolved branch or jump and count its outcome.
+     *
+     * @param slot The decode cache slot of the instruction.
+     * @param pc Address of the instruction.
+     * @param instruction The instruction word.
+     * @param index The counter index returned by predict().
+     * @param taken Whether control left the fall-through path.
+     * @param target The resolved target address.
+     * @param penalty Cycles lost to a misprediction, 0 if the fetch address was right.
+     */
+    void update(uint32_t slot, uint32_t pc, uint32_t instruction, uint32_t index, bool taken, uint32_t target,
+                uint32_t penalty);
+
+    /**
+     * @brief Get the outcomes counted for a decode cache slot.
+     *
+     * @param slot The decode cache slot.
+     * @return Stats The outcomes, all zero if the slot never resolved a branch.
+     */
+    Stats get_stats(uint32_t slot) const { return slot < stats.size() ? stats[slot] : Stats(); }
+
+    /**
+     * @brief Write the misprediction report.
+     *
+     * @param filename Path to the report file.
+     * @param cache The decode cache the slots refer to.
+     * @return true if successful, false otherwise.
+     */
+    bool write_report(const std::string &filename, const DecodeCache &cache) const;
+
+    /**
+     * @brief Get the name of the direction model.
+     *
+     * @return const char* The name accepted by create().
+     */
+    virtual const char *get_name() const = 0;
+
+protected:
+    BranchPredictor();
+
+    /**
+     * @brief Guess the direction of a conditional branch.
+     *
+     * @param pc Address of the branch.
+     * @param index Receives the counter index used for the guess.
+     * @return true if predicted taken, false otherwise.
+     */
+    virtual bool predict_taken(uint32_t pc, uint32_t &index) = 0;
+
+    /**
+     * @brief Train the direction model with a resolved conditional branch.
+     *
+     * @param index The counter index used for the guess.
+     * @param taken Whether the branch was taken.
+     */
+    virtual void train(uint32_t index, bool taken) = 0;
+
+    /**
+     * @brief Move a two-bit saturating counter towards an outcome.
+     *
+     * @param counter The counter, 0 to 1 predicting not taken and 2 to 3 taken.
+     * @param taken Whether the branch was taken.
+     */
+    static void train_counter(uint8_t &counter, bool taken)
+    {
+        if (taken && counter < 3)
+            ++counter;
+        else if (!taken && counter > 0)
+            --counter;
+    }
+
+private:
+    std::vector<uint32_t> btb_tags;    ///< Branch address of each BTB entry, with bit 0 set when valid.
+    std::vector<uint32_t> btb_targets; ///< Taken target of each BTB entry.
+    uint32_t ras[RAS_ENTRIES] = {};    ///< Return addresses, a ring that drops the oldest on overflow.
+    uint32_t ras_top = 0;              ///< Index of the next push.
+    uint32_t ras_depth = 0;            ///< Valid entries in the ring.
+    std::vector<Stats> stats;          ///< Outcomes by decode cache slot.
+};
+
+/**
+ * @brief Predicts every conditional branch not taken.
+ */
+class StaticPredictor : public BranchPredictor
+{
+public:
+    const char *get_name() const override { return "static"; }
+
+protected:
+    bool predict_taken(uint32_t pc, uint32_t &index) override;
+    void train(uint32_t index, bool taken) override;
+};
+
+/**
+ * @brief Two-bit saturating counters indexed by branch address.
+ */
+class BimodalPredictor : public BranchPredictor
+{
+public:
+    BimodalPredictor();
+    const char *get_name() const override { return "bimodal"; }
+
+protected:
+    bool predict_taken(uint32_t pc, uint32_t &index) override;
+    void train(uint32_t index, bool taken) override;
+
+private:
+    std::vector<uint8_t> counters; ///< One counter per table entry.
+};
+
+/**
+ * @brief Two-bit counters indexed by the branch address XOR the global history.
+ *
+ * The history holds the outcomes of the most recently resolved branches,
+ * so a branch fetched while an older one is still in flight is predicted
+ * without that outcome.
+ */
+class GsharePredictor : public BranchPredictor
+{
+public:
+    GsharePredictor();
+    const char *get_name() const override { return "gshare"; }
+
+protected:
+    bool predict_taken(uint32_t pc, uint32_t &index) override;
+    void train(uint32_t index, bool taken) override;
+
+private:
+    std::vector<uint8_t> counters; ///< One counter per table entry.
+    uint32_t history = 0;          ///< Global outcome history, newest in bit 0.
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "bus.h"
+#include "logger.h"
+#include "memory.h"
+#include <algorithm>
+
+/**
+ * @brief Map a device.
+ *
+ * @param name Name of the device, e.g. "uart".
+ * @param base Start address, page aligned.
+ * @param size Size of the range, a multiple of the page size.
+ * @param device The device.
+ * @return true if successful, false if the range is misaligned or overlaps another device.
+ */
+bool Bus::attach(const std::string &name, uint32_t base, uint32_t size, std::unique_ptr<Device> device)
+{
+    if ((base & Memory::PAGE_MASK) != 0 || size == 0 || (size & Memory::PAGE_MASK) != 0 || base > UINT32_MAX - (size - 1))
+    {
+        LOG_ERROR("Error: Device " + name + " must cover whole pages: 0x" + Memory::to_hex_string(base));
+        return false;
+    }
+
+    auto position = std::lower_bound(regions.begin(), regions.end(), base,
+                                     [](const Region &region, uint32_t address) { return region.base < address; });
+    bool overlaps_next = position != regions.end() && position->base - base < size;
+    bool overlaps_previous = position != regions.begin() && base - std::prev(position)->base < std::prev(position)->size;
+    if (overlaps_next || overlaps_previous)
+    {
+        LOG_ERROR("Error: Device " + name + " overlaps another device at: 0x" + Memory::to_hex_string(base));
+        return false;
+    }
+
+    regions.insert(position, Region{base, size, name, std::move(device)});
+    LOG_INFO("Mapped device " + name + " at: 0x" + Memory::to_hex_string(base));
+    return true;
+}
+
+/**
+ * @brief Binary search of the regions.
+ *
+ * @param address The guest address.
+ * @param offset Receives the offset of the address within the device.
+ * @return Device* The device, or nullptr if the address is not mapped to one.
+ */
+Device *Bus::find_region(uint32_t address, uint32_t &offset) const
+{
+    // The last region starting at or below the address is the only candidate
+    auto position = std::upper_bound(regions.begin(), regions.end(), address,
+                                     [](uint32_t value, const Region &region) { return value < region.base; });
+    if (position == regions.begin())
+    {
+        return nullptr;
+    }
+    const Region &region = *std::prev(position);
+    offset = address - region.base;
+    return offset < region.size ? region.device.get() : nullptr;
+}
+
+/**
+ * @brief Get a device by name.
+ *
+ * @param name Name given to attach().
+ * @return Device* The device, or nullptr if there is none of that name.
+ */
+Device *Bus::get_device(const std::string &name) const
+{
+    for (const Region &region : regions)
+    {
+        if (region.name == name)
+        {
+            return region.device.get();
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Write out the buffered output of every device.
+ */
+void Bus::flush()
+{
+    for (Region &region : regions)
+    {
+        region.device->flush();
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A memory-mapped device.
+ *
+ * Devices are shared by every hart of a machine, so implementations guard
+ * their own state.
+ */
+class Device
+{
+public:
+    virtual ~Device() = default;
+
+    /**
+     * @brief Read a register.
+     *
+     * @param offset Offset of the access from the start of the device.
+     * @param size Size of the access in bytes.
+     * @return uint32_t The value read.
+     */
+    virtual uint32_t read(uint32_t offset, uint32_t size) = 0;
+
+    /**
+     * @brief Write a register.
+     *
+     * @param offset Offset of the access from the start of the device.
+     * @param value The value written.
+     * @param size Size of the access in bytes.
+     * @return true if the device wrote guest memory, so TLBs must be refilled, false otherwise.
+     */
+    virtual bool write(uint32_t offset, uint32_t value, uint32_t size) = 0;
+
+    /**
+     * @brief Write out any buffered output.
+     */
+    virtual void flush() {}
+};
+
+/**
+ * @brief Address ranges of the memory-mapped devices of an address space.
+ *
+ * Regions cover whole pages, so a page is either RAM or a device and the
+ * TLB only ever holds RAM. Accesses reach the bus only after missing both
+ * the TLB and the page table, and find their device by a binary search of
+ * the regions sorted by base address.
+ */
+class Bus
+{
+public:
+    /**
+     * @brief Map a device.
+     *
+     * @param name Name of the device, e.g. "uart".
+     * @param base Start address, page aligned.
+     * @param size Size of the range, a multiple of the page size.
+     * @param device The device.
+     * @return true if successful, false if the range is misaligned or overlaps another device.
+     */
+    bool attach(const std::string &name, uint32_t base, uint32_t size, std::unique_ptr<Device> device);
+
+    /**
+     * @brief Find the device covering an address.
+     *
+     * @param address The guest address.
+     * @param offset Receives the offset of the address within the device.
+     * @return Device* The device, or nullptr if the address is not mapped to one.
+     */
+    Device *find(uint32_t address, uint32_t &offset) const
+    {
+        return regions.empty() ? nullptr : find_region(address, offset);
+    }
+
+    /**
+     * @brief Get a device by name.
+     *
+     * @param name Name given to attach().
+     * @return Device* The device, or nullptr if there is none of that name.
+     */
+    Device *get_device(const std::string &name) const;
+
+    /**
+     * @brief Check whether any device is mapped.
+     *
+     * @return true if there is none, false otherwise.
+     */
+    bool empty() const { return regions.empty(); }
+
+    /**
+     * @brief Write out the buffered output of every device.
+     */
+    void flush();
+
+private:
+    /**
+     * @brief A device and the addresses it answers to.
+     */
+    struct Region
+    {
+        uint32_t base;                  ///< Start address.
+        uint32_t size;                  ///< Size in bytes.
+        std::string name;               ///< Name of the device.
+        std::unique_ptr<Device> device; ///< The device.
+    };
+
+    /**
+     * @brief Binary search of the regions.
+     *
+     * @param address The guest address.
+     * @param offset Receives the offset of the address within the device.
+     * @return Device* The device, or nullptr if the address is not mapped to one.
+     */
+    Device *find_region(uint32_t address, uint32_t &offset) const;
+
+    std::vector<Region> regions; ///< Regions sorted by base address.
+};
+
+#endif
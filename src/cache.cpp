@@ -0,0 +1,356 @@
+#include "cache.h"
+#include "logger.h"
+#include "memory.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+namespace
+{
+
+/**
+ * @brief Check whether a value is a non-zero power of two.
+ *
+ * @param value The value.
+ * @return true if it is, false otherwise.
+ */
+bool is_power_of_two(uint32_t value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+/**
+ * @brief Parse an unsigned number that must use up the whole field.
+ *
+ * @param text The field.
+ * @param value Receives the number.
+ * @return true if successful, false otherwise.
+ */
+bool parse_number(const std::string &text, uint32_t &value)
+{
+    char *end = nullptr;
+    unsigned long parsed = std::strtoul(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0' || parsed > UINT32_MAX)
+    {
+        return false;
+    }
+    value = static_cast<uint32_t>(parsed);
+    return true;
+}
+
+const char *const POLICY_NAMES[] = {"lru", "fifo", "random"};
+
+} // namespace
+
+/**
+ * @brief Parse a "size:ways:line[:policy[:latency]]" description, e.g. "32k:8:64:lru:1".
+ *
+ * @param text The description.
+ * @return true if successful, false otherwise.
+ */
+bool CacheConfig::parse(const std::string &text)
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true)
+    {
+        size_t end = text.find(':', start);
+        fields.push_back(text.substr(start, end - start));
+        if (end == std::string::npos)
+        {
+            break;
+        }
+        start = end + 1;
+    }
+    if (fields.size() > 5)
+    {
+        return false;
+    }
+
+    CacheConfig parsed = *this;
+    if (!fields[0].empty())
+    {
+        std::string size_text = fields[0];
+        uint32_t scale = 1;
+        char suffix = size_text.back();
+        if (suffix == 'k' || suffix == 'K')
+            scale = 1024;
+        else if (suffix == 'm' || suffix == 'M')
+            scale = 1024 * 1024;
+        if (scale != 1)
+            size_text.pop_back();
+        if (!parse_number(size_text, parsed.size) || parsed.size > UINT32_MAX / scale)
+            return false;
+        parsed.size *= scale;
+    }
+    if (fields.size() > 1 && !parse_number(fields[1], parsed.ways))
+        return false;
+    if (fields.size() > 2 && !parse_number(fields[2], parsed.line_size))
+        return false;
+    if (fields.size() > 3)
+    {
+        const char *const *policy = std::find(std::begin(POLICY_NAMES), std::end(POLICY_NAMES), fields[3]);
+        if (policy == std::end(POLICY_NAMES))
+            return false;
+        parsed.policy = static_cast<ReplacementPolicy>(policy - std::begin(POLICY_NAMES));
+    }
+    if (fields.size() > 4 && !parse_number(fields[4], parsed.latency))
+        return false;
+
+    // Sets are selected by masking the line number; bounding the ways first
+    // keeps ways * line_size from wrapping around
+    if (parsed.ways == 0 || parsed.latency == 0 || parsed.line_size < 4 || !is_power_of_two(parsed.line_size) ||
+        parsed.ways > parsed.size / parsed.line_size || parsed.size % (parsed.ways * parsed.line_size) != 0 ||
+        !is_power_of_two(parsed.size / (parsed.ways * parsed.line_size)))
+    {
+        return false;
+    }
+    *this = parsed;
+    return true;
+}
+
+/**
+ * @brief Construct an empty cache.
+ *
+ * @param name Name used in the report, e.g. "L1D".
+ * @param config The geometry, already validated by CacheConfig::parse().
+ */
+Cache::Cache(const std::string &name, const CacheConfig &config)
+    : name(name), config(config), line_shift(0), set_mask(config.size / (config.ways * config.line_size) - 1),
+      tags(config.size / config.line_size, INVALID), stamps(tags.size(), 0), dirty(tags.size(), 0)
+{
+    while ((1u << line_shift) < config.line_size)
+    {
+        ++line_shift;
+    }
+}
+
+/**
+ * @brief Look up a line and fill it on a miss.
+ *
+ * @param address Any byte address in the line.
+ * @param write Whether the access marks the line dirty.
+ * @return Lookup Whether it hit and what the fill replaced.
+ */
+Cache::Lookup Cache::access(uint32_t address, bool write)
+{
+    Lookup lookup;
+    uint32_t line = address >> line_shift;
+    size_t base = static_cast<size_t>(line & set_mask) * config.ways;
+    ++clock;
+    ++stats.accesses;
+
+    // Compare every way without an early exit so the loop vectorises
+    const uint32_t *set = tags.data() + base;
+    uint32_t way = config.ways;
+    for (uint32_t i = 0; i < config.ways; ++i)
+    {
+        way = set[i] == line ? i : way;
+    }
+    if (way != config.ways)
+    {
+        if (config.policy == ReplacementPolicy::LRU)
+        {
+            stamps[base + way] = clock;
+        }
+        dirty[base + way] |= write;
+        lookup.hit = true;
+        return lookup;
+    }
+
+    // Empty ways carry stamp 0 and are taken first by every policy
+    ++stats.misses;
+    way = static_cast<uint32_t>(std::min_element(stamps.begin() + base, stamps.begin() + base + config.ways) -
+                                (stamps.begin() + base));
+    if (config.policy == ReplacementPolicy::RANDOM && set[way] != INVALID)
+    {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        way = random_state % config.ways;
+    }
+
+    if (set[way] != INVALID)
+    {
+        ++stats.evictions;
+        lookup.evicted = true;
+        lookup.victim = set[way] << line_shift;
+        if (dirty[base + way])
+        {
+            ++stats.writebacks;
+            lookup.writeback = true;
+        }
+    }
+    tags[base + way] = line;
+    stamps[base + way] = clock;
+    dirty[base + way] = write;
+    return lookup;
+}
+
+/**
+ * @brief Construct the hierarchy.
+ *
+ * @param l1i The L1 instruction cache.
+ * @param l1d The L1 data cache.
+ * @param l2 The unified L2, or nullptr to go straight to memory.
+ * @param memory_latency Cycles to read a line from memory.
+ */
+CacheHierarchy::CacheHierarchy(const CacheConfig &l1i, const CacheConfig &l1d, const CacheConfig *l2, uint32_t memory_latency)
+    : l1i(std::make_unique<Cache>("L1I", l1i)), l1d(std::make_unique<Cache>("L1D", l1d)),
+      l2(l2 ? std::make_unique<Cache>("L2", *l2) : nullptr), memory_latency(memory_latency)
+{
+}
+
+/**
+ * @brief Look up an address in an L1 cache and the levels behind it.
+ *
+ * @param l1 The L1 cache to start from.
+ * @param address The address.
+ * @param write true for a store.
+ * @return CacheAccess Where it was served and its latency.
+ */
+CacheAccess CacheHierarchy::access(Cache &l1, uint32_t address, bool write)
+{
+    CacheAccess result;
+    result.latency = l1.get_config().latency;
+    Cache::Lookup first = l1.access(address, write);
+    if (first.hit)
+    {
+        return result;
+    }
+    result.evictions += first.evicted;
+
+    if (l2)
+    {
+        // Dirty L1 victims drain into L2 through a write buffer, off the critical path
+        if (first.writeback)
+        {
+            result.evictions += l2->access(first.victim, true).evicted;
+        }
+        result.latency += l2->get_config().latency;
+        Cache::Lookup second = l2->access(address, false);
+        result.evictions += second.evicted;
+        if (second.hit)
+        {
+            result.level = 1;
+            return result;
+        }
+    }
+    result.level = 2;
+    result.latency += memory_latency;
+    return result;
+}
+
+/**
+ * @brief Count an access against an instruction.
+ *
+ * @param by_slot Counters by decode cache slot.
+ * @param slot The decode cache slot.
+ * @param result The outcome of the access.
+ */
+void CacheHierarchy::count(std::vector<PcStats> &by_slot, uint32_t slot, const CacheAccess &result)
+{
+    if (slot >= by_slot.size())
+    {
+        by_slot.resize(slot + 1);
+    }
+    PcStats &stats = by_slot[slot];
+    ++stats.accesses;
+    stats.l1_misses += result.level != 0;
+    stats.memory += result.level == 2;
+    stats.evictions += result.evictions;
+}
+
+/**
+ * @brief Write per-level counts and the instructions with the most misses.
+ *
+ * @param filename Path to the report file.
+ * @param cache The decode cache the slots refer to.
+ * @return true if successful, false otherwise.
+ */
+bool CacheHierarchy::write_report(const std::string &filename, const DecodeCache &cache) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open cache report: " + filename);
+        return false;
+    }
+
+    auto percent = [](uint64_t value, uint64_t total)
+    { return total ? 100.0 * static_cast<double>(value) / static_cast<double>(total) : 0.0; };
+
+    file << std::left << std::setw(6) << "Level" << std::right << std::setw(9) << "size" << std::setw(6) << "ways"
+         << std::setw(6) << "line" << "  " << std::left << std::setw(8) << "policy" << std::right << std::setw(7) << "latency"
+         << std::setw(14) << "accesses" << std::setw(14) << "misses" << std::setw(8) << "miss%" << std::setw(14)
+         << "evictions" << std::setw(14) << "writebacks" << '\n';
+    for (const Cache *level : {l1i.get(), l1d.get(), l2.get()})
+    {
+        if (!level)
+        {
+            continue;
+        }
+        const CacheConfig &config = level->get_config();
+        const CacheLevelStats &stats = level->get_stats();
+        file << std::left << std::setw(6) << level->get_name() << std::right << std::setw(9) << config.size
+             << std::setw(6) << config.ways << std::setw(6) << config.line_size << "  " << std::left << std::setw(8)
+             << POLICY_NAMES[static_cast<size_t>(config.policy)] << std::right << std::setw(7) << config.latency
+             << std::setw(14) << stats.accesses << std::setw(14) << stats.misses << std::setw(8) << std::fixed
+             << std::setprecision(2) << percent(stats.misses, stats.accesses) << std::setw(14) << stats.evictions
+             << std::setw(14) << stats.writebacks << '\n';
+    }
+    file << "Memory latency: " << memory_latency << " cycles\n";
+
+    // Instructions with the most L1 misses on each side, slots merged by PC
+    auto write_pcs = [&](const char *title, const std::vector<PcStats> &by_slot)
+    {
+        struct Totals
+        {
+            const DecodedInstruction *decoded = nullptr;
+            PcStats stats;
+        };
+        std::map<uint32_t, Totals> by_pc;
+        uint32_t slots = std::min<uint32_t>(cache.get_slot_count(), static_cast<uint32_t>(by_slot.size()));
+        for (uint32_t slot = 0; slot < slots; ++slot)
+        {
+            const PcStats &stats = by_slot[slot];
+            if (stats.l1_misses == 0)
+            {
+                continue;
+            }
+            Totals &totals = by_pc[cache.get_slot_pc(slot)];
+            totals.decoded = &cache.get_slot_instruction(slot);
+            totals.stats.accesses += stats.accesses;
+            totals.stats.l1_misses += stats.l1_misses;
+            totals.stats.memory += stats.memory;
+            totals.stats.evictions += stats.evictions;
+        }
+
+        std::vector<std::pair<uint32_t, Totals>> sorted(by_pc.begin(), by_pc.end());
+        std::stable_sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b)
+                         { return a.second.stats.l1_misses > b.second.stats.l1_misses; });
+        if (sorted.size() > HOT_PC_COUNT)
+        {
+            sorted.resize(HOT_PC_COUNT);
+        }
+        file << '\n' << title << ":\n" << std::left << std::setw(22) << "  pc" << std::right << std::setw(14) << "accesses"
+             << std::setw(14) << "L1 misses" << std::setw(8) << "miss%" << std::setw(14) << "memory" << std::setw(14)
+             << "evictions" << '\n';
+        for (const auto &entry : sorted)
+        {
+            const PcStats &stats = entry.second.stats;
+            file << "  0x" << std::left << std::setw(10) << Memory::to_hex_string(entry.first)
+                 << std::setw(8) << Profiler::mnemonic(*entry.second.decoded) << std::right << std::setw(14) << stats.accesses
+                 << std::setw(14) << stats.l1_misses << std::setw(8) << percent(stats.l1_misses, stats.accesses)
+                 << std::setw(14) << stats.memory << std::setw(14) << stats.evictions << '\n';
+        }
+    };
+    write_pcs("Fetch misses", fetch_by_slot);
+    write_pcs("Data misses", data_by_slot);
+
+    LOG_INFO("Cache report written to: " + filename);
+    return true;
+}
@@ -0,0 +1,227 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "decode_cache.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Victim selection of a set-associative cache.
+ */
+enum class ReplacementPolicy : uint8_t
+{
+    LRU,   ///< Least recently used way.
+    FIFO,  ///< Way filled longest ago.
+    RANDOM ///< Pseudo-random way, the same sequence on every run.
+};
+
+/**
+ * @brief Geometry and timing of one cache level.
+ */
+struct CacheConfig
+{
+    uint32_t size = 32 * 1024;                          ///< Capacity in bytes.
+    uint32_t ways = 4;                                  ///< Associativity.
+    uint32_t line_size = 64;                            ///< Line size in bytes.
+    ReplacementPolicy policy = ReplacementPolicy::LRU;  ///< Victim selection.
+    uint32_t latency = 1;                               ///< Cycles to hit in this level.
+
+    /**
+     * @brief Parse a "size:ways:line[:policy[:latency]]" description, e.g. "32k:8:64:lru:1".
+     *
+     * Fields that are left out keep their current value. The size takes a k
+     * or m suffix, the policy is lru, fifo or random, and the number of sets
+     * and the line size must be powers of two.
+     *
+     * @param text The description.
+     * @return true if successful, false otherwise.
+     */
+    bool parse(const std::string &text);
+};
+
+/**
+ * @brief Hit, miss and eviction counts of one cache level.
+ */
+struct CacheLevelStats
+{
+    uint64_t accesses = 0;   ///< Lookups.
+    uint64_t misses = 0;     ///< Lookups that had to fill a line.
+    uint64_t evictions = 0;  ///< Valid lines replaced by a fill.
+    uint64_t writebacks = 0; ///< Dirty lines written to the next level.
+};
+
+/**
+ * @brief Where an access was served and what it cost.
+ */
+struct CacheAccess
+{
+    uint32_t latency = 1;  ///< Cycles until the data is available.
+    uint8_t level = 0;     ///< 0 for an L1 hit, 1 if served by L2, 2 if served by memory.
+    uint8_t evictions = 0; ///< Lines replaced on the way.
+};
+
+/**
+ * @brief Tag store of one set-associative, write-back, write-allocate cache level.
+ *
+ * Only tags are modelled, data always comes from Memory. Tags, use stamps
+ * and dirty bits are kept in separate arrays with the ways of a set next to
+ * each other, so a lookup compares all ways of a set in one vectorisable
+ * loop.
+ */
+class Cache
+{
+public:
+    /**
+     * @brief Construct an empty cache.
+     *
+     * @param name Name used in the report, e.g. "L1D".
+     * @param config The geometry, already validated by CacheConfig::parse().
+     */
+    Cache(const std::string &name, const CacheConfig &config);
+
+    /**
+     * @brief Outcome of one lookup.
+     */
+    struct Lookup
+    {
+        bool hit = false;       ///< The line was present.
+        bool evicted = false;   ///< The fill replaced a valid line.
+        bool writeback = false; ///< The replaced line was dirty.
+        uint32_t victim = 0;    ///< Address of the replaced line.
+    };
+
+    /**
+     * @brief Look up a line and fill it on a miss.
+     *
+     * @param address Any byte address in the line.
+     * @param write Whether the access marks the line dirty.
+     * @return Lookup Whether it hit and what the fill replaced.
+     */
+    Lookup access(uint32_t address, bool write);
+
+    /**
+     * @brief Get the hit, miss and eviction counts.
+     *
+     * @return const CacheLevelStats& The counts.
+     */
+    const CacheLevelStats &get_stats() const { return stats; }
+
+    /**
+     * @brief Get the name used in the report.
+     *
+     * @return const std::string& The name.
+     */
+    const std::string &get_name() const { return name; }
+
+    /**
+     * @brief Get the geometry and timing.
+     *
+     * @return const CacheConfig& The configuration.
+     */
+    const CacheConfig &get_config() const { return config; }
+
+private:
+    static constexpr uint32_t INVALID = UINT32_MAX; ///< Tag of an empty way; no line number reaches it.
+
+    std::string name;            ///< Name used in the report.
+    CacheConfig config;          ///< Geometry and timing.
+    uint32_t line_shift;         ///< log2 of the line size.
+    uint32_t set_mask;           ///< Number of sets minus one.
+    std::vector<uint32_t> tags;  ///< Line number held by each way, INVALID if empty.
+    std::vector<uint64_t> stamps; ///< Last use (LRU) or fill (FIFO) of each way.
+    std::vector<uint8_t> dirty;  ///< Whether each way holds a modified line.
+    uint64_t clock = 0;          ///< Access counter the stamps are taken from.
+    uint32_t random_state = 0x9E3779B9u; ///< Xorshift state for random replacement.
+    CacheLevelStats stats;       ///< Hit, miss and eviction counts.
+};
+
+/**
+ * @brief Per-hart L1 instruction and data caches in front of an optional L2.
+ *
+ * The pipelined model charges every fetch and every load or store the
+ * latency returned here instead of a single cycle. Accesses are also counted
+ * by decode cache slot, so the report can name the instructions that miss.
+ */
+class CacheHierarchy
+{
+public:
+    /**
+     * @brief Accesses of one instruction, split by where they were served.
+     */
+    struct PcStats
+    {
+        uint64_t accesses = 0;  ///< Fetches or data accesses.
+        uint64_t l1_misses = 0; ///< Accesses that missed in L1.
+        uint64_t memory = 0;    ///< Accesses served by memory.
+        uint64_t evictions = 0; ///< Lines the accesses replaced at any level.
+    };
+
+    /**
+     * @brief Construct the hierarchy.
+     *
+     * @param l1i The L1 instruction cache.
+     * @param l1d The L1 data cache.
+     * @param l2 The unified L2, or nullptr to go straight to memory.
+     * @param memory_latency Cycles to read a line from memory.
+     */
+    CacheHierarchy(const CacheConfig &l1i, const CacheConfig &l1d, const CacheConfig *l2, uint32_t memory_latency);
+
+    /**
+     * @brief Fetch an instruction through the L1 instruction cache.
+     *
+     * @param address Address of the instruction.
+     * @return CacheAccess Where it was served and its latency.
+     */
+    CacheAccess fetch(uint32_t address) { return access(*l1i, address, false); }
+
+    /**
+     * @brief Load or store through the L1 data cache.
+     *
+     * @param address Effective address.
+     * @param write true for a store.
+     * @return CacheAccess Where it was served and its latency.
+     */
+    CacheAccess data(uint32_t address, bool write) { return access(*l1d, address, write); }
+
+    /**
+     * @brief Count a fetch against the instruction that was fetched.
+     *
+     * @param slot The decode cache slot.
+     * @param result The outcome of the fetch.
+     */
+    void count_fetch(uint32_t slot, const CacheAccess &result) { count(fetch_by_slot, slot, result); }
+
+    /**
+     * @brief Count a load or store against the instruction that made it.
+     *
+     * @param slot The decode cache slot.
+     * @param result The outcome of the access.
+     */
+    void count_data(uint32_t slot, const CacheAccess &result) { count(data_by_slot, slot, result); }
+
+    /**
+     * @brief Write per-level counts and the instructions with the most misses.
+     *
+     * @param filename Path to the report file.
+     * @param cache The decode cache the slots refer to.
+     * @return true if successful, false otherwise.
+     */
+    bool write_report(const std::string &filename, const DecodeCache &cache) const;
+
+private:
+    static constexpr size_t HOT_PC_COUNT = 50; ///< Number of instructions listed in the report.
+
+    CacheAccess access(Cache &l1, uint32_t address, bool write);
+    static void count(std::vector<PcStats> &by_slot, uint32_t slot, const CacheAccess &result);
+
+    std::unique_ptr<Cache> l1i;       ///< L1 instruction cache.
+    std::unique_ptr<Cache> l1d;       ///< L1 data cache.
+    std::unique_ptr<Cache> l2;        ///< Unified L2, null if absent.
+    uint32_t memory_latency;          ///< Cycles to read a line from memory.
+    std::vector<PcStats> fetch_by_slot; ///< Fetch outcomes by decode cache slot.
+    std::vector<PcStats> data_by_slot;  ///< Load and store outcomes by decode cache slot.
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "cosim.h"
+#include "isa.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+namespace
+{
+/**
+ * @brief Format a 32-bit value as eight hexadecimal digits.
+ *
+ * @param value The value.
+ * @return std::string The digits, with a 0x prefix.
+ */
+std::string hex(uint32_t value)
+{
+    char text[11];
+    std::snprintf(text, sizeof(text), "0x%08x", value);
+    return text;
+}
+
+/**
+ * @brief Report one differing value.
+ *
+ * @param report The report.
+ * @param name Name of the register or location.
+ * @param value Value on the hart under test.
+ * @param reference Value on the reference.
+ */
+void report_value(std::ostream &report, const std::string &name, uint32_t value, uint32_t reference)
+{
+    report << "  " << name << ": " << hex(value) << ", reference " << hex(reference) << '\n';
+}
+
+/**
+ * @brief Read a little-endian word from a host page.
+ *
+ * @param bytes The first byte.
+ * @return uint32_t The word.
+ */
+uint32_t read_word(const uint8_t *bytes)
+{
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+/**
+ * @brief Sort a page log and drop repeats.
+ *
+ * @param pages The page numbers.
+ */
+void sort_unique(std::vector<uint32_t> &pages)
+{
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+}
+
+const char *const HALT_NAMES[] = {"running", "exit", "tohost", "return", "limit", "stopped", "trap"};
+} // namespace
+
+constexpr uint64_t CoSimulation::DEFAULT_INTERVAL;
+constexpr uint32_t CoSimulation::MAX_REPORTED_WORDS;
+
+/**
+ * @brief Construct a new CoSimulation object and start logging the stores of both harts.
+ *
+ * @param cpu The hart under test, ready to run.
+ * @param engine The engine the hart under test runs on.
+ * @param reference The reference hart, in the same state with a memory of its own.
+ * @param interval Instructions between checks, at least 1.
+ */
+CoSimulation::CoSimulation(CPU &cpu, Engine engine, CPU &reference, uint64_t interval)
+    : cpu(cpu), engine(engine), reference(reference), interval(std::max<uint64_t>(interval, 1)), block_engine(cpu)
+{
+    cpu.memory.set_dirty_log(&dirty_pages);
+    reference.memory.set_dirty_log(&reference_dirty_pages);
+}
+
+/**
+ * @brief Stop logging the stores of both harts.
+ */
+CoSimulation::~CoSimulation()
+{
+    cpu.memory.set_dirty_log(nullptr);
+    reference.memory.set_dirty_log(nullptr);
+}
+
+/**
+ * @brief Run both harts until the hart under test halts or the states diverge.
+ *
+ * @param report Receives the differences if the states diverge.
+ * @return true if the states agreed at every check, false otherwise.
+ */
+bool CoSimulation::run(std::ostream &report)
+{
+    while (true)
+    {
+        advance();
+        follow();
+        ++checks;
+
+        std::ostringstream differences;
+        if (!compare(differences))
+        {
+            report << "Co-simulation diverged between instructions " << agreed << " and "
+                   << cpu.get_instructions_retired() << ":\n"
+                   << differences.str();
+
+            // The next instruction of each hart, the first clue where they parted
+            for (CPU *hart : {&cpu, &reference})
+            {
+                if (hart->is_halted())
+                {
+                    continue;
+                }
+                DecodedInstruction decoded{};
+                uint32_t instruction = hart->fetch_instruction(hart->pc);
+                report << "  " << (hart == &cpu ? "next" : "reference next") << ": " << hex(hart->pc) << "  "
+                       << (CPU::try_decode_instruction(instruction, decoded) ? Isa::disassemble(decoded, hart->pc)
+                                                                             : "unknown " + hex(instruction))
+                       << '\n';
+            }
+            return false;
+        }
+        agreed = cpu.get_instructions_retired();
+
+        if (cpu.is_halted())
+        {
+            LOG_INFO("Co-simulation agreed at " + std::to_string(checks) + " checks over " + std::to_string(agreed) +
+                     " instructions");
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Run the hart under test for about one interval.
+ */
+void CoSimulation::advance()
+{
+    cpu.set_break_count(cpu.get_instructions_retired() + interval);
+    if (engine == Engine::BLOCK)
+    {
+        block_engine.run();
+    }
+    else
+    {
+        cpu.run();
+    }
+    cpu.set_break_count(0);
+}
+
+/**
+ * @brief Bring the reference to the retired count of the hart under test.
+ */
+void CoSimulation::follow()
+{
+    uint64_t target = cpu.get_instructions_retired();
+    if (target > reference.get_instructions_retired() + 2)
+    {
+        reference.set_break_count(target - 2);
+        reference.run();
+        reference.set_break_count(0);
+    }
+    while (!reference.is_halted() && reference.get_instructions_retired() < target)
+    {
+        reference.step();
+    }
+
+    // An instruction that halts need not retire, so give the reference the chance to halt too
+    if (cpu.is_halted() && cpu.get_halt_reason() != HaltReason::LIMIT && !reference.is_halted() &&
+        reference.get_instructions_retired() == target)
+    {
+        reference.step();
+    }
+}
+
+/**
+ * @brief Compare the architectural state and the logged pages of both harts.
+ *
+ * @param report Receives the differences.
+ * @return true if the states agree, false otherwise.
+ */
+bool CoSimulation::compare(std::ostream &report)
+{
+    bool same = true;
+    auto check = [&report, &same](const std::string &name, uint32_t value, uint32_t reference)
+    {
+        if (value != reference)
+        {
+            report_value(report, name, value, reference);
+            same = false;
+        }
+    };
+
+    if (cpu.get_instructions_retired() != reference.get_instructions_retired())
+    {
+        report << "  retired: " << cpu.get_instructions_retired() << ", reference "
+               << reference.get_instructions_retired() << '\n';
+        same = false;
+    }
+    check("pc", cpu.pc, reference.pc);
+    for (uint32_t i = 0; i < 32; ++i)
+    {
+        check(Isa::register_name(i), cpu.registers[i], reference.registers[i]);
+    }
+    for (uint32_t i = 0; i < 32; ++i)
+    {
+        check(Isa::float_register_name(i), cpu.float_registers[i], reference.float_registers[i]);
+    }
+    check("fcsr", cpu.fcsr, reference.fcsr);
+    check("mstatus", cpu.mstatus, reference.mstatus);
+    check("mie", cpu.mie, reference.mie);
+    check("mtvec", cpu.mtvec, reference.mtvec);
+    check("mscratch", cpu.mscratch, reference.mscratch);
+    check("mepc", cpu.mepc, reference.mepc);
+    check("mcause", cpu.mcause, reference.mcause);
+    check("mtval", cpu.mtval, reference.mtval);
+
+    // A hart that ran into its instruction limit has not really halted
+    HaltReason reason = cpu.get_halt_reason() == HaltReason::LIMIT ? HaltReason::NONE : cpu.get_halt_reason();
+    if (reason != reference.get_halt_reason())
+    {
+        report << "  halt: " << HALT_NAMES[static_cast<int>(reason)] << ", reference "
+               << HALT_NAMES[static_cast<int>(reference.get_halt_reason())] << '\n';
+        same = false;
+    }
+    else if (reason != HaltReason::NONE)
+    {
+        check("exit code", cpu.get_exit_code(), reference.get_exit_code());
+    }
+
+    // Only pages either hart stored to can have come to differ
+    dirty_pages.insert(dirty_pages.end(), reference_dirty_pages.begin(), reference_dirty_pages.end());
+    sort_unique(dirty_pages);
+    reference_dirty_pages.clear();
+    Memory &memory = cpu.memory.get_memory();
+    Memory &reference_memory = reference.memory.get_memory();
+    uint32_t reported = 0;
+    uint32_t unreported = 0;
+    for (uint32_t page : dirty_pages)
+    {
+        uint32_t base = page << Memory::PAGE_SHIFT;
+        const uint8_t *bytes = memory.host_pointer(base);
+        const uint8_t *reference_bytes = reference_memory.host_pointer(base);
+        if (std::memcmp(bytes, reference_bytes, Memory::PAGE_SIZE) == 0)
+        {
+            continue;
+        }
+        same = false;
+        for (uint32_t offset = 0; offset < Memory::PAGE_SIZE; offset += 4)
+        {
+            uint32_t word = read_word(bytes + offset);
+            uint32_t reference_word = read_word(reference_bytes + offset);
+            if (word == reference_word)
+            {
+                continue;
+            }
+            if (reported < MAX_REPORTED_WORDS)
+            {
+                report_value(report, "memory " + hex(base + offset), word, reference_word);
+                ++reported;
+            }
+            else
+            {
+                ++unreported;
+            }
+        }
+    }
+    if (unreported)
+    {
+        report << "  and " << unreported << " more memory words\n";
+    }
+    dirty_pages.clear();
+    return same;
+}
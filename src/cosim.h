@@ -0,0 +1,99 @@
+#ifndef COSIM_H
+#define COSIM_H
+
+#include "block_engine.h"
+#include "cpu.h"
+#include "machine.h"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief Runs a hart in lockstep with a reference hart and stops where their states diverge.
+ *
+ * The hart under test runs on its engine until it has retired at least an
+ * interval of instructions more, leaving at the next block boundary. The
+ * reference, a pipelined CPU with a memory of its own holding the same
+ * program, then retires exactly as many. The two compare the program
+ * counter, the integer and floating-point registers, the machine CSRs and
+ * the pages either of them stored to since the last check.
+ *
+ * Stores are found through the write TLB: every run flushes it on entry, so
+ * each page written is logged once when it is refilled and the stores that
+ * hit the TLB cost nothing. A check therefore costs one refill and one page
+ * compare per page written, and both engines run at full speed in between.
+ * An interval of 1 checks at every block boundary.
+ */
+class CoSimulation
+{
+public:
+    static constexpr uint64_t DEFAULT_INTERVAL = 100000; ///< Instructions between checks.
+    static constexpr uint32_t MAX_REPORTED_WORDS = 8;    ///< Differing memory words listed in a report.
+
+    /**
+     * @brief Construct a new CoSimulation object and start logging the stores of both harts.
+     *
+     * @param cpu The hart under test, ready to run.
+     * @param engine The engine the hart under test runs on.
+     * @param reference The reference hart, in the same state with a memory of its own.
+     * @param interval Instructions between checks, at least 1.
+     */
+    CoSimulation(CPU &cpu, Engine engine, CPU &reference, uint64_t interval = DEFAULT_INTERVAL);
+
+    /**
+     * @brief Stop logging the stores of both harts.
+     */
+    ~CoSimulation();
+
+    CoSimulation(const CoSimulation &) = delete;
+    CoSimulation &operator=(const CoSimulation &) = delete;
+
+    /**
+     * @brief Run both harts until the hart under test halts or the states diverge.
+     *
+     * @param report Receives the differences if the states diverge.
+     * @return true if the states agreed at every check, false otherwise.
+     */
+    bool run(std::ostream &report);
+
+    /**
+     * @brief Get the number of checks made.
+     *
+     * @return uint64_t The check count.
+     */
+    uint64_t get_check_count() const { return checks; }
+
+private:
+    /**
+     * @brief Run the hart under test for about one interval.
+     */
+    void advance();
+
+    /**
+     * @brief Bring the reference to the retired count of the hart under test.
+     *
+     * Runs the pipelined model to just short of the count, then steps, since
+     * a break may retire up to two instructions past its count.
+     */
+    void follow();
+
+    /**
+     * @brief Compare the architectural state and the logged pages of both harts.
+     *
+     * @param report Receives the differences.
+     * @return true if the states agree, false otherwise.
+     */
+    bool compare(std::ostream &report);
+
+    CPU &cpu;                                   ///< The hart under test.
+    Engine engine;                              ///< Engine of the hart under test.
+    CPU &reference;                             ///< The reference hart.
+    uint64_t interval;                          ///< Instructions between checks.
+    BlockEngine block_engine;                   ///< Translated blocks, kept across intervals.
+    std::vector<uint32_t> dirty_pages;          ///< Pages the hart under test stored to since the last check.
+    std::vector<uint32_t> reference_dirty_pages; ///< Pages the reference stored to since the last check.
+    uint64_t checks = 0;                        ///< Checks made.
+    uint64_t agreed = 0;                        ///< Retired count of the last check that agreed.
+};
+
+#endif
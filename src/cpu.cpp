@@ -1,644 +1,1619 @@
 #include "cpu.h"
+#include "branch_predictor.h"
+#include "devices.h"
 #include "logger.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "trace.h"
 #include <fstream>
-#include <iostream>
-#include <iomanip>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdio>
+
+namespace
+{
+    // Linux system call numbers used by newlib and bare-metal test programs
+    constexpr uint32_t SYS_WRITE = 64;
+    constexpr uint32_t SYS_EXIT = 93;
+    constexpr uint32_t SYS_EXIT_GROUP = 94;
+
+    constexpr int32_t GUEST_EBADF = 9;   // Bad file descriptor
+    constexpr int32_t GUEST_EFAULT = 14; // Bad address
+    constexpr int32_t GUEST_ENOSYS = 38; // Function not implemented
+
+    // RV32 with the A, C, F, I and M extensions
+    constexpr uint32_t MISA_VALUE = (1u << 30) | (1u << ('A' - 'A')) | (1u << ('C' - 'A')) | (1u << ('F' - 'A')) |
+                                    (1u << ('I' - 'A')) | (1u << ('M' - 'A'));
+
+    /**
+     * @brief Get a printable name for a halt reason.
+     *
+     * @param reason The halt reason.
+     * @return const char* The name.
+     */
+    const char *halt_reason_name(HaltReason reason)
+    {
+        switch (reason)
+        {
+        case HaltReason::EXIT:
+            return "exit system call";
+        case HaltReason::TOHOST:
+            return "tohost";
+        case HaltReason::RETURN:
+            return "return to address 0";
+        case HaltReason::LIMIT:
+            return "instruction limit";
+        case HaltReason::STOPPED:
+            return "another hart";
+        case HaltReason::TRAP:
+            return "unhandled trap";
+        default:
+            return "running";
+        }
+    }
+
+    /**
+     * @brief Get a printable name for a trap cause.
+     *
+     * @param cause The mcause value.
+     * @return const char* The name.
+     */
+    const char *trap_cause_name(TrapCause cause)
+    {
+        switch (cause)
+        {
+        case TrapCause::ILLEGAL_INSTRUCTION:
+            return "illegal instruction";
+        case TrapCause::BREAKPOINT:
+            return "breakpoint";
+        case TrapCause::LOAD_MISALIGNED:
+            return "misaligned load";
+        case TrapCause::LOAD_ACCESS_FAULT:
+            return "load access fault";
+        case TrapCause::STORE_MISALIGNED:
+            return "misaligned store";
+        case TrapCause::STORE_ACCESS_FAULT:
+            return "store access fault";
+        case TrapCause::MACHINE_ECALL:
+            return "environment call";
+        case TrapCause::MACHINE_SOFTWARE_INTERRUPT:
+            return "software interrupt";
+        case TrapCause::MACHINE_TIMER_INTERRUPT:
+            return "timer interrupt";
+        default:
+            return "unknown trap";
+        }
+    }
+}
 
 // Constructor
 /**
  * @brief Construct a new CPU object.
  *
- * @param memory Reference to the memory object.
+ * @param memory Reference to the memory object, which may be shared by several harts.
+ * @param hart_id The hart number, also passed to the program in a0.
  */
-CPU::CPU(Memory &memory) : memory(memory), pc(0)
+CPU::CPU(Memory &memory, uint32_t hart_id) : memory(memory), hart_id(hart_id), pc(0)
 {
     // Initialize registers to zero
     for (auto &reg : registers)
     {
         reg = 0;
     }
+    for (auto &reg : float_registers)
+    {
+        reg = 0;
+    }
+    registers[10] = hart_id;
 }
 
 /**
- * @brief Fetch the next instruction from memory.
+ * @brief Read the instruction at an address.
  *
- * @param pipeline The pipeline state.
+ * A word that fits in the page is read at once, which covers every
+ * full-size instruction but those starting in the last half word of a page.
+ * There only the first half word is read until it tells the instruction is
+ * full size, so a compressed instruction never touches the next page.
+ *
+ * @param address Address of the instruction, half-word aligned.
+ * @return uint32_t The instruction word, with a compressed instruction in the low half word.
  */
-void CPU::fetch(Pipeline &pipeline)
+uint32_t CPU::fetch_instruction(uint32_t address)
 {
-    if (!pipeline.fetch.valid)
+    if ((address & Memory::PAGE_MASK) <= Memory::PAGE_SIZE - 4)
     {
-        pipeline.fetch.instruction = memory.load_word(pc);
-        pipeline.fetch.pc = pc;
-        pc += 4;
-        pipeline.fetch.valid = true;
-        LOG_DEBUG("Fetched instruction: 0x" + Memory::to_hex_string(pipeline.fetch.instruction) + " from address: 0x" + Memory::to_hex_string(pc));
+        uint32_t word = memory.load_word(address);
+        return Isa::instruction_length(word) == 4 ? word : word & 0xFFFF;
+    }
+    uint32_t low = memory.load_half_word(address);
+    if (Isa::instruction_length(low) == 2)
+    {
+        return low;
     }
+    return low | static_cast<uint32_t>(memory.load_half_word(address + 2)) << 16;
 }
 
 /**
- * @brief Decode the fetched instruction.
+ * @brief Fetch the next instruction into IF/ID unless ID is stalled.
  *
  * @param pipeline The pipeline state.
  */
-void CPU::decode(Pipeline &pipeline)
+void CPU::fetch(Pipeline &pipeline)
 {
-    if (pipeline.fetch.valid)
+    // A redirect leaves a bubble: the new address is fetched in the next cycle
+    if (pipeline.redirected)
     {
-        uint32_t instruction = pipeline.fetch.instruction;
-        if (instruction == 0)
+        pipeline.redirected = false;
+        return;
+    }
+    if (!pipeline.fetch.valid && !pipeline.fetch_stopped)
+    {
+        // An instruction-cache miss holds IF for the extra cycles of its latency
+        if (pipeline.fetch_wait > 0)
         {
-            LOG_ERROR("Encountered a zero instruction, which is unsupported.");
-            throw std::runtime_error("Unsupported instruction! Instruction: 0x0");
+            if (--pipeline.fetch_wait > 0)
+            {
+                ++pipeline_stats.fetch_stalls;
+                return;
+            }
         }
-
-        Opcode opcode = static_cast<Opcode>(instruction & 0x7F);
-        LOG_DEBUG("Decoding instruction: 0x" + Memory::to_hex_string(instruction) + " with opcode: 0x" + Memory::to_hex_string(static_cast<uint8_t>(opcode)));
-
-        switch (opcode)
-        {
-        case Opcode::R_TYPE:
+        else if (caches)
         {
-            RType r_type = {
-                static_cast<RTypeFunct3>((instruction >> 12) & 0x7), // funct3
-                static_cast<Funct7>((instruction >> 25) & 0x7F),     // funct7
-                static_cast<uint8_t>((instruction >> 7) & 0x1F),     // rd
-                static_cast<uint8_t>((instruction >> 15) & 0x1F),    // rs1
-                static_cast<uint8_t>((instruction >> 20) & 0x1F)     // rs2
-            };
-            LOG_DEBUG("Decoded R-Type: funct3=" + std::to_string(static_cast<uint8_t>(r_type.funct3)) +
-                      ", funct7=" + std::to_string(static_cast<uint8_t>(r_type.funct7)) +
-                      ", rd=" + std::to_string(r_type.rd) +
-                      ", rs1=" + std::to_string(r_type.rs1) +
-                      ", rs2=" + std::to_string(r_type.rs2));
-            pipeline.decode.decoded_instruction = r_type;
-            break;
-        }
-        case Opcode::I_TYPE_LOAD:
-        {
-            IType i_type = {
-                static_cast<ITypeFunct3>((instruction >> 12) & 0x7), // funct3
-                static_cast<uint8_t>((instruction >> 7) & 0x1F),     // rd
-                static_cast<uint8_t>((instruction >> 15) & 0x1F),    // rs1
-                static_cast<int32_t>(instruction) >> 20              // imm
-            };
-            LOG_DEBUG("Decoded I-Type Load: funct3=" + std::to_string(static_cast<uint8_t>(i_type.funct3)) +
-                      ", rd=" + std::to_string(i_type.rd) +
-                      ", rs1=" + std::to_string(i_type.rs1) +
-                      ", imm=" + std::to_string(i_type.imm));
-            pipeline.decode.decoded_instruction = i_type;
-            break;
-        }
-        case Opcode::I_TYPE_ALU:
-        {
-            IType i_type = {
-                static_cast<ITypeFunct3>((instruction >> 12) & 0x7), // funct3
-                static_cast<uint8_t>((instruction >> 7) & 0x1F),     // rd
-                static_cast<uint8_t>((instruction >> 15) & 0x1F),    // rs1
-                static_cast<int32_t>(instruction) >> 20              // imm
-            };
-            LOG_DEBUG("Decoded I-Type ALU: funct3=" + std::to_string(static_cast<uint8_t>(i_type.funct3)) +
-                      ", rd=" + std::to_string(i_type.rd) +
-                      ", rs1=" + std::to_string(i_type.rs1) +
-                      ", imm=" + std::to_string(i_type.imm));
-            pipeline.decode.decoded_instruction = i_type;
-            break;
-        }
-        case Opcode::JALR:
-        {
-            IType i_type = {
-                static_cast<ITypeFunct3>((instruction >> 12) & 0x7), // funct3
-                static_cast<uint8_t>((instruction >> 7) & 0x1F),     // rd
-                static_cast<uint8_t>((instruction >> 15) & 0x1F),    // rs1
-                static_cast<int32_t>(instruction) >> 20              // imm
-            };
-            LOG_DEBUG("Decoded JALR: funct3=" + std::to_string(static_cast<uint8_t>(i_type.funct3)) +
-                      ", rd=" + std::to_string(i_type.rd) +
-                      ", rs1=" + std::to_string(i_type.rs1) +
-                      ", imm=" + std::to_string(i_type.imm));
-            pipeline.decode.decoded_instruction = i_type;
-            break;
-        }
-        case Opcode::S_TYPE:
-        {
-            int32_t imm = ((instruction >> 7) & 0x1F) | ((instruction >> 25) << 5);
-            if (imm & 0x800)
-                imm |= 0xFFFFF000; // Sign-extend the immediate value
-            SType s_type = {
-                static_cast<STypeFunct3>((instruction >> 12) & 0x7), // funct3
-                static_cast<uint8_t>((instruction >> 15) & 0x1F),    // rs1
-                static_cast<uint8_t>((instruction >> 20) & 0x1F),    // rs2
-                imm                                                  // imm
-            };
-            LOG_DEBUG("Decoded S-Type: imm=" + std::to_string(s_type.imm) +
-                      ", rs1=" + std::to_string(s_type.rs1) +
-                      ", rs2=" + std::to_string(s_type.rs2) +
-                      ", funct3=" + std::to_string(static_cast<uint8_t>(s_type.funct3)));
-            pipeline.decode.decoded_instruction = s_type;
-            break;
-        }
-        case Opcode::B_TYPE:
-        {
-            int32_t imm = ((instruction >> 7) & 0x1E) | ((instruction >> 25) << 5) | ((instruction & 0x80) << 4) | ((instruction & 0x80000000) >> 19);
-            if (imm & 0x1000)
-                imm |= 0xFFFFE000; // Sign-extend the immediate value
-            BType b_type = {
-                static_cast<BTypeFunct3>((instruction >> 12) & 0x7), // funct3
-                static_cast<uint8_t>((instruction >> 15) & 0x1F),    // rs1
-                static_cast<uint8_t>((instruction >> 20) & 0x1F),    // rs2
-                imm                                                  // imm
-            };
-            LOG_DEBUG("Decoded B-Type: imm=" + std::to_string(b_type.imm) +
-                      ", rs1=" + std::to_string(b_type.rs1) +
-                      ", rs2=" + std::to_string(b_type.rs2) +
-                      ", funct3=" + std::to_string(static_cast<uint8_t>(b_type.funct3)));
-            pipeline.decode.decoded_instruction = b_type;
-            break;
-        }
-        case Opcode::J_TYPE:
-        {
-            JType j_type = {
-                static_cast<uint8_t>((instruction >> 7) & 0x1F), // rd
-                static_cast<int32_t>(
-                    ((instruction >> 21) & 0x3FF) |               // imm[10:1]
-                    ((instruction >> 20) & 0x1) << 11 |           // imm[11]
-                    ((instruction >> 12) & 0xFF) << 12 |          // imm[19:12]
-                    ((instruction & 0x80000000) ? 0xFFF00000 : 0) // imm[31]
-                    )};
-            LOG_DEBUG("Decoded J-Type: rd=" + std::to_string(j_type.rd) +
-                      ", imm=" + std::to_string(j_type.imm));
-            pipeline.decode.decoded_instruction = j_type;
-            break;
-        }
-        default:
-            LOG_ERROR("Unsupported instruction! Instruction: 0x" + Memory::to_hex_string(instruction));
-            throw std::runtime_error("Unsupported instruction! Instruction: 0x" + Memory::to_hex_string(instruction));
+            pipeline.fetch.cache_access = caches->fetch(pc);
+            if (pipeline.fetch.cache_access.latency > 1)
+            {
+                pipeline.fetch_wait = pipeline.fetch.cache_access.latency - 1;
+                ++pipeline_stats.fetch_stalls;
+                return;
+            }
         }
 
-        pipeline.decode.pc = pipeline.fetch.pc;
-        pipeline.decode.valid = true;
-        pipeline.fetch.valid = false;
-        LOG_DEBUG("Decoded instruction at address: 0x" + Memory::to_hex_string(pipeline.decode.pc));
+        pipeline.fetch.instruction = fetch_instruction(pc);
+        pipeline.fetch.pc = pc;
+        pipeline.fetch.prediction = 0;
+        pc = branch_predictor ? branch_predictor->predict(pc, pipeline.fetch.instruction, pipeline.fetch.prediction)
+                              : pc + Isa::instruction_length(pipeline.fetch.instruction);
+        pipeline.fetch.predicted_pc = pc;
+        pipeline.fetch.valid = true;
+        LOG_DEBUG("Fetched instruction: 0x" + Memory::to_hex_string(pipeline.fetch.instruction) + " from address: 0x" + Memory::to_hex_string(pipeline.fetch.pc));
     }
 }
 
 /**
- * @brief Execute the decoded instruction.
+ * @brief Decode IF/ID into ID/EX, stalling on load-use and serialization hazards.
  *
  * @param pipeline The pipeline state.
  */
-void CPU::execute(Pipeline &pipeline)
+void CPU::decode(Pipeline &pipeline)
 {
-    if (pipeline.decode.valid)
+    // ID/EX is still occupied while MEM waits for the data cache
+    if (!pipeline.fetch.valid || pipeline.decode.valid)
     {
-        auto &decoded = pipeline.decode.decoded_instruction;
-        pipeline.execute.instruction = decoded;
-        pipeline.execute.pc = pipeline.decode.pc;
-        pipeline.execute.valid = true;
-        pipeline.decode.valid = false;
+        return;
+    }
 
-        if (std::holds_alternative<RType>(decoded))
+    const CachedInstruction *cached = decode_cache.lookup(pipeline.fetch.pc);
+    DecodedInstruction decoded;
+    bool supported = cached != nullptr || try_decode_instruction(pipeline.fetch.instruction, decoded);
+    if (!cached && supported)
+    {
+        cached = &decode_cache.insert(pipeline.fetch.pc, decoded);
+        if (profiler)
         {
-            auto r_type = std::get<RType>(decoded);
-            pipeline.execute.alu_result = execute_r_type(r_type);
+            profiler->ensure_slot(cached->slot);
         }
-        else if (std::holds_alternative<IType>(decoded))
+    }
+
+    if (supported)
+    {
+        const DecodedInstruction &instr = cached->decoded;
+
+        // A breakpoint waits in IF/ID until every older instruction has retired
+        if (instr.opcode == Opcode::DEBUG_BREAK)
         {
-            auto i_type = std::get<IType>(decoded);
-            if (static_cast<Opcode>(pipeline.fetch.instruction & 0x7F) == Opcode::I_TYPE_ALU)
+            if (!pipeline.execute.valid && !pipeline.memory.valid)
             {
-                pipeline.execute.alu_result = execute_i_type(i_type);
+                pc = pipeline.fetch.pc;
+                pipeline.fetch.valid = false;
+                request_break();
             }
-            else
+            return;
+        }
+
+        // System, fence and atomic instructions run in EX once every older
+        // instruction has retired, so they see the architectural registers
+        bool serializing = instr.opcode == Opcode::SYSTEM || instr.opcode == Opcode::MISC_MEM || instr.opcode == Opcode::AMO;
+        if (serializing && pipeline.execute.valid)
+        {
+            ++pipeline_stats.serialize_stalls;
+            return;
+        }
+
+        // A load result reaches EX one cycle too late to be forwarded
+        const ExecuteStage &older = pipeline.execute;
+        if (older.valid && older.rd != 0 && (older.decoded.opcode == Opcode::I_TYPE_LOAD || older.decoded.opcode == Opcode::AMO))
+        {
+            // Encodings without a source register leave its field zero
+            if (older.rd == instr.rs1 || older.rd == instr.rs2)
             {
-                int32_t sign_extended_imm = static_cast<int32_t>(i_type.imm);
-                pipeline.execute.alu_result = registers[i_type.rs1] + sign_extended_imm;
+                // Cycles spent on a data-cache miss are counted by MEM
+                if (pipeline.memory_wait == 0)
+                {
+                    ++pipeline_stats.load_use_stalls;
+                }
+                return;
             }
         }
-        else if (std::holds_alternative<JType>(decoded))
+
+        pipeline.decode.decoded = instr;
+        pipeline.decode.slot = cached->slot;
+        if (caches)
         {
-            auto j_type = std::get<JType>(decoded);
-            execute_j_type(j_type);
+            caches->count_fetch(cached->slot, pipeline.fetch.cache_access);
         }
-        else if (std::holds_alternative<SType>(decoded))
-        {
-            auto s_type = std::get<SType>(decoded);
+    }
 
-            // Sign-extend the immediate value
-            int32_t sign_extended_imm = static_cast<int32_t>(s_type.imm);
+    pipeline.decode.instruction = pipeline.fetch.instruction;
+    pipeline.decode.supported = supported;
+    pipeline.decode.pc = pipeline.fetch.pc;
+    pipeline.decode.predicted_pc = pipeline.fetch.predicted_pc;
+    pipeline.decode.prediction = pipeline.fetch.prediction;
+    pipeline.decode.valid = true;
+    pipeline.fetch.valid = false;
+    LOG_DEBUG("Decoded instruction at address: 0x" + Memory::to_hex_string(pipeline.decode.pc));
+}
 
-            // Perform the addition
-            pipeline.execute.alu_result = registers[s_type.rs1] + sign_extended_imm;
-        }
-        else if (std::holds_alternative<BType>(decoded))
+/**
+ * @brief Decode a raw instruction word.
+ *
+ * @param instruction The raw instruction word.
+ * @return DecodedInstruction The decoded instruction.
+ */
+DecodedInstruction CPU::decode_instruction(uint32_t instruction)
+{
+    DecodedInstruction decoded;
+    if (!try_decode_instruction(instruction, decoded))
+    {
+        if (instruction == 0)
         {
-            auto b_type = std::get<BType>(decoded);
-            execute_b_type(b_type);
+            LOG_ERROR("Encountered a zero instruction, which is unsupported.");
         }
         else
         {
-            LOG_ERROR("Unsupported instruction!");
-            throw std::runtime_error("Unsupported instruction!");
+            LOG_ERROR("Unsupported instruction! Instruction: 0x" + Memory::to_hex_string(instruction));
         }
+        throw std::runtime_error("Unsupported instruction! Instruction: 0x" + Memory::to_hex_string(instruction));
     }
+    return decoded;
 }
 
 /**
- * @brief Execute an I-Type instruction.
+ * @brief Decode a raw instruction word without reporting unsupported ones.
  *
- * @param pipeline The pipeline state.
- * @param instr The decoded I-Type instruction.
+ * The pipeline decodes instructions fetched down a path that may be
+ * discarded, so a failed decode only becomes an error once the instruction
+ * is known to execute. A compressed instruction decodes as the full-size
+ * instruction it expands to, with its own length.
+ *
+ * @param instruction The raw instruction word.
+ * @param decoded Receives the decoded instruction.
+ * @return true if the instruction is supported, false otherwise.
  */
-uint32_t CPU::execute_i_type(const IType &instr)
+bool CPU::try_decode_instruction(uint32_t instruction, DecodedInstruction &decoded)
 {
-    uint32_t result = 0;
-    LOG_DEBUG("Executing I-Type instruction");
-    switch (instr.funct3)
+    decoded.length = static_cast<uint8_t>(Isa::instruction_length(instruction));
+    if (decoded.length == 2)
     {
-    case ITypeFunct3::ADDI:
-        result = registers[instr.rs1] + instr.imm;
-        LOG_DEBUG("Executed ADDI: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " + " + std::to_string(instr.imm));
-        break;
-    case ITypeFunct3::SLLI:
-        result = registers[instr.rs1] << (instr.imm & 0x1F);
-        LOG_DEBUG("Executed SLLI: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " << " + std::to_string(instr.imm & 0x1F));
-        break;
-    case ITypeFunct3::SLTI:
-        result = (int32_t)registers[instr.rs1] < (int32_t)instr.imm ? 1 : 0;
-        LOG_DEBUG("Executed SLTI: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " < " + std::to_string(instr.imm));
+        instruction = Isa::expand_compressed(instruction);
+    }
+    decoded.operation = Isa::match(instruction);
+    if (decoded.operation == Operation::NONE)
+    {
+        return false;
+    }
+    decoded.opcode = static_cast<Opcode>(instruction & 0x7F);
+
+    uint8_t funct3 = static_cast<uint8_t>((instruction >> 12) & 0x7);
+    uint8_t rd = static_cast<uint8_t>((instruction >> 7) & 0x1F);
+    uint8_t rs1 = static_cast<uint8_t>((instruction >> 15) & 0x1F);
+    uint8_t rs2 = static_cast<uint8_t>((instruction >> 20) & 0x1F);
+    decoded.funct3 = 0;
+    decoded.rd = 0;
+    decoded.rs1 = 0;
+    decoded.rs2 = 0;
+    decoded.rs3 = 0;
+    decoded.imm = 0;
+
+    // The table tells the encoding, so only the fields are left to extract
+    switch (Isa::format(decoded.operation))
+    {
+    case IsaFormat::R:
+    case IsaFormat::R_RM:
+    case IsaFormat::R4:
+    case IsaFormat::UNARY:
+    case IsaFormat::UNARY_RM:
+    case IsaFormat::AMO:
+    case IsaFormat::LR:
+        // AMO aq and rl are ignored, ordering is always sequentially consistent.
+        // Floating-point instructions keep their rounding mode in funct3.
+        decoded.funct3 = funct3;
+        decoded.rd = rd;
+        decoded.rs1 = rs1;
+        decoded.rs2 = rs2;
+        decoded.rs3 = static_cast<uint8_t>(instruction >> 27);
         break;
-    case ITypeFunct3::SLTIU:
-        result = registers[instr.rs1] < (uint32_t)instr.imm ? 1 : 0;
-        LOG_DEBUG("Executed SLTIU: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " < " + std::to_string(instr.imm));
+    case IsaFormat::I:
+    case IsaFormat::SHIFT:
+    case IsaFormat::EXACT:
+        decoded.funct3 = funct3;
+        decoded.rd = rd;
+        decoded.rs1 = rs1;
+        decoded.imm = static_cast<int32_t>(instruction) >> 20;
         break;
-    case ITypeFunct3::XORI:
-        result = registers[instr.rs1] ^ instr.imm;
-        LOG_DEBUG("Executed XORI: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " ^ " + std::to_string(instr.imm));
+    case IsaFormat::S:
+    {
+        int32_t imm = ((instruction >> 7) & 0x1F) | ((instruction >> 25) << 5);
+        if (imm & 0x800)
+            imm |= 0xFFFFF000; // Sign-extend the immediate value
+        decoded.funct3 = funct3;
+        decoded.rs1 = rs1;
+        decoded.rs2 = rs2;
+        decoded.imm = imm;
         break;
-    case ITypeFunct3::SRLI:
-        // case ITypeFunct3::SRAI:
-        if ((instr.imm & 0x40000000) == 0)
-        {
-            result = registers[instr.rs1] >> (instr.imm & 0x1F);
-            LOG_DEBUG("Executed SRLI: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " >> " + std::to_string(instr.imm & 0x1F));
-        }
-        else
-        {
-            result = (int32_t)registers[instr.rs1] >> (instr.imm & 0x1F);
-            LOG_DEBUG("Executed SRAI: x" + std::to_string(instr.rd) + " = (int32_t)x" + std::to_string(instr.rs1) + " >> " + std::to_string(instr.imm & 0x1F));
-        }
+    }
+    case IsaFormat::B:
+    {
+        int32_t imm = ((instruction >> 7) & 0x1E) | ((instruction >> 25) << 5) | ((instruction & 0x80) << 4) | ((instruction & 0x80000000) >> 19);
+        if (imm & 0x1000)
+            imm |= 0xFFFFE000; // Sign-extend the immediate value
+        decoded.funct3 = funct3;
+        decoded.rs1 = rs1;
+        decoded.rs2 = rs2;
+        decoded.imm = imm;
         break;
-    case ITypeFunct3::ORI:
-        result = registers[instr.rs1] | instr.imm;
-        LOG_DEBUG("Executed ORI: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " | " + std::to_string(instr.imm));
+    }
+    case IsaFormat::U:
+        decoded.rd = rd;
+        decoded.imm = static_cast<int32_t>(instruction & 0xFFFFF000);
         break;
-    case ITypeFunct3::ANDI:
-        result = registers[instr.rs1] & instr.imm;
-        LOG_DEBUG("Executed ANDI: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " & " + std::to_string(instr.imm));
+    case IsaFormat::J:
+        decoded.rd = rd;
+        decoded.imm = static_cast<int32_t>(((instruction >> 21) & 0x3FF) << 1 |          // imm[10:1]
+                                           ((instruction >> 20) & 0x1) << 11 |           // imm[11]
+                                           ((instruction >> 12) & 0xFF) << 12 |          // imm[19:12]
+                                           ((instruction & 0x80000000) ? 0xFFF00000 : 0) // imm[31]
+        );
         break;
-    default:
-        LOG_ERROR("Unsupported I-Type function! Funct3: " + std::to_string(static_cast<uint8_t>(instr.funct3)));
-        std::cerr << "Unsupported I-Type function! Funct3: " << static_cast<uint8_t>(instr.funct3) << std::endl;
     }
-    return result;
+
+    LOG_DEBUG("Decoded instruction: 0x" + Memory::to_hex_string(instruction) + " as " + Isa::mnemonic(decoded.operation));
+    return true;
 }
 
 /**
- * @brief Execute the memory stage.
+ * @brief Execute ID/EX into EX/MEM, forwarding operands and resolving control flow.
  *
  * @param pipeline The pipeline state.
  */
-void CPU::mem(Pipeline &pipeline)
+void CPU::execute(Pipeline &pipeline)
 {
-    if (pipeline.execute.valid)
+    if (!pipeline.decode.valid || pipeline.execute.valid)
     {
-        auto &instr = pipeline.execute.instruction;
-        pipeline.memory.instruction = instr;
-        pipeline.memory.pc = pipeline.execute.pc;
-        pipeline.memory.valid = true;
-        pipeline.execute.valid = false;
+        return;
+    }
+    pipeline.decode.valid = false;
 
-        if (std::holds_alternative<IType>(instr))
-        {
-            auto i_type = std::get<IType>(instr);
-            if (static_cast<Opcode>(pipeline.fetch.instruction & 0x7F) == Opcode::I_TYPE_LOAD)
-            {
-                uint32_t address = pipeline.execute.alu_result;
-                LOG_DEBUG("Executing memory load at address: 0x" + Memory::to_hex_string(address));
-                switch (i_type.funct3)
-                {
-                case ITypeFunct3::LB:
-                    pipeline.memory.result = (int8_t)memory.load_byte(address);
-                    break;
-                case ITypeFunct3::LH:
-                    pipeline.memory.result = (int16_t)memory.load_half_word(address);
-                    break;
-                case ITypeFunct3::LW:
-                    pipeline.memory.result = memory.load_word(address);
-                    break;
-                default:
-                    LOG_ERROR("Unsupported load function! Funct3: " + std::to_string(static_cast<uint8_t>(i_type.funct3)));
-                    std::cerr << "Unsupported load function! Funct3: " << static_cast<uint8_t>(i_type.funct3) << std::endl;
-                }
-                pipeline.write_back = {pipeline.memory.pc, i_type.rd, pipeline.memory.result, true};
-            }
-        }
-        else if (std::holds_alternative<SType>(instr))
+    // The instruction does not retire and the ones fetched behind it are
+    // discarded; the handler is fetched in the next cycle
+    auto trap = [this, &pipeline](uint32_t address)
+    {
+        pipeline.execute.valid = false;
+        take_exception(address);
+        if (!is_halted())
         {
-            auto s_type = std::get<SType>(instr);
-            uint32_t address = pipeline.execute.alu_result;
-            LOG_DEBUG("Executing memory store at address: 0x" + Memory::to_hex_string(address));
-            switch (s_type.funct3)
-            {
-            case STypeFunct3::SB:
-                memory.store_byte(address, registers[s_type.rs2] & 0xFF);
-                break;
-            case STypeFunct3::SH:
-                memory.store_half_word(address, registers[s_type.rs2] & 0xFFFF);
-                break;
-            case STypeFunct3::SW:
-                memory.store_word(address, registers[s_type.rs2]);
-                break;
-            default:
-                LOG_ERROR("Unsupported store function! Funct3: " + std::to_string(static_cast<uint8_t>(s_type.funct3)));
-                std::cerr << "Unsupported store function! Funct3: " << static_cast<uint8_t>(s_type.funct3) << std::endl;
-            }
+            uint32_t penalty = pipeline.fetch.valid ? 2 : 1;
+            pipeline_stats.jump_flushes += penalty;
+            pipeline.fetch.valid = false;
+            pipeline.fetch_wait = 0;
+            pipeline.redirected = true;
         }
-    }
-}
-
-/**
- * @brief Execute the fetch-decode-run cycle.
- */
-void CPU::run()
-{
-    Pipeline pipeline;
+    };
 
-    // Dump CPU registers before starting execution
-    LOG_INFO("CPU state at start:");
-    print_registers();
-
-    while (true)
+    // Instructions fetched past this one may still be discarded, so an
+    // unsupported instruction is only reported once it reaches EX
+    if (!pipeline.decode.supported)
     {
-        // Fetch stage
-        fetch(pipeline);
-
-        // Decode stage
-        decode(pipeline);
+        raise_exception(TrapCause::ILLEGAL_INSTRUCTION, pipeline.decode.instruction);
+        trap(pipeline.decode.pc);
+        return;
+    }
 
-        // Execute stage
-        execute(pipeline);
+    ExecuteStage &out = pipeline.execute;
+    out.decoded = pipeline.decode.decoded;
+    const DecodedInstruction &decoded = out.decoded;
+    out.slot = pipeline.decode.slot;
+    out.pc = pipeline.decode.pc;
+    out.word = pipeline.decode.instruction;
+    out.rd = 0;
+    out.returns = false;
+    out.valid = true;
+    LOG_DEBUG("Executing " + Isa::disassemble(decoded, out.pc));
 
-        // Memory stage
-        mem(pipeline);
+    // MEM/WB already holds the result of the instruction one ahead, the one
+    // two ahead has just been written to the register file
+    auto operand = [this, &pipeline](uint32_t reg)
+    {
+        if (reg == 0)
+        {
+            return 0u;
+        }
+        if (pipeline.memory.valid && pipeline.memory.rd == reg)
+        {
+            ++pipeline_stats.forwards_ex_mem;
+            return pipeline.memory.result;
+        }
+        if (pipeline.write_back.valid && pipeline.write_back.rd == reg)
+        {
+            ++pipeline_stats.forwards_mem_wb;
+        }
+        return registers[reg];
+    };
 
-        // Write-back stage
-        write_back(pipeline);
+    // A wrong fetch address discards the instruction in IF/ID and the one
+    // that would have been fetched this cycle
+    auto redirect = [this, &pipeline](uint32_t target, uint64_t &flushes)
+    {
+        uint32_t penalty = pipeline.fetch.valid ? 2 : 1;
+        flushes += penalty;
+        pipeline.fetch.valid = false;
+        pipeline.fetch_wait = 0;
+        pipeline.redirected = true;
+        pc = target;
+        return penalty;
+    };
 
-        // Check for the ret instruction (0x00008067)
-        if (pipeline.fetch.instruction == 0x00008067)
+    // Branches and jumps only redirect when IF guessed the next address
+    // wrong, and report the outcome to the predictor either way
+    auto resolve = [this, &pipeline, &out, &redirect](bool taken, uint32_t target, uint64_t &flushes)
+    {
+        uint32_t next_pc = taken ? target : out.pc + Isa::instruction_length(out.word);
+        uint32_t penalty = next_pc != pipeline.decode.predicted_pc ? redirect(next_pc, flushes) : 0;
+        if (branch_predictor)
         {
-            LOG_INFO("Encountered ret instruction. Terminating execution.");
-            break;
+            branch_predictor->update(out.slot, out.pc, pipeline.decode.instruction, pipeline.decode.prediction, taken,
+                                     target, penalty);
         }
+    };
 
-        // Dump CPU registers after executing the instruction
-        LOG_INFO("CPU state after execution:");
-        print_registers();
+    switch (decoded.opcode)
+    {
+    case Opcode::R_TYPE:
+    {
+        out.alu_result = Isa::evaluate_alu(decoded.operation, operand(decoded.rs1), operand(decoded.rs2));
+        out.rd = decoded.rd;
+        break;
     }
-}
-
-/**
- * @brief Execute a store instruction.
- *
- * @param instr The decoded S-Type instruction.
- */
-void CPU::execute_s_type(const SType &instr)
-{
-    uint32_t address = registers[instr.rs1] + instr.imm;
-    LOG_DEBUG("Executing store instruction at address: 0x" + Memory::to_hex_string(address));
-    switch (instr.funct3)
+    case Opcode::I_TYPE_ALU:
     {
-    case STypeFunct3::SB:
-        memory.store_byte(address, registers[instr.rs2] & 0xFF);
-        LOG_DEBUG("Stored byte from register x" + std::to_string(instr.rs2) + " to address: 0x" + Memory::to_hex_string(address));
+        out.alu_result = Isa::evaluate_alu(decoded.operation, operand(decoded.rs1), static_cast<uint32_t>(decoded.imm));
+        out.rd = decoded.rd;
         break;
-    case STypeFunct3::SH:
-        memory.store_half_word(address, registers[instr.rs2] & 0xFFFF);
-        LOG_DEBUG("Stored half word from register x" + std::to_string(instr.rs2) + " to address: 0x" + Memory::to_hex_string(address));
+    }
+    case Opcode::LUI:
+    {
+        out.alu_result = static_cast<uint32_t>(decoded.imm);
+        out.rd = decoded.rd;
         break;
-    case STypeFunct3::SW:
-        memory.store_word(address, registers[instr.rs2]);
-        LOG_DEBUG("Stored word from register x" + std::to_string(instr.rs2) + " to address: 0x" + Memory::to_hex_string(address));
+    }
+    case Opcode::AUIPC:
+    {
+        out.alu_result = out.pc + static_cast<uint32_t>(decoded.imm);
+        out.rd = decoded.rd;
         break;
-    default:
-        LOG_ERROR("Unsupported store function! Funct3: " + std::to_string(static_cast<uint8_t>(instr.funct3)));
-        std::cerr << "Unsupported store function! Funct3: " << static_cast<uint8_t>(instr.funct3) << std::endl;
     }
-}
-
-/**
- * @brief Execute an R-Type instruction.
- *
- * @param instr The decoded R-Type instruction.
- */
-uint32_t CPU::execute_r_type(const RType &instr)
-{
-    LOG_DEBUG("Executing R-Type instruction");
-
-    uint32_t result = 0;
-    switch (instr.funct3)
-    {
-    case RTypeFunct3::ADD:
-        // case RTypeFunct3::SUB:
-        // case RTypeFunct3::MUL:
-        if (instr.funct7 == Funct7::ADD)
-        { // ADD
-            result = registers[instr.rs1] + registers[instr.rs2];
-            LOG_DEBUG("Executed ADD: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " + x" + std::to_string(instr.rs2));
-        }
-        else if (instr.funct7 == Funct7::SUB)
-        { // SUB
-            result = registers[instr.rs1] - registers[instr.rs2];
-            LOG_DEBUG("Executed SUB: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " - x" + std::to_string(instr.rs2));
-        }
-        else if (instr.funct7 == Funct7::MUL)
-        { // MUL
-            result = registers[instr.rs1] * registers[instr.rs2];
-            LOG_DEBUG("Executed MUL: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " * x" + std::to_string(instr.rs2));
-        }
+    case Opcode::I_TYPE_LOAD:
+    {
+        out.alu_result = operand(decoded.rs1) + decoded.imm;
+        out.rd = decoded.rd;
         break;
-    case RTypeFunct3::SLL:
-        // case RTypeFunct3::MULH:
-        if (instr.funct7 == Funct7::SLL)
-        {
-            result = registers[instr.rs1] << (registers[instr.rs2] & 0x1F);
-            LOG_DEBUG("Executed SLL: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " << " + std::to_string(registers[instr.rs2] & 0x1F));
-        }
-        else if (instr.funct7 == Funct7::MULH)
+    }
+    case Opcode::S_TYPE:
+    {
+        out.alu_result = operand(decoded.rs1) + decoded.imm;
+        out.store_value = operand(decoded.rs2);
+        break;
+    }
+    case Opcode::LOAD_FP:
+    {
+        // MEM writes the floating-point register, so WB has nothing to do
+        out.alu_result = operand(decoded.rs1) + decoded.imm;
+        break;
+    }
+    case Opcode::STORE_FP:
+    {
+        out.alu_result = operand(decoded.rs1) + decoded.imm;
+        out.store_value = float_registers[decoded.rs2];
+        break;
+    }
+    case Opcode::OP_FP:
+    case Opcode::FMADD:
+    case Opcode::FMSUB:
+    case Opcode::FNMSUB:
+    case Opcode::FNMADD:
+    {
+        // Floating-point registers are written here and by MEM, in program
+        // order and before any younger instruction reads them in EX, so
+        // they need no forwarding; integer results go through the latches
+        if (!valid_rounding_mode(decoded.funct3))
         {
-            int64_t result_mul = (int64_t)registers[instr.rs1] * (int64_t)registers[instr.rs2];
-            result = result_mul >> 32;
-            LOG_DEBUG("Executed MULH: x" + std::to_string(instr.rd) + " = (int64_t)x" + std::to_string(instr.rs1) + " * (int64_t)x" + std::to_string(instr.rs2) + " >> 32");
+            raise_exception(TrapCause::ILLEGAL_INSTRUCTION, out.word);
+            trap(out.pc);
+            break;
         }
-        break;
-    case RTypeFunct3::SLT:
-        // case RTypeFunct3::MULHSU:
-        if (instr.funct7 == Funct7::SLT)
+        uint32_t integer_source = Isa::float_source(decoded.operation) ? 0 : operand(decoded.rs1);
+        uint32_t value = execute_fp(decoded.operation, decoded, integer_source);
+        if (Isa::float_destination(decoded.operation))
         {
-            result = (int32_t)registers[instr.rs1] < (int32_t)registers[instr.rs2] ? 1 : 0;
-            LOG_DEBUG("Executed SLT: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " < x" + std::to_string(instr.rs2));
+            float_registers[decoded.rd] = value;
         }
-        else if (instr.funct7 == Funct7::MULHSU)
+        else
         {
-            int64_t result_mul = (int64_t)registers[instr.rs1] * (uint64_t)registers[instr.rs2];
-            result = result_mul >> 32;
-            LOG_DEBUG("Executed MULHSU: x" + std::to_string(instr.rd) + " = (int64_t)x" + std::to_string(instr.rs1) + " * (uint64_t)x" + std::to_string(instr.rs2) + " >> 32");
+            out.alu_result = value;
+            out.rd = decoded.rd;
         }
         break;
-    case RTypeFunct3::SLTU:
-        // case RTypeFunct3::MULHU:
-        if (instr.funct7 == Funct7::SLTU)
+    }
+    case Opcode::B_TYPE:
+    {
+        bool taken = Isa::evaluate_branch(decoded.operation, operand(decoded.rs1), operand(decoded.rs2));
+        resolve(taken, out.pc + decoded.imm, pipeline_stats.branch_flushes);
+        if (taken && profiler)
         {
-            result = registers[instr.rs1] < registers[instr.rs2] ? 1 : 0;
-            LOG_DEBUG("Executed SLTU: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " < x" + std::to_string(instr.rs2));
+            profiler->count_taken(out.slot);
         }
-        else if (instr.funct7 == Funct7::MULHU)
+        break;
+    }
+    case Opcode::J_TYPE:
+    {
+        out.alu_result = out.pc + Isa::instruction_length(out.word);
+        out.rd = decoded.rd;
+        resolve(true, out.pc + decoded.imm, pipeline_stats.jump_flushes);
+        break;
+    }
+    case Opcode::JALR:
+    {
+        uint32_t target = (operand(decoded.rs1) + decoded.imm) & ~1u;
+        out.alu_result = out.pc + Isa::instruction_length(out.word);
+        out.rd = decoded.rd;
+        resolve(true, target, pipeline_stats.jump_flushes);
+
+        // The entry function is started with ra = 0, so this is its return
+        if (target == 0)
         {
-            uint64_t result_mul = (uint64_t)registers[instr.rs1] * (uint64_t)registers[instr.rs2];
-            result = result_mul >> 32;
-            LOG_DEBUG("Executed MULHU: x" + std::to_string(instr.rd) + " = (uint64_t)x" + std::to_string(instr.rs1) + " * (uint64_t)x" + std::to_string(instr.rs2) + " >> 32");
+            out.returns = true;
+            pipeline.fetch.valid = false;
+            pipeline.fetch_stopped = true;
         }
         break;
-    case RTypeFunct3::XOR:
-        // case RTypeFunct3::DIV:
-        if (instr.funct7 == Funct7::XOR)
+    }
+    case Opcode::AMO:
+    {
+        // Serialized in ID, so the register file is up to date
+        bool stored = false;
+        out.alu_result = execute_amo(decoded.operation, decoded, stored);
+        out.rd = decoded.rd;
+        if (exception_raised)
         {
-            result = registers[instr.rs1] ^ registers[instr.rs2];
-            LOG_DEBUG("Executed XOR: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " ^ x" + std::to_string(instr.rs2));
+            trap(out.pc);
         }
-        else if (instr.funct7 == Funct7::DIV)
+        break;
+    }
+    case Opcode::SYSTEM:
+    {
+        // Serialized in ID like the other system instructions
+        if (Isa::format(decoded.operation) != IsaFormat::EXACT)
         {
-            if (registers[instr.rs2] == 0)
+            out.alu_result = execute_csr(decoded.operation, decoded, registers[decoded.rs1]);
+            out.rd = decoded.rd;
+            if (exception_raised)
             {
-                LOG_ERROR("Division by zero!");
-                throw std::runtime_error("Division by zero!");
+                trap(out.pc);
             }
-            result = (int32_t)registers[instr.rs1] / (int32_t)registers[instr.rs2];
-            LOG_DEBUG("Executed DIV: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " / x" + std::to_string(instr.rs2));
-        }
-        break;
-    case RTypeFunct3::SRL:
-        // case RTypeFunct3::SRA:
-        if (instr.funct7 == Funct7::SRL)
-        { // SRL
-            result = registers[instr.rs1] >> (registers[instr.rs2] & 0x1F);
-            LOG_DEBUG("Executed SRL: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " >> " + std::to_string(registers[instr.rs2] & 0x1F));
-        }
-        else if (instr.funct7 == Funct7::SRA)
-        { // SRA
-            result = (int32_t)registers[instr.rs1] >> (registers[instr.rs2] & 0x1F);
-            LOG_DEBUG("Executed SRA: x" + std::to_string(instr.rd) + " = (int32_t)x" + std::to_string(instr.rs1) + " >> " + std::to_string(registers[instr.rs2] & 0x1F));
+            break;
         }
-        break;
-    case RTypeFunct3::OR:
-        // case RTypeFunct3::REM:
-        if (instr.funct7 == Funct7::OR)
+
+        // The architectural PC is kept if the call halts, and MRET redirects fetch
+        uint32_t fetch_pc = pc;
+        uint32_t next_pc = out.pc + Isa::instruction_length(out.word);
+        pc = next_pc;
+        execute_system(decoded.operation, out.pc);
+        if (exception_raised)
         {
-            result = registers[instr.rs1] | registers[instr.rs2];
-            LOG_DEBUG("Executed OR: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " | x" + std::to_string(instr.rs2));
+            pc = fetch_pc;
+            trap(out.pc);
         }
-        else if (instr.funct7 == Funct7::REM)
+        else if (!is_halted())
         {
-            if (registers[instr.rs2] == 0)
+            uint32_t target = pc;
+            pc = fetch_pc;
+            if (target != next_pc)
             {
-                LOG_ERROR("Remainder by zero!");
-                throw std::runtime_error("Remainder by zero!");
+                redirect(target, pipeline_stats.jump_flushes);
             }
-            result = (int32_t)registers[instr.rs1] % (int32_t)registers[instr.rs2];
-            LOG_DEBUG("Executed REM: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " % x" + std::to_string(instr.rs2));
         }
         break;
-    case RTypeFunct3::AND:
-        // case RTypeFunct3::REMU:
-        if (instr.funct7 == Funct7::AND)
-        {
-            result = registers[instr.rs1] & registers[instr.rs2];
-            LOG_DEBUG("Executed AND: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " & x" + std::to_string(instr.rs2));
-        }
-        else if (instr.funct7 == Funct7::REMU)
+    }
+    case Opcode::MISC_MEM:
+    {
+        execute_fence(decoded);
+        if (decoded.operation == Operation::FENCE_I)
         {
-            if (registers[instr.rs2] == 0)
-            {
-                LOG_ERROR("Remainder by zero!");
-                throw std::runtime_error("Remainder by zero!");
-            }
-            result = registers[instr.rs1] % registers[instr.rs2];
-            LOG_DEBUG("Executed REMU: x" + std::to_string(instr.rd) + " = x" + std::to_string(instr.rs1) + " % x" + std::to_string(instr.rs2));
+            // Instructions behind it were fetched before the fence
+            redirect(out.pc + Isa::instruction_length(out.word), pipeline_stats.jump_flushes);
         }
         break;
+    }
     default:
-        LOG_ERROR("Unsupported funct3 for R-Type");
-        throw std::invalid_argument("Unsupported funct3 for R-Type");
+        LOG_ERROR("Unsupported instruction!");
+        throw std::runtime_error("Unsupported instruction!");
     }
-    return result;
 }
 
 /**
- * @brief Execute a B-Type instruction.
+ * @brief Perform the load or store of EX/MEM into MEM/WB.
  *
- * @param instr The decoded B-Type instruction.
+ * @param pipeline The pipeline state.
  */
-void CPU::execute_b_type(const BType &instr)
+void CPU::mem(Pipeline &pipeline)
 {
-    uint32_t target = pc + instr.imm;
-    LOG_DEBUG("Executing B-Type instruction with target address: 0x" + Memory::to_hex_string(target));
+    if (!pipeline.execute.valid)
+    {
+        return;
+    }
+    const ExecuteStage &in = pipeline.execute;
 
-    switch (instr.funct3)
+    // A data-cache miss holds the instruction in EX/MEM for the extra cycles of its latency
+    if (pipeline.memory_wait > 0)
     {
-    case BTypeFunct3::BEQ:
-        if (registers[instr.rs1] == registers[instr.rs2])
+        if (--pipeline.memory_wait > 0)
         {
-            pc = target - 4; // Adjust PC since it's already incremented
-            LOG_DEBUG("Executed BEQ: Branch taken to address: 0x" + Memory::to_hex_string(pc));
+            ++pipeline_stats.memory_stalls;
+            return;
         }
-        break;
-    case BTypeFunct3::BNE:
-        if (registers[instr.rs1] != registers[instr.rs2])
+    }
+    else if (caches && (in.decoded.opcode == Opcode::I_TYPE_LOAD || in.decoded.opcode == Opcode::S_TYPE ||
+                        in.decoded.opcode == Opcode::LOAD_FP || in.decoded.opcode == Opcode::STORE_FP))
+    {
+        CacheAccess access = caches->data(in.alu_result, in.decoded.opcode == Opcode::S_TYPE || in.decoded.opcode == Opcode::STORE_FP);
+        caches->count_data(in.slot, access);
+        if (access.latency > 1)
         {
-            pc = target - 4;
-            LOG_DEBUG("Executed BNE: Branch taken to address: 0x" + Memory::to_hex_string(pc));
+            pipeline.memory_wait = access.latency - 1;
+            ++pipeline_stats.memory_stalls;
+            return;
         }
-        break;
-    default:
-        LOG_ERROR("Unsupported B-Type function! Funct3: " + std::to_string(static_cast<uint8_t>(instr.funct3)));
-        std::cerr << "Unsupported B-Type function! Funct3: " << static_cast<uint8_t>(instr.funct3) << std::endl;
+    }
+
+    MemoryStage &out = pipeline.memory;
+    out.opcode = in.decoded.opcode;
+    out.slot = in.slot;
+    out.pc = in.pc;
+    out.word = in.word;
+    out.result = in.alu_result;
+    out.memory_flags = 0;
+    out.rd = in.rd;
+    out.returns = in.returns;
+    out.valid = true;
+    pipeline.execute.valid = false;
+
+    if (in.decoded.opcode == Opcode::I_TYPE_LOAD || in.decoded.opcode == Opcode::LOAD_FP)
+    {
+        out.result = execute_load(in.decoded.operation, in.alu_result);
+        out.address = in.alu_result;
+        out.memory_value = out.result;
+        out.memory_flags = TraceRecord::MEMORY_READ;
+        if (in.decoded.opcode == Opcode::LOAD_FP)
+        {
+            float_registers[in.decoded.rd] = out.result;
+        }
+    }
+    else if (in.decoded.opcode == Opcode::S_TYPE || in.decoded.opcode == Opcode::STORE_FP)
+    {
+        // Same path as the block engine, so tohost and code invalidation behave alike
+        uint32_t size = execute_s_type(in.decoded.operation, in.alu_result, in.store_value);
+        out.address = in.alu_result;
+        out.memory_value = size < 4 ? in.store_value & ((1u << (8 * size)) - 1) : in.store_value;
+        out.memory_flags = TraceRecord::MEMORY_WRITE;
     }
 }
 
 /**
- * @brief Execute a J-Type instruction.
+ * @brief Execute a load instruction.
  *
- * @param instr The decoded J-Type instruction.
+ * @param operation The load.
+ * @param address The effective address.
+ * @return uint32_t The loaded value.
  */
-void CPU::execute_j_type(const JType &instr)
+uint32_t CPU::execute_load(Operation operation, uint32_t address)
 {
-    LOG_DEBUG("Executing J-Type instruction");
-    registers[instr.rd] = pc + 4;
-    pc += instr.imm - 4;
-    LOG_DEBUG("Executed JAL: x" + std::to_string(instr.rd) + " = 0x" + Memory::to_hex_string(pc));
+    LOG_DEBUG("Executing memory load at address: 0x" + Memory::to_hex_string(address));
+    switch (operation)
+    {
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) \
+    case Operation::NAME:                                        \
+        return load<Operation::NAME>(address);
+        PHLEGO_ISA_LOAD(PHLEGO_ISA_CASE)
+        PHLEGO_ISA_FP_LOAD(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+    default:
+        LOG_ERROR("Not a load: " + std::string(Isa::mnemonic(operation)));
+        throw std::runtime_error("Not a load: " + std::string(Isa::mnemonic(operation)));
+    }
 }
 
 /**
- * @brief Set the program counter.
- *
- * @param address The address to set the program counter to.
+ * @brief Execute the fetch-decode-run cycle.
  */
-void CPU::set_pc(uint32_t address)
+void CPU::run()
 {
-    pc = address;
-    LOG_DEBUG("Program counter set to: 0x" + Memory::to_hex_string(pc));
+    Pipeline &pipeline = latches;
+
+    // Pages may have been replaced since the last run
+    memory.flush();
+
+    // Dump CPU registers before starting execution
+    if (Logger::is_trace_enabled())
+    {
+        LOG_INFO("CPU state at start:");
+        print_registers();
+    }
+
+    // The limit drops to zero once the program halts, so one compare covers
+    // both, and to the next interrupt check while interrupts are enabled
+    do
+    {
+        while (instructions_retired < run_limit.load(std::memory_order_relaxed))
+        {
+            if (!cycle(pipeline))
+            {
+                break;
+            }
+
+            // Dump CPU registers after every cycle
+            if (Logger::is_trace_enabled())
+            {
+                LOG_INFO("CPU state after cycle " + std::to_string(pipeline_stats.cycles) + ":");
+                print_registers();
+            }
+        }
+    } while (service_events());
+
+    if (is_halted())
+    {
+        finish_halt(pipeline);
+    }
+    else if (take_break())
+    {
+        // The debugger runs the hart again later
+        settle_pipeline(pipeline);
+        return;
+    }
+    else
+    {
+        halt(instruction_limit && instructions_retired >= instruction_limit ? HaltReason::LIMIT : HaltReason::STOPPED, 0);
+    }
+
+    // Dump CPU registers after the program terminates
+    if (Logger::is_enabled(LOG_LEVEL_INFO))
+    {
+        LOG_INFO("CPU state at end:");
+        print_registers();
+    }
+}
+
+/**
+ * @brief Advance every stage by one cycle.
+ *
+ * @param pipeline The pipeline state.
+ * @return true if the cycle completed, false if an instruction halted the hart.
+ */
+bool CPU::cycle(Pipeline &pipeline)
+{
+    ++pipeline_stats.cycles;
+
+    write_back(pipeline);
+    if (halt_reason != HaltReason::NONE)
+    {
+        return false;
+    }
+    mem(pipeline);
+    if (halt_reason != HaltReason::NONE)
+    {
+        return false;
+    }
+    execute(pipeline);
+    if (halt_reason != HaltReason::NONE)
+    {
+        return false;
+    }
+    decode(pipeline);
+    fetch(pipeline);
+    return true;
+}
+
+/**
+ * @brief Retire the instructions ahead of the one that halted the hart.
+ *
+ * @param pipeline The pipeline state.
+ */
+void CPU::finish_halt(Pipeline &pipeline)
+{
+    // Instructions behind the one that ended the program never retire,
+    // the ones ahead of it still do
+    pipeline.fetch.valid = false;
+    pipeline.decode.valid = false;
+    while (pipeline.execute.valid || pipeline.memory.valid)
+    {
+        ++pipeline_stats.cycles;
+        write_back(pipeline);
+        mem(pipeline);
+    }
+}
+
+/**
+ * @brief Bring the pipeline to an instruction boundary for the debugger.
+ *
+ * @param pipeline The pipeline state.
+ */
+void CPU::settle_pipeline(Pipeline &pipeline)
+{
+    // Loads and stores in MEM/WB have been performed, and system, fence,
+    // atomic and floating-point instructions take effect in EX, so those
+    // retire. Everything younger has only touched the latches and is
+    // fetched again on resume.
+    Opcode opcode = pipeline.execute.decoded.opcode;
+    bool executed = pipeline.execute.valid &&
+                    (opcode == Opcode::SYSTEM || opcode == Opcode::MISC_MEM || opcode == Opcode::AMO ||
+                     opcode == Opcode::OP_FP || opcode == Opcode::FMADD || opcode == Opcode::FMSUB ||
+                     opcode == Opcode::FNMSUB || opcode == Opcode::FNMADD);
+    write_back(pipeline);
+    if (executed)
+    {
+        pipeline.memory_wait = 0;
+        mem(pipeline);
+        write_back(pipeline);
+    }
+    if (is_halted())
+    {
+        finish_halt(pipeline);
+        return;
+    }
+
+    uint32_t next_pc = pipeline.execute.valid  ? pipeline.execute.pc
+                       : pipeline.decode.valid ? pipeline.decode.pc
+                       : pipeline.fetch.valid  ? pipeline.fetch.pc
+                                               : pc;
+    pipeline = Pipeline();
+    pc = next_pc;
+}
+
+/**
+ * @brief Make a hart that returned for the debugger runnable again.
+ */
+void CPU::resume()
+{
+    break_pending.store(false, std::memory_order_relaxed);
+    set_instruction_limit(instruction_limit);
+}
+
+/**
+ * @brief Make run() return as for request_break() once a number of instructions have retired.
+ *
+ * @param count The retired count to return at, 0 for none.
+ */
+void CPU::set_break_count(uint64_t count)
+{
+    break_count = count;
+    set_instruction_limit(instruction_limit);
+}
+
+/**
+ * @brief Check whether the hart still waits in WFI for an interrupt.
+ *
+ * @return true if the hart should not run yet, false otherwise.
+ */
+bool CPU::is_waiting()
+{
+    if (waiting && clint)
+    {
+        uint32_t pending = 0;
+        read_csr(static_cast<uint32_t>(Csr::MIP), pending);
+        waiting = (pending & mie) == 0;
+    }
+    else
+    {
+        waiting = false;
+    }
+    return waiting;
+}
+
+/**
+ * @brief Retire exactly one instruction with the pipelined model.
+ */
+void CPU::step()
+{
+    // Fetch one instruction, then let it drain through the other stages
+    while (!latches.fetch.valid && !is_halted() && cycle(latches))
+    {
+    }
+    if (!is_halted())
+    {
+        drain_pipeline();
+    }
+    if (is_halted())
+    {
+        finish_halt(latches);
+    }
+    take_break();
+    resume();
+}
+
+/**
+ * @brief Complete the instructions in flight without fetching new ones.
+ */
+void CPU::drain_pipeline()
+{
+    latches.fetch_stopped = true;
+    while (!is_pipeline_empty() && cycle(latches))
+    {
+    }
+    latches.fetch_stopped = false;
+    latches.redirected = false;
+    latches.fetch_wait = 0;
+}
+
+/**
+ * @brief Check whether any instruction is in flight.
+ *
+ * @return true if every pipeline latch is empty, false otherwise.
+ */
+bool CPU::is_pipeline_empty() const
+{
+    return !latches.fetch.valid && !latches.decode.valid && !latches.execute.valid && !latches.memory.valid;
+}
+
+/**
+ * @brief Execute a store instruction.
+ *
+ * @param operation The store.
+ * @param address The effective address.
+ * @param value The value of rs2.
+ * @return uint32_t The size of the store in bytes.
+ */
+uint32_t CPU::execute_s_type(Operation operation, uint32_t address, uint32_t value)
+{
+    LOG_DEBUG("Executing store instruction at address: 0x" + Memory::to_hex_string(address));
+    switch (operation)
+    {
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) \
+    case Operation::NAME:                                        \
+        store<Operation::NAME>(address, value);                  \
+        return sizeof(SEMANTICS);
+        PHLEGO_ISA_STORE(PHLEGO_ISA_CASE)
+        PHLEGO_ISA_FP_STORE(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+    default:
+        LOG_ERROR("Not a store: " + std::string(Isa::mnemonic(operation)));
+        throw std::runtime_error("Not a store: " + std::string(Isa::mnemonic(operation)));
+    }
+}
+
+/**
+ * @brief Execute a J-Type instruction.
+ *
+ * @param instr The decoded J-Type instruction.
+ * @param address Address of the JAL.
+ */
+void CPU::execute_j_type(const DecodedInstruction &instr, uint32_t address)
+{
+    LOG_DEBUG("Executing J-Type instruction");
+    if (instr.rd != 0)
+    {
+        registers[instr.rd] = pc; // PC already points past the JAL
+    }
+    pc = address + instr.imm;
+    LOG_DEBUG("Executed JAL: x" + std::to_string(instr.rd) + " = 0x" + Memory::to_hex_string(pc));
+}
+
+/**
+ * @brief Execute a JALR instruction.
+ *
+ * @param instr The decoded I-Type JALR instruction.
+ */
+void CPU::execute_jalr(const DecodedInstruction &instr)
+{
+    LOG_DEBUG("Executing JALR instruction");
+    uint32_t target = (registers[instr.rs1] + instr.imm) & ~1u;
+    if (instr.rd != 0)
+    {
+        registers[instr.rd] = pc; // PC already points past the JALR
+    }
+    pc = target;
+    LOG_DEBUG("Executed JALR: x" + std::to_string(instr.rd) + " = 0x" + Memory::to_hex_string(pc));
+
+    // The entry function is started with ra = 0, so this is its return
+    if (target == 0)
+    {
+        halt(HaltReason::RETURN, registers[10]);
+    }
+}
+
+/**
+ * @brief Execute an ECALL, EBREAK, MRET or WFI instruction.
+ *
+ * @param operation The SYSTEM instruction.
+ * @param address Address of the instruction.
+ */
+void CPU::execute_system(Operation operation, uint32_t address)
+{
+    switch (operation)
+    {
+    case Operation::EBREAK:
+        raise_exception(TrapCause::BREAKPOINT, address);
+        return;
+    case Operation::MRET:
+        pc = mepc;
+        mstatus = (mstatus & MSTATUS_MPIE ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+        request_event_check();
+        LOG_DEBUG("Executed MRET to 0x" + Memory::to_hex_string(pc));
+        return;
+    case Operation::WFI:
+        // Another hart may use the thread meanwhile; otherwise there is nothing
+        // to wait for and the interrupt, if any, is taken at the next check
+        if (yield_on_wfi && clint && mie)
+        {
+            waiting = true;
+            request_break();
+            return;
+        }
+        request_event_check();
+        return;
+    default:
+        break;
+    }
+
+    // A guest trap handler serves its own system calls
+    if (mtvec != 0)
+    {
+        raise_exception(TrapCause::MACHINE_ECALL, 0);
+        return;
+    }
+
+    uint32_t number = registers[17];
+    LOG_DEBUG("Executing ECALL: a7 = " + std::to_string(number));
+    switch (number)
+    {
+    case SYS_EXIT:
+    case SYS_EXIT_GROUP:
+        halt(HaltReason::EXIT, registers[10]);
+        break;
+    case SYS_WRITE:
+    {
+        uint32_t fd = registers[10];
+        uint32_t buffer = registers[11];
+        uint32_t length = registers[12];
+        if (fd != 1 && fd != 2)
+        {
+            registers[10] = static_cast<uint32_t>(-GUEST_EBADF);
+            break;
+        }
+        // A page at a time, so the length costs no host memory; the write
+        // ends early at memory the program never loaded or wrote
+        char chunk[Memory::PAGE_SIZE];
+        uint32_t written = 0;
+        while (written < length && memory.is_present(buffer + written))
+        {
+            uint32_t address = buffer + written;
+            uint32_t size = std::min(length - written, Memory::PAGE_SIZE - (address & Memory::PAGE_MASK));
+            for (uint32_t i = 0; i < size; ++i)
+            {
+                chunk[i] = static_cast<char>(memory.load_byte(address + i));
+            }
+            if (!quiet)
+            {
+                std::fwrite(chunk, 1, size, fd == 1 ? stdout : stderr);
+            }
+            written += size;
+        }
+        registers[10] = written == 0 && length != 0 ? static_cast<uint32_t>(-GUEST_EFAULT) : written;
+        break;
+    }
+    default:
+        LOG_ERROR("Unsupported system call! a7 = " + std::to_string(number));
+        registers[10] = static_cast<uint32_t>(-GUEST_ENOSYS);
+        break;
+    }
+}
+
+/**
+ * @brief Execute a FENCE or FENCE.I instruction.
+ *
+ * @param instr The decoded I-Type MISC-MEM instruction.
+ */
+void CPU::execute_fence(const DecodedInstruction &instr)
+{
+    if (instr.operation == Operation::FENCE_I)
+    {
+        // Code written by this or another hart becomes visible to this hart only
+        decode_cache.clear();
+        LOG_DEBUG("Executed FENCE.I: decode cache cleared");
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    LOG_DEBUG("Executed FENCE");
+}
+
+/**
+ * @brief Execute an atomic memory operation, LR or SC.
+ *
+ * A misaligned address raises a misaligned exception and a device address
+ * an access fault, both with the address in mtval, before memory is touched.
+ *
+ * @param operation The atomic instruction.
+ * @param instr The decoded R-Type AMO instruction.
+ * @param stored Set to whether memory was written, false for LR and a failed SC.
+ * @return uint32_t The value for rd.
+ */
+uint32_t CPU::execute_amo(Operation operation, const DecodedInstruction &instr, bool &stored)
+{
+    stored = false;
+    uint32_t address = registers[instr.rs1];
+    uint32_t source = registers[instr.rs2];
+    if (address & 0x3)
+    {
+        raise_exception(operation == Operation::LR_W ? TrapCause::LOAD_MISALIGNED : TrapCause::STORE_MISALIGNED, address);
+        return 0;
+    }
+
+    // Devices have no words to reserve or update atomically
+    if (memory.is_device(address))
+    {
+        raise_exception(operation == Operation::LR_W ? TrapCause::LOAD_ACCESS_FAULT : TrapCause::STORE_ACCESS_FAULT,
+                        address);
+        return 0;
+    }
+
+    uint32_t result = 0;
+    switch (operation)
+    {
+    case Operation::LR_W:
+        result = memory.load_word(address);
+        reservation_address = address;
+        reservation_value = result;
+        reservation_valid = true;
+        LOG_DEBUG("Executed LR.W at address: 0x" + Memory::to_hex_string(address));
+        return result;
+    case Operation::SC_W:
+    {
+        // The reservation holds while the word still has the value LR saw
+        stored = reservation_valid && reservation_address == address &&
+                      memory.compare_and_store_word(address, reservation_value, source);
+        reservation_valid = false;
+        LOG_DEBUG("Executed SC.W at address: 0x" + Memory::to_hex_string(address) + (stored ? " succeeded" : " failed"));
+        if (!stored)
+        {
+            return 1;
+        }
+        break;
+    }
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS)                                                   \
+    case Operation::NAME:                                                                                          \
+        result = memory.update_word(address, [source](uint32_t value) { return Isa::amo<Operation::NAME>(value, source); }); \
+        break;
+        PHLEGO_ISA_AMO(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+    default:
+        LOG_ERROR("Not an atomic instruction: " + std::string(Isa::mnemonic(operation)));
+        throw std::runtime_error("Not an atomic instruction: " + std::string(Isa::mnemonic(operation)));
+    }
+
+    stored = true;
+    decode_cache.invalidate(address, 4);
+    LOG_DEBUG("Executed AMO at address: 0x" + Memory::to_hex_string(address));
+    return result;
+}
+
+/**
+ * @brief Execute a floating-point instruction other than a load or store.
+ *
+ * Accumulates the exception flags it raises in fcsr. The rounding mode
+ * must have passed valid_rounding_mode().
+ *
+ * @param operation The floating-point instruction.
+ * @param instr The decoded R-Type instruction.
+ * @param integer_source The value of integer register rs1, for the conversions and moves from it.
+ * @return uint32_t The value for rd, a floating-point or an integer register as the table says.
+ */
+uint32_t CPU::execute_fp(Operation operation, const DecodedInstruction &instr, uint32_t integer_source)
+{
+    uint32_t a = Isa::float_source(operation) ? float_registers[instr.rs1] : integer_source;
+    uint32_t flags = 0;
+    uint32_t result = Isa::evaluate_fp(operation, a, float_registers[instr.rs2], float_registers[instr.rs3],
+                                       rounding_mode(instr.funct3), flags);
+    fcsr |= flags;
+    return result;
+}
+
+/**
+ * @brief Execute a CSR instruction.
+ *
+ * CSRRS and CSRRC with x0, and their immediate forms with 0, only read. A
+ * CSR that does not exist, or a write to a read-only one, raises an
+ * illegal instruction exception.
+ *
+ * @param operation The CSR instruction.
+ * @param instr The decoded I-Type SYSTEM instruction.
+ * @param source The value of rs1, ignored by the immediate forms.
+ * @return uint32_t The old value of the CSR, for rd.
+ */
+uint32_t CPU::execute_csr(Operation operation, const DecodedInstruction &instr, uint32_t source)
+{
+    uint32_t number = static_cast<uint32_t>(instr.imm) & 0xFFF;
+    bool immediate = instr.funct3 & 0x4;
+    bool writes = operation == Operation::CSRRW || operation == Operation::CSRRWI || instr.rs1 != 0;
+    uint32_t old_value = 0;
+
+    // The top two bits of the number are both set for read-only CSRs
+    if (!read_csr(number, old_value) || (writes && (number >> 10) == 3))
+    {
+        raise_exception(TrapCause::ILLEGAL_INSTRUCTION, 0);
+        return 0;
+    }
+    if (writes)
+    {
+        write_csr(number, Isa::evaluate_csr(operation, old_value, immediate ? instr.rs1 : source));
+    }
+    return old_value;
+}
+
+/**
+ * @brief Read a CSR.
+ *
+ * @param number The CSR number.
+ * @param value Receives the value.
+ * @return true if the CSR exists, false otherwise.
+ */
+bool CPU::read_csr(uint32_t number, uint32_t &value) const
+{
+    switch (static_cast<Csr>(number))
+    {
+    case Csr::FFLAGS:
+        value = fcsr & 0x1F;
+        return true;
+    case Csr::FRM:
+        value = (fcsr >> 5) & 0x7;
+        return true;
+    case Csr::FCSR:
+        value = fcsr;
+        return true;
+    case Csr::MSTATUS:
+        value = mstatus | MSTATUS_MPP;
+        return true;
+    case Csr::MISA:
+        value = MISA_VALUE;
+        return true;
+    case Csr::MIE:
+        value = mie;
+        return true;
+    case Csr::MTVEC:
+        value = mtvec;
+        return true;
+    case Csr::MSCRATCH:
+        value = mscratch;
+        return true;
+    case Csr::MEPC:
+        value = mepc;
+        return true;
+    case Csr::MCAUSE:
+        value = mcause;
+        return true;
+    case Csr::MTVAL:
+        value = mtval;
+        return true;
+    case Csr::MIP:
+        value = 0;
+        if (clint)
+        {
+            value = (clint->is_software_pending(hart_id) ? MIP_MSIP : 0) | (clint->is_timer_pending(hart_id) ? MIP_MTIP : 0);
+        }
+        return true;
+    case Csr::MHARTID:
+        value = hart_id;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Write a CSR, ignoring the bits it does not implement.
+ *
+ * @param number The CSR number.
+ * @param value The value.
+ * @return true if the CSR exists, false otherwise.
+ */
+bool CPU::write_csr(uint32_t number, uint32_t value)
+{
+    switch (static_cast<Csr>(number))
+    {
+    case Csr::FFLAGS:
+        fcsr = (fcsr & ~0x1Fu) | (value & 0x1F);
+        return true;
+    case Csr::FRM:
+        fcsr = (fcsr & 0x1F) | (value & 0x7) << 5;
+        return true;
+    case Csr::FCSR:
+        fcsr = value & 0xFF;
+        return true;
+    case Csr::MSTATUS:
+        mstatus = value & (MSTATUS_MIE | MSTATUS_MPIE);
+        request_event_check();
+        return true;
+    case Csr::MIE:
+        mie = value & (MIP_MSIP | MIP_MTIP);
+        request_event_check();
+        return true;
+    case Csr::MTVEC:
+        // Direct and vectored modes; the reserved modes read as direct
+        mtvec = value & ~0x2u;
+        return true;
+    case Csr::MSCRATCH:
+        mscratch = value;
+        return true;
+    case Csr::MEPC:
+        mepc = value & ~1u;
+        return true;
+    case Csr::MCAUSE:
+        mcause = value;
+        return true;
+    case Csr::MTVAL:
+        mtval = value;
+        return true;
+    case Csr::MISA:
+    case Csr::MIP:
+    case Csr::MHARTID:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Take the raised exception, jumping to the trap handler.
+ *
+ * @param address Address of the instruction that raised it.
+ */
+void CPU::take_exception(uint32_t address)
+{
+    exception_raised = false;
+    enter_trap(exception_cause, exception_value, address);
+}
+
+/**
+ * @brief Write the trap CSRs and jump to the trap handler.
+ *
+ * @param cause The value for mcause.
+ * @param value The value for mtval.
+ * @param address The value for mepc.
+ */
+void CPU::enter_trap(TrapCause cause, uint32_t value, uint32_t address)
+{
+    mepc = address;
+    mcause = static_cast<uint32_t>(cause);
+    mtval = value;
+    if (mcause >> 31)
+    {
+        ++interrupts_taken;
+    }
+    else
+    {
+        ++exceptions_taken;
+    }
+    mstatus = mstatus & MSTATUS_MIE ? MSTATUS_MPIE : 0;
+    reservation_valid = false;
+
+    // The CSRs still tell what happened, and the PC stays at the instruction
+    if (mtvec == 0)
+    {
+        LOG_ERROR("Unhandled " + std::string(trap_cause_name(cause)) + " at address: 0x" + Memory::to_hex_string(address) +
+                  ", mtval: 0x" + Memory::to_hex_string(mtval));
+        pc = address;
+        halt(HaltReason::TRAP, 1);
+        return;
+    }
+
+    // Vectored mode sends each interrupt to its own entry
+    bool interrupt = mcause >> 31;
+    pc = (mtvec & ~0x3u) + ((mtvec & 1) && interrupt ? 4 * (mcause & 0x7FFFFFFF) : 0);
+    LOG_DEBUG("Trap with mcause " + Memory::to_hex_string(mcause) + " from 0x" + Memory::to_hex_string(address) +
+              " to 0x" + Memory::to_hex_string(pc));
+}
+
+/**
+ * @brief Take a due interrupt and schedule the next check once a run loop has left through its limit.
+ *
+ * @return true if the run goes on, false if it halted, reached the
+ *         instruction limit or was stopped.
+ */
+bool CPU::service_events()
+{
+    if (metrics)
+    {
+        publish_metrics();
+    }
+
+    // Halting, stop() and request_break() drop the limit to zero
+    uint64_t limit = run_limit.load(std::memory_order_relaxed);
+    if (is_halted() || limit == 0 || (instruction_limit && instructions_retired >= instruction_limit))
+    {
+        return false;
+    }
+    if (break_count && instructions_retired >= break_count)
+    {
+        break_count = 0;
+        break_pending.store(true, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t pending = enabled_interrupts();
+    if (pending)
+    {
+        // Older instructions retire and younger ones are fetched again after the handler returns
+        settle_pipeline(latches);
+        if (is_halted())
+        {
+            return false;
+        }
+        enter_trap(pending & MIP_MSIP ? TrapCause::MACHINE_SOFTWARE_INTERRUPT : TrapCause::MACHINE_TIMER_INTERRUPT, 0, pc);
+        if (is_halted())
+        {
+            return false;
+        }
+    }
+
+    // Another thread may stop the hart meanwhile, which must win
+    while (!run_limit.compare_exchange_weak(limit, next_run_limit(), std::memory_order_relaxed))
+    {
+        if (limit == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Get the interrupts that are pending and enabled.
+ *
+ * @return uint32_t The MIP_MSIP and MIP_MTIP bits.
+ */
+uint32_t CPU::enabled_interrupts() const
+{
+    if (!clint || !(mstatus & MSTATUS_MIE) || !mie)
+    {
+        return 0;
+    }
+    uint32_t pending = 0;
+    read_csr(static_cast<uint32_t>(Csr::MIP), pending);
+    return pending & mie;
+}
+
+/**
+ * @brief Get the retired count the run loops stop at next.
+ *
+ * @return uint64_t The instruction limit, the break count or the next interrupt check, whichever comes first.
+ */
+uint64_t CPU::next_run_limit() const
+{
+    uint64_t limit = instruction_limit ? instruction_limit : UINT64_MAX;
+    if (break_count)
+    {
+        limit = std::min(limit, break_count);
+    }
+    if (clint && (mstatus & MSTATUS_MIE) && mie)
+    {
+        limit = std::min(limit, instructions_retired + INTERRUPT_CHECK_INTERVAL);
+    }
+    return limit;
+}
+
+/**
+ * @brief Copy the counters of this hart to its metrics, if it has any.
+ */
+void CPU::publish_metrics()
+{
+    if (!metrics)
+    {
+        return;
+    }
+    const CodeWriteStats &code_writes = decode_cache.get_code_write_stats();
+    metrics->instructions.store(instructions_retired, std::memory_order_relaxed);
+    metrics->decode_hits.store(decode_cache.get_hits(), std::memory_order_relaxed);
+    metrics->decode_misses.store(decode_cache.get_misses(), std::memory_order_relaxed);
+    metrics->tlb_refills.store(memory.get_refills(), std::memory_order_relaxed);
+    metrics->code_stores.store(code_writes.code_stores, std::memory_order_relaxed);
+    metrics->entries_invalidated.store(code_writes.entries_invalidated, std::memory_order_relaxed);
+    metrics->blocks_invalidated.store(code_writes.blocks_invalidated, std::memory_order_relaxed);
+    metrics->exceptions.store(exceptions_taken, std::memory_order_relaxed);
+    metrics->interrupts.store(interrupts_taken, std::memory_order_relaxed);
+    metrics->halted.store(is_halted(), std::memory_order_relaxed);
+}
+
+/**
+ * @brief Make the run loop leave at the next block boundary to publish its metrics.
+ */
+void CPU::request_metrics()
+{
+    // One is the lowest limit that does not read as a stop
+    uint64_t limit = run_limit.load(std::memory_order_relaxed);
+    while (limit > 1 && !run_limit.compare_exchange_weak(limit, 1, std::memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * @brief Make the run loop leave at the next block boundary to check for interrupts.
+ */
+void CPU::request_event_check()
+{
+    // Zero would read as a stop
+    uint64_t check = std::max<uint64_t>(instructions_retired, 1);
+    uint64_t limit = run_limit.load(std::memory_order_relaxed);
+    while (limit > check && !run_limit.compare_exchange_weak(limit, check, std::memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * @brief Stop execution at the next block boundary.
+ *
+ * @param reason Why execution stops.
+ * @param code The exit code of the program.
+ */
+void CPU::halt(HaltReason reason, uint32_t code)
+{
+    halt_reason = reason;
+    exit_code = code;
+    run_limit.store(0, std::memory_order_relaxed);
+    LOG_INFO("Hart " + std::to_string(hart_id) + " halted by " + halt_reason_name(reason) + " with exit code " + std::to_string(static_cast<int32_t>(code)));
+}
+
+/**
+ * @brief Limit the number of instructions to retire, 0 for no limit.
+ *
+ * @param limit The instruction limit.
+ */
+void CPU::set_instruction_limit(uint64_t limit)
+{
+    instruction_limit = limit;
+    if (!is_halted())
+    {
+        run_limit.store(next_run_limit(), std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Set the program counter.
+ *
+ * @param address The address to set the program counter to.
+ */
+void CPU::set_pc(uint32_t address)
+{
+    // Anything in flight belonged to the old address
+    latches = Pipeline();
+    pc = address;
+    LOG_DEBUG("Program counter set to: 0x" + Memory::to_hex_string(pc));
 }
 
 /**
@@ -652,54 +1627,109 @@ void CPU::set_sp(uint32_t address)
     LOG_DEBUG("Stack pointer set to: 0x" + Memory::to_hex_string(registers[2]));
 }
 
+/**
+ * @brief Set the value of an integer register; writes to x0 are ignored.
+ *
+ * @param index The register number.
+ * @param value The register value.
+ */
+void CPU::set_register(uint32_t index, uint32_t value)
+{
+    if (index != 0)
+    {
+        registers[index] = value;
+    }
+}
+
+/**
+ * @brief Attach a profiler, or detach it with nullptr.
+ *
+ * @param profiler The profiler to count executed instructions into.
+ */
+void CPU::set_profiler(Profiler *profiler)
+{
+    this->profiler = profiler;
+    track_slots();
+    if (profiler && decode_cache.get_slot_count() > 0)
+    {
+        profiler->ensure_slot(decode_cache.get_slot_count() - 1);
+    }
+}
+
 /**
  * @brief Print the CPU registers.
  */
 void CPU::print_registers() const
 {
-    std::cout << "PC: 0x" << Memory::to_hex_string(pc) << std::endl;
+    // Format the whole dump at once and write it with a single call
+    char text[64 + 32 * 16];
+    int length = std::snprintf(text, sizeof(text), "PC: 0x%x\n", pc);
     for (size_t i = 0; i < 32; ++i)
     {
-        std::cout << "x" << std::setw(2) << std::setfill('0') << i << ": "
-                  << std::setw(8) << std::setfill(' ') << Memory::to_hex_string(registers[i]) << std::endl;
+        length += std::snprintf(text + length, sizeof(text) - length, "x%02zu: %8x\n", i, registers[i]);
     }
-    std::cout << std::endl;
+    text[length++] = '\n';
+    std::fwrite(text, 1, length, stdout);
 }
 
 /**
- * @brief Execute the write-back stage.
+ * @brief Write MEM/WB to the register file and retire it.
  *
  * @param pipeline The pipeline state.
  */
 void CPU::write_back(Pipeline &pipeline)
 {
-    if (pipeline.memory.valid)
+    pipeline.write_back.valid = false;
+    if (!pipeline.memory.valid)
+    {
+        return;
+    }
+    const MemoryStage &in = pipeline.memory;
+    pipeline.memory.valid = false;
+    ++instructions_retired;
+    if (profiler)
     {
-        auto &instr = pipeline.memory.instruction;
-        pipeline.write_back.pc = pipeline.memory.pc;
-        pipeline.write_back.valid = true;
-        pipeline.memory.valid = false;
+        profiler->count(in.slot);
+    }
+    if (tracer)
+    {
+        tracer->record({in.pc, in.word, in.rd != 0 ? in.result : 0, in.memory_flags ? in.address : 0,
+                        in.memory_flags ? in.memory_value : 0, in.rd, in.memory_flags, 0});
+    }
 
-        if (std::holds_alternative<RType>(instr))
-        {
-            auto r_type = std::get<RType>(instr);
-            registers[r_type.rd] = pipeline.execute.alu_result;
-            LOG_DEBUG("Write-back R-Type: x" + std::to_string(r_type.rd) + " = " + std::to_string(pipeline.execute.alu_result));
-        }
-        else if (std::holds_alternative<IType>(instr))
-        {
-            if (static_cast<Opcode>(pipeline.fetch.instruction & 0x7F) == Opcode::I_TYPE_ALU)
-            {
-                auto i_type = std::get<IType>(instr);
-                registers[i_type.rd] = pipeline.execute.alu_result;
-                LOG_DEBUG("Write-back I-Type: x" + std::to_string(i_type.rd) + " = " + Memory::to_hex_string(pipeline.execute.alu_result));
-            }
-            else
-            {
-                auto i_type = std::get<IType>(instr);
-                registers[i_type.rd] = pipeline.memory.result;
-                LOG_DEBUG("Write-back I-Type: x" + std::to_string(i_type.rd) + " = " + Memory::to_hex_string(pipeline.memory.result));
-            }
-        }
+    if (in.rd != 0)
+    {
+        registers[in.rd] = in.result;
+        pipeline.write_back = {in.pc, in.rd, in.result, true};
+        LOG_DEBUG("Write-back: x" + std::to_string(in.rd) + " = " + Memory::to_hex_string(in.result));
+    }
+
+    if (in.returns)
+    {
+        halt(HaltReason::RETURN, registers[10]);
     }
 }
+
+/**
+ * @brief Print the cycle counts.
+ *
+ * @param out The stream to print to.
+ * @param instructions The instructions retired over the same cycles.
+ */
+void PipelineStats::print(std::ostream &out, uint64_t instructions) const
+{
+    char text[512];
+    double cpi = instructions ? static_cast<double>(cycles) / static_cast<double>(instructions) : 0.0;
+    std::snprintf(text, sizeof(text),
+                  "Cycles: %llu\nInstructions: %llu\nCPI: %.3f\n"
+                  "Load-use stalls: %llu\nSerialization stalls: %llu\n"
+                  "Branch flushes: %llu\nJump flushes: %llu\n"
+                  "Instruction cache stalls: %llu\nData cache stalls: %llu\n"
+                  "Forwards EX/MEM: %llu\nForwards MEM/WB: %llu\n",
+                  static_cast<unsigned long long>(cycles), static_cast<unsigned long long>(instructions), cpi,
+                  static_cast<unsigned long long>(load_use_stalls), static_cast<unsigned long long>(serialize_stalls),
+                  static_cast<unsigned long long>(branch_flushes), static_cast<unsigned long long>(jump_flushes),
+                  static_cast<unsigned long long>(fetch_stalls), static_cast<unsigned long long>(memory_stalls),
+                  static_cast<unsigned long long>(forwards_ex_mem), static_cast<unsigned long long>(forwards_mem_wb));
+    out << text;
+}
@@ -2,202 +2,85 @@
 #define CPU_H
 
 #include "memory.h"
-#include <variant>
+#include "instruction.h"
+#include "decode_cache.h"
+#include "cache.h"
+#include "isa.h"
+#include <atomic>
+#include <ostream>
+
+class BranchPredictor;
+class Clint;
+struct HartMetrics;
+class TraceWriter;
+class Profiler;
 
 /**
- * @brief Enum for R-Type funct3 values.
+ * @brief Reason the CPU stopped executing.
  */
-enum class RTypeFunct3 : uint8_t
+enum class HaltReason
 {
-    ADD = 0x0,
-    SUB = 0x0,
-    SLL = 0x1,
-    SLT = 0x2,
-    SLTU = 0x3,
-    XOR = 0x4,
-    SRL = 0x5,
-    SRA = 0x5,
-    OR = 0x6,
-    AND = 0x7,
-    MUL = 0x0,
-    MULH = 0x1,
-    MULHSU = 0x2,
-    MULHU = 0x3,
-    DIV = 0x4,
-    DIVU = 0x5,
-    REM = 0x6,
-    REMU = 0x7
+    NONE,   ///< Still running.
+    EXIT,   ///< The program made the exit system call.
+    TOHOST, ///< The program stored an exit code to tohost.
+    RETURN, ///< The entry function returned to address 0.
+    LIMIT,  ///< The instruction limit was reached.
+    STOPPED, ///< Another hart ended the program.
+    TRAP    ///< A trap was taken with no handler installed in mtvec.
 };
 
-/**
- * @brief Enum for I-Type funct3 values.
- */
-enum class ITypeFunct3 : uint8_t
-{
-    ADDI = 0x0,
-    SLTI = 0x2,
-    SLTIU = 0x3,
-    XORI = 0x4,
-    ORI = 0x6,
-    ANDI = 0x7,
-    SLLI = 0x1,
-    SRLI = 0x5,
-    SRAI = 0x5,
-    LB = 0x0,
-    LH = 0x1,
-    LW = 0x2,
-    LBU = 0x4,
-    LHU = 0x5
-};
-
-/**
- * @brief Enum for S-Type funct3 values.
- */
-enum class STypeFunct3 : uint8_t
-{
-    SB = 0x0,
-    SH = 0x1,
-    SW = 0x2
-};
-
-/**
- * @brief Enum for B-Type funct3 values.
- */
-enum class BTypeFunct3 : uint8_t
-{
-    BEQ = 0x0,
-    BNE = 0x1,
-    BLT = 0x4,
-    BGE = 0x5,
-    BLTU = 0x6,
-    BGEU = 0x7
-};
-
-/**
- * @brief Enum for funct7 values.
- */
-enum class Funct7 : uint8_t
-{
-    ADD = 0x00,
-    SUB = 0x20,
-    SLL = 0x00,
-    SLT = 0x00,
-    SLTU = 0x00,
-    XOR = 0x00,
-    SRL = 0x00,
-    SRA = 0x20,
-    OR = 0x00,
-    AND = 0x00,
-    MUL = 0x01,
-    MULH = 0x01,
-    MULHSU = 0x01,
-    MULHU = 0x01,
-    DIV = 0x01,
-    DIVU = 0x01,
-    REM = 0x01,
-    REMU = 0x01
-};
-
-/**
- * @brief Enum for opcodes.
- */
-enum class Opcode : uint8_t
-{
-    R_TYPE = 0x33,
-    I_TYPE_LOAD = 0x03,
-    I_TYPE_ALU = 0x13,
-    JALR = 0x67,
-    S_TYPE = 0x23,
-    B_TYPE = 0x63,
-    J_TYPE = 0x6F
-};
-
-/**
- * @brief Struct for R-Type instructions.
- */
-struct RType
-{
-    RTypeFunct3 funct3; ///< Function 3 field
-    Funct7 funct7;      ///< Function 7 field
-    uint8_t rd;         ///< Destination register
-    uint8_t rs1;        ///< Source register 1
-    uint8_t rs2;        ///< Source register 2
-};
-
-/**
- * @brief Struct for I-Type instructions.
- */
-struct IType
-{
-    ITypeFunct3 funct3; ///< Function 3 field
-    uint8_t rd;         ///< Destination register
-    uint8_t rs1;        ///< Source register 1
-    int32_t imm;        ///< Immediate value
-};
-
-/**
- * @brief Struct for J-Type instructions.
- */
-struct JType
-{
-    uint8_t rd;  ///< Destination register
-    int32_t imm; ///< Immediate value
-};
-
-/**
- * @brief Struct for S-Type instructions.
- */
-struct SType
-{
-    STypeFunct3 funct3; ///< Function 3 field
-    uint8_t rs1;        ///< Source register 1
-    uint8_t rs2;        ///< Source register 2
-    int32_t imm;        ///< Immediate value
-};
-
-/**
- * @brief Struct for B-Type instructions.
- */
-struct BType
-{
-    BTypeFunct3 funct3; ///< Function 3 field
-    uint8_t rs1;        ///< Source register 1
-    uint8_t rs2;        ///< Source register 2
-    int32_t imm;        ///< Immediate value
-};
-
-// Pipeline stages
-struct FetchStage
+// Pipeline latches, each holding the instruction that left a stage
+struct FetchStage // IF/ID
 {
     uint32_t instruction;
     uint32_t pc;
+    uint32_t predicted_pc; // Address fetched next, checked once the instruction resolves in EX
+    uint32_t prediction;   // Counter index the branch predictor guessed with
+    CacheAccess cache_access; // Where the instruction cache served the fetch
     bool valid = false;
 };
 
-struct DecodeStage
+struct DecodeStage // ID/EX
 {
-    std::variant<RType, IType, SType, BType, JType> decoded_instruction;
+    DecodedInstruction decoded;
+    uint32_t instruction; // Raw word, decoded again to report an unsupported instruction
+    uint32_t slot;
     uint32_t pc;
+    uint32_t predicted_pc;
+    uint32_t prediction;
+    bool supported;
     bool valid = false;
 };
 
-struct ExecuteStage
+struct ExecuteStage // EX/MEM
 {
-    std::variant<RType, IType, SType, BType, JType> instruction;
+    DecodedInstruction decoded;
+    uint32_t slot;
     uint32_t pc;
-    uint32_t alu_result;
+    uint32_t word;       // Raw instruction word, for the trace
+    uint32_t alu_result; // Value for rd, or the effective address of a load or store
+    uint32_t store_value;
+    uint8_t rd;          // 0 if the instruction writes no register
+    bool returns;        // JALR to address 0, ends the program once retired
     bool valid = false;
 };
 
-struct MemoryStage
+struct MemoryStage // MEM/WB
 {
-    std::variant<RType, IType, SType, BType, JType> instruction;
+    Opcode opcode;
+    uint32_t slot;
     uint32_t pc;
+    uint32_t word;
     uint32_t result;
+    uint32_t address;      // Effective address of a load or store
+    uint32_t memory_value; // Value loaded or stored
+    uint8_t memory_flags;  // TraceRecord::MEMORY_READ and MEMORY_WRITE bits
+    uint8_t rd;
+    bool returns;
     bool valid = false;
 };
 
-struct WriteBackStage
+struct WriteBackStage // Instruction retired in the current cycle
 {
     uint32_t pc;
     uint32_t rd;
@@ -213,96 +96,519 @@ struct Pipeline
     ExecuteStage execute;
     MemoryStage memory;
     WriteBackStage write_back;
+    bool fetch_stopped = false; // Set once the program has returned, or while draining
+    bool redirected = false;    // EX changed the fetch address in the current cycle
+    uint32_t fetch_wait = 0;    // Cycles left on an instruction-cache miss
+    uint32_t memory_wait = 0;   // Cycles left on a data-cache miss in MEM
+};
+
+/**
+ * @brief Cycle counts of the pipelined model.
+ *
+ * Stall and flush counts are in cycles; a branch or jump is resolved in EX
+ * and, if the address fetched after it was wrong, discards the two younger
+ * instructions behind it. Without a branch predictor every taken branch and
+ * jump is fetched past.
+ */
+struct PipelineStats
+{
+    uint64_t cycles = 0;           ///< Cycles simulated.
+    uint64_t load_use_stalls = 0;  ///< Cycles an instruction waited in ID for a load result.
+    uint64_t serialize_stalls = 0; ///< Cycles a system, fence or atomic instruction waited for older ones to retire.
+    uint64_t branch_flushes = 0;   ///< Cycles lost to mispredicted branches.
+    uint64_t jump_flushes = 0;     ///< Cycles lost to mispredicted JAL and JALR, to FENCE.I and to traps.
+    uint64_t fetch_stalls = 0;     ///< Cycles IF waited for the instruction cache.
+    uint64_t memory_stalls = 0;    ///< Cycles MEM waited for the data cache.
+    uint64_t forwards_ex_mem = 0;  ///< Operands forwarded from the EX/MEM latch.
+    uint64_t forwards_mem_wb = 0;  ///< Operands forwarded from the MEM/WB latch.
+
+    /**
+     * @brief Print the cycle counts.
+     *
+     * @param out The stream to print to.
+     * @param instructions The instructions retired over the same cycles.
+     */
+    void print(std::ostream &out, uint64_t instructions) const;
 };
 
 /**
  * @brief Class representing the CPU.
+ *
+ * The hart runs in machine mode. An instruction that cannot complete raises
+ * an exception with raise_exception(), and the engine executing it takes
+ * the trap with take_exception() instead of retiring it: undecodable words,
+ * reserved rounding modes and CSR misuse raise illegal instruction, and
+ * atomics to devices an access fault, so no host exception is thrown for
+ * anything the guest does.
+ *
+ * Interrupts are checked when the run loop leaves through its instruction
+ * limit: while they are enabled the limit is lowered to the next check, so
+ * the loop is the same single compare as without them.
  */
 class CPU
 {
 public:
+    static constexpr uint32_t MSTATUS_MIE = 1u << 3;  ///< Interrupts enabled.
+    static constexpr uint32_t MSTATUS_MPIE = 1u << 7; ///< MIE before the last trap.
+    static constexpr uint32_t MSTATUS_MPP = 3u << 11; ///< Privilege before the last trap, always machine mode.
+    static constexpr uint32_t MIP_MSIP = 1u << 3;     ///< Software interrupt, in mip and mie.
+    static constexpr uint32_t MIP_MTIP = 1u << 7;     ///< Timer interrupt, in mip and mie.
+    static constexpr uint64_t INTERRUPT_CHECK_INTERVAL = 4096; ///< Instructions between interrupt checks.
+    static constexpr uint32_t ZERO_SINK = 32; ///< Register slot the block engine sends writes to x0 to.
+
     /**
      * @brief Construct a new CPU object.
      *
-     * @param memory Reference to the memory object.
+     * @param memory Reference to the memory object, which may be shared by several harts.
+     * @param hart_id The hart number, also passed to the program in a0.
      */
-    CPU(Memory &memory);
+    CPU(Memory &memory, uint32_t hart_id = 0);
 
     /**
-     * @brief Execute the fetch-decode-run cycle.
+     * @brief Run the pipelined model until the program halts or reaches the instruction limit.
+     *
+     * Every iteration is one clock cycle in which all five stages advance.
+     * Instructions in flight when the instruction limit is reached stay in
+     * the latches and go on in the next run.
      */
     void run();
 
     /**
-     * @brief Fetch the next instruction from memory.
+     * @brief Advance every stage by one cycle.
+     *
+     * Stages run from write-back to fetch so each one consumes the latch
+     * its predecessor filled in the previous cycle.
+     *
+     * @param pipeline The pipeline state.
+     * @return true if the cycle completed, false if an instruction halted the hart.
+     */
+    bool cycle(Pipeline &pipeline);
+
+    /**
+     * @brief Complete the instructions in flight without fetching new ones.
+     *
+     * Used before another engine takes over a hart stopped mid-run, so the
+     * program counter is again the address of the next instruction.
+     */
+    void drain_pipeline();
+
+    /**
+     * @brief Check whether any instruction is in flight.
+     *
+     * @return true if every pipeline latch is empty, false otherwise.
+     */
+    bool is_pipeline_empty() const;
+
+    /**
+     * @brief Read the instruction at an address.
+     *
+     * @param address Address of the instruction, half-word aligned.
+     * @return uint32_t The instruction word, with a compressed instruction in the low half word.
+     */
+    uint32_t fetch_instruction(uint32_t address);
+
+    /**
+     * @brief Fetch the next instruction into IF/ID unless ID is stalled.
      *
      * @param pipeline The pipeline state.
      */
     void fetch(Pipeline &pipeline);
 
     /**
-     * @brief Decode the fetched instruction.
+     * @brief Decode IF/ID into ID/EX, stalling on load-use and serialization hazards.
      *
      * @param pipeline The pipeline state.
      */
     void decode(Pipeline &pipeline);
 
     /**
-     * @brief Execute the decoded instruction.
+     * @brief Decode a raw instruction word.
+     *
+     * @param instruction The raw instruction word.
+     * @return DecodedInstruction The decoded instruction.
+     */
+    static DecodedInstruction decode_instruction(uint32_t instruction);
+
+    /**
+     * @brief Decode a raw instruction word without reporting unsupported ones.
+     *
+     * @param instruction The raw instruction word.
+     * @param decoded Receives the decoded instruction.
+     * @return true if the instruction is supported, false otherwise.
+     */
+    static bool try_decode_instruction(uint32_t instruction, DecodedInstruction &decoded);
+
+    /**
+     * @brief Execute ID/EX into EX/MEM, forwarding operands and resolving control flow.
      *
      * @param pipeline The pipeline state.
      */
     void execute(Pipeline &pipeline);
 
     /**
-     * @brief Execute the memory stage.
+     * @brief Perform the load or store of EX/MEM into MEM/WB.
      *
      * @param pipeline The pipeline state.
      */
     void mem(Pipeline &pipeline);
 
     /**
-     * @brief Execute the write-back stage.
+     * @brief Write MEM/WB to the register file and retire it.
      *
      * @param pipeline The pipeline state.
      */
     void write_back(Pipeline &pipeline);
 
     /**
-     * @brief Execute an I-Type ALU instruction.
+     * @brief Execute a load instruction.
      *
-     * @param pipeline The pipeline state.
-     * @param instr The decoded I-Type instruction.
+     * @param operation The load.
+     * @param address The effective address.
+     * @return uint32_t The loaded value.
      */
-    uint32_t execute_i_type(const IType &instr);
+    uint32_t execute_load(Operation operation, uint32_t address);
 
     /**
-     * @brief Execute a store instruction.
+     * @brief Load the value of one load instruction.
      *
-     * @param instr The decoded S-Type instruction.
+     * @tparam OP The load.
+     * @param address The effective address.
+     * @return uint32_t The loaded value, extended to 32 bits.
      */
-    void execute_s_type(const SType &instr);
+    template <Operation OP>
+    uint32_t load(uint32_t address)
+    {
+        using Type = typename Isa::Access<OP>::type;
+        if constexpr (sizeof(Type) == 1)
+        {
+            return static_cast<uint32_t>(static_cast<Type>(memory.load_byte(address)));
+        }
+        else if constexpr (sizeof(Type) == 2)
+        {
+            return static_cast<uint32_t>(static_cast<Type>(memory.load_half_word(address)));
+        }
+        else
+        {
+            return memory.load_word(address);
+        }
+    }
 
     /**
-     * @brief Execute an R-Type instruction.
+     * @brief Execute a store instruction.
      *
-     * @param instr The decoded R-Type instruction.
+     * @param operation The store.
+     * @param address The effective address.
+     * @param value The value of rs2.
+     * @return uint32_t The size of the store in bytes.
      */
-    uint32_t execute_r_type(const RType &instr);
+    uint32_t execute_s_type(Operation operation, uint32_t address, uint32_t value);
 
     /**
-     * @brief Execute a B-Type instruction.
+     * @brief Perform one store instruction, dropping code decoded from the bytes it writes.
      *
-     * @param instr The decoded B-Type instruction.
+     * @tparam OP The store.
+     * @param address The effective address.
+     * @param value The value of rs2.
      */
-    void execute_b_type(const BType &instr);
+    template <Operation OP>
+    void store(uint32_t address, uint32_t value)
+    {
+        using Type = typename Isa::Access<OP>::type;
+        if constexpr (sizeof(Type) == 1)
+        {
+            memory.store_byte(address, static_cast<uint8_t>(value));
+        }
+        else if constexpr (sizeof(Type) == 2)
+        {
+            memory.store_half_word(address, static_cast<uint16_t>(value));
+        }
+        else
+        {
+            memory.store_word(address, value);
+        }
+        decode_cache.invalidate(address, sizeof(Type));
+
+        // riscv-tests convention: (code << 1) | 1, where code 0 is a pass
+        if (sizeof(Type) == 4 && address == tohost_address && tohost_address != 0 && (value & 1))
+        {
+            halt(HaltReason::TOHOST, value >> 1);
+        }
+    }
 
     /**
      * @brief Execute a J-Type instruction.
      *
-     * @param instr The decoded J-Type instruction.
+     * @param instr The decoded JAL.
+     * @param address Address of the JAL.
+     */
+    void execute_j_type(const DecodedInstruction &instr, uint32_t address);
+
+    /**
+     * @brief Execute a JALR instruction.
+     *
+     * @param instr The decoded JALR.
+     */
+    void execute_jalr(const DecodedInstruction &instr);
+
+    /**
+     * @brief Execute a FENCE or FENCE.I instruction.
+     *
+     * @param instr The decoded MISC-MEM instruction.
+     */
+    void execute_fence(const DecodedInstruction &instr);
+
+    /**
+     * @brief Execute an atomic memory operation, LR or SC.
+     *
+     * A misaligned address raises a misaligned exception and a device address
+     * an access fault, both with the address in mtval, before memory is touched.
+     *
+     * @param operation The atomic instruction.
+     * @param instr The decoded AMO instruction.
+     * @param stored Set to whether memory was written, false for LR and a failed SC.
+     * @return uint32_t The value for rd.
+     */
+    uint32_t execute_amo(Operation operation, const DecodedInstruction &instr, bool &stored);
+
+    /**
+     * @brief Execute a floating-point instruction other than a load or store.
+     *
+     * Accumulates the exception flags it raises in fcsr. The rounding mode
+     * must have passed valid_rounding_mode().
+     *
+     * @param operation The floating-point instruction.
+     * @param instr The decoded instruction.
+     * @param integer_source The value of integer register rs1, for the conversions and moves from it.
+     * @return uint32_t The value for rd, a floating-point or an integer register as the table says.
+     */
+    uint32_t execute_fp(Operation operation, const DecodedInstruction &instr, uint32_t integer_source);
+
+    /**
+     * @brief Resolve the rounding mode of a floating-point instruction.
+     *
+     * @param funct3 The rounding mode field, 7 for the dynamic mode in frm.
+     * @return uint32_t The rounding mode.
+     */
+    uint32_t rounding_mode(uint32_t funct3) const
+    {
+        return funct3 == 7 ? (fcsr >> 5) & 0x7 : funct3;
+    }
+
+    /**
+     * @brief Check the rounding mode of a floating-point instruction.
+     *
+     * The decoder accepts every rounding mode field, and frm may hold a
+     * reserved mode too, so the check follows the resolved mode. Callers
+     * raise an illegal instruction exception for a reserved one.
+     *
+     * @param funct3 The rounding mode field, 7 for the dynamic mode in frm.
+     * @return true if the mode is valid, false if it is reserved.
+     */
+    bool valid_rounding_mode(uint32_t funct3) const { return rounding_mode(funct3) <= Fpu::RMM; }
+
+    /**
+     * @brief Execute a CSR instruction.
+     *
+     * CSRRS and CSRRC with x0, and their immediate forms with 0, only read.
+     *
+     * @param operation The CSR instruction.
+     * @param instr The decoded SYSTEM instruction.
+     * @param source The value of rs1, ignored by the immediate forms.
+     * @return uint32_t The old value of the CSR, for rd.
+     */
+    uint32_t execute_csr(Operation operation, const DecodedInstruction &instr, uint32_t source);
+
+    /**
+     * @brief Read a CSR.
+     *
+     * @param number The CSR number.
+     * @param value Receives the value.
+     * @return true if the CSR exists, false otherwise.
+     */
+    bool read_csr(uint32_t number, uint32_t &value) const;
+
+    /**
+     * @brief Write a CSR, ignoring the bits it does not implement.
+     *
+     * @param number The CSR number.
+     * @param value The value.
+     * @return true if the CSR exists, false otherwise.
+     */
+    bool write_csr(uint32_t number, uint32_t value);
+
+    /**
+     * @brief Execute an ECALL, EBREAK, MRET or WFI instruction.
+     *
+     * The program counter already points past the instruction. ECALL is a
+     * system call served by the host until a trap handler is installed.
+     *
+     * @param operation The SYSTEM instruction.
+     * @param address Address of the instruction.
+     */
+    void execute_system(Operation operation, uint32_t address);
+
+    /**
+     * @brief Record an exception raised by the instruction being executed.
+     *
+     * The instruction must not complete; the engine sees is_exception_raised()
+     * and calls take_exception().
+     *
+     * @param cause The exception.
+     * @param value The value for mtval.
+     */
+    void raise_exception(TrapCause cause, uint32_t value)
+    {
+        exception_raised = true;
+        exception_cause = cause;
+        exception_value = value;
+    }
+
+    /**
+     * @brief Check whether the instruction being executed raised an exception.
+     *
+     * @return true if an exception is waiting for take_exception(), false otherwise.
+     */
+    bool is_exception_raised() const { return exception_raised; }
+
+    /**
+     * @brief Take the raised exception, jumping to the trap handler.
+     *
+     * Without a handler in mtvec the hart halts at the instruction instead.
+     *
+     * @param address Address of the instruction that raised it.
+     */
+    void take_exception(uint32_t address);
+
+    /**
+     * @brief Stop execution at the next block boundary.
+     *
+     * @param reason Why execution stops.
+     * @param code The exit code of the program.
      */
-    void execute_j_type(const JType &instr);
+    void halt(HaltReason reason, uint32_t code);
+
+    /**
+     * @brief Ask the CPU to stop at its next block boundary.
+     *
+     * Safe to call from another thread while the CPU runs.
+     */
+    void stop() { run_limit.store(0, std::memory_order_relaxed); }
+
+    /**
+     * @brief Ask the CPU to return from run() at an instruction boundary without halting.
+     *
+     * Safe to call from another thread while the CPU runs. Both engines leave
+     * through the same check as stop(), so a build with the debugger costs
+     * nothing until it is used. The pipelined model retires the instructions
+     * that have already taken effect and fetches the others again on resume.
+     */
+    void request_break()
+    {
+        break_pending.store(true, std::memory_order_relaxed);
+        run_limit.store(0, std::memory_order_release);
+    }
+
+    /**
+     * @brief Make a hart that returned for the debugger runnable again.
+     */
+    void resume();
+
+    /**
+     * @brief Make run() return as for request_break() once a number of instructions have retired.
+     *
+     * The block engine returns at the first block boundary at or past the
+     * count; the pipelined model stops retiring at the count and then
+     * settles as for a break, which may retire the one or two instructions
+     * already past EX. The count is cleared once it is reached.
+     *
+     * @param count The retired count to return at, 0 for none.
+     */
+    void set_break_count(uint64_t count);
+
+    /**
+     * @brief Retire exactly one instruction with the pipelined model.
+     *
+     * The pipeline must be empty, as it is after a break. A breakpoint at the
+     * program counter stops the step without retiring anything.
+     */
+    void step();
+
+    /**
+     * @brief Check whether the CPU has stopped.
+     *
+     * @return true if halted, false otherwise.
+     */
+    bool is_halted() const { return halt_reason != HaltReason::NONE; }
+
+    /**
+     * @brief Get the reason the CPU stopped.
+     *
+     * @return HaltReason The halt reason.
+     */
+    HaltReason get_halt_reason() const { return halt_reason; }
+
+    /**
+     * @brief Get the exit code reported by the program.
+     *
+     * @return uint32_t The exit code.
+     */
+    uint32_t get_exit_code() const { return exit_code; }
+
+    /**
+     * @brief Limit the number of instructions to retire, 0 for no limit.
+     *
+     * @param limit The instruction limit.
+     */
+    void set_instruction_limit(uint64_t limit);
+
+    /**
+     * @brief Attach the CLINT whose timer and software interrupts the hart takes, or detach it with nullptr.
+     *
+     * @param device The CLINT.
+     */
+    void set_clint(const Clint *device) { clint = device; }
+
+    /**
+     * @brief Set the address whose stores report the program result.
+     *
+     * @param address The tohost address, or 0 to disable.
+     */
+    void set_tohost(uint32_t address) { tohost_address = address; }
+
+    /**
+     * @brief Drop what the program writes to stdout and stderr, e.g. on the reference of a co-simulation.
+     *
+     * @param quiet true to drop the output.
+     */
+    void set_quiet(bool quiet) { this->quiet = quiet; }
+
+    /**
+     * @brief Make WFI return from run() as for request_break(), or stop doing so.
+     *
+     * Used when harts share host threads, so a hart waiting for an interrupt
+     * hands its thread to another one.
+     *
+     * @param yield true to return on WFI.
+     */
+    void set_yield_on_wfi(bool yield) { yield_on_wfi = yield; }
+
+    /**
+     * @brief Check whether the hart still waits in WFI for an interrupt.
+     *
+     * The wait ends once an interrupt enabled in mie is pending, even with
+     * MSTATUS_MIE clear. Without a CLINT or with mie clear nothing could end
+     * it, so WFI does not wait then.
+     *
+     * @return true if the hart should not run yet, false otherwise.
+     */
+    bool is_waiting();
+
+    /**
+     * @brief Get the program counter.
+     *
+     * @return uint32_t The address of the next instruction once the pipeline is empty.
+     */
+    uint32_t get_pc() const { return pc; }
 
     /**
      * @brief Set the program counter.
@@ -323,10 +629,224 @@ public:
      */
     void print_registers() const;
 
+    /**
+     * @brief Get the value of an integer register.
+     *
+     * @param index The register number.
+     * @return uint32_t The register value.
+     */
+    uint32_t get_register(uint32_t index) const { return registers[index]; }
+
+    /**
+     * @brief Set the value of an integer register; writes to x0 are ignored.
+     *
+     * @param index The register number.
+     * @param value The register value.
+     */
+    void set_register(uint32_t index, uint32_t value);
+
+    /**
+     * @brief Attach a profiler, or detach it with nullptr.
+     *
+     * @param profiler The profiler to count executed instructions into.
+     */
+    void set_profiler(Profiler *profiler);
+
+    /**
+     * @brief Attach counters for the metrics endpoint, or detach them with nullptr.
+     *
+     * @param metrics The counters this hart publishes to.
+     */
+    void set_metrics(HartMetrics *metrics) { this->metrics = metrics; }
+
+    /**
+     * @brief Copy the counters of this hart to its metrics, if it has any.
+     *
+     * Only the thread running the hart may call this.
+     */
+    void publish_metrics();
+
+    /**
+     * @brief Make the run loop leave at the next block boundary to publish its metrics.
+     *
+     * Safe to call from any thread; a stop or halt still wins.
+     */
+    void request_metrics();
+
+    /**
+     * @brief Attach a branch predictor to the fetch stage, or detach it with nullptr.
+     *
+     * Without one the pipelined model fetches sequentially past every branch.
+     *
+     * @param predictor The branch predictor.
+     */
+    void set_branch_predictor(BranchPredictor *predictor)
+    {
+        branch_predictor = predictor;
+        track_slots();
+    }
+
+    /**
+     * @brief Attach a cache model to the fetch and memory stages, or detach it with nullptr.
+     *
+     * Without one every fetch, load and store takes a single cycle.
+     *
+     * @param hierarchy The cache hierarchy of this hart.
+     */
+    void set_cache_hierarchy(CacheHierarchy *hierarchy)
+    {
+        caches = hierarchy;
+        track_slots();
+    }
+
+    /**
+     * @brief Record every instruction the pipelined model retires, or stop with nullptr.
+     *
+     * @param writer The trace writer, already open.
+     */
+    void set_trace_writer(TraceWriter *writer) { tracer = writer; }
+
+    /**
+     * @brief Get the decoded instruction cache.
+     *
+     * @return const DecodeCache& The decode cache.
+     */
+    const DecodeCache &get_decode_cache() const { return decode_cache; }
+
+    /**
+     * @brief Get the number of instructions retired by either engine.
+     *
+     * @return uint64_t The retired instruction count.
+     */
+    uint64_t get_instructions_retired() const { return instructions_retired; }
+
+    /**
+     * @brief Get the cycle counts of the pipelined model.
+     *
+     * @return const PipelineStats& The cycle counts.
+     */
+    const PipelineStats &get_pipeline_stats() const { return pipeline_stats; }
+
+    /**
+     * @brief Get the hart number.
+     *
+     * @return uint32_t The hart number.
+     */
+    uint32_t get_hart_id() const { return hart_id; }
+
 private:
-    Memory &memory;         ///< Reference to the memory object.
+    friend class BlockEngine;
+    friend class CoSimulation;
+    friend class GdbServer;
+    friend class Snapshot;
+
+    /**
+     * @brief Consume a pending break once a run loop has exited.
+     *
+     * @return true if the loop exited for the debugger, false otherwise.
+     */
+    bool take_break()
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return break_pending.exchange(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Keep a decode cache slot per instruction while anything counts by slot.
+     */
+    void track_slots() { decode_cache.set_slot_tracking(profiler || branch_predictor || caches); }
+
+    /**
+     * @brief Take a due interrupt and schedule the next check once a run loop has left through its limit.
+     *
+     * @return true if the run goes on, false if it halted, reached the
+     *         instruction limit or was stopped.
+     */
+    bool service_events();
+
+    /**
+     * @brief Get the interrupts that are pending and enabled.
+     *
+     * @return uint32_t The MIP_MSIP and MIP_MTIP bits.
+     */
+    uint32_t enabled_interrupts() const;
+
+    /**
+     * @brief Get the retired count the run loops stop at next.
+     *
+     * @return uint64_t The instruction limit, the break count or the next interrupt check, whichever comes first.
+     */
+    uint64_t next_run_limit() const;
+
+    /**
+     * @brief Make the run loop leave at the next block boundary to check for interrupts.
+     */
+    void request_event_check();
+
+    /**
+     * @brief Write the trap CSRs and jump to the trap handler.
+     *
+     * @param cause The value for mcause.
+     * @param value The value for mtval.
+     * @param address The value for mepc.
+     */
+    void enter_trap(TrapCause cause, uint32_t value, uint32_t address);
+
+    /**
+     * @brief Bring the pipeline to an instruction boundary for the debugger.
+     *
+     * @param pipeline The pipeline state.
+     */
+    void settle_pipeline(Pipeline &pipeline);
+
+    /**
+     * @brief Retire the instructions ahead of the one that halted the hart.
+     *
+     * @param pipeline The pipeline state.
+     */
+    void finish_halt(Pipeline &pipeline);
+
+    MemoryPort memory;      ///< This hart's port to the memory object.
+    uint32_t hart_id;       ///< Hart number.
     uint32_t pc;            ///< Program Counter.
-    uint32_t registers[32]; ///< Registers.
+    uint32_t registers[33]; ///< Registers x0 to x31, then ZERO_SINK, so x0 is never written.
+    uint32_t float_registers[32]; ///< Floating-point registers, as single-precision bits.
+    uint32_t fcsr = 0;      ///< Floating-point control and status: frm in bits 7-5, fflags in bits 4-0.
+    uint32_t mstatus = 0;   ///< MSTATUS_MIE and MSTATUS_MPIE; MSTATUS_MPP always reads as set.
+    uint32_t mie = 0;       ///< Enabled interrupts, MIP_MSIP and MIP_MTIP.
+    uint32_t mtvec = 0;     ///< Trap handler, 0 for none; bit 0 selects vectored interrupts.
+    uint32_t mscratch = 0;  ///< Scratch register for the trap handler.
+    uint32_t mepc = 0;      ///< Address the last trap interrupted.
+    uint32_t mcause = 0;    ///< Cause of the last trap.
+    uint32_t mtval = 0;     ///< Faulting address or instruction of the last trap.
+    bool exception_raised = false; ///< The instruction being executed raised an exception.
+    TrapCause exception_cause = TrapCause::ILLEGAL_INSTRUCTION; ///< Cause of the raised exception.
+    uint32_t exception_value = 0; ///< mtval of the raised exception.
+    const Clint *clint = nullptr; ///< Optional source of timer and software interrupts.
+    Pipeline latches;       ///< Pipeline latches, kept across runs so snapshots capture them.
+    PipelineStats pipeline_stats; ///< Cycle counts of the pipelined model.
+    DecodeCache decode_cache; ///< Decoded instructions keyed by PC.
+    Profiler *profiler = nullptr; ///< Optional profiler.
+    HartMetrics *metrics = nullptr; ///< Optional counters for the metrics endpoint.
+    BranchPredictor *branch_predictor = nullptr; ///< Optional branch predictor of the pipelined model.
+    CacheHierarchy *caches = nullptr; ///< Optional cache model of the pipelined model.
+    TraceWriter *tracer = nullptr; ///< Optional binary trace of retired instructions.
+    uint64_t instructions_retired = 0; ///< Instructions retired.
+    std::atomic<uint64_t> run_limit{UINT64_MAX}; ///< Retired count to stop at, 0 once halted or stopped.
+    std::atomic<bool> break_pending{false}; ///< request_break() was called since the last break.
+    uint64_t instruction_limit = 0; ///< Instruction limit, 0 for none.
+    uint64_t break_count = 0; ///< Retired count to break at, 0 for none.
+    HaltReason halt_reason = HaltReason::NONE; ///< Why execution stopped.
+    uint32_t exit_code = 0; ///< Exit code reported by the program.
+    uint32_t tohost_address = 0; ///< Address of tohost, 0 if unused.
+    bool quiet = false; ///< Output of the write system call is dropped.
+    bool yield_on_wfi = false; ///< WFI returns from run().
+    bool waiting = false; ///< The last WFI has not seen an interrupt yet.
+    uint32_t reservation_address = 0; ///< Address reserved by LR.
+    uint32_t reservation_value = 0; ///< Value loaded by LR.
+    bool reservation_valid = false; ///< An LR reservation is held.
+    uint64_t exceptions_taken = 0; ///< Exceptions taken, handled or not.
+    uint64_t interrupts_taken = 0; ///< Interrupts taken.
 };
 
 #endif
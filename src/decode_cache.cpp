@@ -0,0 +1,218 @@
+#include "decode_cache.h"
+#include "logger.h"
+#include "memory.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+/**
+ * @brief Find the page holding a page number, remembering the last hit.
+ *
+ * @param page_number The page number.
+ * @return DecodeCache::Page* The page, or nullptr if it is not cached.
+ */
+DecodeCache::Page *DecodeCache::find_page(uint32_t page_number)
+{
+    if (last_page && last_page_number == page_number)
+    {
+        return last_page;
+    }
+
+    auto it = pages.find(page_number);
+    if (it == pages.end())
+    {
+        return nullptr;
+    }
+
+    last_page_number = page_number;
+    last_page = it->second.get();
+    return last_page;
+}
+
+/**
+ * @brief Look up the decoded instruction at an address.
+ *
+ * @param pc Address of the instruction.
+ * @return const CachedInstruction* The cached record, or nullptr on a miss.
+ */
+const CachedInstruction *DecodeCache::lookup(uint32_t pc)
+{
+    Page *page = find_page(pc >> PAGE_SHIFT);
+    uint32_t index = (pc & (PAGE_SIZE - 1)) >> 1;
+    if (page && page->valid[index])
+    {
+        ++hits;
+        return &page->entries[index];
+    }
+    ++misses;
+    return nullptr;
+}
+
+/**
+ * @brief Insert a decoded instruction into the cache.
+ *
+ * @param pc Address of the instruction.
+ * @param decoded The decoded instruction.
+ * @return const CachedInstruction& The cached record.
+ */
+const CachedInstruction &DecodeCache::insert(uint32_t pc, const DecodedInstruction &decoded)
+{
+    // A patched address keeps its replacement whatever memory holds
+    const DecodedInstruction *entry = &decoded;
+    if (!patches.empty())
+    {
+        auto patched = patches.find(pc);
+        if (patched != patches.end())
+        {
+            entry = &patched->second;
+        }
+    }
+
+    uint32_t page_number = pc >> PAGE_SHIFT;
+    Page *page = find_page(page_number);
+    if (!page)
+    {
+        auto &owner = pages[page_number];
+        owner = std::make_unique<Page>();
+        page = owner.get();
+        last_page_number = page_number;
+        last_page = page;
+        code_pages.set(page_number);
+        LOG_DEBUG("Decode cache page allocated at: 0x" + Memory::to_hex_string(page_number << PAGE_SHIFT));
+    }
+
+    // Refills after FENCE.I or a store mostly find the instruction that was there
+    auto known = slot_by_pc.find(pc);
+    uint32_t slot;
+    if (known != slot_by_pc.end() &&
+        (!tracking_slots || std::memcmp(&slot_instructions[known->second], entry, sizeof(*entry)) == 0))
+    {
+        slot = known->second;
+        slot_instructions[slot] = *entry;
+    }
+    else
+    {
+        slot = get_slot_count();
+        slot_by_pc[pc] = slot;
+        slot_pcs.push_back(pc);
+        slot_instructions.push_back(*entry);
+    }
+
+    uint32_t index = (pc & (PAGE_SIZE - 1)) >> 1;
+    page->entries[index] = {*entry, slot};
+    page->valid[index] = true;
+
+    // A store to the next page may hit an instruction straddling into it
+    if (index == ENTRIES_PER_PAGE - 1 && entry->length == 4)
+    {
+        code_pages.set((page_number + 1) % PAGE_COUNT);
+    }
+    return page->entries[index];
+}
+
+/**
+ * @brief Make an address decode to a replacement until it is unpatched.
+ *
+ * @param pc Address of the instruction.
+ * @param decoded The replacement, e.g. a DEBUG_BREAK.
+ * @return const CachedInstruction& The cached record of the replacement.
+ */
+const CachedInstruction &DecodeCache::patch(uint32_t pc, const DecodedInstruction &decoded)
+{
+    DecodedInstruction &replacement = patches[pc];
+    replacement = decoded;
+    return insert(pc, replacement);
+}
+
+/**
+ * @brief Drop the replacement of an address, so it is decoded from memory again.
+ *
+ * @param pc Address of the instruction.
+ */
+void DecodeCache::unpatch(uint32_t pc)
+{
+    if (patches.erase(pc) == 0)
+    {
+        return;
+    }
+    if (Page *page = find_page(pc >> PAGE_SHIFT))
+    {
+        page->valid[(pc & (PAGE_SIZE - 1)) >> 1] = false;
+    }
+}
+
+/**
+ * @brief Drop the entries covering any byte written by a store to a page that may hold code.
+ *
+ * @param address Start address of the store.
+ * @param size Size of the store in bytes.
+ */
+void DecodeCache::invalidate_code(uint32_t address, uint32_t size)
+{
+    ++stats.code_stores;
+
+    // A four-byte instruction starting one half word before the store covers its first byte
+    uint32_t first = address >= 2 ? (address - 2) & ~1u : 0;
+    uint32_t last = (address + size - 1) & ~1u;
+    for (uint32_t pc = first;;)
+    {
+        uint32_t page_number = pc >> PAGE_SHIFT;
+        uint32_t page_last = std::min(last, (page_number << PAGE_SHIFT) | (PAGE_SIZE - 2));
+        if (Page *page = find_page(page_number))
+        {
+            for (uint32_t index = (pc & (PAGE_SIZE - 1)) >> 1; index <= ((page_last & (PAGE_SIZE - 1)) >> 1); ++index)
+            {
+                if (page->valid[index])
+                {
+                    page->valid[index] = false;
+                    ++stats.entries_invalidated;
+                    LOG_DEBUG("Decode cache entry invalidated at: 0x" +
+                              Memory::to_hex_string((page_number << PAGE_SHIFT) | (index << 1)));
+                }
+            }
+        }
+        if (page_last == last)
+        {
+            break;
+        }
+        pc = page_last + 2;
+    }
+}
+
+/**
+ * @brief Drop all cached entries.
+ */
+void DecodeCache::clear()
+{
+    for (const auto &page : pages)
+    {
+        code_pages.reset(page.first);
+        code_pages.reset((page.first + 1) % PAGE_COUNT);
+    }
+    pages.clear();
+    last_page = nullptr;
+    ++stats.flushes;
+}
+
+/**
+ * @brief Print the counts and their rates.
+ *
+ * @param out The stream to print to.
+ * @param instructions The instructions retired over the same run.
+ */
+void CodeWriteStats::print(std::ostream &out, uint64_t instructions) const
+{
+    char text[512];
+    double per_million = instructions ? 1e6 / static_cast<double>(instructions) : 0.0;
+    std::snprintf(text, sizeof(text),
+                  "Stores to code pages: %llu (%.3f per million instructions)\n"
+                  "Decoded instructions invalidated: %llu (%.3f per million instructions)\n"
+                  "Translated blocks invalidated: %llu (%.3f per million instructions)\n"
+                  "Full flushes: %llu\n",
+                  static_cast<unsigned long long>(code_stores), static_cast<double>(code_stores) * per_million,
+                  static_cast<unsigned long long>(entries_invalidated),
+                  static_cast<double>(entries_invalidated) * per_million,
+                  static_cast<unsigned long long>(blocks_invalidated),
+                  static_cast<double>(blocks_invalidated) * per_million, static_cast<unsigned long long>(flushes));
+    out << text;
+}
@@ -0,0 +1,255 @@
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include "instruction.h"
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief One bit per page of the 32-bit guest address space.
+ *
+ * Tells with a single bit test whether a page holds code, so stores to data
+ * pay for nothing else. The whole map takes 128 KiB for 4 KiB pages.
+ */
+class PageBitmap
+{
+public:
+    /**
+     * @brief Construct a new PageBitmap object with every bit clear.
+     *
+     * @param page_shift log2 of the page size.
+     */
+    explicit PageBitmap(uint32_t page_shift) : words(((size_t(1) << (32 - page_shift)) + 63) / 64) {}
+
+    /**
+     * @brief Check whether the bit of a page is set.
+     *
+     * @param page_number The page number.
+     * @return true if set, false otherwise.
+     */
+    bool test(uint32_t page_number) const { return (words[page_number >> 6] >> (page_number & 63)) & 1; }
+
+    /**
+     * @brief Set the bit of a page.
+     *
+     * @param page_number The page number.
+     */
+    void set(uint32_t page_number) { words[page_number >> 6] |= uint64_t(1) << (page_number & 63); }
+
+    /**
+     * @brief Clear the bit of a page.
+     *
+     * @param page_number The page number.
+     */
+    void reset(uint32_t page_number) { words[page_number >> 6] &= ~(uint64_t(1) << (page_number & 63)); }
+
+private:
+    std::vector<uint64_t> words; ///< 64 pages per word.
+};
+
+/**
+ * @brief Counts of guest stores into code, for both engines.
+ */
+struct CodeWriteStats
+{
+    uint64_t code_stores = 0;         ///< Stores to a page holding decoded code.
+    uint64_t entries_invalidated = 0; ///< Decoded instructions dropped by those stores.
+    uint64_t blocks_invalidated = 0;  ///< Translated blocks dropped by those stores.
+    uint64_t flushes = 0;             ///< Times all decoded code was dropped, by FENCE.I or a snapshot restore.
+
+    /**
+     * @brief Print the counts and their rates.
+     *
+     * @param out The stream to print to.
+     * @param instructions The instructions retired over the same run.
+     */
+    void print(std::ostream &out, uint64_t instructions) const;
+};
+
+/**
+ * @brief Decoded instruction together with its cache slot.
+ *
+ * Slots number the instructions cached in fill order, so per-instruction
+ * counters can be kept in flat arrays indexed by slot. An address filled
+ * again with the same instruction, e.g. after FENCE.I, gets its old slot
+ * back, so re-decoding code does not grow the arrays.
+ */
+struct CachedInstruction
+{
+    DecodedInstruction decoded; ///< Decoded instruction.
+    uint32_t slot;              ///< Cache slot.
+};
+
+/**
+ * @brief Cache of decoded instructions keyed by program counter.
+ *
+ * Entries are grouped in pages of 4 KiB of guest address space with one
+ * entry per half word, since compressed instructions are half-word aligned.
+ * A page is filled lazily the first time an address in it is decoded. A
+ * bitmap marks the pages holding entries, and the page after one whose last
+ * entry straddles into it, so a store to data costs a bit test per page it
+ * touches. A store to code drops only the entries covering the bytes it
+ * writes, so code sharing a page with data it updates, or copied into RAM
+ * next to code already running, stays decoded. The debugger patches
+ * breakpoints into the cache: a patched address keeps its replacement across
+ * invalidation, so execution finds the breakpoint without checking for one
+ * on every fetch.
+ */
+class DecodeCache
+{
+public:
+    static constexpr uint32_t PAGE_SHIFT = 12;                      ///< log2 of the page size.
+    static constexpr uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;         ///< Page size in bytes.
+    static constexpr uint32_t ENTRIES_PER_PAGE = PAGE_SIZE / 2;     ///< Instruction slots per page, one per half word.
+    static constexpr uint32_t PAGE_COUNT = 1u << (32 - PAGE_SHIFT); ///< Pages in the guest address space.
+
+    /**
+     * @brief Look up the decoded instruction at an address.
+     *
+     * @param pc Address of the instruction.
+     * @return const CachedInstruction* The cached record, or nullptr on a miss.
+     */
+    const CachedInstruction *lookup(uint32_t pc);
+
+    /**
+     * @brief Insert a decoded instruction into the cache.
+     *
+     * @param pc Address of the instruction.
+     * @param decoded The decoded instruction.
+     * @return const CachedInstruction& The cached record.
+     */
+    const CachedInstruction &insert(uint32_t pc, const DecodedInstruction &decoded);
+
+    /**
+     * @brief Make an address decode to a replacement until it is unpatched.
+     *
+     * @param pc Address of the instruction.
+     * @param decoded The replacement, e.g. a DEBUG_BREAK.
+     * @return const CachedInstruction& The cached record of the replacement.
+     */
+    const CachedInstruction &patch(uint32_t pc, const DecodedInstruction &decoded);
+
+    /**
+     * @brief Drop the replacement of an address, so it is decoded from memory again.
+     *
+     * @param pc Address of the instruction.
+     */
+    void unpatch(uint32_t pc);
+
+    /**
+     * @brief Drop the entries covering any byte written by a store.
+     *
+     * @param address Start address of the store.
+     * @param size Size of the store in bytes.
+     */
+    void invalidate(uint32_t address, uint32_t size)
+    {
+        // Stores to data end here; larger writes come from the debugger
+        if (size <= PAGE_SIZE && !code_pages.test(address >> PAGE_SHIFT) &&
+            !code_pages.test((address + size - 1) >> PAGE_SHIFT))
+        {
+            return;
+        }
+        invalidate_code(address, size);
+    }
+
+    /**
+     * @brief Drop all cached entries.
+     */
+    void clear();
+
+    /**
+     * @brief Give each new instruction at an address a slot of its own, or stop doing so.
+     *
+     * Needed while per-slot counters are kept. Otherwise an address filled
+     * with a different instruction reuses its slot, which then names the new
+     * one, so the slot count stays bounded by the addresses decoded.
+     *
+     * @param track true to hand out a new slot for each new instruction.
+     */
+    void set_slot_tracking(bool track) { tracking_slots = track; }
+
+    /**
+     * @brief Count translated blocks dropped by a store, on behalf of the block engine.
+     *
+     * @param count The number of blocks.
+     */
+    void count_blocks_invalidated(uint64_t count) { stats.blocks_invalidated += count; }
+
+    /**
+     * @brief Get the counts of stores into code.
+     *
+     * @return const CodeWriteStats& The counts.
+     */
+    const CodeWriteStats &get_code_write_stats() const { return stats; }
+
+    /**
+     * @brief Get the number of lookups that hit the cache.
+     *
+     * @return uint64_t The hit count.
+     */
+    uint64_t get_hits() const { return hits; }
+
+    /**
+     * @brief Get the number of lookups that missed the cache.
+     *
+     * @return uint64_t The miss count.
+     */
+    uint64_t get_misses() const { return misses; }
+
+    /**
+     * @brief Get the number of slots handed out so far.
+     *
+     * @return uint32_t The slot count.
+     */
+    uint32_t get_slot_count() const { return static_cast<uint32_t>(slot_pcs.size()); }
+
+    /**
+     * @brief Get the address a slot was filled for.
+     *
+     * @param slot The cache slot.
+     * @return uint32_t The instruction address.
+     */
+    uint32_t get_slot_pc(uint32_t slot) const { return slot_pcs[slot]; }
+
+    /**
+     * @brief Get the instruction a slot was filled with.
+     *
+     * @param slot The cache slot.
+     * @return const DecodedInstruction& The decoded instruction.
+     */
+    const DecodedInstruction &get_slot_instruction(uint32_t slot) const { return slot_instructions[slot]; }
+
+private:
+    /**
+     * @brief Decoded entries for one page of guest memory.
+     */
+    struct Page
+    {
+        std::array<CachedInstruction, ENTRIES_PER_PAGE> entries;  ///< Decoded records.
+        std::bitset<ENTRIES_PER_PAGE> valid;                      ///< Valid bit per record.
+    };
+
+    Page *find_page(uint32_t page_number);
+    void invalidate_code(uint32_t address, uint32_t size);
+
+    std::unordered_map<uint32_t, std::unique_ptr<Page>> pages; ///< Pages by page number.
+    uint32_t last_page_number = 0;                             ///< Page number of the last lookup.
+    Page *last_page = nullptr;                                 ///< Page of the last lookup.
+    std::vector<uint32_t> slot_pcs;                            ///< Instruction address by slot.
+    std::vector<DecodedInstruction> slot_instructions;         ///< Decoded instruction by slot.
+    std::unordered_map<uint32_t, uint32_t> slot_by_pc;         ///< Last slot filled at each address.
+    bool tracking_slots = false;                               ///< New instructions get new slots.
+    std::unordered_map<uint32_t, DecodedInstruction> patches;  ///< Replacements by address.
+    uint64_t hits = 0;                                         ///< Lookup hits.
+    uint64_t misses = 0;                                       ///< Lookup misses.
+    PageBitmap code_pages{PAGE_SHIFT};                         ///< Pages that may hold entries.
+    CodeWriteStats stats;                                      ///< Stores into code.
+};
+
+#endif
@@ -0,0 +1,338 @@
+#include "devices.h"
+#include "logger.h"
+#include "memory.h"
+#include <stdexcept>
+#include <vector>
+
+/**
+ * @brief Read a register.
+ *
+ * @param offset Offset of the register.
+ * @param size Size of the access in bytes.
+ * @return uint32_t The line status for LSR, otherwise 0.
+ */
+uint32_t Uart::read(uint32_t offset, uint32_t size)
+{
+    (void)size;
+    return offset == LSR ? LSR_TX_IDLE : 0;
+}
+
+/**
+ * @brief Write a register; bytes written to THR are buffered.
+ *
+ * @param offset Offset of the register.
+ * @param value The value written.
+ * @param size Size of the access in bytes.
+ * @return false, the UART never writes guest memory.
+ */
+bool Uart::write(uint32_t offset, uint32_t value, uint32_t size)
+{
+    (void)size;
+    if (offset != THR)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer.push_back(static_cast<char>(value));
+    if (buffer.size() >= BUFFER_SIZE)
+    {
+        std::fwrite(buffer.data(), 1, buffer.size(), output);
+        buffer.clear();
+    }
+    return false;
+}
+
+/**
+ * @brief Write the buffered bytes to the host stream.
+ */
+void Uart::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::fwrite(buffer.data(), 1, buffer.size(), output);
+    std::fflush(output);
+    buffer.clear();
+}
+
+/**
+ * @brief Construct a new Clint object.
+ *
+ * @param hart_count Number of harts, at most MAX_HARTS.
+ */
+Clint::Clint(uint32_t hart_count)
+    : hart_count(hart_count), start(std::chrono::steady_clock::now()),
+      msip(new std::atomic<uint32_t>[hart_count]), mtimecmp(new std::atomic<uint64_t>[hart_count])
+{
+    if (hart_count == 0 || hart_count > MAX_HARTS)
+    {
+        throw std::runtime_error("The CLINT supports 1 to " + std::to_string(MAX_HARTS) + " harts");
+    }
+    for (uint32_t i = 0; i < hart_count; ++i)
+    {
+        msip[i].store(0, std::memory_order_relaxed);
+        mtimecmp[i].store(UINT64_MAX, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Get the current value of mtime.
+ *
+ * @return uint64_t The timer.
+ */
+uint64_t Clint::get_time() const
+{
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    uint64_t ticks = static_cast<uint64_t>(elapsed.count()) / (1000000000 / FREQUENCY);
+    return ticks + static_cast<uint64_t>(time_offset.load(std::memory_order_relaxed));
+}
+
+/**
+ * @brief Replace part of a 64-bit register.
+ *
+ * @param target The register.
+ * @param offset Offset of the access within the register.
+ * @param value The value written.
+ * @param size Size of the access in bytes.
+ * @return uint64_t The new register value.
+ */
+uint64_t Clint::merge(uint64_t target, uint32_t offset, uint32_t value, uint32_t size)
+{
+    uint64_t mask = (size >= 4 ? 0xFFFFFFFFull : (1ull << (8 * size)) - 1) << (8 * offset);
+    return (target & ~mask) | ((static_cast<uint64_t>(value) << (8 * offset)) & mask);
+}
+
+/**
+ * @brief Read a register.
+ *
+ * @param offset Offset of the register.
+ * @param size Size of the access in bytes.
+ * @return uint32_t The value read.
+ */
+uint32_t Clint::read(uint32_t offset, uint32_t size)
+{
+    uint64_t value = 0;
+    uint32_t shift = 0;
+    if (offset < MSIP + 4 * hart_count)
+    {
+        value = msip[(offset - MSIP) / 4].load(std::memory_order_relaxed);
+        shift = (offset - MSIP) % 4;
+    }
+    else if (offset >= MTIMECMP && offset < MTIMECMP + 8 * hart_count)
+    {
+        value = mtimecmp[(offset - MTIMECMP) / 8].load(std::memory_order_relaxed);
+        shift = (offset - MTIMECMP) % 8;
+    }
+    else if (offset >= MTIME && offset < MTIME + 8)
+    {
+        value = get_time();
+        shift = offset - MTIME;
+    }
+    value >>= 8 * shift;
+    return static_cast<uint32_t>(size >= 4 ? value : value & ((1ull << (8 * size)) - 1));
+}
+
+/**
+ * @brief Write a register.
+ *
+ * @param offset Offset of the register.
+ * @param value The value written.
+ * @param size Size of the access in bytes.
+ * @return false, the CLINT never writes guest memory.
+ */
+bool Clint::write(uint32_t offset, uint32_t value, uint32_t size)
+{
+    if (offset < MSIP + 4 * hart_count)
+    {
+        // Only bit 0 of msip is writable
+        if ((offset - MSIP) % 4 == 0)
+        {
+            msip[(offset - MSIP) / 4].store(value & 1, std::memory_order_relaxed);
+        }
+    }
+    else if (offset >= MTIMECMP && offset < MTIMECMP + 8 * hart_count)
+    {
+        std::atomic<uint64_t> &compare = mtimecmp[(offset - MTIMECMP) / 8];
+        compare.store(merge(compare.load(std::memory_order_relaxed), (offset - MTIMECMP) % 8, value, size),
+                      std::memory_order_relaxed);
+    }
+    else if (offset >= MTIME && offset < MTIME + 8)
+    {
+        // Writing mtime moves the timer, it keeps counting from the new value
+        uint64_t now = get_time();
+        uint64_t time = merge(now, offset - MTIME, value, size);
+        time_offset.fetch_add(static_cast<int64_t>(time - now), std::memory_order_relaxed);
+    }
+    return false;
+}
+
+/**
+ * @brief Read a register.
+ *
+ * @param offset Offset of the register.
+ * @param size Size of the access in bytes.
+ * @return uint32_t The last value stored to it.
+ */
+uint32_t TohostDevice::read(uint32_t offset, uint32_t size)
+{
+    (void)size;
+    if (offset == TOHOST)
+    {
+        return tohost.load(std::memory_order_relaxed);
+    }
+    return offset == FROMHOST ? fromhost.load(std::memory_order_relaxed) : 0;
+}
+
+/**
+ * @brief Write a register.
+ *
+ * @param offset Offset of the register.
+ * @param value The value written.
+ * @param size Size of the access in bytes.
+ * @return false, the registers never write guest memory.
+ */
+bool TohostDevice::write(uint32_t offset, uint32_t value, uint32_t size)
+{
+    (void)size;
+    if (offset == TOHOST)
+    {
+        tohost.store(value, std::memory_order_relaxed);
+    }
+    else if (offset == FROMHOST)
+    {
+        fromhost.store(value, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+/**
+ * @brief Open the backing file for reading and writing.
+ *
+ * @param filename Path to the image; its size is rounded down to whole sectors.
+ * @return true if successful, false otherwise.
+ */
+bool BlockDevice::open(const std::string &filename)
+{
+    file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open block device image: " + filename);
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    if (size / SECTOR_SIZE > UINT32_MAX)
+    {
+        LOG_ERROR("Error: Block device image is too large: " + filename);
+        return false;
+    }
+    capacity = static_cast<uint32_t>(size / SECTOR_SIZE);
+    LOG_INFO("Block device: " + filename + " (" + std::to_string(capacity) + " sectors)");
+    return true;
+}
+
+/**
+ * @brief Read a register.
+ *
+ * @param offset Offset of the register.
+ * @param size Size of the access in bytes.
+ * @return uint32_t The value read.
+ */
+uint32_t BlockDevice::read(uint32_t offset, uint32_t size)
+{
+    (void)size;
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (offset)
+    {
+    case SECTOR:
+        return sector;
+    case ADDRESS:
+        return address;
+    case COUNT:
+        return count;
+    case STATUS:
+        return status;
+    case CAPACITY:
+        return capacity;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Write a register, running a command written to COMMAND.
+ *
+ * @param offset Offset of the register.
+ * @param value The value written.
+ * @param size Size of the access in bytes.
+ * @return true if a read command copied sectors into guest memory, false otherwise.
+ */
+bool BlockDevice::write(uint32_t offset, uint32_t value, uint32_t size)
+{
+    (void)size;
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (offset)
+    {
+    case SECTOR:
+        sector = value;
+        break;
+    case ADDRESS:
+        address = value;
+        break;
+    case COUNT:
+        count = value;
+        break;
+    case COMMAND:
+        status = transfer(value);
+        return value == COMMAND_READ && status == STATUS_OK;
+    default:
+        break;
+    }
+    return false;
+}
+
+/**
+ * @brief Run a command with the current registers.
+ *
+ * @param command COMMAND_READ or COMMAND_WRITE.
+ * @return uint32_t STATUS_OK or STATUS_ERROR.
+ */
+uint32_t BlockDevice::transfer(uint32_t command)
+{
+    uint64_t bytes = static_cast<uint64_t>(count) * SECTOR_SIZE;
+    if ((command != COMMAND_READ && command != COMMAND_WRITE) || !file.is_open() ||
+        static_cast<uint64_t>(sector) + count > capacity || static_cast<uint64_t>(address) + bytes > (1ull << 32))
+    {
+        return STATUS_ERROR;
+    }
+
+    file.clear();
+    std::vector<char> data(static_cast<size_t>(bytes));
+    if (command == COMMAND_READ)
+    {
+        file.seekg(static_cast<std::streamoff>(sector) * SECTOR_SIZE);
+        if (!file.read(data.data(), static_cast<std::streamsize>(bytes)))
+        {
+            return STATUS_ERROR;
+        }
+        memory.store_bytes(address, data.data(), data.size());
+        return STATUS_OK;
+    }
+
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<char>(memory.load_byte(address + static_cast<uint32_t>(i)));
+    }
+    file.seekp(static_cast<std::streamoff>(sector) * SECTOR_SIZE);
+    return file.write(data.data(), static_cast<std::streamsize>(bytes)) ? STATUS_OK : STATUS_ERROR;
+}
+
+/**
+ * @brief Write sectors still buffered by the host stream to the file.
+ */
+void BlockDevice::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file.is_open())
+    {
+        file.flush();
+    }
+}
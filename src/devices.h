@@ -0,0 +1,282 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "bus.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+class Memory;
+
+// Default addresses of the devices mapped by --devices, as on the QEMU virt board where it has them
+constexpr uint32_t CLINT_BASE = 0x02000000;        ///< Core-local interruptor.
+constexpr uint32_t UART_BASE = 0x10000000;         ///< Console UART.
+constexpr uint32_t BLOCK_DEVICE_BASE = 0x10001000; ///< Block device.
+constexpr uint32_t TOHOST_DEVICE_BASE = 0x10002000; ///< tohost and fromhost registers.
+
+/**
+ * @brief Transmit side of a 16550 UART.
+ *
+ * Bytes written to the transmit register are collected and written to the
+ * host in large chunks instead of one write per byte. The line status
+ * register always reports an empty transmitter, and no input is ever ready.
+ */
+class Uart : public Device
+{
+public:
+    static constexpr uint32_t SIZE = 0x1000;        ///< Size of the register range.
+    static constexpr uint32_t THR = 0;              ///< Transmit holding register.
+    static constexpr uint32_t LSR = 5;              ///< Line status register.
+    static constexpr uint8_t LSR_TX_IDLE = 0x60;    ///< Transmit holding register and shifter empty.
+    static constexpr size_t BUFFER_SIZE = 64 * 1024; ///< Bytes collected before a host write.
+
+    /**
+     * @brief Construct a new Uart object.
+     *
+     * @param output The host stream the guest prints to.
+     */
+    explicit Uart(FILE *output = stdout) : output(output) {}
+
+    /**
+     * @brief Write out the remaining output.
+     */
+    ~Uart() override { flush(); }
+
+    /**
+     * @brief Read a register.
+     *
+     * @param offset Offset of the register.
+     * @param size Size of the access in bytes.
+     * @return uint32_t The line status for LSR, otherwise 0.
+     */
+    uint32_t read(uint32_t offset, uint32_t size) override;
+
+    /**
+     * @brief Write a register; bytes written to THR are buffered.
+     *
+     * @param offset Offset of the register.
+     * @param value The value written.
+     * @param size Size of the access in bytes.
+     * @return false, the UART never writes guest memory.
+     */
+    bool write(uint32_t offset, uint32_t value, uint32_t size) override;
+
+    /**
+     * @brief Write the buffered bytes to the host stream.
+     */
+    void flush() override;
+
+private:
+    FILE *output;       ///< Host stream.
+    std::string buffer; ///< Bytes not written to the host yet.
+    std::mutex mutex;   ///< Guards the buffer; every hart may print.
+};
+
+/**
+ * @brief Core-local interruptor holding the machine timer and software interrupt bits.
+ *
+ * mtime counts at FREQUENCY from the host's monotonic clock, so firmware
+ * delays take real time whatever the emulation speed. The layout matches
+ * the SiFive CLINT: msip at 0, mtimecmp at 0x4000 and mtime at 0xBFF8.
+ */
+class Clint : public Device
+{
+public:
+    static constexpr uint32_t SIZE = 0x10000;          ///< Size of the register range.
+    static constexpr uint32_t MSIP = 0x0000;           ///< Software interrupt bit of hart 0, 4 bytes per hart.
+    static constexpr uint32_t MTIMECMP = 0x4000;       ///< Timer compare of hart 0, 8 bytes per hart.
+    static constexpr uint32_t MTIME = 0xBFF8;          ///< Timer.
+    static constexpr uint64_t FREQUENCY = 10000000;    ///< mtime ticks per second.
+    static constexpr uint32_t MAX_HARTS = 4095;        ///< Harts the register layout has room for.
+
+    /**
+     * @brief Construct a new Clint object.
+     *
+     * @param hart_count Number of harts, at most MAX_HARTS.
+     */
+    explicit Clint(uint32_t hart_count);
+
+    /**
+     * @brief Read a register.
+     *
+     * @param offset Offset of the register.
+     * @param size Size of the access in bytes.
+     * @return uint32_t The value read.
+     */
+    uint32_t read(uint32_t offset, uint32_t size) override;
+
+    /**
+     * @brief Write a register.
+     *
+     * @param offset Offset of the register.
+     * @param value The value written.
+     * @param size Size of the access in bytes.
+     * @return false, the CLINT never writes guest memory.
+     */
+    bool write(uint32_t offset, uint32_t value, uint32_t size) override;
+
+    /**
+     * @brief Get the current value of mtime.
+     *
+     * @return uint64_t The timer.
+     */
+    uint64_t get_time() const;
+
+    /**
+     * @brief Check whether the timer of a hart has reached its compare value.
+     *
+     * @param hart The hart id.
+     * @return true if the timer interrupt is pending, false otherwise.
+     */
+    bool is_timer_pending(uint32_t hart) const { return get_time() >= mtimecmp[hart].load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Check whether a software interrupt is pending for a hart.
+     *
+     * @param hart The hart id.
+     * @return true if msip is set, false otherwise.
+     */
+    bool is_software_pending(uint32_t hart) const { return msip[hart].load(std::memory_order_relaxed) & 1; }
+
+private:
+    /**
+     * @brief Replace part of a 64-bit register.
+     *
+     * @param target The register.
+     * @param offset Offset of the access within the register.
+     * @param value The value written.
+     * @param size Size of the access in bytes.
+     * @return uint64_t The new register value.
+     */
+    static uint64_t merge(uint64_t target, uint32_t offset, uint32_t value, uint32_t size);
+
+    uint32_t hart_count;                                  ///< Number of harts.
+    std::chrono::steady_clock::time_point start;           ///< Host time mtime counts from.
+    std::atomic<int64_t> time_offset{0};                   ///< Difference written to mtime by the guest.
+    std::unique_ptr<std::atomic<uint32_t>[]> msip;         ///< Software interrupt bit by hart.
+    std::unique_ptr<std::atomic<uint64_t>[]> mtimecmp;     ///< Timer compare by hart.
+};
+
+/**
+ * @brief tohost and fromhost registers for programs without a tohost symbol.
+ *
+ * Stores are latched; the hart halts on a store of (code << 1) | 1 through
+ * the same check as the tohost symbol.
+ */
+class TohostDevice : public Device
+{
+public:
+    static constexpr uint32_t SIZE = 0x1000;   ///< Size of the register range.
+    static constexpr uint32_t TOHOST = 0;      ///< Offset of tohost.
+    static constexpr uint32_t FROMHOST = 8;    ///< Offset of fromhost.
+
+    /**
+     * @brief Read a register.
+     *
+     * @param offset Offset of the register.
+     * @param size Size of the access in bytes.
+     * @return uint32_t The last value stored to it.
+     */
+    uint32_t read(uint32_t offset, uint32_t size) override;
+
+    /**
+     * @brief Write a register.
+     *
+     * @param offset Offset of the register.
+     * @param value The value written.
+     * @param size Size of the access in bytes.
+     * @return false, the registers never write guest memory.
+     */
+    bool write(uint32_t offset, uint32_t value, uint32_t size) override;
+
+private:
+    std::atomic<uint32_t> tohost{0};   ///< Last value stored to tohost.
+    std::atomic<uint32_t> fromhost{0}; ///< Last value stored to fromhost.
+};
+
+/**
+ * @brief Block device backed by a host file, transferring whole sectors by DMA.
+ *
+ * The guest sets SECTOR, ADDRESS and COUNT and writes a command; the
+ * transfer completes before the command store retires and STATUS reports
+ * the outcome. Reads into memory do not invalidate decoded code, so a
+ * program that loads code this way runs FENCE.I before jumping to it.
+ */
+class BlockDevice : public Device
+{
+public:
+    static constexpr uint32_t SIZE = 0x1000;        ///< Size of the register range.
+    static constexpr uint32_t SECTOR_SIZE = 512;    ///< Bytes per sector.
+    static constexpr uint32_t SECTOR = 0x00;        ///< First sector of the transfer.
+    static constexpr uint32_t ADDRESS = 0x04;       ///< Guest address of the transfer.
+    static constexpr uint32_t COUNT = 0x08;         ///< Sectors to transfer.
+    static constexpr uint32_t COMMAND = 0x0C;       ///< Write COMMAND_READ or COMMAND_WRITE to start.
+    static constexpr uint32_t STATUS = 0x10;        ///< STATUS_OK or STATUS_ERROR of the last command.
+    static constexpr uint32_t CAPACITY = 0x14;      ///< Size of the device in sectors.
+    static constexpr uint32_t COMMAND_READ = 1;     ///< Copy sectors into guest memory.
+    static constexpr uint32_t COMMAND_WRITE = 2;    ///< Copy guest memory into sectors.
+    static constexpr uint32_t STATUS_OK = 0;        ///< The command completed.
+    static constexpr uint32_t STATUS_ERROR = 1;     ///< The command was out of range or failed on the host.
+
+    /**
+     * @brief Construct a new BlockDevice object.
+     *
+     * @param memory The memory transfers go to and from.
+     */
+    explicit BlockDevice(Memory &memory) : memory(memory) {}
+
+    /**
+     * @brief Open the backing file for reading and writing.
+     *
+     * @param filename Path to the image; its size is rounded down to whole sectors.
+     * @return true if successful, false otherwise.
+     */
+    bool open(const std::string &filename);
+
+    /**
+     * @brief Read a register.
+     *
+     * @param offset Offset of the register.
+     * @param size Size of the access in bytes.
+     * @return uint32_t The value read.
+     */
+    uint32_t read(uint32_t offset, uint32_t size) override;
+
+    /**
+     * @brief Write a register, running a command written to COMMAND.
+     *
+     * @param offset Offset of the register.
+     * @param value The value written.
+     * @param size Size of the access in bytes.
+     * @return true if a read command copied sectors into guest memory, false otherwise.
+     */
+    bool write(uint32_t offset, uint32_t value, uint32_t size) override;
+
+    /**
+     * @brief Write sectors still buffered by the host stream to the file.
+     */
+    void flush() override;
+
+private:
+    /**
+     * @brief Run a command with the current registers.
+     *
+     * @param command COMMAND_READ or COMMAND_WRITE.
+     * @return uint32_t STATUS_OK or STATUS_ERROR.
+     */
+    uint32_t transfer(uint32_t command);
+
+    Memory &memory;             ///< Memory transfers go to and from.
+    std::fstream file;          ///< The backing file.
+    uint32_t capacity = 0;      ///< Size in sectors.
+    uint32_t sector = 0;        ///< SECTOR register.
+    uint32_t address = 0;       ///< ADDRESS register.
+    uint32_t count = 0;         ///< COUNT register.
+    uint32_t status = STATUS_OK; ///< STATUS register.
+    std::mutex mutex;           ///< Serialises commands from different harts.
+};
+
+#endif
@@ -0,0 +1,624 @@
+#include "fpu.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE_MATH__)
+#include <xmmintrin.h>
+#else
+#include <cfenv>
+#endif
+
+namespace
+{
+    float to_float(uint32_t bits)
+    {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    uint32_t to_bits(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    uint64_t to_bits(double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    bool is_nan(uint32_t a)
+    {
+        return (a & 0x7FFFFFFF) > 0x7F800000;
+    }
+
+    bool is_signaling(uint32_t a)
+    {
+        return is_nan(a) && !(a & 0x00400000);
+    }
+
+    bool is_infinite(uint32_t a)
+    {
+        return (a & 0x7FFFFFFF) == 0x7F800000;
+    }
+
+    bool is_zero(uint32_t a)
+    {
+        return (a & 0x7FFFFFFF) == 0;
+    }
+
+#if defined(__SSE_MATH__)
+    /**
+     * @brief Host rounding and exception flags for the duration of one operation.
+     *
+     * Sets MXCSR directly: the flags are its low six bits and the rounding
+     * control bits 13 and 14.
+     */
+    class HostEnvironment
+    {
+    public:
+        explicit HostEnvironment(bool toward_zero) : saved(_mm_getcsr())
+        {
+            _mm_setcsr((saved & ~0x603Fu) | (toward_zero ? 0x6000u : 0u));
+        }
+
+        ~HostEnvironment()
+        {
+            _mm_setcsr(saved);
+        }
+
+        /**
+         * @brief Get the flags raised since construction; denormal operands are not a RISC-V flag.
+         *
+         * @return uint32_t The flags in fflags order.
+         */
+        uint32_t raised() const
+        {
+            uint32_t status = _mm_getcsr();
+            return (status & 0x01) << 4 | (status & 0x04) << 1 | (status & 0x08) >> 1 | (status & 0x10) >> 3 |
+                   (status & 0x20) >> 5;
+        }
+
+    private:
+        uint32_t saved; ///< MXCSR to restore.
+    };
+#else
+    /**
+     * @brief Host rounding and exception flags for the duration of one operation, through <cfenv>.
+     */
+    class HostEnvironment
+    {
+    public:
+        explicit HostEnvironment(bool toward_zero) : saved(std::fegetround())
+        {
+            std::feclearexcept(FE_ALL_EXCEPT);
+            std::fesetround(toward_zero ? FE_TOWARDZERO : FE_TONEAREST);
+        }
+
+        ~HostEnvironment()
+        {
+            std::fesetround(saved);
+        }
+
+        /**
+         * @brief Get the flags raised since construction.
+         *
+         * @return uint32_t The flags in fflags order.
+         */
+        uint32_t raised() const
+        {
+            int status = std::fetestexcept(FE_ALL_EXCEPT);
+            return (status & FE_INEXACT ? Fpu::NX : 0) | (status & FE_UNDERFLOW ? Fpu::UF : 0) |
+                   (status & FE_OVERFLOW ? Fpu::OF : 0) | (status & FE_DIVBYZERO ? Fpu::DZ : 0) |
+                   (status & FE_INVALID ? Fpu::NV : 0);
+        }
+
+    private:
+        int saved; ///< Rounding mode to restore.
+    };
+#endif
+
+    /**
+     * @brief Round a double to single precision in any rounding mode.
+     *
+     * The double must hold the exact result, or the result rounded towards
+     * zero with its lowest bit forced to one when inexact, so the bits lost
+     * below single precision still tell exact from inexact and below from
+     * above the halfway point. Tininess is detected after rounding.
+     *
+     * @param bits The double.
+     * @param rm The rounding mode, one of RNE to RMM.
+     * @param flags Receives NX, UF and OF.
+     * @return uint32_t The single-precision number.
+     */
+    uint32_t round_to_single(uint64_t bits, uint32_t rm, uint32_t &flags)
+    {
+        uint32_t sign = static_cast<uint32_t>(bits >> 63) << 31;
+        uint32_t biased = static_cast<uint32_t>(bits >> 52) & 0x7FF;
+        uint64_t significand = bits & ((uint64_t{1} << 52) - 1);
+        if (biased == 0x7FF)
+        {
+            return significand ? Fpu::CANONICAL_NAN : sign | 0x7F800000;
+        }
+        if (biased == 0 && significand == 0)
+        {
+            return sign;
+        }
+        significand |= uint64_t{1} << 52;
+        int32_t exponent = static_cast<int32_t>(biased) - 1023;
+
+        // Drop the bits below the kept ones, returning whether the rest rounds away from zero
+        auto round = [&](uint32_t shift, uint64_t &kept) {
+            shift = shift < 63 ? shift : 63;
+            kept = significand >> shift;
+            uint64_t rest = significand & ((uint64_t{1} << shift) - 1);
+            uint64_t half = uint64_t{1} << (shift - 1);
+            switch (rm)
+            {
+            case Fpu::RNE:
+                return rest > half || (rest == half && (kept & 1));
+            case Fpu::RDN:
+                return rest != 0 && sign != 0;
+            case Fpu::RUP:
+                return rest != 0 && sign == 0;
+            case Fpu::RMM:
+                return rest >= half;
+            default:
+                return false;
+            }
+        };
+        bool inexact = (significand & ((uint64_t{1} << 29) - 1)) != 0;
+
+        uint64_t kept;
+        if (exponent < -126)
+        {
+            // Tiny unless rounding to 24 bits with an unbounded exponent reaches the smallest normal
+            bool tiny = exponent < -127 || !(round(29, kept) && kept + 1 == uint64_t{1} << 24);
+            uint32_t shift = 29 + static_cast<uint32_t>(-126 - exponent);
+            inexact = shift >= 64 || (significand & ((uint64_t{1} << shift) - 1)) != 0;
+            bool up = round(shift, kept);
+            kept += up;
+            if (inexact)
+            {
+                flags |= Fpu::NX | (tiny ? Fpu::UF : 0);
+            }
+            // A carry into bit 23 turns the subnormal into the smallest normal
+            return sign | static_cast<uint32_t>(kept);
+        }
+
+        bool up = round(29, kept);
+        kept += up;
+        if (kept == uint64_t{1} << 24)
+        {
+            kept >>= 1;
+            ++exponent;
+        }
+        if (inexact)
+        {
+            flags |= Fpu::NX;
+        }
+        if (exponent > 127)
+        {
+            flags |= Fpu::OF | Fpu::NX;
+            bool to_infinity = rm == Fpu::RNE || rm == Fpu::RMM || (rm == Fpu::RDN && sign) || (rm == Fpu::RUP && !sign);
+            return sign | (to_infinity ? 0x7F800000 : 0x7F7FFFFF);
+        }
+        return sign | static_cast<uint32_t>(exponent + 127) << 23 | (static_cast<uint32_t>(kept) & 0x7FFFFF);
+    }
+
+    /**
+     * @brief Evaluate an operation in either precision and round its result.
+     *
+     * @tparam Function Callable taking 0.0f or 0.0 and computing in that type.
+     * @param function The operation.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The single-precision result.
+     */
+    template <typename Function>
+    uint32_t evaluate(Function function, uint32_t rm, uint32_t &flags)
+    {
+        if (rm == Fpu::RNE)
+        {
+            HostEnvironment host(false);
+            volatile float result = function(0.0f);
+            flags |= host.raised();
+            uint32_t bits = to_bits(static_cast<float>(result));
+            return is_nan(bits) ? Fpu::CANONICAL_NAN : bits;
+        }
+
+        uint64_t bits;
+        uint32_t raised;
+        {
+            HostEnvironment host(true);
+            volatile double result = function(0.0);
+            raised = host.raised();
+            bits = to_bits(static_cast<double>(result));
+        }
+        // The double cannot overflow or underflow, so inexact only means rounded: make it round to odd
+        if (raised & Fpu::NX)
+        {
+            bits |= 1;
+        }
+        flags |= raised & (Fpu::NV | Fpu::DZ);
+        return round_to_single(bits, rm, flags);
+    }
+
+    /**
+     * @brief Evaluate a sum and give an exact zero the sign the rounding mode calls for.
+     *
+     * Terms of opposite signs that cancel exactly sum to -0 when rounding
+     * down and +0 otherwise, but the round to odd path computes towards zero.
+     *
+     * @tparam Function Callable taking 0.0f or 0.0 and computing in that type.
+     * @param function The sum.
+     * @param opposite The terms have opposite signs.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The single-precision result.
+     */
+    template <typename Function>
+    uint32_t evaluate_sum(Function function, bool opposite, uint32_t rm, uint32_t &flags)
+    {
+        uint32_t raised = 0;
+        uint32_t result = evaluate(function, rm, raised);
+        flags |= raised;
+        return result == 0 && opposite && rm == Fpu::RDN && !(raised & Fpu::NX) ? 0x80000000 : result;
+    }
+
+    /**
+     * @brief Round to an integral value in a rounding mode, without raising flags.
+     *
+     * @param value The value.
+     * @param rm The rounding mode.
+     * @return double The integral value.
+     */
+    double round_integral(double value, uint32_t rm)
+    {
+        switch (rm)
+        {
+        case Fpu::RNE:
+            return std::nearbyint(value);
+        case Fpu::RTZ:
+            return std::trunc(value);
+        case Fpu::RDN:
+            return std::floor(value);
+        case Fpu::RUP:
+            return std::ceil(value);
+        default:
+            return std::round(value);
+        }
+    }
+
+    /**
+     * @brief Convert to an integer type, saturating out-of-range values and NaN.
+     *
+     * @tparam Integer int32_t or uint32_t.
+     * @param a The operand.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The integer.
+     */
+    template <typename Integer>
+    uint32_t to_integer(uint32_t a, uint32_t rm, uint32_t &flags)
+    {
+        constexpr Integer LOW = std::numeric_limits<Integer>::min();
+        constexpr Integer HIGH = std::numeric_limits<Integer>::max();
+        if (is_nan(a))
+        {
+            flags |= Fpu::NV;
+            return static_cast<uint32_t>(HIGH);
+        }
+        double value = to_float(a);
+        double integral = round_integral(value, rm);
+        if (integral < static_cast<double>(LOW) || integral > static_cast<double>(HIGH))
+        {
+            flags |= Fpu::NV;
+            return static_cast<uint32_t>(integral < 0 ? LOW : HIGH);
+        }
+        if (integral != value)
+        {
+            flags |= Fpu::NX;
+        }
+        return static_cast<uint32_t>(static_cast<Integer>(integral));
+    }
+}
+
+/**
+ * @brief Add two numbers.
+ *
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The rounded sum.
+ */
+uint32_t Fpu::add(uint32_t a, uint32_t b, uint32_t rm, uint32_t &flags)
+{
+    float x = to_float(a), y = to_float(b);
+    return evaluate_sum([&](auto zero) { return static_cast<decltype(zero)>(x) + static_cast<decltype(zero)>(y); },
+                        ((a ^ b) >> 31) != 0, rm, flags);
+}
+
+/**
+ * @brief Subtract two numbers.
+ *
+ * @param a The minuend.
+ * @param b The subtrahend.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The rounded difference.
+ */
+uint32_t Fpu::subtract(uint32_t a, uint32_t b, uint32_t rm, uint32_t &flags)
+{
+    float x = to_float(a), y = to_float(b);
+    return evaluate_sum([&](auto zero) { return static_cast<decltype(zero)>(x) - static_cast<decltype(zero)>(y); },
+                        ((a ^ b) >> 31) == 0, rm, flags);
+}
+
+/**
+ * @brief Multiply two numbers.
+ *
+ * @param a The first factor.
+ * @param b The second factor.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The rounded product.
+ */
+uint32_t Fpu::multiply(uint32_t a, uint32_t b, uint32_t rm, uint32_t &flags)
+{
+    float x = to_float(a), y = to_float(b);
+    return evaluate([&](auto zero) { return static_cast<decltype(zero)>(x) * static_cast<decltype(zero)>(y); }, rm,
+                    flags);
+}
+
+/**
+ * @brief Divide two numbers.
+ *
+ * @param a The dividend.
+ * @param b The divisor.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The rounded quotient.
+ */
+uint32_t Fpu::divide(uint32_t a, uint32_t b, uint32_t rm, uint32_t &flags)
+{
+    float x = to_float(a), y = to_float(b);
+    return evaluate([&](auto zero) { return static_cast<decltype(zero)>(x) / static_cast<decltype(zero)>(y); }, rm,
+                    flags);
+}
+
+/**
+ * @brief Take the square root of a number.
+ *
+ * @param a The operand.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The rounded square root.
+ */
+uint32_t Fpu::square_root(uint32_t a, uint32_t rm, uint32_t &flags)
+{
+    float x = to_float(a);
+    return evaluate([&](auto zero) { return std::sqrt(static_cast<decltype(zero)>(x)); }, rm, flags);
+}
+
+/**
+ * @brief Multiply and add with a single rounding, as FMADD, FMSUB, FNMSUB and FNMADD.
+ *
+ * RISC-V raises invalid for infinity times zero even when the addend is a
+ * quiet NaN, which the host leaves open.
+ *
+ * @param a The first factor.
+ * @param b The second factor.
+ * @param c The addend.
+ * @param negate_product Negate a times b.
+ * @param negate_addend Negate c.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The rounded result.
+ */
+uint32_t Fpu::fused_multiply_add(uint32_t a, uint32_t b, uint32_t c, bool negate_product, bool negate_addend,
+                                 uint32_t rm, uint32_t &flags)
+{
+    if ((is_infinite(a) && is_zero(b)) || (is_zero(a) && is_infinite(b)))
+    {
+        flags |= NV;
+    }
+    uint32_t product_sign = (a ^ b) >> 31 ^ negate_product;
+    uint32_t addend_sign = c >> 31 ^ negate_addend;
+    float x = to_float(negate_product ? a ^ 0x80000000 : a), y = to_float(b);
+    float z = to_float(negate_addend ? c ^ 0x80000000 : c);
+    return evaluate_sum(
+        [&](auto zero) {
+            using Type = decltype(zero);
+            return std::fma(static_cast<Type>(x), static_cast<Type>(y), static_cast<Type>(z));
+        },
+        product_sign != addend_sign, rm, flags);
+}
+
+/**
+ * @brief Get the smaller number, treating -0 as below +0 and ignoring a single NaN.
+ *
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The minimum.
+ */
+uint32_t Fpu::minimum(uint32_t a, uint32_t b, uint32_t &flags)
+{
+    if (is_signaling(a) || is_signaling(b))
+    {
+        flags |= NV;
+    }
+    if (is_nan(a) || is_nan(b))
+    {
+        return is_nan(a) ? (is_nan(b) ? CANONICAL_NAN : b) : a;
+    }
+    float x = to_float(a), y = to_float(b);
+    // Equal operands differ at most in the sign of a zero
+    return x < y ? a : (y < x ? b : a | b);
+}
+
+/**
+ * @brief Get the larger number, treating -0 as below +0 and ignoring a single NaN.
+ *
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The maximum.
+ */
+uint32_t Fpu::maximum(uint32_t a, uint32_t b, uint32_t &flags)
+{
+    if (is_signaling(a) || is_signaling(b))
+    {
+        flags |= NV;
+    }
+    if (is_nan(a) || is_nan(b))
+    {
+        return is_nan(a) ? (is_nan(b) ? CANONICAL_NAN : b) : a;
+    }
+    float x = to_float(a), y = to_float(b);
+    return x > y ? a : (y > x ? b : a & b);
+}
+
+/**
+ * @brief Compare for equality, a quiet comparison.
+ *
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t 1 if equal, 0 otherwise.
+ */
+uint32_t Fpu::equal(uint32_t a, uint32_t b, uint32_t &flags)
+{
+    if (is_nan(a) || is_nan(b))
+    {
+        flags |= is_signaling(a) || is_signaling(b) ? NV : 0;
+        return 0;
+    }
+    return to_float(a) == to_float(b);
+}
+
+/**
+ * @brief Compare for less than, a signaling comparison.
+ *
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t 1 if a is less than b, 0 otherwise.
+ */
+uint32_t Fpu::less(uint32_t a, uint32_t b, uint32_t &flags)
+{
+    if (is_nan(a) || is_nan(b))
+    {
+        flags |= NV;
+        return 0;
+    }
+    return to_float(a) < to_float(b);
+}
+
+/**
+ * @brief Compare for less than or equal, a signaling comparison.
+ *
+ * @param a The first operand.
+ * @param b The second operand.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t 1 if a is less than or equal to b, 0 otherwise.
+ */
+uint32_t Fpu::less_equal(uint32_t a, uint32_t b, uint32_t &flags)
+{
+    if (is_nan(a) || is_nan(b))
+    {
+        flags |= NV;
+        return 0;
+    }
+    return to_float(a) <= to_float(b);
+}
+
+/**
+ * @brief Classify a number as FCLASS.S does.
+ *
+ * @param a The operand.
+ * @return uint32_t One bit set: -inf, -normal, -subnormal, -0, +0, +subnormal, +normal, +inf, sNaN, qNaN.
+ */
+uint32_t Fpu::classify(uint32_t a)
+{
+    bool negative = a >> 31;
+    uint32_t exponent = (a >> 23) & 0xFF;
+    uint32_t fraction = a & 0x7FFFFF;
+    if (exponent == 0xFF)
+    {
+        if (fraction)
+        {
+            return fraction & 0x400000 ? 1u << 9 : 1u << 8;
+        }
+        return negative ? 1u << 0 : 1u << 7;
+    }
+    if (exponent == 0)
+    {
+        if (fraction)
+        {
+            return negative ? 1u << 2 : 1u << 5;
+        }
+        return negative ? 1u << 3 : 1u << 4;
+    }
+    return negative ? 1u << 1 : 1u << 6;
+}
+
+/**
+ * @brief Convert to a signed integer, saturating out-of-range values.
+ *
+ * @param a The operand.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The integer.
+ */
+uint32_t Fpu::to_signed(uint32_t a, uint32_t rm, uint32_t &flags)
+{
+    return to_integer<int32_t>(a, rm, flags);
+}
+
+/**
+ * @brief Convert to an unsigned integer, saturating out-of-range values.
+ *
+ * @param a The operand.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The integer.
+ */
+uint32_t Fpu::to_unsigned(uint32_t a, uint32_t rm, uint32_t &flags)
+{
+    return to_integer<uint32_t>(a, rm, flags);
+}
+
+/**
+ * @brief Convert from a signed integer.
+ *
+ * @param a The integer.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The rounded number.
+ */
+uint32_t Fpu::from_signed(uint32_t a, uint32_t rm, uint32_t &flags)
+{
+    int32_t value = static_cast<int32_t>(a);
+    return evaluate([&](auto zero) { return static_cast<decltype(zero)>(value); }, rm, flags);
+}
+
+/**
+ * @brief Convert from an unsigned integer.
+ *
+ * @param a The integer.
+ * @param rm The rounding mode.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The rounded number.
+ */
+uint32_t Fpu::from_unsigned(uint32_t a, uint32_t rm, uint32_t &flags)
+{
+    return evaluate([&](auto zero) { return static_cast<decltype(zero)>(a); }, rm, flags);
+}
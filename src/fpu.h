@@ -0,0 +1,205 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <cstdint>
+
+/**
+ * @brief Single-precision arithmetic of the F extension on raw register bits.
+ *
+ * Every operation takes the rounding mode already resolved from the
+ * instruction and fcsr, one of RNE to RMM since the reserved modes trap
+ * before execution, and ORs the exception flags it raises into flags.
+ * In round to nearest even, the mode the host runs in, operations are one
+ * host SSE or NEON scalar instruction bracketed by reading its exception
+ * flags. Other modes compute in double precision rounded to odd and round
+ * the result to single precision in software, which is exact for every
+ * operation here and gives the same flags as a soft-float library.
+ */
+class Fpu
+{
+public:
+    Fpu() = delete;
+
+    static constexpr uint32_t NX = 0x01; ///< Inexact.
+    static constexpr uint32_t UF = 0x02; ///< Underflow.
+    static constexpr uint32_t OF = 0x04; ///< Overflow.
+    static constexpr uint32_t DZ = 0x08; ///< Division by zero.
+    static constexpr uint32_t NV = 0x10; ///< Invalid operation.
+
+    static constexpr uint32_t RNE = 0; ///< Round to nearest, ties to even.
+    static constexpr uint32_t RTZ = 1; ///< Round towards zero.
+    static constexpr uint32_t RDN = 2; ///< Round down.
+    static constexpr uint32_t RUP = 3; ///< Round up.
+    static constexpr uint32_t RMM = 4; ///< Round to nearest, ties to max magnitude.
+
+    static constexpr uint32_t CANONICAL_NAN = 0x7FC00000; ///< The only NaN an operation returns.
+
+    /**
+     * @brief Add two numbers.
+     *
+     * @param a The first operand.
+     * @param b The second operand.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The rounded sum.
+     */
+    static uint32_t add(uint32_t a, uint32_t b, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Subtract two numbers.
+     *
+     * @param a The minuend.
+     * @param b The subtrahend.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The rounded difference.
+     */
+    static uint32_t subtract(uint32_t a, uint32_t b, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Multiply two numbers.
+     *
+     * @param a The first factor.
+     * @param b The second factor.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The rounded product.
+     */
+    static uint32_t multiply(uint32_t a, uint32_t b, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Divide two numbers.
+     *
+     * @param a The dividend.
+     * @param b The divisor.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The rounded quotient.
+     */
+    static uint32_t divide(uint32_t a, uint32_t b, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Take the square root of a number.
+     *
+     * @param a The operand.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The rounded square root.
+     */
+    static uint32_t square_root(uint32_t a, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Multiply and add with a single rounding, as FMADD, FMSUB, FNMSUB and FNMADD.
+     *
+     * @param a The first factor.
+     * @param b The second factor.
+     * @param c The addend.
+     * @param negate_product Negate a times b.
+     * @param negate_addend Negate c.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The rounded result.
+     */
+    static uint32_t fused_multiply_add(uint32_t a, uint32_t b, uint32_t c, bool negate_product, bool negate_addend,
+                                       uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Get the smaller number, treating -0 as below +0 and ignoring a single NaN.
+     *
+     * @param a The first operand.
+     * @param b The second operand.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The minimum.
+     */
+    static uint32_t minimum(uint32_t a, uint32_t b, uint32_t &flags);
+
+    /**
+     * @brief Get the larger number, treating -0 as below +0 and ignoring a single NaN.
+     *
+     * @param a The first operand.
+     * @param b The second operand.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The maximum.
+     */
+    static uint32_t maximum(uint32_t a, uint32_t b, uint32_t &flags);
+
+    /**
+     * @brief Compare for equality, a quiet comparison.
+     *
+     * @param a The first operand.
+     * @param b The second operand.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t 1 if equal, 0 otherwise.
+     */
+    static uint32_t equal(uint32_t a, uint32_t b, uint32_t &flags);
+
+    /**
+     * @brief Compare for less than, a signaling comparison.
+     *
+     * @param a The first operand.
+     * @param b The second operand.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t 1 if a is less than b, 0 otherwise.
+     */
+    static uint32_t less(uint32_t a, uint32_t b, uint32_t &flags);
+
+    /**
+     * @brief Compare for less than or equal, a signaling comparison.
+     *
+     * @param a The first operand.
+     * @param b The second operand.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t 1 if a is less than or equal to b, 0 otherwise.
+     */
+    static uint32_t less_equal(uint32_t a, uint32_t b, uint32_t &flags);
+
+    /**
+     * @brief Classify a number as FCLASS.S does.
+     *
+     * @param a The operand.
+     * @return uint32_t One bit set: -inf, -normal, -subnormal, -0, +0, +subnormal, +normal, +inf, sNaN, qNaN.
+     */
+    static uint32_t classify(uint32_t a);
+
+    /**
+     * @brief Convert to a signed integer, saturating out-of-range values.
+     *
+     * @param a The operand.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The integer.
+     */
+    static uint32_t to_signed(uint32_t a, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Convert to an unsigned integer, saturating out-of-range values.
+     *
+     * @param a The operand.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The integer.
+     */
+    static uint32_t to_unsigned(uint32_t a, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Convert from a signed integer.
+     *
+     * @param a The integer.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The rounded number.
+     */
+    static uint32_t from_signed(uint32_t a, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Convert from an unsigned integer.
+     *
+     * @param a The integer.
+     * @param rm The rounding mode.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The rounded number.
+     */
+    static uint32_t from_unsigned(uint32_t a, uint32_t rm, uint32_t &flags);
+};
+
+#endif
@@ -0,0 +1,943 @@
+#include "gdb_server.h"
+#include "logger.h"
+#include "profiler.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+constexpr uint32_t PC_REGISTER = 32;      ///< Debugger number of the program counter.
+constexpr uint32_t FLOAT_REGISTER = 33;   ///< Debugger number of f0, followed by f1 to f31.
+constexpr uint32_t FFLAGS_REGISTER = 66;  ///< Debugger number of fflags, followed by frm and fcsr.
+constexpr uint32_t LAST_REGISTER = 68;    ///< Highest debugger register number.
+constexpr int POLL_INTERVAL_MS = 10;      ///< How often a running hart checks for an interrupt.
+constexpr char INTERRUPT = 0x03;          ///< Sent by the debugger to stop a running hart.
+
+// Names the debugger shows, in register order
+const char *const REGISTER_NAMES[32] = {"zero", "ra", "sp", "gp", "tp",  "t0",  "t1", "t2", "fp", "s1", "a0",
+                                        "a1",   "a2", "a3", "a4", "a5",  "a6",  "a7", "s2", "s3", "s4", "s5",
+                                        "s6",   "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+/**
+ * @brief Build the target description announced to the debugger.
+ *
+ * @return std::string The XML document.
+ */
+std::string target_description()
+{
+    std::string xml = "<?xml version=\"1.0\"?>\n<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+                      "<target version=\"1.0\">\n<architecture>riscv:rv32</architecture>\n"
+                      "<feature name=\"org.gnu.gdb.riscv.cpu\">\n";
+    for (uint32_t i = 0; i < 32; ++i)
+    {
+        const char *type = i == 1 ? "code_ptr" : (i == 2 || i == 8 ? "data_ptr" : "int");
+        xml += "<reg name=\"" + std::string(REGISTER_NAMES[i]) + "\" bitsize=\"32\" type=\"" + type + "\" regnum=\"" +
+               std::to_string(i) + "\"/>\n";
+    }
+    xml += "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\" regnum=\"32\"/>\n</feature>\n"
+           "<feature name=\"org.gnu.gdb.riscv.fpu\">\n";
+    for (uint32_t i = 0; i < 32; ++i)
+    {
+        xml += "<reg name=\"f" + std::to_string(i) + "\" bitsize=\"32\" type=\"ieee_single\" regnum=\"" +
+               std::to_string(FLOAT_REGISTER + i) + "\"/>\n";
+    }
+    const char *const csrs[3] = {"fflags", "frm", "fcsr"};
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        xml += "<reg name=\"" + std::string(csrs[i]) + "\" bitsize=\"32\" type=\"int\" regnum=\"" +
+               std::to_string(FFLAGS_REGISTER + i) + "\"/>\n";
+    }
+    xml += "</feature>\n</target>\n";
+    return xml;
+}
+
+/**
+ * @brief Check whether a debugger register number is in the target description.
+ *
+ * @param number The register number.
+ * @return true if the register exists, false otherwise.
+ */
+bool is_register(uint32_t number)
+{
+    return number <= LAST_REGISTER && (number < FLOAT_REGISTER + 32 || number >= FFLAGS_REGISTER);
+}
+
+/**
+ * @brief Format a byte as two hex digits.
+ *
+ * @param value The byte.
+ * @return std::string The digits.
+ */
+std::string hex_byte(uint32_t value)
+{
+    static const char DIGITS[] = "0123456789abcdef";
+    return {DIGITS[(value >> 4) & 0xF], DIGITS[value & 0xF]};
+}
+
+/**
+ * @brief Format a register in guest byte order, as the protocol sends it.
+ *
+ * @param value The register value.
+ * @return std::string Eight hex digits.
+ */
+std::string hex_register(uint32_t value)
+{
+    return hex_byte(value) + hex_byte(value >> 8) + hex_byte(value >> 16) + hex_byte(value >> 24);
+}
+
+/**
+ * @brief Parse a hex number.
+ *
+ * @param text The digits.
+ * @return uint32_t The value; parsing stops at the first other character.
+ */
+uint32_t parse_hex(const std::string &text)
+{
+    return static_cast<uint32_t>(std::strtoul(text.c_str(), nullptr, 16));
+}
+
+/**
+ * @brief Parse a register sent in guest byte order.
+ *
+ * @param text At least eight hex digits.
+ * @return uint32_t The register value.
+ */
+uint32_t parse_register(const std::string &text)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        value |= parse_hex(text.substr(2 * i, 2)) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Compute the checksum of a packet.
+ *
+ * @param data The packet data.
+ * @return uint32_t The sum of the bytes modulo 256.
+ */
+uint32_t checksum(const std::string &data)
+{
+    uint32_t sum = 0;
+    for (char byte : data)
+    {
+        sum += static_cast<uint8_t>(byte);
+    }
+    return sum & 0xFF;
+}
+} // namespace
+
+/**
+ * @brief Construct a new GdbServer object.
+ *
+ * @param cpu The hart to debug, ready to run.
+ * @param engine The engine used to continue the hart.
+ */
+GdbServer::GdbServer(CPU &cpu, Engine engine)
+    : cpu(cpu), memory(cpu.memory.get_memory()), engine(engine), block_engine(cpu)
+{
+}
+
+/**
+ * @brief Close the sockets if still open.
+ */
+GdbServer::~GdbServer()
+{
+    cpu.memory.set_watcher(nullptr);
+    if (connection >= 0)
+    {
+        close(connection);
+    }
+    if (listener >= 0)
+    {
+        close(listener);
+    }
+}
+
+/**
+ * @brief Wait for a debugger and serve its session.
+ *
+ * @param port TCP port to listen on at 127.0.0.1.
+ * @return true if a session was served, false if the port could not be opened.
+ */
+bool GdbServer::serve(uint16_t port)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int reuse = 1;
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 1) != 0)
+    {
+        LOG_ERROR("Error: Cannot listen for GDB on port " + std::to_string(port));
+        return false;
+    }
+
+    LOG_INFO("Waiting for GDB on 127.0.0.1:" + std::to_string(port));
+    connection = accept(listener, nullptr, nullptr);
+    close(listener);
+    listener = -1;
+    if (connection < 0)
+    {
+        LOG_ERROR("Error: Cannot accept the GDB connection");
+        return false;
+    }
+    int no_delay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    LOG_INFO("GDB connected");
+
+    std::string packet;
+    std::string reply;
+    bool serving = true;
+    while (serving && read_packet(packet))
+    {
+        reply.clear();
+        serving = handle(packet, reply);
+        // A kill has no reply
+        if (packet != "k" && !send_packet(reply))
+        {
+            break;
+        }
+        if (packet == "QStartNoAckMode")
+        {
+            acknowledge = false;
+        }
+    }
+
+    if (connection >= 0)
+    {
+        close(connection);
+        connection = -1;
+    }
+    LOG_INFO("GDB disconnected");
+
+    if (detached && !faulted && !cpu.is_halted())
+    {
+        try
+        {
+            run_hart();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR("Error: " + std::string(e.what()));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Answer one packet.
+ *
+ * @param packet The packet data.
+ * @param reply Receives the reply, empty for unsupported packets.
+ * @return true to keep serving, false to end the session.
+ */
+bool GdbServer::handle(const std::string &packet, std::string &reply)
+{
+    if (packet.empty())
+    {
+        return true;
+    }
+
+    size_t comma = packet.find(',');
+    size_t colon = packet.find(':');
+    switch (packet[0])
+    {
+    case '?':
+        reply = stop_reply();
+        return true;
+    case 'g':
+        for (uint32_t i = 0; i <= PC_REGISTER; ++i)
+        {
+            reply += hex_register(read_register(i));
+        }
+        return true;
+    case 'G':
+        for (uint32_t i = 0; i <= PC_REGISTER && 1 + 8 * (i + 1) <= packet.size(); ++i)
+        {
+            write_register(i, parse_register(packet.substr(1 + 8 * i, 8)));
+        }
+        reply = "OK";
+        return true;
+    case 'p':
+    {
+        uint32_t number = parse_hex(packet.substr(1));
+        reply = is_register(number) ? hex_register(read_register(number)) : "E00";
+        return true;
+    }
+    case 'P':
+    {
+        size_t equals = packet.find('=');
+        uint32_t number = parse_hex(packet.substr(1));
+        if (equals == std::string::npos || !is_register(number) || packet.size() < equals + 9)
+        {
+            reply = "E00";
+            return true;
+        }
+        write_register(number, parse_register(packet.substr(equals + 1)));
+        reply = "OK";
+        return true;
+    }
+    case 'm':
+        if (comma == std::string::npos || !read_memory(parse_hex(packet.substr(1)), parse_hex(packet.substr(comma + 1)), reply))
+        {
+            reply = "E01";
+        }
+        return true;
+    case 'M':
+    {
+        if (comma == std::string::npos || colon == std::string::npos)
+        {
+            reply = "E00";
+            return true;
+        }
+        std::vector<uint8_t> bytes;
+        for (size_t i = colon + 1; i + 1 < packet.size(); i += 2)
+        {
+            bytes.push_back(static_cast<uint8_t>(parse_hex(packet.substr(i, 2))));
+        }
+        reply = bytes.size() == parse_hex(packet.substr(comma + 1)) && write_memory(parse_hex(packet.substr(1)), bytes) ? "OK" : "E01";
+        return true;
+    }
+    case 'c':
+    case 's':
+        if (packet.size() > 1)
+        {
+            write_register(PC_REGISTER, parse_hex(packet.substr(1)));
+        }
+        reply = resume(packet[0] == 's');
+        return true;
+    case 'Z':
+    case 'z':
+    {
+        if (packet.size() < 4 || comma == std::string::npos)
+        {
+            reply = "E00";
+            return true;
+        }
+        char type = packet[1];
+        uint32_t address = parse_hex(packet.substr(3));
+        uint32_t length = parse_hex(packet.substr(packet.find(',', 3) + 1));
+        bool insert = packet[0] == 'Z';
+        if (type == '0' || type == '1')
+        {
+            // Compressed instructions make every half word a possible instruction start
+            if (address & 1)
+            {
+                reply = "E01";
+                return true;
+            }
+            if (insert)
+            {
+                insert_breakpoint(address);
+            }
+            else
+            {
+                remove_breakpoint(address);
+            }
+        }
+        else if (type >= '2' && type <= '4' && length > 0)
+        {
+            auto same = [&](const Watchpoint &watchpoint)
+            { return watchpoint.address == address && watchpoint.length == length && watchpoint.type == type; };
+            watchpoints.erase(std::remove_if(watchpoints.begin(), watchpoints.end(), same), watchpoints.end());
+            if (insert)
+            {
+                watchpoints.push_back({address, length, type});
+            }
+            update_watchpoints();
+        }
+        else
+        {
+            return true;
+        }
+        reply = "OK";
+        return true;
+    }
+    case 'k':
+        return false;
+    case 'D':
+        for (uint32_t address : std::set<uint32_t>(breakpoints))
+        {
+            remove_breakpoint(address);
+        }
+        watchpoints.clear();
+        update_watchpoints();
+        detached = true;
+        reply = "OK";
+        return false;
+    case 'H':
+    case 'T':
+        reply = "OK";
+        return true;
+    case 'q':
+        if (packet.rfind("qSupported", 0) == 0)
+        {
+            reply = "PacketSize=4000;qXfer:features:read+;swbreak+;QStartNoAckMode+";
+        }
+        else if (packet == "qAttached")
+        {
+            reply = "1";
+        }
+        else if (packet == "qfThreadInfo")
+        {
+            reply = "m1";
+        }
+        else if (packet == "qsThreadInfo")
+        {
+            reply = "l";
+        }
+        else if (packet == "qC")
+        {
+            reply = "QC1";
+        }
+        else if (packet == "qSymbol::")
+        {
+            reply = "OK";
+        }
+        else if (packet.rfind("qXfer:features:read:target.xml:", 0) == 0)
+        {
+            static const std::string xml = target_description();
+            size_t separator = packet.find(',', colon);
+            size_t offset = parse_hex(packet.substr(packet.rfind(':') + 1));
+            size_t length = separator == std::string::npos ? 0 : parse_hex(packet.substr(separator + 1));
+            reply = offset >= xml.size() ? "l" : (offset + length >= xml.size() ? "l" : "m") + xml.substr(offset, length);
+        }
+        return true;
+    case 'Q':
+        if (packet == "QStartNoAckMode")
+        {
+            reply = "OK";
+        }
+        return true;
+    case 'v':
+        if (packet.rfind("vKill", 0) == 0)
+        {
+            reply = "OK";
+            return false;
+        }
+        // An empty answer to vCont? makes the debugger fall back to c and s
+        return true;
+    default:
+        // X and everything else are unsupported; the debugger falls back to M for writes
+        return true;
+    }
+}
+
+/**
+ * @brief Run the hart until it stops, and describe why.
+ *
+ * @param single_step Retire one instruction instead of continuing.
+ * @return std::string The stop reply.
+ */
+std::string GdbServer::resume(bool single_step)
+{
+    if (faulted || cpu.is_halted())
+    {
+        return stop_reply();
+    }
+
+    watch_type = 0;
+    interrupted = false;
+    at_breakpoint = false;
+    try
+    {
+        // A continue from a breakpoint first steps over it
+        if (single_step || breakpoints.count(cpu.get_pc()))
+        {
+            step_hart();
+        }
+        if (!single_step && !cpu.is_halted() && watch_type == 0)
+        {
+            run_hart();
+            at_breakpoint = !cpu.is_halted() && watch_type == 0 && breakpoints.count(cpu.get_pc()) != 0;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("Error: " + std::string(e.what()));
+        faulted = true;
+    }
+    return stop_reply();
+}
+
+/**
+ * @brief Continue the hart on a thread while watching the connection for an interrupt.
+ */
+void GdbServer::run_hart()
+{
+    if (engine == Engine::BLOCK && blocks_stale)
+    {
+        block_engine.flush();
+        blocks_stale = false;
+    }
+
+    std::atomic<bool> finished{false};
+    std::string error;
+    std::thread runner([this, &finished, &error]()
+                       {
+                           try
+                           {
+                               if (engine == Engine::BLOCK)
+                               {
+                                   block_engine.run();
+                               }
+                               else
+                               {
+                                   cpu.run();
+                               }
+                           }
+                           catch (const std::exception &e)
+                           {
+                               error = e.what();
+                           }
+                           finished.store(true, std::memory_order_release);
+                       });
+
+    // The debugger only sends an interrupt while the hart runs
+    while (connection >= 0 && !finished.load(std::memory_order_acquire))
+    {
+        pollfd descriptor{connection, POLLIN, 0};
+        if (input_position == input.size() && poll(&descriptor, 1, POLL_INTERVAL_MS) <= 0)
+        {
+            continue;
+        }
+        char byte;
+        if (!read_byte(byte))
+        {
+            close(connection);
+            connection = -1;
+            cpu.request_break();
+        }
+        else if (byte == INTERRUPT)
+        {
+            interrupted = true;
+            cpu.request_break();
+        }
+    }
+    runner.join();
+    cpu.resume();
+
+    if (!error.empty())
+    {
+        throw std::runtime_error(error);
+    }
+}
+
+/**
+ * @brief Retire one instruction, lifting a breakpoint at the program counter meanwhile.
+ */
+void GdbServer::step_hart()
+{
+    uint32_t address = cpu.get_pc();
+    bool lifted = breakpoints.count(address) != 0;
+    if (lifted)
+    {
+        cpu.decode_cache.unpatch(address);
+    }
+    cpu.step();
+    if (lifted)
+    {
+        const CachedInstruction &cached = cpu.decode_cache.patch(address, {Opcode::DEBUG_BREAK, {}});
+        if (cpu.profiler)
+        {
+            cpu.profiler->ensure_slot(cached.slot);
+        }
+    }
+    // Stores of the pipelined model do not reach the translated blocks
+    blocks_stale = true;
+}
+
+/**
+ * @brief Describe the state the hart stopped in.
+ *
+ * @return std::string The stop reply.
+ */
+std::string GdbServer::stop_reply() const
+{
+    if (faulted)
+    {
+        return "S04";
+    }
+    if (cpu.get_halt_reason() == HaltReason::TRAP)
+    {
+        // The hart stays at the instruction, as after a fault
+        return cpu.mcause == static_cast<uint32_t>(TrapCause::BREAKPOINT) ? "S05" : "S04";
+    }
+    if (cpu.is_halted())
+    {
+        return "W" + hex_byte(cpu.get_exit_code());
+    }
+    if (watch_type != 0)
+    {
+        const char *kind = watch_type == '2' ? "watch" : (watch_type == '3' ? "rwatch" : "awatch");
+        return "T05" + std::string(kind) + ":" + Memory::to_hex_string(watch_address) + ";";
+    }
+    if (at_breakpoint)
+    {
+        return "T05swbreak:;";
+    }
+    return interrupted ? "S02" : "S05";
+}
+
+/**
+ * @brief Make an address decode to a breakpoint.
+ *
+ * @param address Address of the instruction.
+ */
+void GdbServer::insert_breakpoint(uint32_t address)
+{
+    if (!breakpoints.insert(address).second)
+    {
+        return;
+    }
+    const CachedInstruction &cached = cpu.decode_cache.patch(address, {Opcode::DEBUG_BREAK, {}});
+    if (cpu.profiler)
+    {
+        cpu.profiler->ensure_slot(cached.slot);
+    }
+    block_engine.invalidate(address, 4);
+}
+
+/**
+ * @brief Restore the instruction at a breakpoint.
+ *
+ * @param address Address of the instruction.
+ */
+void GdbServer::remove_breakpoint(uint32_t address)
+{
+    if (breakpoints.erase(address) == 0)
+    {
+        return;
+    }
+    cpu.decode_cache.unpatch(address);
+    block_engine.invalidate(address, 4);
+}
+
+/**
+ * @brief Recompute the watched pages after the watchpoints changed.
+ */
+void GdbServer::update_watchpoints()
+{
+    watched_pages.clear();
+    for (const Watchpoint &watchpoint : watchpoints)
+    {
+        uint32_t last = (watchpoint.address + watchpoint.length - 1) >> Memory::PAGE_SHIFT;
+        for (uint32_t page = watchpoint.address >> Memory::PAGE_SHIFT;; ++page)
+        {
+            watched_pages.insert(page);
+            if (page == last)
+            {
+                break;
+            }
+        }
+    }
+    // One instruction per block lets the block engine stop right after the access
+    cpu.memory.set_watcher(watchpoints.empty() ? nullptr : this);
+    block_engine.set_block_limit(watchpoints.empty() ? BlockEngine::MAX_BLOCK_SIZE : 1);
+}
+
+/**
+ * @brief Check whether accesses to a page are reported.
+ *
+ * @param page_number The guest page number.
+ * @return true if a watchpoint covers part of the page, false otherwise.
+ */
+bool GdbServer::watches_page(uint32_t page_number) const
+{
+    return watched_pages.count(page_number) != 0;
+}
+
+/**
+ * @brief Stop the hart after an access that hits a watchpoint.
+ *
+ * @param address Address of the access.
+ * @param size Size of the access in bytes.
+ * @param write Whether the access stores to memory.
+ */
+void GdbServer::on_access(uint32_t address, uint32_t size, bool write)
+{
+    if (watch_type != 0)
+    {
+        return;
+    }
+    for (const Watchpoint &watchpoint : watchpoints)
+    {
+        bool overlaps = address < watchpoint.address + watchpoint.length && watchpoint.address < address + size;
+        bool matches = watchpoint.type == '4' || (watchpoint.type == '2') == write;
+        if (overlaps && matches)
+        {
+            watch_type = watchpoint.type;
+            watch_address = watchpoint.address;
+            cpu.request_break();
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Read guest memory for the debugger.
+ *
+ * @param address Start address.
+ * @param length Number of bytes.
+ * @param reply Receives the bytes in hex.
+ * @return true if successful, false if the range touches a device.
+ */
+bool GdbServer::read_memory(uint32_t address, uint32_t length, std::string &reply) const
+{
+    if (length == 0 || touches_device(address, length))
+    {
+        return length == 0;
+    }
+    // Pages never touched read as zero without being allocated
+    for (uint32_t i = 0; i < length; ++i)
+    {
+        uint32_t byte_address = address + i;
+        reply += hex_byte(memory.is_page_present(byte_address) ? memory.load_byte(byte_address) : 0);
+    }
+    return true;
+}
+
+/**
+ * @brief Write guest memory for the debugger and drop code decoded from it.
+ *
+ * @param address Start address.
+ * @param bytes The bytes.
+ * @return true if successful, false if the range touches a device.
+ */
+bool GdbServer::write_memory(uint32_t address, const std::vector<uint8_t> &bytes)
+{
+    if (bytes.empty())
+    {
+        return true;
+    }
+    uint32_t size = static_cast<uint32_t>(bytes.size());
+    if (touches_device(address, size))
+    {
+        return false;
+    }
+    memory.store_bytes(address, bytes.data(), bytes.size());
+    // Shared pages may have been copied behind the TLB
+    cpu.memory.flush();
+    cpu.decode_cache.invalidate(address, size);
+    block_engine.invalidate(address, size);
+    return true;
+}
+
+/**
+ * @brief Check whether any device answers in a range.
+ *
+ * @param address Start address.
+ * @param length Number of bytes.
+ * @return true if a device is mapped, false otherwise.
+ */
+bool GdbServer::touches_device(uint32_t address, uint32_t length) const
+{
+    if (memory.get_bus().empty())
+    {
+        return false;
+    }
+    // Devices cover whole pages, so one address per page tells
+    uint32_t last = (address + length - 1) >> Memory::PAGE_SHIFT;
+    for (uint32_t page = address >> Memory::PAGE_SHIFT;; ++page)
+    {
+        uint32_t offset;
+        uint32_t page_address = page << Memory::PAGE_SHIFT;
+        if (!memory.is_page_present(page_address) && memory.get_bus().find(page_address, offset))
+        {
+            return true;
+        }
+        if (page == last)
+        {
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief Get a register in the debugger's numbering.
+ *
+ * @param number x0 to x31, 32 for the program counter, f0 to f31 from 33, or fflags, frm and fcsr from 66.
+ * @return uint32_t The value.
+ */
+uint32_t GdbServer::read_register(uint32_t number) const
+{
+    if (number >= FFLAGS_REGISTER)
+    {
+        uint32_t value = 0;
+        cpu.read_csr(static_cast<uint32_t>(Csr::FFLAGS) + number - FFLAGS_REGISTER, value);
+        return value;
+    }
+    if (number >= FLOAT_REGISTER)
+    {
+        return cpu.float_registers[number - FLOAT_REGISTER];
+    }
+    return number == PC_REGISTER ? cpu.get_pc() : cpu.get_register(number);
+}
+
+/**
+ * @brief Set a register in the debugger's numbering.
+ *
+ * @param number x0 to x31, 32 for the program counter, f0 to f31 from 33, or fflags, frm and fcsr from 66.
+ * @param value The value.
+ */
+void GdbServer::write_register(uint32_t number, uint32_t value)
+{
+    if (number >= FFLAGS_REGISTER)
+    {
+        cpu.write_csr(static_cast<uint32_t>(Csr::FFLAGS) + number - FFLAGS_REGISTER, value);
+    }
+    else if (number >= FLOAT_REGISTER)
+    {
+        cpu.float_registers[number - FLOAT_REGISTER] = value;
+    }
+    else if (number == PC_REGISTER)
+    {
+        cpu.set_pc(value);
+    }
+    else
+    {
+        cpu.set_register(number, value);
+    }
+}
+
+/**
+ * @brief Read the next packet, acknowledging it unless acknowledgements are off.
+ *
+ * @param packet Receives the packet data.
+ * @return true if a packet was read, false if the connection dropped.
+ */
+bool GdbServer::read_packet(std::string &packet)
+{
+    while (true)
+    {
+        // Acknowledgements and interrupts between packets are skipped
+        char byte;
+        do
+        {
+            if (!read_byte(byte))
+            {
+                return false;
+            }
+        } while (byte != '$');
+
+        packet.clear();
+        while (read_byte(byte) && byte != '#')
+        {
+            packet += byte;
+        }
+        char digits[2];
+        if (byte != '#' || !read_byte(digits[0]) || !read_byte(digits[1]))
+        {
+            return false;
+        }
+        if (!acknowledge)
+        {
+            return true;
+        }
+        bool intact = parse_hex(std::string(digits, 2)) == checksum(packet);
+        if (!write_bytes(intact ? "+" : "-"))
+        {
+            return false;
+        }
+        if (intact)
+        {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Send a packet, resending it until it is acknowledged.
+ *
+ * @param data The packet data.
+ * @return true if successful, false if the connection dropped.
+ */
+bool GdbServer::send_packet(const std::string &data)
+{
+    std::string frame = "$" + data + "#" + hex_byte(checksum(data));
+    while (true)
+    {
+        if (!write_bytes(frame))
+        {
+            return false;
+        }
+        if (!acknowledge)
+        {
+            return true;
+        }
+        char byte;
+        do
+        {
+            if (!read_byte(byte))
+            {
+                return false;
+            }
+        } while (byte != '+' && byte != '-');
+        if (byte == '+')
+        {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Send bytes to the debugger.
+ *
+ * @param data The bytes.
+ * @return true if successful, false if the connection dropped.
+ */
+bool GdbServer::write_bytes(const std::string &data)
+{
+    if (connection < 0)
+    {
+        return false;
+    }
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t written = send(connection, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+/**
+ * @brief Read one byte from the debugger.
+ *
+ * @param byte Receives the byte.
+ * @return true if successful, false if the connection dropped.
+ */
+bool GdbServer::read_byte(char &byte)
+{
+    if (input_position == input.size())
+    {
+        char buffer[4096];
+        ssize_t received = connection < 0 ? 0 : recv(connection, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        input.assign(buffer, static_cast<size_t>(received));
+        input_position = 0;
+    }
+    byte = input[input_position++];
+    return true;
+}
@@ -0,0 +1,232 @@
+#ifndef GDB_SERVER_H
+#define GDB_SERVER_H
+
+#include "block_engine.h"
+#include "machine.h"
+#include "memory.h"
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief Stub serving the GDB remote serial protocol for a single hart.
+ *
+ * Listens on a loopback TCP port and lets one debugger read and write
+ * registers and memory, set breakpoints and watchpoints, continue, step and
+ * interrupt the hart. Breakpoints are patched into the decode cache rather
+ * than into guest memory, so memory reads by the debugger and the program
+ * see the original code. Watchpoints keep their pages out of the hart's TLB,
+ * so only accesses to those pages take the slow path. Single steps use the
+ * pipelined model whichever engine continues.
+ */
+class GdbServer : private AccessWatcher
+{
+public:
+    /**
+     * @brief Construct a new GdbServer object.
+     *
+     * @param cpu The hart to debug, ready to run.
+     * @param engine The engine used to continue the hart.
+     */
+    GdbServer(CPU &cpu, Engine engine);
+
+    /**
+     * @brief Close the sockets if still open.
+     */
+    ~GdbServer() override;
+
+    GdbServer(const GdbServer &) = delete;
+    GdbServer &operator=(const GdbServer &) = delete;
+
+    /**
+     * @brief Wait for a debugger and serve its session.
+     *
+     * Returns once the debugger kills or detaches from the hart, or the
+     * connection drops; a detached hart runs to completion first.
+     *
+     * @param port TCP port to listen on at 127.0.0.1.
+     * @return true if a session was served, false if the port could not be opened.
+     */
+    bool serve(uint16_t port);
+
+private:
+    /**
+     * @brief A watched address range.
+     */
+    struct Watchpoint
+    {
+        uint32_t address; ///< Start address.
+        uint32_t length;  ///< Size in bytes.
+        char type;        ///< '2' for write, '3' for read and '4' for access watchpoints.
+    };
+
+    /**
+     * @brief Check whether accesses to a page are reported.
+     *
+     * @param page_number The guest page number.
+     * @return true if a watchpoint covers part of the page, false otherwise.
+     */
+    bool watches_page(uint32_t page_number) const override;
+
+    /**
+     * @brief Stop the hart after an access that hits a watchpoint.
+     *
+     * @param address Address of the access.
+     * @param size Size of the access in bytes.
+     * @param write Whether the access stores to memory.
+     */
+    void on_access(uint32_t address, uint32_t size, bool write) override;
+
+    /**
+     * @brief Read the next packet, acknowledging it unless acknowledgements are off.
+     *
+     * @param packet Receives the packet data.
+     * @return true if a packet was read, false if the connection dropped.
+     */
+    bool read_packet(std::string &packet);
+
+    /**
+     * @brief Send a packet, resending it until it is acknowledged.
+     *
+     * @param data The packet data.
+     * @return true if successful, false if the connection dropped.
+     */
+    bool send_packet(const std::string &data);
+
+    /**
+     * @brief Send bytes to the debugger.
+     *
+     * @param data The bytes.
+     * @return true if successful, false if the connection dropped.
+     */
+    bool write_bytes(const std::string &data);
+
+    /**
+     * @brief Read one byte from the debugger.
+     *
+     * @param byte Receives the byte.
+     * @return true if successful, false if the connection dropped.
+     */
+    bool read_byte(char &byte);
+
+    /**
+     * @brief Answer one packet.
+     *
+     * @param packet The packet data.
+     * @param reply Receives the reply, empty for unsupported packets.
+     * @return true to keep serving, false to end the session.
+     */
+    bool handle(const std::string &packet, std::string &reply);
+
+    /**
+     * @brief Run the hart until it stops, and describe why.
+     *
+     * @param single_step Retire one instruction instead of continuing.
+     * @return std::string The stop reply.
+     */
+    std::string resume(bool single_step);
+
+    /**
+     * @brief Continue the hart on a thread while watching the connection for an interrupt.
+     */
+    void run_hart();
+
+    /**
+     * @brief Retire one instruction, lifting a breakpoint at the program counter meanwhile.
+     */
+    void step_hart();
+
+    /**
+     * @brief Describe the state the hart stopped in.
+     *
+     * @return std::string The stop reply.
+     */
+    std::string stop_reply() const;
+
+    /**
+     * @brief Make an address decode to a breakpoint.
+     *
+     * @param address Address of the instruction.
+     */
+    void insert_breakpoint(uint32_t address);
+
+    /**
+     * @brief Restore the instruction at a breakpoint.
+     *
+     * @param address Address of the instruction.
+     */
+    void remove_breakpoint(uint32_t address);
+
+    /**
+     * @brief Recompute the watched pages after the watchpoints changed.
+     */
+    void update_watchpoints();
+
+    /**
+     * @brief Read guest memory for the debugger.
+     *
+     * @param address Start address.
+     * @param length Number of bytes.
+     * @param reply Receives the bytes in hex.
+     * @return true if successful, false if the range touches a device.
+     */
+    bool read_memory(uint32_t address, uint32_t length, std::string &reply) const;
+
+    /**
+     * @brief Write guest memory for the debugger and drop code decoded from it.
+     *
+     * @param address Start address.
+     * @param bytes The bytes.
+     * @return true if successful, false if the range touches a device.
+     */
+    bool write_memory(uint32_t address, const std::vector<uint8_t> &bytes);
+
+    /**
+     * @brief Check whether any device answers in a range.
+     *
+     * @param address Start address.
+     * @param length Number of bytes.
+     * @return true if a device is mapped, false otherwise.
+     */
+    bool touches_device(uint32_t address, uint32_t length) const;
+
+    /**
+     * @brief Get a register in the debugger's numbering.
+     *
+     * @param number x0 to x31, 32 for the program counter, f0 to f31 from 33, or fflags, frm and fcsr from 66.
+     * @return uint32_t The value.
+     */
+    uint32_t read_register(uint32_t number) const;
+
+    /**
+     * @brief Set a register in the debugger's numbering.
+     *
+     * @param number x0 to x31, 32 for the program counter, f0 to f31 from 33, or fflags, frm and fcsr from 66.
+     * @param value The value.
+     */
+    void write_register(uint32_t number, uint32_t value);
+
+    CPU &cpu;                                 ///< The hart.
+    Memory &memory;                           ///< Memory of the hart.
+    Engine engine;                            ///< Engine used to continue.
+    BlockEngine block_engine;                 ///< Translated blocks, kept across continues.
+    bool blocks_stale = false;                ///< A step may have changed code behind the blocks.
+    int listener = -1;                        ///< Listening socket.
+    int connection = -1;                      ///< Connection to the debugger.
+    bool acknowledge = true;                  ///< Packets are acknowledged with '+'.
+    std::string input;                        ///< Bytes received but not consumed yet.
+    size_t input_position = 0;                ///< Next byte of the input.
+    std::set<uint32_t> breakpoints;           ///< Breakpoint addresses.
+    std::vector<Watchpoint> watchpoints;      ///< Watched ranges.
+    std::unordered_set<uint32_t> watched_pages; ///< Pages covered by a watchpoint.
+    char watch_type = 0;                      ///< Type of the watchpoint that stopped the hart, 0 if none.
+    uint32_t watch_address = 0;               ///< Address of that watchpoint.
+    bool interrupted = false;                 ///< The debugger interrupted the last continue.
+    bool at_breakpoint = false;               ///< The last continue stopped at a breakpoint.
+    bool faulted = false;                     ///< The hart raised an error and cannot go on.
+    bool detached = false;                    ///< The debugger detached; the hart runs to completion.
+};
+
+#endif
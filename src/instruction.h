@@ -0,0 +1,108 @@
+#ifndef INSTRUCTION_H
+#define INSTRUCTION_H
+
+#include "isa_table.h"
+#include <cstdint>
+
+/**
+ * @brief Every supported instruction, generated from the ISA table.
+ */
+enum class Operation : uint8_t
+{
+    NONE, ///< Not decoded, also used for the debugger breakpoint.
+#define PHLEGO_OPERATION(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) NAME,
+    PHLEGO_ISA(PHLEGO_OPERATION)
+#undef PHLEGO_OPERATION
+    COUNT ///< Number of operations.
+};
+
+/**
+ * @brief Enum for opcodes.
+ */
+enum class Opcode : uint8_t
+{
+    R_TYPE = 0x33,
+    I_TYPE_LOAD = 0x03,
+    I_TYPE_ALU = 0x13,
+    JALR = 0x67,
+    S_TYPE = 0x23,
+    B_TYPE = 0x63,
+    J_TYPE = 0x6F,
+    SYSTEM = 0x73,
+    MISC_MEM = 0x0F,
+    AMO = 0x2F,
+    LUI = 0x37,
+    AUIPC = 0x17,
+    LOAD_FP = 0x07,
+    STORE_FP = 0x27,
+    OP_FP = 0x53,
+    FMADD = 0x43,
+    FMSUB = 0x47,
+    FNMSUB = 0x4B,
+    FNMADD = 0x4F,
+    DEBUG_BREAK = 0x00 ///< Never decoded; patched into the decode cache at a debugger breakpoint.
+};
+
+/**
+ * @brief Numbers of the supported CSRs.
+ */
+enum class Csr : uint16_t
+{
+    FFLAGS = 0x001,   ///< Floating-point exception flags.
+    FRM = 0x002,      ///< Floating-point dynamic rounding mode.
+    FCSR = 0x003,     ///< frm and fflags together.
+    MSTATUS = 0x300,  ///< Machine status: the global interrupt enable and its copy from before the trap.
+    MISA = 0x301,     ///< Machine ISA, read-only here.
+    MIE = 0x304,      ///< Machine interrupt enables.
+    MTVEC = 0x305,    ///< Machine trap handler address and mode.
+    MSCRATCH = 0x340, ///< Scratch register for the trap handler.
+    MEPC = 0x341,     ///< Address of the instruction the trap interrupted.
+    MCAUSE = 0x342,   ///< Cause of the last trap.
+    MTVAL = 0x343,    ///< Faulting address or instruction of the last trap.
+    MIP = 0x344,      ///< Machine interrupts pending, read-only here.
+    MHARTID = 0xF14   ///< Hart number.
+};
+
+/**
+ * @brief mcause values of the traps the CPU takes.
+ *
+ * Interrupts have the top bit set.
+ */
+enum class TrapCause : uint32_t
+{
+    ILLEGAL_INSTRUCTION = 2,                ///< Undecodable instruction or unsupported CSR access.
+    BREAKPOINT = 3,                         ///< EBREAK.
+    LOAD_MISALIGNED = 4,                    ///< LR to an address that is not word aligned.
+    LOAD_ACCESS_FAULT = 5,                  ///< LR to a device.
+    STORE_MISALIGNED = 6,                   ///< SC or AMO to an address that is not word aligned.
+    STORE_ACCESS_FAULT = 7,                 ///< SC or AMO to a device.
+    MACHINE_ECALL = 11,                     ///< ECALL while a trap handler is installed.
+    MACHINE_SOFTWARE_INTERRUPT = 0x80000003, ///< msip set in the CLINT.
+    MACHINE_TIMER_INTERRUPT = 0x80000007    ///< mtime reached mtimecmp.
+};
+
+/**
+ * @brief Compact decoded instruction record.
+ *
+ * One fixed-size record holds every encoding, so pipeline latches and
+ * translated blocks copy 12 bytes with no variant to dispatch on. The opcode
+ * tag tells loads, ALU operations and JALR apart without looking at the raw
+ * word, and the operation means no stage has to tell instructions sharing a
+ * funct3 apart again. Fields an encoding does not have are zero.
+ */
+struct DecodedInstruction
+{
+    Opcode opcode;                         ///< Opcode tag
+    Operation operation = Operation::NONE; ///< The instruction
+    uint8_t length = 4;                    ///< Size of the encoding in bytes, 2 for a compressed instruction
+    uint8_t funct3 = 0;                    ///< Function 3 field, the rounding mode of floating-point instructions
+    uint8_t rd = 0;                        ///< Destination register
+    uint8_t rs1 = 0;                       ///< Source register 1
+    uint8_t rs2 = 0;                       ///< Source register 2
+    uint8_t rs3 = 0;                       ///< Source register 3, only used by the fused multiply-add instructions
+    int32_t imm = 0;                       ///< Sign-extended immediate, U-type already shifted into the upper 20 bits
+};
+
+static_assert(sizeof(DecodedInstruction) == 12, "Decoded instructions are packed into 12 bytes");
+
+#endif
@@ -0,0 +1,560 @@
+#include "isa.h"
+#include "logger.h"
+#include "memory.h"
+#include <array>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+    /**
+     * @brief Encoding and name of one instruction.
+     */
+    struct IsaEntry
+    {
+        Operation operation; ///< The instruction.
+        const char *name;    ///< Mnemonic.
+        IsaFormat format;    ///< Encoding.
+        uint32_t match;      ///< Value of the bits selected by the format.
+    };
+
+    // Indexed by Operation
+    const IsaEntry ENTRIES[] = {
+        {Operation::NONE, "unknown", IsaFormat::EXACT, 0},
+#define PHLEGO_ISA_ENTRY(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) {Operation::NAME, MNEMONIC, IsaFormat::FORMAT, MATCH},
+        PHLEGO_ISA(PHLEGO_ISA_ENTRY)
+#undef PHLEGO_ISA_ENTRY
+    };
+    static_assert(sizeof(ENTRIES) / sizeof(ENTRIES[0]) == static_cast<size_t>(Operation::COUNT),
+                  "Every operation needs an ISA table entry");
+
+    const char *const REGISTER_NAMES[32] = {"zero", "ra", "sp", "gp", "tp",  "t0",  "t1", "t2", "s0", "s1", "a0",
+                                            "a1",   "a2", "a3", "a4", "a5",  "a6",  "a7", "s2", "s3", "s4", "s5",
+                                            "s6",   "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+    const char *const FLOAT_REGISTER_NAMES[32] = {"ft0", "ft1", "ft2",  "ft3",  "ft4", "ft5", "ft6",  "ft7",
+                                                  "fs0", "fs1", "fa0",  "fa1",  "fa2", "fa3", "fa4",  "fa5",
+                                                  "fa6", "fa7", "fs2",  "fs3",  "fs4", "fs5", "fs6",  "fs7",
+                                                  "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11"};
+
+    /**
+     * @brief Get the decoder dispatch index of an instruction word.
+     *
+     * @param instruction The raw instruction word.
+     * @return uint32_t The opcode and funct3 bits.
+     */
+    uint32_t dispatch_key(uint32_t instruction)
+    {
+        return (instruction & 0x7F) | ((instruction >> 5) & 0x380);
+    }
+
+    /**
+     * @brief Build the decoder dispatch table from the ISA table.
+     *
+     * Entries are grouped by opcode and funct3, so decoding a word compares it
+     * with the few entries sharing both; formats without a funct3 are listed
+     * under every value of it.
+     *
+     * @return std::array<std::vector<Operation>, 1024> The entries by dispatch key.
+     */
+    std::array<std::vector<Operation>, 1024> build_dispatch()
+    {
+        std::array<std::vector<Operation>, 1024> dispatch;
+        for (const IsaEntry &entry : ENTRIES)
+        {
+            if (entry.operation == Operation::NONE)
+            {
+                continue;
+            }
+            bool any_funct3 = (Isa::format_mask(entry.format) & 0x7000) == 0;
+            for (uint32_t funct3 = 0; funct3 < 8; ++funct3)
+            {
+                if (any_funct3 || funct3 == ((entry.match >> 12) & 0x7))
+                {
+                    dispatch[dispatch_key((entry.match & ~0x7000u) | (funct3 << 12))].push_back(entry.operation);
+                }
+            }
+        }
+        return dispatch;
+    }
+
+    /**
+     * @brief Move a field of a compressed instruction to its place in an immediate.
+     *
+     * @param instruction The compressed instruction.
+     * @param low Lowest bit of the field.
+     * @param count Width of the field in bits.
+     * @param to Bit of the immediate the field starts at.
+     * @return uint32_t The field at its place.
+     */
+    constexpr uint32_t field(uint32_t instruction, uint32_t low, uint32_t count, uint32_t to)
+    {
+        return ((instruction >> low) & ((1u << count) - 1)) << to;
+    }
+
+    /**
+     * @brief Sign-extend an immediate.
+     *
+     * @param value The immediate.
+     * @param bits Width of the immediate in bits.
+     * @return uint32_t The sign-extended immediate.
+     */
+    constexpr uint32_t sign_extend(uint32_t value, uint32_t bits)
+    {
+        return static_cast<uint32_t>(static_cast<int32_t>(value << (32 - bits)) >> (32 - bits));
+    }
+
+    // Encoders for the full-size instruction a compressed one expands to
+    constexpr uint32_t encode_r(Opcode opcode, uint32_t funct3, uint32_t funct7, uint32_t rd, uint32_t rs1, uint32_t rs2)
+    {
+        return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | static_cast<uint32_t>(opcode);
+    }
+
+    constexpr uint32_t encode_i(Opcode opcode, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t imm)
+    {
+        return (imm & 0xFFF) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | static_cast<uint32_t>(opcode);
+    }
+
+    constexpr uint32_t encode_s(Opcode opcode, uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t imm)
+    {
+        return ((imm >> 5) & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (imm & 0x1F) << 7 |
+               static_cast<uint32_t>(opcode);
+    }
+
+    constexpr uint32_t encode_b(uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t imm)
+    {
+        return ((imm >> 12) & 0x1) << 31 | ((imm >> 5) & 0x3F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+               ((imm >> 1) & 0xF) << 8 | ((imm >> 11) & 0x1) << 7 | static_cast<uint32_t>(Opcode::B_TYPE);
+    }
+
+    constexpr uint32_t encode_j(uint32_t rd, uint32_t imm)
+    {
+        return ((imm >> 20) & 0x1) << 31 | ((imm >> 1) & 0x3FF) << 21 | ((imm >> 11) & 0x1) << 20 |
+               ((imm >> 12) & 0xFF) << 12 | rd << 7 | static_cast<uint32_t>(Opcode::J_TYPE);
+    }
+
+    /**
+     * @brief Format a branch or jump target.
+     *
+     * @param pc Address of the instruction.
+     * @param offset The immediate.
+     * @return std::string The target address in hex.
+     */
+    std::string target(uint32_t pc, int32_t offset)
+    {
+        return "0x" + Memory::to_hex_string(pc + static_cast<uint32_t>(offset));
+    }
+
+    /**
+     * @brief Get the name of rd in the register file the instruction writes.
+     *
+     * @param operation The operation.
+     * @param index The register number.
+     * @return const char* The name.
+     */
+    const char *destination_name(Operation operation, uint32_t index)
+    {
+        return Isa::float_destination(operation) ? Isa::float_register_name(index) : Isa::register_name(index);
+    }
+
+    /**
+     * @brief Get the name of a source register in the register file the instruction reads.
+     *
+     * @param operation The operation.
+     * @param index The register number.
+     * @return const char* The name.
+     */
+    const char *source_name(Operation operation, uint32_t index)
+    {
+        return Isa::float_source(operation) ? Isa::float_register_name(index) : Isa::register_name(index);
+    }
+
+    /**
+     * @brief Format the rounding mode of a floating-point instruction, which assemblers leave out when dynamic.
+     *
+     * @param funct3 The rounding mode field.
+     * @return std::string The operand, with its leading separator.
+     */
+    std::string rounding_mode(uint32_t funct3)
+    {
+        static const char *const NAMES[8] = {"rne", "rtz", "rdn", "rup", "rmm", "0x5", "0x6", "dyn"};
+        uint32_t rm = funct3 & 0x7;
+        return rm == 7 ? "" : std::string(", ") + NAMES[rm];
+    }
+}
+
+/**
+ * @brief Expand a compressed instruction into the full-size instruction it stands for.
+ *
+ * Covers RV32C and the single-precision loads and stores of RV32FC. The
+ * expansion is decoded like any other word, so compressed code shares the
+ * decoded form, the handlers and the decode cache with full-size code.
+ *
+ * @param instruction The compressed instruction in the low half word.
+ * @return uint32_t The equivalent instruction word, or 0 if it is reserved or unsupported.
+ */
+uint32_t Isa::expand_compressed(uint32_t instruction)
+{
+    uint32_t funct3 = (instruction >> 13) & 0x7;
+    uint32_t rd = (instruction >> 7) & 0x1F; // Also rs1 of CI and CR
+    uint32_t rs2 = (instruction >> 2) & 0x1F;
+    uint32_t rd_prime = 8 + ((instruction >> 2) & 0x7); // rd' of CIW and CL, rs2' of CS and CA
+    uint32_t rs1_prime = 8 + ((instruction >> 7) & 0x7);
+    uint32_t imm6 = sign_extend(field(instruction, 2, 5, 0) | field(instruction, 12, 1, 5), 6);
+
+    switch ((instruction & 0x3) << 3 | funct3)
+    {
+    // Quadrant 0
+    case 0x00: // C.ADDI4SPN
+    {
+        uint32_t imm = field(instruction, 6, 1, 2) | field(instruction, 5, 1, 3) | field(instruction, 11, 2, 4) |
+                       field(instruction, 7, 4, 6);
+        return imm ? encode_i(Opcode::I_TYPE_ALU, 0, rd_prime, 2, imm) : 0;
+    }
+    case 0x02: // C.LW
+    {
+        uint32_t imm = field(instruction, 6, 1, 2) | field(instruction, 10, 3, 3) | field(instruction, 5, 1, 6);
+        return encode_i(Opcode::I_TYPE_LOAD, 2, rd_prime, rs1_prime, imm);
+    }
+    case 0x03: // C.FLW
+    {
+        uint32_t imm = field(instruction, 6, 1, 2) | field(instruction, 10, 3, 3) | field(instruction, 5, 1, 6);
+        return encode_i(Opcode::LOAD_FP, 2, rd_prime, rs1_prime, imm);
+    }
+    case 0x06: // C.SW
+    {
+        uint32_t imm = field(instruction, 6, 1, 2) | field(instruction, 10, 3, 3) | field(instruction, 5, 1, 6);
+        return encode_s(Opcode::S_TYPE, 2, rs1_prime, rd_prime, imm);
+    }
+    case 0x07: // C.FSW
+    {
+        uint32_t imm = field(instruction, 6, 1, 2) | field(instruction, 10, 3, 3) | field(instruction, 5, 1, 6);
+        return encode_s(Opcode::STORE_FP, 2, rs1_prime, rd_prime, imm);
+    }
+
+    // Quadrant 1
+    case 0x08: // C.ADDI, C.NOP
+        return encode_i(Opcode::I_TYPE_ALU, 0, rd, rd, imm6);
+    case 0x09: // C.JAL
+    case 0x0D: // C.J
+    {
+        uint32_t imm = field(instruction, 3, 3, 1) | field(instruction, 11, 1, 4) | field(instruction, 2, 1, 5) |
+                       field(instruction, 7, 1, 6) | field(instruction, 6, 1, 7) | field(instruction, 9, 2, 8) |
+                       field(instruction, 8, 1, 10) | field(instruction, 12, 1, 11);
+        return encode_j(funct3 == 1 ? 1 : 0, sign_extend(imm, 12));
+    }
+    case 0x0A: // C.LI
+        return encode_i(Opcode::I_TYPE_ALU, 0, rd, 0, imm6);
+    case 0x0B: // C.ADDI16SP, C.LUI
+        if (rd == 2)
+        {
+            uint32_t imm = field(instruction, 6, 1, 4) | field(instruction, 2, 1, 5) | field(instruction, 5, 1, 6) |
+                           field(instruction, 3, 2, 7) | field(instruction, 12, 1, 9);
+            return imm ? encode_i(Opcode::I_TYPE_ALU, 0, 2, 2, sign_extend(imm, 10)) : 0;
+        }
+        return imm6 ? (imm6 << 12) | rd << 7 | static_cast<uint32_t>(Opcode::LUI) : 0;
+    case 0x0C: // C.SRLI, C.SRAI, C.ANDI and the register-register operations
+        switch ((instruction >> 10) & 0x3)
+        {
+        case 0:
+            return instruction & 0x1000 ? 0 : encode_i(Opcode::I_TYPE_ALU, 5, rs1_prime, rs1_prime, rs2);
+        case 1:
+            return instruction & 0x1000 ? 0 : encode_i(Opcode::I_TYPE_ALU, 5, rs1_prime, rs1_prime, 0x400 | rs2);
+        case 2:
+            return encode_i(Opcode::I_TYPE_ALU, 7, rs1_prime, rs1_prime, imm6);
+        default:
+        {
+            // C.SUB, C.XOR, C.OR and C.AND; the forms with bit 12 set are RV64 only
+            static const uint32_t FUNCT3[4] = {0, 4, 6, 7};
+            uint32_t select = (instruction >> 5) & 0x3;
+            if (instruction & 0x1000)
+            {
+                return 0;
+            }
+            return encode_r(Opcode::R_TYPE, FUNCT3[select], select == 0 ? 0x20 : 0, rs1_prime, rs1_prime, rd_prime);
+        }
+        }
+    case 0x0E: // C.BEQZ
+    case 0x0F: // C.BNEZ
+    {
+        uint32_t imm = field(instruction, 3, 2, 1) | field(instruction, 10, 2, 3) | field(instruction, 2, 1, 5) |
+                       field(instruction, 5, 2, 6) | field(instruction, 12, 1, 8);
+        return encode_b(funct3 & 1, rs1_prime, 0, sign_extend(imm, 9));
+    }
+
+    // Quadrant 2
+    case 0x10: // C.SLLI
+        return instruction & 0x1000 ? 0 : encode_i(Opcode::I_TYPE_ALU, 1, rd, rd, rs2);
+    case 0x12: // C.LWSP
+    {
+        uint32_t imm = field(instruction, 4, 3, 2) | field(instruction, 12, 1, 5) | field(instruction, 2, 2, 6);
+        return rd ? encode_i(Opcode::I_TYPE_LOAD, 2, rd, 2, imm) : 0;
+    }
+    case 0x13: // C.FLWSP, where f0 is a valid destination
+    {
+        uint32_t imm = field(instruction, 4, 3, 2) | field(instruction, 12, 1, 5) | field(instruction, 2, 2, 6);
+        return encode_i(Opcode::LOAD_FP, 2, rd, 2, imm);
+    }
+    case 0x14: // C.JR, C.MV, C.EBREAK, C.JALR, C.ADD
+        if (!(instruction & 0x1000))
+        {
+            if (rs2)
+            {
+                return encode_r(Opcode::R_TYPE, 0, 0, rd, 0, rs2); // C.MV
+            }
+            return rd ? encode_i(Opcode::JALR, 0, 0, rd, 0) : 0; // C.JR
+        }
+        if (rs2)
+        {
+            return encode_r(Opcode::R_TYPE, 0, 0, rd, rd, rs2); // C.ADD
+        }
+        return rd ? encode_i(Opcode::JALR, 0, 1, rd, 0) : 0x00100073; // C.JALR, C.EBREAK
+    case 0x16: // C.SWSP
+    {
+        uint32_t imm = field(instruction, 9, 4, 2) | field(instruction, 7, 2, 6);
+        return encode_s(Opcode::S_TYPE, 2, 2, rs2, imm);
+    }
+    case 0x17: // C.FSWSP
+    {
+        uint32_t imm = field(instruction, 9, 4, 2) | field(instruction, 7, 2, 6);
+        return encode_s(Opcode::STORE_FP, 2, 2, rs2, imm);
+    }
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Find the operation encoded by an instruction word.
+ *
+ * @param instruction The raw instruction word.
+ * @return Operation The operation, or Operation::NONE if no entry matches.
+ */
+Operation Isa::match(uint32_t instruction)
+{
+    static const std::array<std::vector<Operation>, 1024> dispatch = build_dispatch();
+    for (Operation operation : dispatch[dispatch_key(instruction)])
+    {
+        const IsaEntry &entry = ENTRIES[static_cast<size_t>(operation)];
+        if ((instruction & format_mask(entry.format)) == entry.match)
+        {
+            return operation;
+        }
+    }
+    return Operation::NONE;
+}
+
+/**
+ * @brief Get the encoding of an operation.
+ *
+ * @param operation The operation.
+ * @return IsaFormat The encoding.
+ */
+IsaFormat Isa::format(Operation operation)
+{
+    return ENTRIES[static_cast<size_t>(operation)].format;
+}
+
+/**
+ * @brief Get the fixed bits of the encoding of an operation.
+ *
+ * @param operation The operation.
+ * @return uint32_t The match value of the table entry, 0 for Operation::NONE.
+ */
+uint32_t Isa::encoding(Operation operation)
+{
+    return ENTRIES[static_cast<size_t>(operation)].match;
+}
+
+/**
+ * @brief Get the assembler name of an operation.
+ *
+ * @param operation The operation.
+ * @return const char* The mnemonic, "unknown" for Operation::NONE.
+ */
+const char *Isa::mnemonic(Operation operation)
+{
+    return ENTRIES[static_cast<size_t>(operation)].name;
+}
+
+/**
+ * @brief Get the ABI name of an integer register.
+ *
+ * @param index The register number.
+ * @return const char* The name.
+ */
+const char *Isa::register_name(uint32_t index)
+{
+    return REGISTER_NAMES[index & 0x1F];
+}
+
+/**
+ * @brief Get the ABI name of a floating-point register.
+ *
+ * @param index The register number.
+ * @return const char* The name.
+ */
+const char *Isa::float_register_name(uint32_t index)
+{
+    return FLOAT_REGISTER_NAMES[index & 0x1F];
+}
+
+/**
+ * @brief Get the name of a CSR.
+ *
+ * @param number The CSR number.
+ * @return std::string The name, or the number in hex if the CSR has none here.
+ */
+std::string Isa::csr_name(uint32_t number)
+{
+    switch (static_cast<Csr>(number))
+    {
+    case Csr::FFLAGS:
+        return "fflags";
+    case Csr::FRM:
+        return "frm";
+    case Csr::FCSR:
+        return "fcsr";
+    case Csr::MSTATUS:
+        return "mstatus";
+    case Csr::MISA:
+        return "misa";
+    case Csr::MIE:
+        return "mie";
+    case Csr::MTVEC:
+        return "mtvec";
+    case Csr::MSCRATCH:
+        return "mscratch";
+    case Csr::MEPC:
+        return "mepc";
+    case Csr::MCAUSE:
+        return "mcause";
+    case Csr::MTVAL:
+        return "mtval";
+    case Csr::MIP:
+        return "mip";
+    case Csr::MHARTID:
+        return "mhartid";
+    default:
+    {
+        char text[16];
+        std::snprintf(text, sizeof(text), "0x%x", number);
+        return text;
+    }
+    }
+}
+
+/**
+ * @brief Format a decoded instruction as assembly.
+ *
+ * @param decoded The decoded instruction.
+ * @param pc Address of the instruction, used for branch and jump targets.
+ * @return std::string The instruction, with ABI register names.
+ */
+std::string Isa::disassemble(const DecodedInstruction &decoded, uint32_t pc)
+{
+    std::string text = mnemonic(decoded.operation);
+    if (decoded.operation == Operation::NONE)
+    {
+        return text;
+    }
+    text += ' ';
+
+    switch (format(decoded.operation))
+    {
+    case IsaFormat::R:
+    case IsaFormat::R_RM:
+    case IsaFormat::R4:
+    {
+        text += std::string(destination_name(decoded.operation, decoded.rd)) + ", " +
+                source_name(decoded.operation, decoded.rs1) + ", " + source_name(decoded.operation, decoded.rs2);
+        if (format(decoded.operation) == IsaFormat::R4)
+        {
+            text += std::string(", ") + source_name(decoded.operation, decoded.rs3);
+        }
+        if (format(decoded.operation) != IsaFormat::R)
+        {
+            text += rounding_mode(decoded.funct3);
+        }
+        break;
+    }
+    case IsaFormat::UNARY:
+    case IsaFormat::UNARY_RM:
+    {
+        text += std::string(destination_name(decoded.operation, decoded.rd)) + ", " +
+                source_name(decoded.operation, decoded.rs1);
+        if (format(decoded.operation) == IsaFormat::UNARY_RM)
+        {
+            text += rounding_mode(decoded.funct3);
+        }
+        break;
+    }
+    case IsaFormat::AMO:
+    case IsaFormat::LR:
+    {
+        text += std::string(register_name(decoded.rd)) + ", ";
+        if (decoded.operation != Operation::LR_W)
+        {
+            text += std::string(register_name(decoded.rs2)) + ", ";
+        }
+        text += "(" + std::string(register_name(decoded.rs1)) + ")";
+        break;
+    }
+    case IsaFormat::I:
+    case IsaFormat::SHIFT:
+    {
+        if (decoded.opcode == Opcode::MISC_MEM)
+        {
+            text.pop_back();
+        }
+        else if (decoded.opcode == Opcode::I_TYPE_LOAD || decoded.opcode == Opcode::LOAD_FP ||
+                 decoded.opcode == Opcode::JALR)
+        {
+            text += std::string(destination_name(decoded.operation, decoded.rd)) + ", " + std::to_string(decoded.imm) +
+                    "(" + register_name(decoded.rs1) + ")";
+        }
+        else if (decoded.opcode == Opcode::SYSTEM)
+        {
+            // The immediate forms take a 5-bit immediate in place of rs1
+            std::string source = (decoded.funct3 & 0x4) ? std::to_string(decoded.rs1)
+                                                                            : register_name(decoded.rs1);
+            text += std::string(register_name(decoded.rd)) + ", " + csr_name(decoded.imm & 0xFFF) + ", " + source;
+        }
+        else
+        {
+            int32_t imm = format(decoded.operation) == IsaFormat::SHIFT ? decoded.imm & 0x1F : decoded.imm;
+            text += std::string(register_name(decoded.rd)) + ", " + register_name(decoded.rs1) + ", " + std::to_string(imm);
+        }
+        break;
+    }
+    case IsaFormat::S:
+    {
+        const char *source = decoded.opcode == Opcode::STORE_FP ? float_register_name(decoded.rs2)
+                                                                : register_name(decoded.rs2);
+        text += std::string(source) + ", " + std::to_string(decoded.imm) + "(" + register_name(decoded.rs1) + ")";
+        break;
+    }
+    case IsaFormat::B:
+    {
+        text += std::string(register_name(decoded.rs1)) + ", " + register_name(decoded.rs2) + ", " + target(pc, decoded.imm);
+        break;
+    }
+    case IsaFormat::U:
+    {
+        char imm[16];
+        std::snprintf(imm, sizeof(imm), "0x%x", static_cast<uint32_t>(decoded.imm) >> 12);
+        text += std::string(register_name(decoded.rd)) + ", " + imm;
+        break;
+    }
+    case IsaFormat::J:
+    {
+        text += std::string(register_name(decoded.rd)) + ", " + target(pc, decoded.imm);
+        break;
+    }
+    case IsaFormat::EXACT:
+        text.pop_back();
+        break;
+    }
+    return text;
+}
@@ -0,0 +1,620 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include "fpu.h"
+#include "instruction.h"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief Encoding of an ISA table entry, which selects the bits it matches on.
+ */
+enum class IsaFormat : uint8_t
+{
+    R,        ///< opcode, funct3 and funct7.
+    R_RM,     ///< opcode and funct7; funct3 is the rounding mode.
+    R4,       ///< opcode and the format bits of funct7; rs3 takes the rest, funct3 is the rounding mode.
+    UNARY,    ///< opcode, funct3, funct7 and rs2, which selects the operation.
+    UNARY_RM, ///< opcode, funct7 and rs2; funct3 is the rounding mode.
+    I,        ///< opcode and funct3.
+    SHIFT,    ///< opcode, funct3 and the upper immediate bits of a shift by immediate.
+    S,        ///< opcode and funct3.
+    B,        ///< opcode and funct3.
+    U,        ///< opcode only.
+    J,        ///< opcode only.
+    AMO,      ///< opcode, funct3 and funct5; aq and rl are ignored.
+    LR,       ///< As AMO, with rs2 required to be zero.
+    EXACT     ///< The whole word.
+};
+
+/**
+ * @brief Instruction semantics and metadata generated from the ISA table.
+ *
+ * The templates are specialized once per instruction, so a handler bound at
+ * translation time evaluates its instruction without any further dispatch.
+ * The evaluate functions switch on the operation for callers that decide at
+ * run time, such as the pipelined model.
+ */
+class Isa
+{
+public:
+    Isa() = delete;
+
+    /**
+     * @brief Get the bits an encoding matches on.
+     *
+     * @param format The encoding.
+     * @return uint32_t The mask.
+     */
+    static constexpr uint32_t format_mask(IsaFormat format)
+    {
+        switch (format)
+        {
+        case IsaFormat::R:
+        case IsaFormat::SHIFT:
+            return 0xFE00707F;
+        case IsaFormat::R_RM:
+            return 0xFE00007F;
+        case IsaFormat::R4:
+            return 0x0600007F;
+        case IsaFormat::UNARY:
+            return 0xFFF0707F;
+        case IsaFormat::UNARY_RM:
+            return 0xFFF0007F;
+        case IsaFormat::U:
+        case IsaFormat::J:
+            return 0x0000007F;
+        case IsaFormat::AMO:
+            return 0xF800707F;
+        case IsaFormat::LR:
+            return 0xF9F0707F;
+        case IsaFormat::EXACT:
+            return 0xFFFFFFFF;
+        default:
+            return 0x0000707F;
+        }
+    }
+
+    /**
+     * @brief Check whether rd of an instruction is a floating-point register.
+     *
+     * @param operation The operation.
+     * @return true for floating-point loads and for results in a floating-point register, false otherwise.
+     */
+    static constexpr bool float_destination(Operation operation)
+    {
+        switch (operation)
+        {
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) case Operation::NAME:
+            PHLEGO_ISA_FP_LOAD(PHLEGO_ISA_CASE)
+            PHLEGO_ISA_FP(PHLEGO_ISA_CASE)
+            PHLEGO_ISA_FP_FROM_INT(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * @brief Check whether rs1 of an instruction is a floating-point register.
+     *
+     * rs2 and rs3 are floating-point registers for every instruction of the
+     * floating-point lists that uses them.
+     *
+     * @param operation The operation.
+     * @return true for operations on floating-point registers, false otherwise.
+     */
+    static constexpr bool float_source(Operation operation)
+    {
+        switch (operation)
+        {
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) case Operation::NAME:
+            PHLEGO_ISA_FP(PHLEGO_ISA_CASE)
+            PHLEGO_ISA_FP_TO_INT(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * @brief Get the size of an instruction from the low bits of its first half word.
+     *
+     * @param instruction The raw instruction word, or just its first half word.
+     * @return uint32_t 2 for a compressed instruction, 4 otherwise.
+     */
+    static constexpr uint32_t instruction_length(uint32_t instruction)
+    {
+        return (instruction & 0x3) == 0x3 ? 4 : 2;
+    }
+
+    /**
+     * @brief Expand a compressed instruction into the full-size instruction it stands for.
+     *
+     * @param instruction The compressed instruction in the low half word.
+     * @return uint32_t The equivalent instruction word, or 0 if it is reserved or unsupported.
+     */
+    static uint32_t expand_compressed(uint32_t instruction);
+
+    /**
+     * @brief Find the operation encoded by an instruction word.
+     *
+     * @param instruction The raw instruction word.
+     * @return Operation The operation, or Operation::NONE if no entry matches.
+     */
+    static Operation match(uint32_t instruction);
+
+    /**
+     * @brief Get the encoding of an operation.
+     *
+     * @param operation The operation.
+     * @return IsaFormat The encoding.
+     */
+    static IsaFormat format(Operation operation);
+
+    /**
+     * @brief Get the fixed bits of the encoding of an operation.
+     *
+     * ORing in the register and immediate fields gives an instruction word,
+     * so encoders need no opcode or funct constants of their own.
+     *
+     * @param operation The operation.
+     * @return uint32_t The match value of the table entry, 0 for Operation::NONE.
+     */
+    static uint32_t encoding(Operation operation);
+
+    /**
+     * @brief Get the assembler name of an operation.
+     *
+     * @param operation The operation.
+     * @return const char* The mnemonic, "unknown" for Operation::NONE.
+     */
+    static const char *mnemonic(Operation operation);
+
+    /**
+     * @brief Format a decoded instruction as assembly.
+     *
+     * @param decoded The decoded instruction.
+     * @param pc Address of the instruction, used for branch and jump targets.
+     * @return std::string The instruction, with ABI register names.
+     */
+    static std::string disassemble(const DecodedInstruction &decoded, uint32_t pc);
+
+    /**
+     * @brief Get the ABI name of an integer register.
+     *
+     * @param index The register number.
+     * @return const char* The name.
+     */
+    static const char *register_name(uint32_t index);
+
+    /**
+     * @brief Get the ABI name of a floating-point register.
+     *
+     * @param index The register number.
+     * @return const char* The name.
+     */
+    static const char *float_register_name(uint32_t index);
+
+    /**
+     * @brief Get the name of a CSR.
+     *
+     * @param number The CSR number.
+     * @return std::string The name, or the number in hex if the CSR has none here.
+     */
+    static std::string csr_name(uint32_t number);
+
+    /**
+     * @brief Get the upper half of the product of two signed integers, as MULH does.
+     *
+     * @param a The first factor.
+     * @param b The second factor.
+     * @return uint32_t The upper 32 bits of the 64-bit product.
+     */
+    static uint32_t multiply_high_signed(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Get the upper half of the product of a signed and an unsigned integer, as MULHSU does.
+     *
+     * @param a The signed factor.
+     * @param b The unsigned factor.
+     * @return uint32_t The upper 32 bits of the 64-bit product.
+     */
+    static uint32_t multiply_high_signed_unsigned(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Divide as signed integers, as DIV does.
+     *
+     * @param a The dividend.
+     * @param b The divisor.
+     * @return uint32_t The quotient, all ones if b is zero and a if the quotient overflows.
+     */
+    static uint32_t divide_signed(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Divide as unsigned integers, as DIVU does.
+     *
+     * @param a The dividend.
+     * @param b The divisor.
+     * @return uint32_t The quotient, all ones if b is zero.
+     */
+    static uint32_t divide_unsigned(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Get the remainder of a signed division, as REM does.
+     *
+     * @param a The dividend.
+     * @param b The divisor.
+     * @return uint32_t The remainder, a if b is zero and zero if the quotient overflows.
+     */
+    static uint32_t remainder_signed(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Get the remainder of an unsigned division, as REMU does.
+     *
+     * @param a The dividend.
+     * @param b The divisor.
+     * @return uint32_t The remainder, a if b is zero.
+     */
+    static uint32_t remainder_unsigned(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Compute the result of a register or immediate ALU operation.
+     *
+     * @tparam OP The operation.
+     * @param a The value of rs1.
+     * @param b The value of rs2, or the immediate.
+     * @return uint32_t The value for rd.
+     */
+    template <Operation OP>
+    static uint32_t alu(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Evaluate the condition of a branch.
+     *
+     * @tparam OP The operation.
+     * @param a The value of rs1.
+     * @param b The value of rs2.
+     * @return true if the branch is taken, false otherwise.
+     */
+    template <Operation OP>
+    static bool branch(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Compute the word an atomic memory operation stores.
+     *
+     * @tparam OP The operation.
+     * @param a The word in memory.
+     * @param b The value of rs2.
+     * @return uint32_t The word to store.
+     */
+    template <Operation OP>
+    static uint32_t amo(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Compute the result of a floating-point instruction.
+     *
+     * @tparam OP The operation.
+     * @param a The value of rs1.
+     * @param b The value of rs2.
+     * @param c The value of rs3.
+     * @param rm The rounding mode, already resolved from frm if dynamic.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The value for rd.
+     */
+    template <Operation OP>
+    static uint32_t fp(uint32_t a, uint32_t b, uint32_t c, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Compute the value a CSR instruction writes to its CSR.
+     *
+     * @tparam OP The operation.
+     * @param a The old value of the CSR.
+     * @param b The value of rs1, or the immediate.
+     * @return uint32_t The new value.
+     */
+    template <Operation OP>
+    static uint32_t csr(uint32_t a, uint32_t b);
+
+    /**
+     * @brief Memory access of a load or store; type is the accessed integer type.
+     *
+     * @tparam OP The operation.
+     */
+    template <Operation OP>
+    struct Access;
+
+    /**
+     * @brief Compute the result of an ALU operation chosen at run time.
+     *
+     * @param operation The operation.
+     * @param a The value of rs1.
+     * @param b The value of rs2, or the immediate.
+     * @return uint32_t The value for rd.
+     */
+    static uint32_t evaluate_alu(Operation operation, uint32_t a, uint32_t b);
+
+    /**
+     * @brief Evaluate the condition of a branch chosen at run time.
+     *
+     * @param operation The operation.
+     * @param a The value of rs1.
+     * @param b The value of rs2.
+     * @return true if the branch is taken, false otherwise.
+     */
+    static bool evaluate_branch(Operation operation, uint32_t a, uint32_t b);
+
+    /**
+     * @brief Compute the result of a floating-point instruction chosen at run time.
+     *
+     * @param operation The operation.
+     * @param a The value of rs1.
+     * @param b The value of rs2.
+     * @param c The value of rs3.
+     * @param rm The rounding mode, already resolved from frm if dynamic.
+     * @param flags Receives the exception flags raised.
+     * @return uint32_t The value for rd.
+     */
+    static uint32_t evaluate_fp(Operation operation, uint32_t a, uint32_t b, uint32_t c, uint32_t rm, uint32_t &flags);
+
+    /**
+     * @brief Compute the value a CSR instruction chosen at run time writes to its CSR.
+     *
+     * @param operation The operation.
+     * @param a The old value of the CSR.
+     * @param b The value of rs1, or the immediate.
+     * @return uint32_t The new value.
+     */
+    static uint32_t evaluate_csr(Operation operation, uint32_t a, uint32_t b);
+};
+
+/**
+ * @brief Get the upper half of the product of two signed integers, as MULH does.
+ *
+ * @param a The first factor.
+ * @param b The second factor.
+ * @return uint32_t The upper 32 bits of the 64-bit product.
+ */
+inline uint32_t Isa::multiply_high_signed(uint32_t a, uint32_t b)
+{
+    int64_t product = static_cast<int64_t>(static_cast<int32_t>(a)) * static_cast<int32_t>(b);
+    return static_cast<uint32_t>(static_cast<uint64_t>(product) >> 32);
+}
+
+/**
+ * @brief Get the upper half of the product of a signed and an unsigned integer, as MULHSU does.
+ *
+ * @param a The signed factor.
+ * @param b The unsigned factor.
+ * @return uint32_t The upper 32 bits of the 64-bit product.
+ */
+inline uint32_t Isa::multiply_high_signed_unsigned(uint32_t a, uint32_t b)
+{
+    // Both fit in 64 bits signed, and so does their product
+    int64_t product = static_cast<int64_t>(static_cast<int32_t>(a)) * static_cast<int64_t>(b);
+    return static_cast<uint32_t>(static_cast<uint64_t>(product) >> 32);
+}
+
+// The M extension defines a result for every operand pair instead of trapping.
+// The cases the host would fault on divide by one instead, and a mask built
+// from the comparisons patches the result, so there is no branch to mispredict.
+
+/**
+ * @brief Divide as signed integers, as DIV does.
+ *
+ * @param a The dividend.
+ * @param b The divisor.
+ * @return uint32_t The quotient, all ones if b is zero and a if the quotient overflows.
+ */
+inline uint32_t Isa::divide_signed(uint32_t a, uint32_t b)
+{
+    uint32_t by_zero = b == 0;
+    uint32_t overflow = (a == 0x80000000) & (b == 0xFFFFFFFF);
+    int32_t divisor = (by_zero | overflow) ? 1 : static_cast<int32_t>(b);
+    // Dividing by one leaves a, which is the overflow result
+    return static_cast<uint32_t>(static_cast<int32_t>(a) / divisor) | (0u - by_zero);
+}
+
+/**
+ * @brief Divide as unsigned integers, as DIVU does.
+ *
+ * @param a The dividend.
+ * @param b The divisor.
+ * @return uint32_t The quotient, all ones if b is zero.
+ */
+inline uint32_t Isa::divide_unsigned(uint32_t a, uint32_t b)
+{
+    uint32_t by_zero = b == 0;
+    return a / (b | by_zero) | (0u - by_zero);
+}
+
+/**
+ * @brief Get the remainder of a signed division, as REM does.
+ *
+ * @param a The dividend.
+ * @param b The divisor.
+ * @return uint32_t The remainder, a if b is zero and zero if the quotient overflows.
+ */
+inline uint32_t Isa::remainder_signed(uint32_t a, uint32_t b)
+{
+    uint32_t by_zero = b == 0;
+    uint32_t overflow = (a == 0x80000000) & (b == 0xFFFFFFFF);
+    int32_t divisor = (by_zero | overflow) ? 1 : static_cast<int32_t>(b);
+    // The remainder of dividing by one is zero, which is the overflow result
+    return static_cast<uint32_t>(static_cast<int32_t>(a) % divisor) | (a & (0u - by_zero));
+}
+
+/**
+ * @brief Get the remainder of an unsigned division, as REMU does.
+ *
+ * @param a The dividend.
+ * @param b The divisor.
+ * @return uint32_t The remainder, a if b is zero.
+ */
+inline uint32_t Isa::remainder_unsigned(uint32_t a, uint32_t b)
+{
+    uint32_t by_zero = b == 0;
+    return a % (b | by_zero) | (a & (0u - by_zero));
+}
+
+// One specialization per table entry; the semantics are written in terms of a and b
+#define PHLEGO_ISA_ALU_SPECIALIZATION(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS)                          \
+    template <>                                                                                          \
+    inline uint32_t Isa::alu<Operation::NAME>([[maybe_unused]] uint32_t a, [[maybe_unused]] uint32_t b) \
+    {                                                                                                    \
+        return static_cast<uint32_t>(SEMANTICS);                                                         \
+    }
+PHLEGO_ISA_ALU(PHLEGO_ISA_ALU_SPECIALIZATION)
+PHLEGO_ISA_ALU_IMM(PHLEGO_ISA_ALU_SPECIALIZATION)
+#undef PHLEGO_ISA_ALU_SPECIALIZATION
+
+#define PHLEGO_ISA_BRANCH_SPECIALIZATION(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) \
+    template <>                                                                    \
+    inline bool Isa::branch<Operation::NAME>(uint32_t a, uint32_t b)               \
+    {                                                                              \
+        return SEMANTICS;                                                          \
+    }
+PHLEGO_ISA_BRANCH(PHLEGO_ISA_BRANCH_SPECIALIZATION)
+#undef PHLEGO_ISA_BRANCH_SPECIALIZATION
+
+#define PHLEGO_ISA_AMO_SPECIALIZATION(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS)                          \
+    template <>                                                                                          \
+    inline uint32_t Isa::amo<Operation::NAME>([[maybe_unused]] uint32_t a, [[maybe_unused]] uint32_t b) \
+    {                                                                                                    \
+        return SEMANTICS;                                                                                \
+    }
+PHLEGO_ISA_AMO(PHLEGO_ISA_AMO_SPECIALIZATION)
+#undef PHLEGO_ISA_AMO_SPECIALIZATION
+
+#define PHLEGO_ISA_FP_SPECIALIZATION(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS)                                  \
+    template <>                                                                                              \
+    inline uint32_t Isa::fp<Operation::NAME>([[maybe_unused]] uint32_t a, [[maybe_unused]] uint32_t b,      \
+                                             [[maybe_unused]] uint32_t c, [[maybe_unused]] uint32_t rm,     \
+                                             [[maybe_unused]] uint32_t &flags)                              \
+    {                                                                                                        \
+        return SEMANTICS;                                                                                    \
+    }
+PHLEGO_ISA_FP(PHLEGO_ISA_FP_SPECIALIZATION)
+PHLEGO_ISA_FP_TO_INT(PHLEGO_ISA_FP_SPECIALIZATION)
+PHLEGO_ISA_FP_FROM_INT(PHLEGO_ISA_FP_SPECIALIZATION)
+#undef PHLEGO_ISA_FP_SPECIALIZATION
+
+#define PHLEGO_ISA_CSR_SPECIALIZATION(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS)                          \
+    template <>                                                                                          \
+    inline uint32_t Isa::csr<Operation::NAME>([[maybe_unused]] uint32_t a, [[maybe_unused]] uint32_t b) \
+    {                                                                                                    \
+        return SEMANTICS;                                                                                \
+    }
+PHLEGO_ISA_CSR(PHLEGO_ISA_CSR_SPECIALIZATION)
+#undef PHLEGO_ISA_CSR_SPECIALIZATION
+
+#define PHLEGO_ISA_ACCESS_SPECIALIZATION(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) \
+    template <>                                                                    \
+    struct Isa::Access<Operation::NAME>                                            \
+    {                                                                              \
+        using type = SEMANTICS;                                                    \
+    };
+PHLEGO_ISA_LOAD(PHLEGO_ISA_ACCESS_SPECIALIZATION)
+PHLEGO_ISA_STORE(PHLEGO_ISA_ACCESS_SPECIALIZATION)
+PHLEGO_ISA_FP_LOAD(PHLEGO_ISA_ACCESS_SPECIALIZATION)
+PHLEGO_ISA_FP_STORE(PHLEGO_ISA_ACCESS_SPECIALIZATION)
+#undef PHLEGO_ISA_ACCESS_SPECIALIZATION
+
+/**
+ * @brief Compute the result of an ALU operation chosen at run time.
+ *
+ * @param operation The operation.
+ * @param a The value of rs1.
+ * @param b The value of rs2, or the immediate.
+ * @return uint32_t The value for rd.
+ */
+inline uint32_t Isa::evaluate_alu(Operation operation, uint32_t a, uint32_t b)
+{
+    switch (operation)
+    {
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) \
+    case Operation::NAME:                                        \
+        return alu<Operation::NAME>(a, b);
+        PHLEGO_ISA_ALU(PHLEGO_ISA_CASE)
+        PHLEGO_ISA_ALU_IMM(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+    default:
+        throw std::runtime_error("Not an ALU operation: " + std::string(mnemonic(operation)));
+    }
+}
+
+/**
+ * @brief Evaluate the condition of a branch chosen at run time.
+ *
+ * @param operation The operation.
+ * @param a The value of rs1.
+ * @param b The value of rs2.
+ * @return true if the branch is taken, false otherwise.
+ */
+inline bool Isa::evaluate_branch(Operation operation, uint32_t a, uint32_t b)
+{
+    switch (operation)
+    {
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) \
+    case Operation::NAME:                                        \
+        return branch<Operation::NAME>(a, b);
+        PHLEGO_ISA_BRANCH(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+    default:
+        throw std::runtime_error("Not a branch: " + std::string(mnemonic(operation)));
+    }
+}
+
+/**
+ * @brief Compute the result of a floating-point instruction chosen at run time.
+ *
+ * @param operation The operation.
+ * @param a The value of rs1.
+ * @param b The value of rs2.
+ * @param c The value of rs3.
+ * @param rm The rounding mode, already resolved from frm if dynamic.
+ * @param flags Receives the exception flags raised.
+ * @return uint32_t The value for rd.
+ */
+inline uint32_t Isa::evaluate_fp(Operation operation, uint32_t a, uint32_t b, uint32_t c, uint32_t rm, uint32_t &flags)
+{
+    switch (operation)
+    {
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) \
+    case Operation::NAME:                                        \
+        return fp<Operation::NAME>(a, b, c, rm, flags);
+        PHLEGO_ISA_FP(PHLEGO_ISA_CASE)
+        PHLEGO_ISA_FP_TO_INT(PHLEGO_ISA_CASE)
+        PHLEGO_ISA_FP_FROM_INT(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+    default:
+        throw std::runtime_error("Not a floating-point operation: " + std::string(mnemonic(operation)));
+    }
+}
+
+/**
+ * @brief Compute the value a CSR instruction chosen at run time writes to its CSR.
+ *
+ * @param operation The operation.
+ * @param a The old value of the CSR.
+ * @param b The value of rs1, or the immediate.
+ * @return uint32_t The new value.
+ */
+inline uint32_t Isa::evaluate_csr(Operation operation, uint32_t a, uint32_t b)
+{
+    switch (operation)
+    {
+#define PHLEGO_ISA_CASE(NAME, MNEMONIC, FORMAT, MATCH, SEMANTICS) \
+    case Operation::NAME:                                        \
+        return csr<Operation::NAME>(a, b);
+        PHLEGO_ISA_CSR(PHLEGO_ISA_CASE)
+#undef PHLEGO_ISA_CASE
+    default:
+        throw std::runtime_error("Not a CSR instruction: " + std::string(mnemonic(operation)));
+    }
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef ISA_TABLE_H
+#define ISA_TABLE_H
+
+/*
+ * The instruction set, one line per instruction:
+ *
+ *     X(NAME, "mnemonic", FORMAT, match, semantics)
+ *
+ * FORMAT is an IsaFormat and selects the bits that must equal match; the
+ * decoder, disassembler, profiler and both engines are generated from these
+ * lists, so an instruction is added here and nowhere else. The meaning of
+ * the semantics column depends on the list:
+ *
+ * - PHLEGO_ISA_ALU and PHLEGO_ISA_ALU_IMM: the value for rd, computed from
+ *   a (rs1) and b (rs2 or the immediate).
+ * - PHLEGO_ISA_LOAD and PHLEGO_ISA_STORE: the type of the memory access; a
+ *   signed type sign-extends.
+ * - PHLEGO_ISA_BRANCH: the condition on a (rs1) and b (rs2).
+ * - PHLEGO_ISA_AMO: the value stored, from a (the old value) and b (rs2).
+ * - PHLEGO_ISA_FP_LOAD and PHLEGO_ISA_FP_STORE: as PHLEGO_ISA_LOAD and
+ *   PHLEGO_ISA_STORE, with a floating-point register for rd or rs2.
+ * - PHLEGO_ISA_FP, PHLEGO_ISA_FP_TO_INT and PHLEGO_ISA_FP_FROM_INT: the value
+ *   for rd, computed from a (rs1), b (rs2) and c (rs3) in the rounding mode
+ *   rm, ORing exception flags into flags. Registers are floating-point ones
+ *   except rd of PHLEGO_ISA_FP_TO_INT and rs1 of PHLEGO_ISA_FP_FROM_INT.
+ * - PHLEGO_ISA_CSR: the new CSR value, from a (the old value) and b (rs1 or
+ *   the immediate).
+ * - PHLEGO_ISA_CONTROL: the block engine handler, op_<semantics>.
+ */
+
+#define PHLEGO_ISA_ALU(X)                                                                                            \
+    X(ADD, "add", R, 0x00000033, a + b)                                                                              \
+    X(SUB, "sub", R, 0x40000033, a - b)                                                                              \
+    X(SLL, "sll", R, 0x00001033, a << (b & 0x1F))                                                                    \
+    X(SLT, "slt", R, 0x00002033, static_cast<int32_t>(a) < static_cast<int32_t>(b))                                  \
+    X(SLTU, "sltu", R, 0x00003033, a < b)                                                                            \
+    X(XOR, "xor", R, 0x00004033, a ^ b)                                                                              \
+    X(SRL, "srl", R, 0x00005033, a >> (b & 0x1F))                                                                    \
+    X(SRA, "sra", R, 0x40005033, static_cast<int32_t>(a) >> (b & 0x1F))                                              \
+    X(OR, "or", R, 0x00006033, a | b)                                                                                \
+    X(AND, "and", R, 0x00007033, a & b)                                                                              \
+    X(MUL, "mul", R, 0x02000033, a * b)                                                                              \
+    X(MULH, "mulh", R, 0x02001033, multiply_high_signed(a, b))                                                       \
+    X(MULHSU, "mulhsu", R, 0x02002033, multiply_high_signed_unsigned(a, b))                                          \
+    X(MULHU, "mulhu", R, 0x02003033, (static_cast<uint64_t>(a) * static_cast<uint64_t>(b)) >> 32)                    \
+    X(DIV, "div", R, 0x02004033, divide_signed(a, b))                                                                \
+    X(DIVU, "divu", R, 0x02005033, divide_unsigned(a, b))                                                            \
+    X(REM, "rem", R, 0x02006033, remainder_signed(a, b))                                                             \
+    X(REMU, "remu", R, 0x02007033, remainder_unsigned(a, b))
+
+#define PHLEGO_ISA_ALU_IMM(X)                                                                                        \
+    X(ADDI, "addi", I, 0x00000013, a + b)                                                                            \
+    X(SLTI, "slti", I, 0x00002013, static_cast<int32_t>(a) < static_cast<int32_t>(b))                                \
+    X(SLTIU, "sltiu", I, 0x00003013, a < b)                                                                          \
+    X(XORI, "xori", I, 0x00004013, a ^ b)                                                                            \
+    X(ORI, "ori", I, 0x00006013, a | b)                                                                              \
+    X(ANDI, "andi", I, 0x00007013, a & b)                                                                            \
+    X(SLLI, "slli", SHIFT, 0x00001013, a << (b & 0x1F))                                                              \
+    X(SRLI, "srli", SHIFT, 0x00005013, a >> (b & 0x1F))                                                              \
+    X(SRAI, "srai", SHIFT, 0x40005013, static_cast<int32_t>(a) >> (b & 0x1F))
+
+#define PHLEGO_ISA_LOAD(X)                                                                                           \
+    X(LB, "lb", I, 0x00000003, int8_t)                                                                               \
+    X(LH, "lh", I, 0x00001003, int16_t)                                                                              \
+    X(LW, "lw", I, 0x00002003, uint32_t)                                                                             \
+    X(LBU, "lbu", I, 0x00004003, uint8_t)                                                                            \
+    X(LHU, "lhu", I, 0x00005003, uint16_t)
+
+#define PHLEGO_ISA_STORE(X)                                                                                          \
+    X(SB, "sb", S, 0x00000023, uint8_t)                                                                              \
+    X(SH, "sh", S, 0x00001023, uint16_t)                                                                             \
+    X(SW, "sw", S, 0x00002023, uint32_t)
+
+#define PHLEGO_ISA_BRANCH(X)                                                                                         \
+    X(BEQ, "beq", B, 0x00000063, a == b)                                                                             \
+    X(BNE, "bne", B, 0x00001063, a != b)                                                                             \
+    X(BLT, "blt", B, 0x00004063, static_cast<int32_t>(a) < static_cast<int32_t>(b))                                  \
+    X(BGE, "bge", B, 0x00005063, static_cast<int32_t>(a) >= static_cast<int32_t>(b))                                 \
+    X(BLTU, "bltu", B, 0x00006063, a < b)                                                                            \
+    X(BGEU, "bgeu", B, 0x00007063, a >= b)
+
+#define PHLEGO_ISA_AMO(X)                                                                                            \
+    X(AMOSWAP_W, "amoswap.w", AMO, 0x0800202F, b)                                                                    \
+    X(AMOADD_W, "amoadd.w", AMO, 0x0000202F, a + b)                                                                  \
+    X(AMOXOR_W, "amoxor.w", AMO, 0x2000202F, a ^ b)                                                                  \
+    X(AMOAND_W, "amoand.w", AMO, 0x6000202F, a & b)                                                                  \
+    X(AMOOR_W, "amoor.w", AMO, 0x4000202F, a | b)                                                                    \
+    X(AMOMIN_W, "amomin.w", AMO, 0x8000202F, static_cast<int32_t>(a) < static_cast<int32_t>(b) ? a : b)              \
+    X(AMOMAX_W, "amomax.w", AMO, 0xA000202F, static_cast<int32_t>(a) > static_cast<int32_t>(b) ? a : b)              \
+    X(AMOMINU_W, "amominu.w", AMO, 0xC000202F, a < b ? a : b)                                                        \
+    X(AMOMAXU_W, "amomaxu.w", AMO, 0xE000202F, a > b ? a : b)
+
+#define PHLEGO_ISA_FP_LOAD(X)                                                                                        \
+    X(FLW, "flw", I, 0x00002007, uint32_t)
+
+#define PHLEGO_ISA_FP_STORE(X)                                                                                       \
+    X(FSW, "fsw", S, 0x00002027, uint32_t)
+
+#define PHLEGO_ISA_FP(X)                                                                                             \
+    X(FADD_S, "fadd.s", R_RM, 0x00000053, Fpu::add(a, b, rm, flags))                                                 \
+    X(FSUB_S, "fsub.s", R_RM, 0x08000053, Fpu::subtract(a, b, rm, flags))                                            \
+    X(FMUL_S, "fmul.s", R_RM, 0x10000053, Fpu::multiply(a, b, rm, flags))                                            \
+    X(FDIV_S, "fdiv.s", R_RM, 0x18000053, Fpu::divide(a, b, rm, flags))                                              \
+    X(FSQRT_S, "fsqrt.s", UNARY_RM, 0x58000053, Fpu::square_root(a, rm, flags))                                      \
+    X(FSGNJ_S, "fsgnj.s", R, 0x20000053, (a & 0x7FFFFFFF) | (b & 0x80000000))                                        \
+    X(FSGNJN_S, "fsgnjn.s", R, 0x20001053, (a & 0x7FFFFFFF) | (~b & 0x80000000))                                     \
+    X(FSGNJX_S, "fsgnjx.s", R, 0x20002053, a ^ (b & 0x80000000))                                                     \
+    X(FMIN_S, "fmin.s", R, 0x28000053, Fpu::minimum(a, b, flags))                                                    \
+    X(FMAX_S, "fmax.s", R, 0x28001053, Fpu::maximum(a, b, flags))                                                    \
+    X(FMADD_S, "fmadd.s", R4, 0x00000043, Fpu::fused_multiply_add(a, b, c, false, false, rm, flags))                 \
+    X(FMSUB_S, "fmsub.s", R4, 0x00000047, Fpu::fused_multiply_add(a, b, c, false, true, rm, flags))                  \
+    X(FNMSUB_S, "fnmsub.s", R4, 0x0000004B, Fpu::fused_multiply_add(a, b, c, true, false, rm, flags))                \
+    X(FNMADD_S, "fnmadd.s", R4, 0x0000004F, Fpu::fused_multiply_add(a, b, c, true, true, rm, flags))
+
+#define PHLEGO_ISA_FP_TO_INT(X)                                                                                      \
+    X(FEQ_S, "feq.s", R, 0xA0002053, Fpu::equal(a, b, flags))                                                        \
+    X(FLT_S, "flt.s", R, 0xA0001053, Fpu::less(a, b, flags))                                                         \
+    X(FLE_S, "fle.s", R, 0xA0000053, Fpu::less_equal(a, b, flags))                                                   \
+    X(FCVT_W_S, "fcvt.w.s", UNARY_RM, 0xC0000053, Fpu::to_signed(a, rm, flags))                                      \
+    X(FCVT_WU_S, "fcvt.wu.s", UNARY_RM, 0xC0100053, Fpu::to_unsigned(a, rm, flags))                                  \
+    X(FMV_X_W, "fmv.x.w", UNARY, 0xE0000053, a)                                                                      \
+    X(FCLASS_S, "fclass.s", UNARY, 0xE0001053, Fpu::classify(a))
+
+#define PHLEGO_ISA_FP_FROM_INT(X)                                                                                    \
+    X(FCVT_S_W, "fcvt.s.w", UNARY_RM, 0xD0000053, Fpu::from_signed(a, rm, flags))                                    \
+    X(FCVT_S_WU, "fcvt.s.wu", UNARY_RM, 0xD0100053, Fpu::from_unsigned(a, rm, flags))                                \
+    X(FMV_W_X, "fmv.w.x", UNARY, 0xF0000053, a)
+
+#define PHLEGO_ISA_CSR(X)                                                                                            \
+    X(CSRRW, "csrrw", I, 0x00001073, b)                                                                              \
+    X(CSRRS, "csrrs", I, 0x00002073, a | b)                                                                          \
+    X(CSRRC, "csrrc", I, 0x00003073, a & ~b)                                                                         \
+    X(CSRRWI, "csrrwi", I, 0x00005073, b)                                                                            \
+    X(CSRRSI, "csrrsi", I, 0x00006073, a | b)                                                                        \
+    X(CSRRCI, "csrrci", I, 0x00007073, a & ~b)
+
+#define PHLEGO_ISA_CONTROL(X)                                                                                        \
+    X(LUI, "lui", U, 0x00000037, lui)                                                                                \
+    X(AUIPC, "auipc", U, 0x00000017, auipc)                                                                          \
+    X(JAL, "jal", J, 0x0000006F, j_type)                                                                             \
+    X(JALR, "jalr", I, 0x00000067, jalr)                                                                             \
+    X(FENCE, "fence", I, 0x0000000F, fence)                                                                          \
+    X(FENCE_I, "fence.i", I, 0x0000100F, fence)                                                                      \
+    X(ECALL, "ecall", EXACT, 0x00000073, system)                                                                     \
+    X(EBREAK, "ebreak", EXACT, 0x00100073, system)                                                                   \
+    X(MRET, "mret", EXACT, 0x30200073, system)                                                                       \
+    X(WFI, "wfi", EXACT, 0x10500073, system)                                                                         \
+    X(LR_W, "lr.w", LR, 0x1000202F, amo)                                                                             \
+    X(SC_W, "sc.w", AMO, 0x1800202F, amo)
+
+// Every instruction, in the order of the Operation enum
+#define PHLEGO_ISA(X)                                                                                                \
+    PHLEGO_ISA_ALU(X)                                                                                                \
+    PHLEGO_ISA_ALU_IMM(X)                                                                                            \
+    PHLEGO_ISA_LOAD(X)                                                                                               \
+    PHLEGO_ISA_STORE(X)                                                                                              \
+    PHLEGO_ISA_BRANCH(X)                                                                                             \
+    PHLEGO_ISA_AMO(X)                                                                                                \
+    PHLEGO_ISA_FP_LOAD(X)                                                                                            \
+    PHLEGO_ISA_FP_STORE(X)                                                                                           \
+    PHLEGO_ISA_FP(X)                                                                                                 \
+    PHLEGO_ISA_FP_TO_INT(X)                                                                                          \
+    PHLEGO_ISA_FP_FROM_INT(X)                                                                                        \
+    PHLEGO_ISA_CSR(X)                                                                                                \
+    PHLEGO_ISA_CONTROL(X)
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
 #include <string>
 
 // Define logging levels
@@ -14,29 +16,84 @@
 #define LOG_LEVEL LOG_LEVEL_DEBUG
 #endif
 
+// The message expression is only evaluated when the level is enabled at runtime
+#define LOG_AT(level, name, message)                                          \
+    do                                                                        \
+    {                                                                         \
+        if (Logger::is_enabled(level))                                        \
+        {                                                                     \
+            Logger::log(name, message, __FUNCTION__, __FILE__, __LINE__);     \
+        }                                                                     \
+    } while (0)
+
 #if LOG_LEVEL <= LOG_LEVEL_ERROR
-#define LOG_ERROR(message) Logger::log("ERROR", message, __FUNCTION__, __FILE__, __LINE__)
+#define LOG_ERROR(message) LOG_AT(LOG_LEVEL_ERROR, "ERROR", message)
 #else
-#define LOG_ERROR(message)
+#define LOG_ERROR(message) do { } while (0)
 #endif
 
 #if LOG_LEVEL <= LOG_LEVEL_INFO
-#define LOG_INFO(message) Logger::log("INFO", message, __FUNCTION__, __FILE__, __LINE__)
+#define LOG_INFO(message) LOG_AT(LOG_LEVEL_INFO, "INFO", message)
 #else
-#define LOG_INFO(message)
+#define LOG_INFO(message) do { } while (0)
 #endif
 
 #if LOG_LEVEL <= LOG_LEVEL_DEBUG
-#define LOG_DEBUG(message) Logger::log("DEBUG", message, __FUNCTION__, __FILE__, __LINE__)
+#define LOG_DEBUG(message) LOG_AT(LOG_LEVEL_DEBUG, "DEBUG", message)
 #else
-#define LOG_DEBUG(message)
+#define LOG_DEBUG(message) do { } while (0)
 #endif
 
 /**
  * @brief Class for logging messages.
+ *
+ * Messages are appended to a preallocated buffer and written to stderr in
+ * large chunks; errors are flushed immediately. The buffer is shared by all
+ * harts and guarded by a mutex, which is only taken for enabled messages.
+ * The level can be raised at runtime above the compile-time LOG_LEVEL, and
+ * per-instruction state dumps are only produced in trace mode.
  */
 class Logger {
 public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024; ///< Size of the output buffer.
+
+    /**
+     * @brief Check whether a level is enabled at runtime.
+     *
+     * @param level The log level (e.g., LOG_LEVEL_DEBUG).
+     * @return true if messages at this level are logged, false otherwise.
+     */
+    static bool is_enabled(int level) {
+        return level >= runtime_level;
+    }
+
+    /**
+     * @brief Set the runtime log level.
+     *
+     * @param level The lowest level to log.
+     */
+    static void set_level(int level) {
+        runtime_level = level < LOG_LEVEL ? LOG_LEVEL : level;
+    }
+
+    /**
+     * @brief Check whether trace mode is enabled.
+     *
+     * @return true if per-instruction state dumps are requested, false otherwise.
+     */
+    static bool is_trace_enabled() {
+        return trace;
+    }
+
+    /**
+     * @brief Enable or disable trace mode.
+     *
+     * @param enabled True to dump the CPU state after every instruction.
+     */
+    static void set_trace(bool enabled) {
+        trace = enabled;
+    }
+
     /**
      * @brief Log a message.
      *
@@ -46,9 +103,80 @@ public:
      * @param file The file name where the log is called.
      * @param line The line number where the log is called.
      */
-    static void log(const std::string& level, const std::string& message, const std::string& function, const std::string& file, int line) {
-        std::cerr << "[" << level << "] " << file << ":" << line << " (" << function << ") - " << message << std::endl;
+    static void log(const char* level, const std::string& message, const char* function, const char* file, int line) {
+        char position[32];
+        int position_length = std::snprintf(position, sizeof(position), ":%d (", line);
+
+        std::lock_guard<std::mutex> lock(mutex());
+        Buffer& out = buffer();
+        out.append("[", 1);
+        out.append(level, std::strlen(level));
+        out.append("] ", 2);
+        out.append(file, std::strlen(file));
+        out.append(position, static_cast<size_t>(position_length));
+        out.append(function, std::strlen(function));
+        out.append(") - ", 4);
+        out.append(message.data(), message.size());
+        out.append("\n", 1);
+
+        if (std::strcmp(level, "ERROR") == 0) {
+            out.flush();
+        }
+    }
+
+    /**
+     * @brief Write buffered messages to stderr.
+     */
+    static void flush() {
+        std::lock_guard<std::mutex> lock(mutex());
+        buffer().flush();
     }
+
+private:
+    /**
+     * @brief Fixed-size output buffer flushed when full and at exit.
+     */
+    struct Buffer {
+        char data[BUFFER_SIZE];
+        size_t used = 0;
+
+        void append(const char* text, size_t length) {
+            if (used + length > BUFFER_SIZE) {
+                flush();
+                if (length > BUFFER_SIZE) {
+                    std::fwrite(text, 1, length, stderr);
+                    return;
+                }
+            }
+            std::memcpy(data + used, text, length);
+            used += length;
+        }
+
+        void flush() {
+            if (used) {
+                std::fwrite(data, 1, used, stderr);
+                used = 0;
+            }
+            std::fflush(stderr);
+        }
+
+        ~Buffer() {
+            flush();
+        }
+    };
+
+    static Buffer& buffer() {
+        static Buffer instance;
+        return instance;
+    }
+
+    static std::mutex& mutex() {
+        static std::mutex instance;
+        return instance;
+    }
+
+    static inline int runtime_level = LOG_LEVEL; ///< Lowest level logged at runtime.
+    static inline bool trace = false;            ///< Dump the CPU state after every instruction.
 };
 
 #endif
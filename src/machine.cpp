@@ -0,0 +1,239 @@
+#include "machine.h"
+#include "block_engine.h"
+#include "logger.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Construct a new Machine object.
+ *
+ * @param memory Reference to the shared guest memory.
+ * @param hart_count Number of harts, at least one.
+ */
+Machine::Machine(Memory &memory, uint32_t hart_count) : memory(memory)
+{
+    if (hart_count == 0)
+    {
+        throw std::runtime_error("A machine needs at least one hart");
+    }
+    harts.reserve(hart_count);
+    for (uint32_t i = 0; i < hart_count; ++i)
+    {
+        harts.push_back(std::make_unique<CPU>(memory, i));
+    }
+}
+
+/**
+ * @brief Run one hart on the calling thread.
+ *
+ * @param cpu The hart.
+ * @param engine The execution engine.
+ */
+void Machine::run_hart(CPU &cpu, Engine engine)
+{
+    if (engine == Engine::BLOCK)
+    {
+        BlockEngine block_engine(cpu);
+        block_engine.run();
+    }
+    else
+    {
+        cpu.run();
+    }
+    cpu.publish_metrics();
+}
+
+/**
+ * @brief Run every hart until all of them have halted.
+ *
+ * @param engine The execution engine.
+ */
+void Machine::run(Engine engine)
+{
+    if (harts.size() == 1)
+    {
+        run_hart(*harts.front(), engine);
+        return;
+    }
+
+    if (thread_count)
+    {
+        run_scheduled(engine);
+        return;
+    }
+
+    // Copy shared file-backed pages up front so the page table only grows
+    // while harts run concurrently
+    memory.make_private();
+    LOG_INFO("Starting " + std::to_string(harts.size()) + " harts");
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto stop_all = [this]()
+    {
+        for (auto &hart : harts)
+        {
+            hart->stop();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(harts.size());
+    for (auto &hart : harts)
+    {
+        CPU &cpu = *hart;
+        threads.emplace_back([&cpu, engine, &error_mutex, &error, &stop_all]()
+        {
+            try
+            {
+                run_hart(cpu, engine);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                stop_all();
+                return;
+            }
+
+            // Exiting the program, or failing in it, ends it for every hart
+            HaltReason reason = cpu.get_halt_reason();
+            if (reason == HaltReason::EXIT || reason == HaltReason::TOHOST || reason == HaltReason::TRAP)
+            {
+                stop_all();
+            }
+        });
+    }
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * @brief Run every hart in turns on the thread pool until all of them have halted.
+ *
+ * @param engine The execution engine.
+ */
+void Machine::run_scheduled(Engine engine)
+{
+    memory.make_private();
+    WorkStealingPool pool(thread_count);
+    LOG_INFO("Starting " + std::to_string(harts.size()) + " harts on " + std::to_string(pool.get_worker_count()) +
+             " threads");
+
+    // Translated blocks belong to a hart, not to a thread, so they survive migration
+    std::vector<std::unique_ptr<BlockEngine>> block_engines(harts.size());
+    for (size_t i = 0; i < harts.size(); ++i)
+    {
+        if (engine == Engine::BLOCK)
+        {
+            block_engines[i] = std::make_unique<BlockEngine>(*harts[i]);
+        }
+        harts[i]->set_yield_on_wfi(true);
+    }
+
+    // A hart between turns would miss stop(), so the flag is checked again
+    // once its next turn is set up
+    std::atomic<bool> stopping{false};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    auto stop_all = [this, &stopping]()
+    {
+        stopping.store(true);
+        for (auto &hart : harts)
+        {
+            hart->stop();
+        }
+    };
+
+    pool.run_slices(harts.size(), [this, &block_engines, &stopping, &error_mutex, &error, &stop_all](size_t index)
+    {
+        CPU &cpu = *harts[index];
+        if (!stopping.load() && cpu.is_waiting())
+        {
+            std::this_thread::yield();
+            return true;
+        }
+
+        try
+        {
+            cpu.set_break_count(cpu.get_instructions_retired() + quantum);
+            if (stopping.load())
+            {
+                cpu.stop();
+            }
+            if (block_engines[index])
+            {
+                block_engines[index]->run();
+            }
+            else
+            {
+                cpu.run();
+            }
+            if (!cpu.is_halted())
+            {
+                return true;
+            }
+            cpu.publish_metrics();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+            stop_all();
+            return false;
+        }
+
+        // Exiting the program, or failing in it, ends it for every hart
+        HaltReason reason = cpu.get_halt_reason();
+        if (reason == HaltReason::EXIT || reason == HaltReason::TOHOST || reason == HaltReason::TRAP)
+        {
+            stop_all();
+        }
+        return false;
+    });
+
+    for (auto &hart : harts)
+    {
+        hart->set_yield_on_wfi(false);
+        hart->set_break_count(0);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * @brief Get the hart whose halt decides the machine result.
+ *
+ * @return const CPU& The lowest-numbered hart that exited or took an unhandled trap, or hart 0.
+ */
+const CPU &Machine::result_hart() const
+{
+    for (const auto &hart : harts)
+    {
+        HaltReason reason = hart->get_halt_reason();
+        if (reason == HaltReason::EXIT || reason == HaltReason::TOHOST || reason == HaltReason::TRAP)
+        {
+            return *hart;
+        }
+    }
+    return *harts.front();
+}
@@ -0,0 +1,130 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "cpu.h"
+#include "memory.h"
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Execution engine used to run every hart of a machine.
+ */
+enum class Engine
+{
+    PIPELINE, ///< Pipelined model, CPU::run().
+    BLOCK     ///< Translated basic blocks, BlockEngine::run().
+};
+
+/**
+ * @brief A set of harts sharing one guest address space.
+ *
+ * Each hart owns its registers, decode cache and TLB and runs on its own host
+ * thread. Guest memory is shared; aligned word accesses are atomic and the A
+ * extension and FENCE give guests the means to synchronise. A hart that exits
+ * the program stops every other hart; harts that return or reach their
+ * instruction limit stop on their own.
+ *
+ * With many more harts than host cores, the harts can instead take turns on
+ * a fixed pool of host threads, each running for a quantum of instructions
+ * and then going back to the run queue of its thread, from which idle
+ * threads steal. A hart in WFI gives up its turn until an interrupt is
+ * pending.
+ */
+class Machine
+{
+public:
+    static constexpr uint64_t DEFAULT_QUANTUM = 10000; ///< Instructions a scheduled hart runs per turn.
+
+    /**
+     * @brief Construct a new Machine object.
+     *
+     * @param memory Reference to the shared guest memory.
+     * @param hart_count Number of harts, at least one.
+     */
+    Machine(Memory &memory, uint32_t hart_count);
+
+    /**
+     * @brief Get a hart.
+     *
+     * @param index The hart index.
+     * @return CPU& The hart.
+     */
+    CPU &get_hart(uint32_t index) { return *harts[index]; }
+
+    /**
+     * @brief Get the number of harts.
+     *
+     * @return uint32_t The hart count.
+     */
+    uint32_t get_hart_count() const { return static_cast<uint32_t>(harts.size()); }
+
+    /**
+     * @brief Run every hart until all of them have halted.
+     *
+     * A single hart runs on the calling thread. An exception raised on any hart
+     * stops the others and is rethrown once all threads have joined.
+     *
+     * @param engine The execution engine.
+     */
+    void run(Engine engine);
+
+    /**
+     * @brief Time-slice the harts over a fixed number of host threads instead of one thread each.
+     *
+     * The block engine ends a turn at the first block boundary past the
+     * quantum, so translated code still runs a whole block at a time.
+     *
+     * @param thread_count Number of host threads, 0 for one thread per hart.
+     * @param quantum Instructions a hart runs per turn.
+     */
+    void set_scheduling(size_t thread_count, uint64_t quantum = DEFAULT_QUANTUM)
+    {
+        this->thread_count = thread_count;
+        this->quantum = quantum;
+    }
+
+    /**
+     * @brief Get the reason the machine halted.
+     *
+     * @return HaltReason The halt reason of the hart that ended the program,
+     *         or of hart 0 if no hart ended it.
+     */
+    HaltReason get_halt_reason() const { return result_hart().get_halt_reason(); }
+
+    /**
+     * @brief Get the exit code of the program.
+     *
+     * @return uint32_t The exit code of the hart that ended the program.
+     */
+    uint32_t get_exit_code() const { return result_hart().get_exit_code(); }
+
+private:
+    /**
+     * @brief Run one hart on the calling thread.
+     *
+     * @param cpu The hart.
+     * @param engine The execution engine.
+     */
+    static void run_hart(CPU &cpu, Engine engine);
+
+    /**
+     * @brief Run every hart in turns on the thread pool until all of them have halted.
+     *
+     * @param engine The execution engine.
+     */
+    void run_scheduled(Engine engine);
+
+    /**
+     * @brief Get the hart whose halt decides the machine result.
+     *
+     * @return const CPU& The lowest-numbered hart that exited or took an unhandled trap, or hart 0.
+     */
+    const CPU &result_hart() const;
+
+    Memory &memory;                         ///< Shared guest memory.
+    std::vector<std::unique_ptr<CPU>> harts; ///< Harts, indexed by hart id.
+    size_t thread_count = 0;                 ///< Host threads of the scheduler, 0 for one per hart.
+    uint64_t quantum = DEFAULT_QUANTUM;      ///< Instructions a scheduled hart runs per turn.
+};
+
+#endif
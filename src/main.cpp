@@ -1,7 +1,55 @@
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include "batch.h"
+#include "branch_predictor.h"
+#include "cache.h"
+#include "cosim.h"
 #include "cpu.h"
+#include "devices.h"
+#include "gdb_server.h"
+#include "machine.h"
 #include "memory.h"
+#include "metrics.h"
 #include "logger.h"
+#include "profiler.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "trace.h"
+
+namespace {
+
+/**
+ * @brief Parse the decimal value of a numeric flag.
+ *
+ * @param text The value.
+ * @param value Receives the number.
+ * @param min The smallest value accepted.
+ * @param max The largest value accepted, by default the largest the type holds.
+ * @return true if successful, false otherwise.
+ */
+template <typename T>
+bool parse_number(const std::string& text, T& value, uint64_t min = 0,
+                  uint64_t max = std::numeric_limits<T>::max()) {
+    // strtoull skips white space and negates a minus sign
+    if (text.empty() || text[0] < '0' || text[0] > '9') {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE || parsed < min || parsed > max) {
+        return false;
+    }
+    value = static_cast<T>(parsed);
+    return true;
+}
+
+} // namespace
 
 /**
  * @brief Main function to run the emulator.
@@ -11,42 +59,440 @@
  * @return int Exit status.
  */
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        LOG_ERROR("Usage: emulator <log_level> <path_to_elf> <path_to_disassembled>");
+    std::string engine = "pipeline";
+    std::string elf_path;
+    std::string profile_path;
+    std::string folded_path;
+    uint64_t max_instructions = 0;
+    uint32_t hart_count = 1;
+    std::string manifest_path;
+    std::string results_path = "-";
+    size_t job_threads = 0;
+    std::string worker_list;
+    size_t local_workers = 0;
+    std::string history_path;
+    uint16_t serve_port = 0;
+    std::string restore_path;
+    std::string save_path;
+    bool pipeline_stats = false;
+    bool smc_stats = false;
+    std::string predictor_name;
+    std::string branch_report_path;
+    bool caches = false;
+    bool cache_error = false;
+    bool number_error = false;
+    CacheConfig l1i_config;
+    CacheConfig l1d_config;
+    l1d_config.ways = 8;
+    CacheConfig l2_config;
+    l2_config.size = 256 * 1024;
+    l2_config.ways = 8;
+    l2_config.latency = 10;
+    bool l2 = false;
+    uint32_t memory_latency = 100;
+    std::string cache_report_path;
+    std::string trace_path;
+    bool trace_compress = false;
+    bool devices = false;
+    std::string block_device_path;
+    uint16_t gdb_port = 0;
+    uint16_t metrics_port = 0;
+    bool cosim = false;
+    uint64_t cosim_interval = CoSimulation::DEFAULT_INTERVAL;
+    size_t hart_threads = 0;
+    uint64_t quantum = Machine::DEFAULT_QUANTUM;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--engine=", 0) == 0) {
+            engine = arg.substr(9);
+        } else if (arg.rfind("--profile=", 0) == 0) {
+            profile_path = arg.substr(10);
+        } else if (arg.rfind("--profile-folded=", 0) == 0) {
+            folded_path = arg.substr(17);
+        } else if (arg.rfind("--max-instructions=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(19), max_instructions);
+        } else if (arg.rfind("--harts=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(8), hart_count, 1);
+        } else if (arg.rfind("--hart-threads=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(15), hart_threads, 1);
+        } else if (arg.rfind("--quantum=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(10), quantum, 1);
+        } else if (arg.rfind("--batch=", 0) == 0) {
+            manifest_path = arg.substr(8);
+        } else if (arg.rfind("--results=", 0) == 0) {
+            results_path = arg.substr(10);
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(7), job_threads);
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            worker_list = arg.substr(10);
+        } else if (arg.rfind("--local-workers=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(16), local_workers);
+        } else if (arg.rfind("--history=", 0) == 0) {
+            history_path = arg.substr(10);
+        } else if (arg.rfind("--serve-batch=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(14), serve_port, 1);
+        } else if (arg.rfind("--restore=", 0) == 0) {
+            restore_path = arg.substr(10);
+        } else if (arg.rfind("--save-snapshot=", 0) == 0) {
+            save_path = arg.substr(16);
+        } else if (arg.rfind("--branch-predictor=", 0) == 0) {
+            predictor_name = arg.substr(19);
+        } else if (arg.rfind("--branch-report=", 0) == 0) {
+            branch_report_path = arg.substr(16);
+        } else if (arg.rfind("--cache-l1i=", 0) == 0) {
+            caches = true;
+            cache_error |= !l1i_config.parse(arg.substr(12));
+        } else if (arg.rfind("--cache-l1d=", 0) == 0) {
+            caches = true;
+            cache_error |= !l1d_config.parse(arg.substr(12));
+        } else if (arg.rfind("--cache-l2=", 0) == 0) {
+            caches = l2 = true;
+            cache_error |= !l2_config.parse(arg.substr(11));
+        } else if (arg.rfind("--memory-latency=", 0) == 0) {
+            caches = true;
+            number_error |= !parse_number(arg.substr(17), memory_latency);
+        } else if (arg.rfind("--cache-report=", 0) == 0) {
+            caches = true;
+            cache_report_path = arg.substr(15);
+        } else if (arg == "--pipeline-stats") {
+            pipeline_stats = true;
+        } else if (arg == "--smc-stats") {
+            smc_stats = true;
+        } else if (arg.rfind("--trace-file=", 0) == 0) {
+            trace_path = arg.substr(13);
+        } else if (arg == "--trace-compress") {
+            trace_compress = true;
+        } else if (arg == "--devices") {
+            devices = true;
+        } else if (arg.rfind("--block-device=", 0) == 0) {
+            devices = true;
+            block_device_path = arg.substr(15);
+        } else if (arg.rfind("--gdb=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(6), gdb_port, 1);
+        } else if (arg.rfind("--metrics=", 0) == 0) {
+            number_error |= !parse_number(arg.substr(10), metrics_port, 1);
+        } else if (arg == "--cosim") {
+            cosim = true;
+        } else if (arg.rfind("--cosim-interval=", 0) == 0) {
+            cosim = true;
+            number_error |= !parse_number(arg.substr(17), cosim_interval, 1);
+        } else if (arg == "--trace") {
+            Logger::set_trace(true);
+        } else if (arg.rfind("--log-level=", 0) == 0) {
+            std::string level = arg.substr(12);
+            if (level == "debug") {
+                Logger::set_level(LOG_LEVEL_DEBUG);
+            } else if (level == "info") {
+                Logger::set_level(LOG_LEVEL_INFO);
+            } else if (level == "error") {
+                Logger::set_level(LOG_LEVEL_ERROR);
+            } else {
+                elf_path.clear();
+                break;
+            }
+        } else if (elf_path.empty()) {
+            elf_path = arg;
+        } else {
+            elf_path.clear();
+            break;
+        }
+    }
+
+    // A single run needs an ELF file or a snapshot to start from; snapshots hold one hart
+    bool single_run = !elf_path.empty() || !restore_path.empty();
+    bool snapshots = !restore_path.empty() || !save_path.empty();
+    bool predictor_ok = predictor_name.empty() ? branch_report_path.empty() : BranchPredictor::create(predictor_name) != nullptr;
+    bool sharded = !worker_list.empty() || local_workers > 0;
+    int modes = single_run + !manifest_path.empty() + (serve_port != 0);
+    if (modes != 1 || (snapshots && hart_count != 1) || !predictor_ok || cache_error || number_error ||
+        ((sharded || !history_path.empty()) && manifest_path.empty()) || (!history_path.empty() && !sharded) ||
+        (!trace_path.empty() && engine != "pipeline") || (trace_compress && trace_path.empty()) || (devices && !single_run) ||
+        (gdb_port && (!single_run || hart_count != 1)) || (metrics_port && !single_run) ||
+        (cosim && (elf_path.empty() || snapshots || hart_count != 1 || devices || gdb_port || metrics_port)) ||
+        (hart_threads && !single_run) ||
+        (engine != "pipeline" && engine != "block")) {
+        LOG_ERROR("Usage: phlego [--engine=pipeline|block] [--harts=<n> [--hart-threads=<n>] [--quantum=<n>]]\n"
+                  "              [--log-level=debug|info|error] [--trace]\n"
+                  "              [--max-instructions=<n>] [--profile=<report>] [--profile-folded=<file>]\n"
+                  "              [--pipeline-stats] [--smc-stats] [--branch-predictor=static|bimodal|gshare] [--branch-report=<file>]\n"
+                  "              [--cache-l1i=<cache>] [--cache-l1d=<cache>] [--cache-l2=<cache>] [--memory-latency=<n>]\n"
+                  "              [--cache-report=<file>] [--trace-file=<file> [--trace-compress]]\n"
+                  "              [--devices] [--block-device=<image>] [--gdb=<port>] [--metrics=<port>]\n"
+                  "              [--cosim] [--cosim-interval=<n>]\n"
+                  "              [--restore=<snapshot>] [--save-snapshot=<snapshot>] [<path_to_elf>]\n"
+                  "       phlego --batch=<manifest> [--jobs=<n>] [--results=<file>] [--engine=pipeline|block]\n"
+                  "              [--log-level=debug|info|error] [--max-instructions=<n>]\n"
+                  "              [--profile=<report>] [--profile-folded=<file>]\n"
+                  "              [--workers=<host:port>,...] [--local-workers=<n>] [--history=<results>]\n"
+                  "       phlego --serve-batch=<port> [--jobs=<n>] [--log-level=debug|info|error]");
         return 1;
     }
 
-    Memory memory(1024 * 1024); // 1 MB of memory
-    CPU cpu(memory);
+    // Worker mode: run the shards coordinators send, until killed
+    if (serve_port) {
+        ShardWorker worker(job_threads);
+        return worker.serve(serve_port) ? 0 : 1;
+    }
+
+    // Batch mode: many independent runs in one process, one result record each
+    if (!manifest_path.empty()) {
+        Engine batch_engine = engine == "block" ? Engine::BLOCK : Engine::PIPELINE;
+        BatchRunner batch(batch_engine, max_instructions);
+        if (!batch.load_manifest(manifest_path)) {
+            return 1;
+        }
+        batch.set_profiling(!profile_path.empty() || !folded_path.empty());
+        if (sharded) {
+            // Local workers are forked first, while this process has no other threads
+            ShardCoordinator coordinator(batch, batch_engine);
+            if (!history_path.empty() && !coordinator.load_history(history_path)) {
+                return 1;
+            }
+            if (local_workers && !coordinator.spawn_local(local_workers, job_threads)) {
+                return 1;
+            }
+            std::stringstream addresses(worker_list);
+            std::string address;
+            while (std::getline(addresses, address, ',')) {
+                // An unreachable node only loses its share of the farm
+                coordinator.add_remote(address);
+            }
+            if (!coordinator.run()) {
+                return 1;
+            }
+        } else {
+            batch.run(job_threads);
+        }
+        if (!batch.write_results(results_path) || (!profile_path.empty() && !batch.write_profile(profile_path)) ||
+            (!folded_path.empty() && !batch.write_folded(folded_path))) {
+            return 1;
+        }
+        return batch.get_failed_count() == 0 ? 0 : 1;
+    }
+
+    Memory memory; // Sparse address space, pages are allocated on first touch
 
     // if (!memory.load_from_map(argv[1])) {
     //     LOG_ERROR("Failed to load ELF file: " + std::string(argv[2]));
     //     return 1;
     // }
 
-    if (!memory.load_from_elf(argv[1])) {
-        LOG_ERROR("Failed to load ELF file: " + std::string(argv[2]));
+    // A restored run takes its memory from the snapshot, the ELF file only provides symbols
+    Snapshot snapshot;
+    if (!restore_path.empty()) {
+        if (!snapshot.load(restore_path)) {
+            LOG_ERROR("Failed to load snapshot: " + restore_path);
+            return 1;
+        }
+    } else if (!memory.load_from_elf(elf_path)) {
+        LOG_ERROR("Failed to load ELF file: " + elf_path);
         return 1;
     }
 
-    // Set the stack pointer after loading the ELF file
-    cpu.set_sp(memory.get_stack_pointer());
-
     // if (!memory.load_from_disassembled(argv[2])) {
     //     LOG_ERROR("Failed to load disassembled file: " + std::string(argv[3]));
     //     return 1;
     // }
 
-    // Set the program counter to the initial address read from the disassembled file
-    cpu.set_pc(memory.get_initial_address());
+    // Console, timer and exit register at fixed addresses, plus a disk if an image is given
+    Clint* clint = nullptr;
+    if (devices) {
+        auto timer = std::make_unique<Clint>(hart_count);
+        clint = timer.get();
+        bool mapped = memory.attach_device("clint", CLINT_BASE, Clint::SIZE, std::move(timer)) &&
+                      memory.attach_device("uart", UART_BASE, Uart::SIZE, std::make_unique<Uart>()) &&
+                      memory.attach_device("tohost", TOHOST_DEVICE_BASE, TohostDevice::SIZE, std::make_unique<TohostDevice>());
+        if (mapped && !block_device_path.empty()) {
+            auto disk = std::make_unique<BlockDevice>(memory);
+            mapped = disk->open(block_device_path) &&
+                     memory.attach_device("disk", BLOCK_DEVICE_BASE, BlockDevice::SIZE, std::move(disk));
+        }
+        if (!mapped) {
+            return 1;
+        }
+    }
+
+    Machine machine(memory, hart_count);
+
+    // Every hart starts at the entry point with a0 holding its hart id. The
+    // stack region is split evenly, hart 0 keeping the top slice
+    uint32_t stack_slice = (memory.get_memory_layout().stack_size / hart_count) & ~0xFu;
+    uint32_t stack_pointer = memory.get_stack_pointer();
+    uint32_t initial_address = memory.get_initial_address();
+    for (uint32_t i = 0; i < hart_count; ++i) {
+        CPU& cpu = machine.get_hart(i);
+        cpu.set_sp(stack_pointer - i * stack_slice);
+        cpu.set_pc(initial_address);
+
+        // The program ends with the exit system call, a store to tohost, a return
+        // from the entry point or when the instruction limit is reached
+        // The tohost symbol takes precedence over the tohost device
+        uint32_t tohost = memory.get_tohost_address();
+        cpu.set_tohost(tohost != 0 || !devices ? tohost : TOHOST_DEVICE_BASE + TohostDevice::TOHOST);
+        cpu.set_clint(clint);
+        cpu.set_instruction_limit(max_instructions);
+    }
+
+    // Resume from the snapshot instead; the limit counts from where it was taken
+    if (!restore_path.empty()) {
+        CPU& cpu = machine.get_hart(0);
+        snapshot.restore(cpu);
+        cpu.set_instruction_limit(max_instructions ? cpu.get_instructions_retired() + max_instructions : 0);
+    }
+
+    // Profiling is only paid for when a report is requested, one profile per hart
+    std::vector<std::unique_ptr<Profiler>> profilers;
+    bool profiling = !profile_path.empty() || !folded_path.empty();
+    if (profiling) {
+        for (uint32_t i = 0; i < hart_count; ++i) {
+            profilers.push_back(std::make_unique<Profiler>());
+            // A restored run has no ELF image, so its symbols come from the file given
+            if (memory.get_symbols()) {
+                profilers.back()->set_symbols(memory.get_symbols());
+            } else if (!elf_path.empty()) {
+                profilers.back()->load_symbols(elf_path);
+            }
+            machine.get_hart(i).set_profiler(profilers.back().get());
+        }
+    }
+
+    // Branch prediction only changes the cycle counts of the pipelined model
+    std::vector<std::unique_ptr<BranchPredictor>> predictors;
+    if (!predictor_name.empty()) {
+        for (uint32_t i = 0; i < hart_count; ++i) {
+            predictors.push_back(BranchPredictor::create(predictor_name));
+            machine.get_hart(i).set_branch_predictor(predictors.back().get());
+        }
+    }
+
+    // Caches are private to each hart; a missing L2 sends L1 misses straight to memory
+    std::vector<std::unique_ptr<CacheHierarchy>> hierarchies;
+    if (caches) {
+        for (uint32_t i = 0; i < hart_count; ++i) {
+            hierarchies.push_back(std::make_unique<CacheHierarchy>(l1i_config, l1d_config, l2 ? &l2_config : nullptr,
+                                                                   memory_latency));
+            machine.get_hart(i).set_cache_hierarchy(hierarchies.back().get());
+        }
+    }
+
+    // A binary record of every retired instruction, one file per hart
+    std::vector<std::unique_ptr<TraceWriter>> traces;
+    if (!trace_path.empty()) {
+        for (uint32_t i = 0; i < hart_count; ++i) {
+            traces.push_back(std::make_unique<TraceWriter>());
+            if (!traces.back()->open(trace_path + (hart_count > 1 ? ".hart" + std::to_string(i) : ""), trace_compress)) {
+                return 1;
+            }
+            machine.get_hart(i).set_trace_writer(traces.back().get());
+        }
+    }
+
+    // Live counters for long runs, published by the harts once a second
+    std::unique_ptr<MetricsServer> metrics;
+    if (metrics_port) {
+        metrics = std::make_unique<MetricsServer>(machine);
+        if (!metrics->start(metrics_port)) {
+            return 1;
+        }
+    }
+
+    // The reference of a co-simulation is a pipelined hart on a copy of the program of its own
+    Memory reference_memory;
+    std::unique_ptr<CPU> reference;
+    if (cosim) {
+        if (!reference_memory.load_from_elf(elf_path)) {
+            LOG_ERROR("Failed to load ELF file: " + elf_path);
+            return 1;
+        }
+        reference = std::make_unique<CPU>(reference_memory);
+        reference->set_sp(reference_memory.get_stack_pointer());
+        reference->set_pc(reference_memory.get_initial_address());
+        reference->set_tohost(reference_memory.get_tohost_address());
+        reference->set_quiet(true);
+    }
 
     try {
-        cpu.run();
+        // Pipelined model for accuracy work, translated blocks for bulk runs
+        if (cosim) {
+            CoSimulation simulation(machine.get_hart(0), engine == "block" ? Engine::BLOCK : Engine::PIPELINE,
+                                    *reference, cosim_interval);
+            if (!simulation.run(std::cerr)) {
+                return 1;
+            }
+        } else if (gdb_port) {
+            GdbServer server(machine.get_hart(0), engine == "block" ? Engine::BLOCK : Engine::PIPELINE);
+            if (!server.serve(gdb_port)) {
+                return 1;
+            }
+        } else {
+            // Many harts take turns on a few host threads rather than a thread each
+            machine.set_scheduling(hart_threads, quantum);
+            machine.run(engine == "block" ? Engine::BLOCK : Engine::PIPELINE);
+        }
     } catch (const std::exception& e) {
         LOG_ERROR("Error: " + std::string(e.what()));
         return 1;
     }
+    memory.get_bus().flush();
 
-    return 0;
-}
+    for (auto& trace : traces) {
+        if (!trace->close()) {
+            return 1;
+        }
+    }
+
+    // Cycle counts of the pipelined model, per hart
+    if (pipeline_stats && engine == "pipeline") {
+        for (uint32_t i = 0; i < machine.get_hart_count(); ++i) {
+            CPU& cpu = machine.get_hart(i);
+            std::cerr << "Hart " << i << " pipeline:\n";
+            cpu.get_pipeline_stats().print(std::cerr, cpu.get_instructions_retired());
+        }
+    }
+
+    // Stores into code and what they invalidated, per hart
+    if (smc_stats) {
+        for (uint32_t i = 0; i < machine.get_hart_count(); ++i) {
+            CPU& cpu = machine.get_hart(i);
+            std::cerr << "Hart " << i << " code writes:\n";
+            cpu.get_decode_cache().get_code_write_stats().print(std::cerr, cpu.get_instructions_retired());
+        }
+    }
+
+    // Save the state the run stopped in, e.g. after booting to a known point
+    if (!save_path.empty()) {
+        Snapshot saved;
+        saved.capture(machine.get_hart(0));
+        if (!saved.save(save_path)) {
+            return 1;
+        }
+    }
+
+    for (uint32_t i = 0; i < predictors.size() && !branch_report_path.empty(); ++i) {
+        std::string suffix = hart_count > 1 ? ".hart" + std::to_string(i) : "";
+        predictors[i]->write_report(branch_report_path + suffix, machine.get_hart(i).get_decode_cache());
+    }
 
+    for (uint32_t i = 0; i < hierarchies.size() && !cache_report_path.empty(); ++i) {
+        std::string suffix = hart_count > 1 ? ".hart" + std::to_string(i) : "";
+        hierarchies[i]->write_report(cache_report_path + suffix, machine.get_hart(i).get_decode_cache());
+    }
+
+    for (uint32_t i = 0; i < profilers.size(); ++i) {
+        std::string suffix = hart_count > 1 ? ".hart" + std::to_string(i) : "";
+        const DecodeCache& decode_cache = machine.get_hart(i).get_decode_cache();
+        if (!profile_path.empty()) {
+            profilers[i]->write_report(profile_path + suffix, decode_cache);
+        }
+        if (!folded_path.empty()) {
+            profilers[i]->write_folded(folded_path + suffix, decode_cache);
+        }
+    }
+
+    // A bounded run that was cut short is not a failure
+    if (machine.get_halt_reason() == HaltReason::LIMIT) {
+        return 0;
+    }
+    return static_cast<int>(machine.get_exit_code() & 0xFF);
+}
@@ -4,30 +4,194 @@
 #include <fstream>
 #include <sstream>
 #include <cstring>
-#include <regex>
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <elfio/elfio.hpp>
 
-// Function to convert data based on endianness
-uint32_t convert_endianness(uint32_t value, ELFIO::elfio& reader) {
-    if (reader.get_encoding() == ELFIO::ELFDATA2LSB) {
-        // Little-endian, no conversion needed
-        return value;
-    } else {
-        // Big-endian, convert to little-endian
-        return ((value >> 24) & 0x000000FF) |
-               ((value >> 8) & 0x0000FF00) |
-               ((value << 8) & 0x00FF0000) |
-               ((value << 24) & 0xFF000000);
+namespace {
+
+/**
+ * @brief Read-only private mapping of part of a file, unmapped with its last page.
+ */
+struct FileMapping {
+    void* address;
+    size_t length;
+
+    FileMapping(void* address, size_t length) : address(address), length(length) {}
+    ~FileMapping() { munmap(address, length); }
+};
+
+/**
+ * @brief Allocate a zero-filled page owned by the caller.
+ *
+ * @return std::shared_ptr<uint8_t> The page.
+ */
+std::shared_ptr<uint8_t> allocate_page() {
+    return std::shared_ptr<uint8_t>(new uint8_t[Memory::PAGE_SIZE](), std::default_delete<uint8_t[]>());
+}
+
+/**
+ * @brief Load a PT_LOAD segment into memory.
+ *
+ * Pages whose file offset matches their guest alignment are mapped from the
+ * file without copying; they are copied only when the guest stores to them.
+ * Everything else falls back to copying the segment contents.
+ *
+ * @param memory The memory to load into.
+ * @param fd Descriptor of the ELF file, or -1 to always copy.
+ * @param file_size Size of the ELF file.
+ * @param segment The segment to load.
+ */
+void load_segment(Memory& memory, int fd, uint64_t file_size, const ELFIO::segment& segment) {
+    uint32_t vaddr = static_cast<uint32_t>(segment.get_virtual_address());
+    uint64_t offset = segment.get_offset();
+    uint64_t file_bytes = segment.get_file_size();
+    uint64_t mem_size = segment.get_memory_size();
+
+    bool mapped = false;
+    if (fd >= 0 && file_bytes > 0 && offset + file_bytes <= file_size &&
+        (vaddr & Memory::PAGE_MASK) == (offset & Memory::PAGE_MASK) &&
+        sysconf(_SC_PAGESIZE) == static_cast<long>(Memory::PAGE_SIZE)) {
+        uint64_t map_offset = offset & ~static_cast<uint64_t>(Memory::PAGE_MASK);
+        size_t length = static_cast<size_t>(offset + file_bytes - map_offset);
+        void* base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(map_offset));
+        if (base != MAP_FAILED) {
+            auto mapping = std::make_shared<FileMapping>(base, length);
+            uint64_t segment_end = static_cast<uint64_t>(vaddr) + file_bytes;
+            uint32_t guest = vaddr & ~Memory::PAGE_MASK;
+            for (size_t done = 0; done < length; done += Memory::PAGE_SIZE, guest += Memory::PAGE_SIZE) {
+                uint8_t* host = static_cast<uint8_t*>(base) + done;
+                if (memory.is_page_present(guest)) {
+                    // Page shared with another segment: copy only this segment's bytes
+                    uint32_t start = std::max(guest, vaddr);
+                    uint64_t end = std::min<uint64_t>(static_cast<uint64_t>(guest) + Memory::PAGE_SIZE, segment_end);
+                    memory.store_bytes(start, host + (start - guest), static_cast<size_t>(end - start));
+                } else {
+                    memory.map_page(guest, std::shared_ptr<uint8_t>(mapping, host));
+                }
+            }
+            mapped = true;
+            LOG_DEBUG("Mapped segment at: 0x" + Memory::to_hex_string(vaddr));
+        }
+    }
+
+    if (!mapped && file_bytes > 0) {
+        memory.store_bytes(vaddr, segment.get_data(), static_cast<size_t>(file_bytes));
+        LOG_DEBUG("Copied segment at: 0x" + Memory::to_hex_string(vaddr));
+    }
+
+    // The rest of the segment (.bss) reads as zero
+    if (mem_size > file_bytes) {
+        memory.zero_fill(static_cast<uint32_t>(vaddr + file_bytes), static_cast<size_t>(mem_size - file_bytes));
     }
 }
 
 /**
- * @brief Construct a new Memory object.
+ * @brief Output section named by a line of a linker map.
+ */
+enum class MapSection { TEXT, DATA, BSS, STACK };
+
+/**
+ * @brief Skip one or more whitespace characters.
  *
- * @param size Size of the memory.
+ * @param line The line.
+ * @param position Position in the line; advanced past the whitespace.
+ * @return true if at least one character was skipped, false otherwise.
+ */
+bool skip_spaces(const std::string& line, size_t& position) {
+    size_t start = position;
+    while (position < line.size() && std::isspace(static_cast<unsigned char>(line[position]))) {
+        ++position;
+    }
+    return position > start;
+}
+
+/**
+ * @brief Parse "0x" followed by one or more hex digits.
+ *
+ * @param line The line.
+ * @param position Position in the line; advanced past the number.
+ * @param value Receives the low 32 bits of the number.
+ * @return true if a number was parsed, false otherwise.
+ */
+bool parse_hex(const std::string& line, size_t& position, uint32_t& value) {
+    if (line.compare(position, 2, "0x") != 0 || position + 2 >= line.size() ||
+        !std::isxdigit(static_cast<unsigned char>(line[position + 2]))) {
+        return false;
+    }
+    position += 2;
+    value = 0;
+    while (position < line.size() && std::isxdigit(static_cast<unsigned char>(line[position]))) {
+        char digit = line[position++];
+        value = (value << 4) | static_cast<uint32_t>(std::isdigit(static_cast<unsigned char>(digit)) ? digit - '0' : (digit | 0x20) - 'a' + 10);
+    }
+    return true;
+}
+
+/**
+ * @brief Find the first ".<section> 0x<start> 0x<size>" in a line of a linker map.
+ *
+ * The section is one of text, data, bss and stack, and the fields are
+ * separated by whitespace. Map files are large and mostly other lines,
+ * so the scan only looks closer at dots.
+ *
+ * @param line The line.
+ * @param section Receives the section.
+ * @param start Receives the start address.
+ * @param size Receives the size.
+ * @return true if the line names a section, false otherwise.
+ */
+bool scan_map_line(const std::string& line, MapSection& section, uint32_t& start, uint32_t& size) {
+    static const std::pair<const char*, MapSection> names[] = {
+        {"text", MapSection::TEXT}, {"data", MapSection::DATA}, {"bss", MapSection::BSS}, {"stack", MapSection::STACK}};
+    for (size_t dot = line.find('.'); dot != std::string::npos; dot = line.find('.', dot + 1)) {
+        for (const auto& name : names) {
+            size_t position = dot + 1;
+            size_t length = std::strlen(name.first);
+            if (line.compare(position, length, name.first) != 0) {
+                continue;
+            }
+            position += length;
+            if (skip_spaces(line, position) && parse_hex(line, position, start) &&
+                skip_spaces(line, position) && parse_hex(line, position, size)) {
+                section = name.second;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+/**
+ * @brief Construct a new Memory object with an empty address space.
+ */
+Memory::Memory() : initial_address(0) {
+    LOG_DEBUG("Memory initialized with a sparse 4 GiB address space.");
+}
+
+/**
+ * @brief Destroy the Memory object and its page tables.
+ */
+Memory::~Memory() {
+    clear();
+}
+
+/**
+ * @brief Drop every page and page table.
  */
-Memory::Memory(size_t size) : data(size), initial_address(0) {
-    LOG_DEBUG("Memory initialized with size: " + std::to_string(size) + " bytes.");
+void Memory::clear() {
+    for (auto& table : directory) {
+        delete table.exchange(nullptr, std::memory_order_acq_rel);
+    }
+    page_count.store(0, std::memory_order_relaxed);
 }
 
 /**
@@ -40,11 +204,17 @@ bool Memory::load_from_elf(const std::string& filename) {
     LOG_DEBUG("Loading ELF file: " + filename);
     ELFIO::elfio reader;
 
-    if (!reader.load(filename)) {
+    // Lazy loading: segment contents are mapped from the file, not read by ELFIO
+    if (!reader.load(filename, true)) {
         LOG_ERROR("Error: Failed to open ELF file: " + filename);
         return false;
     }
 
+    if (reader.get_encoding() != ELFIO::ELFDATA2LSB) {
+        LOG_ERROR("Error: Only little-endian ELF files are supported: " + filename);
+        return false;
+    }
+
     // Inizializza il layout della memoria
     for (const auto& segment : reader.segments) {
         if (segment->get_type() == ELFIO::PT_LOAD) {
@@ -80,26 +250,75 @@ bool Memory::load_from_elf(const std::string& filename) {
         layout.stack_size = 0x1000;      // Default
     }
 
-    // Carica le istruzioni nella memoria
-    for (const auto& section : reader.sections) {
-        if (section->get_name() == ".text") {
-            uint32_t vaddr = static_cast<uint32_t>(section->get_address());
-            const char* data_ptr = section->get_data();
-            size_t size = section->get_size();
-
-            for (size_t i = 0; i < size; i += 4) {
-                uint32_t instruction = *reinterpret_cast<const uint32_t*>(data_ptr + i);
-                instruction = convert_endianness(instruction, reader);
-                // Store the instruction in memory
-                store_word(vaddr + i, instruction);
-            }
+    // Map every loadable segment; the file descriptor is not needed once mapped
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    uint64_t file_size = (fd >= 0 && fstat(fd, &file_stat) == 0) ? static_cast<uint64_t>(file_stat.st_size) : 0;
+    for (const auto& segment : reader.segments) {
+        if (segment->get_type() == ELFIO::PT_LOAD) {
+            load_segment(*this, fd, file_size, *segment);
         }
     }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    // Test programs report completion by storing to tohost; other symbols are only read when asked for
+    symbols = std::make_shared<SymbolIndex>(filename);
+    tohost_address = 0;
+    if (symbols->find_address("tohost", tohost_address)) {
+        LOG_DEBUG("Found tohost at: 0x" + Memory::to_hex_string(tohost_address));
+    }
 
     LOG_DEBUG("ELF file loaded successfully: " + filename);
     return true;
 }
 
+/**
+ * @brief Share the contents of an already loaded memory copy-on-write.
+ *
+ * @param image The loaded memory to share.
+ */
+void Memory::load_from_image(const Memory& image) {
+    clear();
+    for (uint32_t high = 0; high < TABLE_SIZE; ++high) {
+        PageTable* table = image.directory[high].load(std::memory_order_acquire);
+        if (!table) {
+            continue;
+        }
+        for (uint32_t index = 0; index < TABLE_SIZE; ++index) {
+            // The image is not written while shared, so its owners can be read without the lock
+            if (table->hosts[index].load(std::memory_order_acquire)) {
+                map_page(((high << TABLE_SHIFT) | index) << PAGE_SHIFT, table->owners[index]);
+            }
+        }
+    }
+    initial_address = image.initial_address;
+    tohost_address = image.tohost_address;
+    symbols = image.symbols;
+    layout = image.layout;
+}
+
+/**
+ * @brief Make this memory a copy-on-write clone of another one.
+ *
+ * @param parent The memory to clone.
+ */
+void Memory::fork_from(Memory& parent) {
+    // The parent gives up ownership so its next store to any page copies it
+    for (uint32_t high = 0; high < TABLE_SIZE; ++high) {
+        PageTable* table = parent.directory[high].load(std::memory_order_acquire);
+        if (!table) {
+            continue;
+        }
+        for (uint32_t index = 0; index < TABLE_SIZE; ++index) {
+            std::lock_guard<std::mutex> lock(parent.lock_for((high << TABLE_SHIFT) | index));
+            table->writable[index] = false;
+        }
+    }
+    load_from_image(parent);
+}
+
 /**
  * @brief Load instructions from a disassembled file.
  *
@@ -175,28 +394,26 @@ bool Memory::load_from_map(const std::string& map_file) {
         return false;
     }
 
-    std::regex section_regex(R"(\.(text|data|bss|stack)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+))");
     std::string line;
     while (std::getline(file, line)) {
-        std::smatch match;
-        if (std::regex_search(line, match, section_regex)) {
-            const std::string& section_name = match[1];
-            uint32_t start = std::stoul(match[2], nullptr, 16);
-            uint32_t size = std::stoul(match[3], nullptr, 16);
-
-            if (section_name == "text") {
-                layout.text_start = start;
-                layout.text_size = size;
-            } else if (section_name == "data") {
-                layout.data_start = start;
-                layout.data_size = size;
-            } else if (section_name == "bss") {
-                layout.bss_start = start;
-                layout.bss_size = size;
-            } else if (section_name == "stack") {
-                layout.stack_start = start;
-                layout.stack_size = size;
-            }
+        MapSection section;
+        uint32_t start;
+        uint32_t size;
+        if (!scan_map_line(line, section, start, size)) {
+            continue;
+        }
+        if (section == MapSection::TEXT) {
+            layout.text_start = start;
+            layout.text_size = size;
+        } else if (section == MapSection::DATA) {
+            layout.data_start = start;
+            layout.data_size = size;
+        } else if (section == MapSection::BSS) {
+            layout.bss_start = start;
+            layout.bss_size = size;
+        } else {
+            layout.stack_start = start;
+            layout.stack_size = size;
         }
     }
 
@@ -216,6 +433,15 @@ uint32_t Memory::get_initial_address() const {
     return initial_address;
 }
 
+/**
+ * @brief Get the memory layout.
+ *
+ * @return MemoryLayout The memory layout.
+ */
+MemoryLayout Memory::get_memory_layout() const {
+    return layout;
+}
+
 /**
  * @brief Get the stack pointer address.
  *
@@ -229,91 +455,204 @@ uint32_t Memory::get_stack_pointer() const {
 }
 
 /**
- * @brief Load a byte from memory.
+ * @brief Get the second-level table for a page number, creating it if needed.
  *
- * @param address Address to load from.
- * @return uint8_t The loaded byte.
+ * @param page_number The guest page number.
+ * @return Memory::PageTable& The page table.
  */
-uint8_t Memory::load_byte(uint32_t address) const {
-    if (address >= data.size()) {
-        LOG_ERROR("Memory load address out of range: 0x" + to_hex_string(address));
-        throw std::out_of_range("Memory load address out of range");
+Memory::PageTable& Memory::table_for(uint32_t page_number) const {
+    auto& slot = directory[page_number >> TABLE_SHIFT];
+    PageTable* table = slot.load(std::memory_order_acquire);
+    if (!table) {
+        // Racing harts may both build a table; the loser frees its own
+        auto fresh = std::make_unique<PageTable>();
+        if (slot.compare_exchange_strong(table, fresh.get(), std::memory_order_acq_rel, std::memory_order_acquire)) {
+            table = fresh.release();
+        }
     }
-    return data[address];
+    return *table;
 }
 
 /**
- * @brief Load a half word from memory.
+ * @brief Allocate a zero-filled page unless another hart got there first.
  *
- * @param address Address to load from.
- * @return uint16_t The loaded half word.
+ * @param page_number The guest page number.
+ * @return uint8_t* The host page.
  */
-uint16_t Memory::load_half_word(uint32_t address) const {
-    if (address + 1 >= data.size()) {
-        LOG_ERROR("Memory load address out of range: 0x" + to_hex_string(address));
-        throw std::out_of_range("Memory load address out of range");
+uint8_t* Memory::install_page(uint32_t page_number) const {
+    PageTable& table = table_for(page_number);
+    uint32_t index = page_number & (TABLE_SIZE - 1);
+
+    std::lock_guard<std::mutex> lock(lock_for(page_number));
+    uint8_t* host = table.hosts[index].load(std::memory_order_relaxed);
+    if (!host) {
+        table.owners[index] = allocate_page();
+        table.writable[index] = true;
+        host = table.owners[index].get();
+        table.hosts[index].store(host, std::memory_order_release);
+        page_count.fetch_add(1, std::memory_order_relaxed);
+        LOG_DEBUG("Allocated page at: 0x" + to_hex_string(page_number << PAGE_SHIFT));
     }
-    return (data[address] << 8) | data[address + 1];
+    return host;
 }
 
 /**
- * @brief Load a word from memory.
+ * @brief Get a writable host page, copying a shared page first.
  *
- * @param address Address to load from.
- * @return uint32_t The loaded word.
+ * @param page_number The guest page number.
+ * @return uint8_t* The host page.
  */
-uint32_t Memory::load_word(uint32_t address) const {
-    if (address + 3 >= data.size()) {
-        LOG_ERROR("Memory load address out of range: 0x" + to_hex_string(address));
-        throw std::out_of_range("Memory load address out of range");
+uint8_t* Memory::writable_page_for(uint32_t page_number) {
+    page_for(page_number);
+
+    PageTable& table = table_for(page_number);
+    uint32_t index = page_number & (TABLE_SIZE - 1);
+    std::lock_guard<std::mutex> lock(lock_for(page_number));
+    if (!table.writable[index]) {
+        std::shared_ptr<uint8_t> copy = allocate_page();
+        std::memcpy(copy.get(), table.owners[index].get(), PAGE_SIZE);
+        table.owners[index] = std::move(copy);
+        table.writable[index] = true;
+        table.hosts[index].store(table.owners[index].get(), std::memory_order_release);
+        copied_page_count.fetch_add(1, std::memory_order_relaxed);
+        LOG_DEBUG("Copied shared page at: 0x" + to_hex_string(page_number << PAGE_SHIFT));
     }
-    return (data[address] << 24) | (data[address + 1] << 16) | (data[address + 2] << 8) | data[address + 3];
+    return table.owners[index].get();
 }
 
 /**
- * @brief Store a byte in memory.
+ * @brief Map a shared, read-only host page into the address space.
  *
- * @param address Address to store at.
- * @param value The byte to store.
+ * @param address Guest address of the page (page aligned).
+ * @param page The host page, keeping its backing storage alive.
+ */
+void Memory::map_page(uint32_t address, std::shared_ptr<uint8_t> page) {
+    uint32_t page_number = address >> PAGE_SHIFT;
+    PageTable& table = table_for(page_number);
+    uint32_t index = page_number & (TABLE_SIZE - 1);
+
+    std::lock_guard<std::mutex> lock(lock_for(page_number));
+    if (!table.owners[index]) {
+        page_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    table.owners[index] = std::move(page);
+    table.writable[index] = false;
+    table.hosts[index].store(table.owners[index].get(), std::memory_order_release);
+}
+
+/**
+ * @brief Check whether a page is present in the address space.
+ *
+ * @param address Any address within the page.
+ * @return true if the page is present, false otherwise.
+ */
+bool Memory::is_page_present(uint32_t address) const {
+    return find_page(address >> PAGE_SHIFT) != nullptr;
+}
+
+/**
+ * @brief Copy every shared page so that no page is replaced later.
  */
-void Memory::store_byte(uint32_t address, uint8_t value) {
-    if (address >= data.size()) {
-        LOG_ERROR("Memory store address out of range: 0x" + to_hex_string(address));
-        throw std::out_of_range("Memory store address out of range");
+void Memory::make_private() {
+    for (uint32_t high = 0; high < TABLE_SIZE; ++high) {
+        PageTable* table = directory[high].load(std::memory_order_acquire);
+        if (!table) {
+            continue;
+        }
+        for (uint32_t index = 0; index < TABLE_SIZE; ++index) {
+            if (table->hosts[index].load(std::memory_order_acquire)) {
+                writable_page_for((high << TABLE_SHIFT) | index);
+            }
+        }
     }
-    data[address] = value;
 }
 
 /**
- * @brief Store a half word in memory.
+ * @brief Map a device into the address space.
+ *
+ * @param name Name of the device, e.g. "uart".
+ * @param base Start address, page aligned.
+ * @param size Size of the range, a multiple of the page size.
+ * @param device The device.
+ * @return true if successful, false if the range is misaligned, overlaps another device or holds RAM.
+ */
+bool Memory::attach_device(const std::string& name, uint32_t base, uint32_t size, std::unique_ptr<Device> device) {
+    // A present page would hide the device from every access
+    for (uint64_t address = base; address < static_cast<uint64_t>(base) + size; address += PAGE_SIZE) {
+        if (is_page_present(static_cast<uint32_t>(address))) {
+            LOG_ERROR("Error: Device " + name + " overlaps loaded memory at: 0x" + to_hex_string(static_cast<uint32_t>(address)));
+            return false;
+        }
+    }
+    return bus.attach(name, base, size, std::move(device));
+}
+
+/**
+ * @brief Clear a range, touching only pages that are already present.
+ *
+ * @param address Start address of the range.
+ * @param size Size of the range in bytes.
+ */
+void Memory::zero_fill(uint32_t address, size_t size) {
+    while (size > 0) {
+        uint32_t offset = address & PAGE_MASK;
+        size_t chunk = std::min<size_t>(size, PAGE_SIZE - offset);
+        // Pages that are not present yet are zero-filled when first touched
+        if (is_page_present(address)) {
+            std::memset(writable_page_for(address >> PAGE_SHIFT) + offset, 0, chunk);
+        }
+        address += static_cast<uint32_t>(chunk);
+        size -= chunk;
+    }
+}
+
+/**
+ * @brief Load a value across a page boundary.
+ *
+ * @param address Address to load from.
+ * @param size Size of the access in bytes.
+ * @return uint32_t The loaded value.
+ */
+uint32_t Memory::load_slow(uint32_t address, size_t size) const {
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t byte_address = address + static_cast<uint32_t>(i);
+        value |= static_cast<uint32_t>(host_pointer(byte_address)[0]) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Store a value across a page boundary.
  *
  * @param address Address to store at.
- * @param value The half word to store.
+ * @param value The value to store.
+ * @param size Size of the access in bytes.
  */
-void Memory::store_half_word(uint32_t address, uint16_t value) {
-    if (address + 1 >= data.size()) {
-        LOG_ERROR("Memory store address out of range: 0x" + to_hex_string(address));
-        throw std::out_of_range("Memory store address out of range");
+void Memory::store_slow(uint32_t address, uint32_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t byte_address = address + static_cast<uint32_t>(i);
+        writable_page_for(byte_address >> PAGE_SHIFT)[byte_address & PAGE_MASK] = static_cast<uint8_t>(value >> (8 * i));
     }
-    data[address] = value >> 8;
-    data[address + 1] = value & 0xFF;
 }
 
 /**
- * @brief Store a word in memory.
+ * @brief Copy a block of bytes into memory.
  *
  * @param address Address to store at.
- * @param value The word to store.
+ * @param source The bytes to copy.
+ * @param size Number of bytes to copy.
  */
-void Memory::store_word(uint32_t address, uint32_t value) {
-    if (address + 3 >= data.size()) {
-        LOG_ERROR("Memory store address out of range: 0x" + to_hex_string(address));
-        throw std::out_of_range("Memory store address out of range");
+void Memory::store_bytes(uint32_t address, const void* source, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(source);
+    while (size > 0) {
+        uint32_t offset = address & PAGE_MASK;
+        size_t chunk = std::min<size_t>(size, PAGE_SIZE - offset);
+        std::memcpy(writable_page_for(address >> PAGE_SHIFT) + offset, bytes, chunk);
+        address += static_cast<uint32_t>(chunk);
+        bytes += chunk;
+        size -= chunk;
     }
-    data[address] = value >> 24;
-    data[address + 1] = (value >> 16) & 0xFF;
-    data[address + 2] = (value >> 8) & 0xFF;
-    data[address + 3] = value & 0xFF;
 }
 
 /**
@@ -337,7 +676,133 @@ void Memory::print_memory(uint32_t start_address, uint32_t end_address) const {
  * @return std::string The hexadecimal string.
  */
 std::string Memory::to_hex_string(uint32_t value) {
-    std::stringstream ss;
-    ss << std::hex << value;
-    return ss.str();
-}
\ No newline at end of file
+    char text[9];
+    int length = std::snprintf(text, sizeof(text), "%x", value);
+    return std::string(text, length);
+}
+
+/**
+ * @brief Drop every TLB entry.
+ */
+void MemoryPort::flush() {
+    read_tlb.fill(TlbEntry());
+    write_tlb.fill(TlbEntry());
+}
+
+/**
+ * @brief Get a readable host page and refill its TLB entry unless the page is watched.
+ *
+ * @param page_number The guest page number.
+ * @return uint8_t* The host page.
+ */
+uint8_t* MemoryPort::readable_host(uint32_t page_number) {
+    uint8_t* host = memory.page_for(page_number);
+    if (!watcher || !watcher->watches_page(page_number)) {
+        read_tlb[page_number & (TLB_ENTRIES - 1)] = {page_number, host};
+        ++refills;
+    }
+    return host;
+}
+
+/**
+ * @brief Check whether an address belongs to a device rather than to memory.
+ *
+ * @param address The guest address.
+ * @return true if a device covers the address and no page is present there, false otherwise.
+ */
+bool MemoryPort::is_device(uint32_t address) const {
+    uint32_t offset;
+    return !memory.bus.empty() && !memory.find_page(address >> Memory::PAGE_SHIFT) && memory.bus.find(address, offset);
+}
+
+/**
+ * @brief Check whether the page holding an address has been loaded or written.
+ *
+ * @param address The guest address.
+ * @return true if the page is present, false if reading it would allocate a zero page or reach a device.
+ */
+bool MemoryPort::is_present(uint32_t address) const {
+    return memory.find_page(address >> Memory::PAGE_SHIFT) != nullptr;
+}
+
+/**
+ * @brief Get a writable host page and refill both TLB entries unless the page is watched.
+ *
+ * @param page_number The guest page number.
+ * @return uint8_t* The host page.
+ */
+uint8_t* MemoryPort::writable_host(uint32_t page_number) {
+    const TlbEntry& entry = write_tlb[page_number & (TLB_ENTRIES - 1)];
+    if (entry.tag == page_number) {
+        return entry.host;
+    }
+
+    if (is_device(page_number << Memory::PAGE_SHIFT)) {
+        throw std::runtime_error("Atomic access to device memory at 0x" + Memory::to_hex_string(page_number << Memory::PAGE_SHIFT));
+    }
+
+    // The page may have just been copied, so the read entry is refreshed too
+    uint8_t* host = memory.writable_page_for(page_number);
+    if (dirty_log) {
+        dirty_log->push_back(page_number);
+    }
+    if (!watcher || !watcher->watches_page(page_number)) {
+        read_tlb[page_number & (TLB_ENTRIES - 1)] = {page_number, host};
+        write_tlb[page_number & (TLB_ENTRIES - 1)] = {page_number, host};
+        ++refills;
+    }
+    return host;
+}
+
+/**
+ * @brief Load a value on a TLB miss or across a page boundary.
+ *
+ * @param address Address to load from.
+ * @param size Size of the access in bytes.
+ * @return uint32_t The loaded value.
+ */
+uint32_t MemoryPort::load_slow(uint32_t address, size_t size) {
+    notify(address, static_cast<uint32_t>(size), false);
+
+    // Device pages are never present, so RAM misses only pay for the page table lookup
+    uint32_t offset;
+    if (!memory.bus.empty() && !memory.find_page(address >> Memory::PAGE_SHIFT)) {
+        if (Device* device = memory.bus.find(address, offset)) {
+            return device->read(offset, static_cast<uint32_t>(size));
+        }
+    }
+
+    uint32_t value = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t byte_address = address + static_cast<uint32_t>(i);
+        value |= static_cast<uint32_t>(readable_host(byte_address >> Memory::PAGE_SHIFT)[byte_address & Memory::PAGE_MASK]) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Store a value on a TLB miss or across a page boundary.
+ *
+ * @param address Address to store at.
+ * @param value The value to store.
+ * @param size Size of the access in bytes.
+ */
+void MemoryPort::store_slow(uint32_t address, uint32_t value, size_t size) {
+    notify(address, static_cast<uint32_t>(size), true);
+
+    uint32_t offset;
+    if (!memory.bus.empty() && !memory.find_page(address >> Memory::PAGE_SHIFT)) {
+        if (Device* device = memory.bus.find(address, offset)) {
+            // A device that wrote guest memory may have replaced pages behind the TLB
+            if (device->write(offset, value, static_cast<uint32_t>(size))) {
+                flush();
+            }
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t byte_address = address + static_cast<uint32_t>(i);
+        writable_host(byte_address >> Memory::PAGE_SHIFT)[byte_address & Memory::PAGE_MASK] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
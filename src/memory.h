@@ -4,8 +4,16 @@
 #include <string>
 #include <vector>
 #include <cstddef> // Necessary for size_t type
+#include <cstdint>
+#include <cstring> // Necessary for std::memcpy
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <iostream> // Necessary for std::cout and std::hex
 #include <elfio/elfio.hpp>
+#include "bus.h"
+#include "symbol_index.h"
 
 /**
  * @brief Struct representing the memory layout.
@@ -33,17 +41,41 @@ struct MemoryLayout {
     }
 };
 
+class MemoryPort;
+
 /**
  * @brief Class representing the memory.
+ *
+ * The 32-bit guest address space is sparse: a two-level page table maps
+ * 4 KiB pages that are allocated on first touch. Pages may also be borrowed
+ * read-only from a host mapping such as an ELF file; they are copied on the
+ * first store. The page table can be shared by several harts: lookups are
+ * lock-free, and installing or copying a page takes one of a set of locks
+ * sharded by page number. Harts reach memory through a MemoryPort, which
+ * holds their private software TLB. Pages may instead belong to a
+ * memory-mapped device on the bus; those pages are never allocated.
  */
 class Memory {
 public:
+    static constexpr uint32_t PAGE_SHIFT = 12;                      ///< log2 of the page size.
+    static constexpr uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;         ///< Page size in bytes.
+    static constexpr uint32_t PAGE_MASK = PAGE_SIZE - 1;            ///< Offset bits within a page.
+    static constexpr uint32_t TABLE_SHIFT = 10;                     ///< log2 of the entries per table.
+    static constexpr uint32_t TABLE_SIZE = 1u << TABLE_SHIFT;       ///< Entries per page table level.
+    static constexpr uint32_t LOCK_SHARDS = 64;                     ///< Locks guarding page installs.
+
     /**
-     * @brief Construct a new Memory object.
-     *
-     * @param size Size of the memory.
+     * @brief Construct a new Memory object with an empty address space.
+     */
+    Memory();
+
+    /**
+     * @brief Destroy the Memory object and its page tables.
      */
-    Memory(size_t size);
+    ~Memory();
+
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
 
     /**
      * @brief Load memory layout from an ELF file.
@@ -53,6 +85,30 @@ public:
      */
     bool load_from_elf(const std::string& filename);
 
+    /**
+     * @brief Replace the address space with the contents of an already loaded memory.
+     *
+     * Every page of the image is mapped read-only and copied on the first
+     * store, so one parsed ELF can back any number of memories. The entry
+     * point, layout and tohost address are taken over as well. Pages are
+     * reference counted, so the image may be destroyed first, but it must not
+     * be written while it is shared.
+     *
+     * @param image The loaded memory to share.
+     */
+    void load_from_image(const Memory& image);
+
+    /**
+     * @brief Make this memory a copy-on-write clone of another one.
+     *
+     * Every page of the parent becomes shared: whichever memory stores to a
+     * page first gets its own copy, so the parent may go on running. Neither
+     * memory may be in use by a running hart during the call.
+     *
+     * @param parent The memory to clone.
+     */
+    void fork_from(Memory& parent);
+
     /**
      * @brief Load instructions from a disassembled file.
      *
@@ -75,7 +131,9 @@ public:
      * @param address Address to load from.
      * @return uint8_t The loaded byte.
      */
-    uint8_t load_byte(uint32_t address) const;
+    uint8_t load_byte(uint32_t address) const {
+        return load<uint8_t>(address);
+    }
 
     /**
      * @brief Load a half word from memory.
@@ -83,7 +141,9 @@ public:
      * @param address Address to load from.
      * @return uint16_t The loaded half word.
      */
-    uint16_t load_half_word(uint32_t address) const;
+    uint16_t load_half_word(uint32_t address) const {
+        return load<uint16_t>(address);
+    }
 
     /**
      * @brief Load a word from memory.
@@ -91,7 +151,9 @@ public:
      * @param address Address to load from.
      * @return uint32_t The loaded word.
      */
-    uint32_t load_word(uint32_t address) const;
+    uint32_t load_word(uint32_t address) const {
+        return load<uint32_t>(address);
+    }
 
     /**
      * @brief Store a byte in memory.
@@ -99,7 +161,9 @@ public:
      * @param address Address to store at.
      * @param value The byte to store.
      */
-    void store_byte(uint32_t address, uint8_t value);
+    void store_byte(uint32_t address, uint8_t value) {
+        store<uint8_t>(address, value);
+    }
 
     /**
      * @brief Store a half word in memory.
@@ -107,7 +171,9 @@ public:
      * @param address Address to store at.
      * @param value The half word to store.
      */
-    void store_half_word(uint32_t address, uint16_t value);
+    void store_half_word(uint32_t address, uint16_t value) {
+        store<uint16_t>(address, value);
+    }
 
     /**
      * @brief Store a word in memory.
@@ -115,7 +181,98 @@ public:
      * @param address Address to store at.
      * @param value The word to store.
      */
-    void store_word(uint32_t address, uint32_t value);
+    void store_word(uint32_t address, uint32_t value) {
+        store<uint32_t>(address, value);
+    }
+
+    /**
+     * @brief Copy a block of bytes into memory.
+     *
+     * @param address Address to store at.
+     * @param source The bytes to copy.
+     * @param size Number of bytes to copy.
+     */
+    void store_bytes(uint32_t address, const void* source, size_t size);
+
+    /**
+     * @brief Get the host address of a guest address.
+     *
+     * The pointer is valid up to the end of the page holding the address and
+     * lets callers read a validated region without a lookup for every word.
+     *
+     * @param address The guest address.
+     * @return const uint8_t* The host address.
+     */
+    const uint8_t* host_pointer(uint32_t address) const {
+        return page_for(address >> PAGE_SHIFT) + (address & PAGE_MASK);
+    }
+
+    /**
+     * @brief Map a shared, read-only host page into the address space.
+     *
+     * The page is copied on the first store to it, so the owner of the
+     * backing storage never sees guest writes.
+     *
+     * @param address Guest address of the page (page aligned).
+     * @param page The host page, keeping its backing storage alive.
+     */
+    void map_page(uint32_t address, std::shared_ptr<uint8_t> page);
+
+    /**
+     * @brief Check whether a page is present in the address space.
+     *
+     * @param address Any address within the page.
+     * @return true if the page is present, false otherwise.
+     */
+    bool is_page_present(uint32_t address) const;
+
+    /**
+     * @brief Clear a range, touching only pages that are already present.
+     *
+     * @param address Start address of the range.
+     * @param size Size of the range in bytes.
+     */
+    void zero_fill(uint32_t address, size_t size);
+
+    /**
+     * @brief Copy every shared page so that no page is replaced later.
+     *
+     * Called before several harts run at once: after this the page table only
+     * grows, so no hart can hold a TLB entry for a page another hart copied.
+     */
+    void make_private();
+
+    /**
+     * @brief Map a device into the address space.
+     *
+     * @param name Name of the device, e.g. "uart".
+     * @param base Start address, page aligned.
+     * @param size Size of the range, a multiple of the page size.
+     * @param device The device.
+     * @return true if successful, false if the range is misaligned, overlaps another device or holds RAM.
+     */
+    bool attach_device(const std::string& name, uint32_t base, uint32_t size, std::unique_ptr<Device> device);
+
+    /**
+     * @brief Get the devices of the address space.
+     *
+     * @return Bus& The bus.
+     */
+    Bus& get_bus() { return bus; }
+
+    /**
+     * @brief Get the number of pages present in the address space.
+     *
+     * @return size_t The page count.
+     */
+    size_t get_page_count() const { return page_count.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get the number of pages copied on a store to a shared page.
+     *
+     * @return size_t The copy count.
+     */
+    size_t get_copied_page_count() const { return copied_page_count.load(std::memory_order_relaxed); }
 
     /**
      * @brief Print the memory contents.
@@ -154,10 +311,500 @@ public:
      */
     uint32_t get_stack_pointer() const;
 
+    /**
+     * @brief Get the address of the tohost symbol of the loaded ELF file.
+     *
+     * @return uint32_t The tohost address, or 0 if the file has none.
+     */
+    uint32_t get_tohost_address() const { return tohost_address; }
+
+    /**
+     * @brief Get the symbols of the loaded ELF file.
+     *
+     * @return std::shared_ptr<const SymbolIndex> The lazily built index, nullptr if no ELF file was loaded.
+     */
+    std::shared_ptr<const SymbolIndex> get_symbols() const { return symbols; }
+
 private:
-    std::vector<uint8_t> data; ///< Memory data.
+    friend class MemoryPort;
+    friend class Snapshot;
+
+    /**
+     * @brief Second-level page table.
+     *
+     * Host addresses are atomics so lookups need no lock; owners and the
+     * writable flags are only touched under the shard lock of the page.
+     */
+    struct PageTable {
+        std::array<std::atomic<uint8_t*>, TABLE_SIZE> hosts{}; ///< Host address by low page number bits.
+        std::array<std::shared_ptr<uint8_t>, TABLE_SIZE> owners; ///< Storage of each page.
+        std::array<bool, TABLE_SIZE> writable{}; ///< Pages owned by this memory; the others are copied on store.
+    };
+
+    /**
+     * @brief Drop every page and page table.
+     */
+    void clear();
+
+    /**
+     * @brief Load a value without a TLB.
+     *
+     * @param address Address to load from.
+     * @return T The loaded value.
+     */
+    template <typename T>
+    T load(uint32_t address) const {
+        uint32_t offset = address & PAGE_MASK;
+        if (offset <= PAGE_SIZE - sizeof(T)) {
+            T value;
+            std::memcpy(&value, page_for(address >> PAGE_SHIFT) + offset, sizeof(T));
+            return from_little_endian(value);
+        }
+        return static_cast<T>(load_slow(address, sizeof(T)));
+    }
+
+    /**
+     * @brief Store a value without a TLB.
+     *
+     * @param address Address to store at.
+     * @param value The value to store.
+     */
+    template <typename T>
+    void store(uint32_t address, T value) {
+        uint32_t offset = address & PAGE_MASK;
+        if (offset <= PAGE_SIZE - sizeof(T)) {
+            value = from_little_endian(value);
+            std::memcpy(writable_page_for(address >> PAGE_SHIFT) + offset, &value, sizeof(T));
+            return;
+        }
+        store_slow(address, value, sizeof(T));
+    }
+
+    /**
+     * @brief Load a value across a page boundary.
+     *
+     * @param address Address to load from.
+     * @param size Size of the access in bytes.
+     * @return uint32_t The loaded value.
+     */
+    uint32_t load_slow(uint32_t address, size_t size) const;
+
+    /**
+     * @brief Store a value across a page boundary.
+     *
+     * @param address Address to store at.
+     * @param value The value to store.
+     * @param size Size of the access in bytes.
+     */
+    void store_slow(uint32_t address, uint32_t value, size_t size);
+
+    /**
+     * @brief Find the host page for a page number without allocating it.
+     *
+     * @param page_number The guest page number.
+     * @return uint8_t* The host page, or nullptr if it is not present.
+     */
+    uint8_t* find_page(uint32_t page_number) const {
+        const PageTable* table = directory[page_number >> TABLE_SHIFT].load(std::memory_order_acquire);
+        return table ? table->hosts[page_number & (TABLE_SIZE - 1)].load(std::memory_order_acquire) : nullptr;
+    }
+
+    /**
+     * @brief Get the host page for a page number, allocating it on first touch.
+     *
+     * @param page_number The guest page number.
+     * @return uint8_t* The host page.
+     */
+    uint8_t* page_for(uint32_t page_number) const {
+        uint8_t* host = find_page(page_number);
+        return host ? host : install_page(page_number);
+    }
+
+    /**
+     * @brief Allocate a zero-filled page unless another hart got there first.
+     *
+     * @param page_number The guest page number.
+     * @return uint8_t* The host page.
+     */
+    uint8_t* install_page(uint32_t page_number) const;
+
+    /**
+     * @brief Get a writable host page, copying a shared page first.
+     *
+     * @param page_number The guest page number.
+     * @return uint8_t* The host page.
+     */
+    uint8_t* writable_page_for(uint32_t page_number);
+
+    /**
+     * @brief Get the second-level table for a page number, creating it if needed.
+     *
+     * @param page_number The guest page number.
+     * @return PageTable& The page table.
+     */
+    PageTable& table_for(uint32_t page_number) const;
+
+    /**
+     * @brief Get the lock guarding installs of a page.
+     *
+     * @param page_number The guest page number.
+     * @return std::mutex& The shard lock.
+     */
+    std::mutex& lock_for(uint32_t page_number) const {
+        return locks[page_number & (LOCK_SHARDS - 1)];
+    }
+
+    /**
+     * @brief Convert between guest little-endian and host byte order.
+     *
+     * @param value The value to convert.
+     * @return T The converted value.
+     */
+    template <typename T>
+    static T from_little_endian(T value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        if constexpr (sizeof(T) == 2) {
+            return __builtin_bswap16(value);
+        } else if constexpr (sizeof(T) == 4) {
+            return __builtin_bswap32(value);
+        }
+#endif
+        return value;
+    }
+
+    // Pages are allocated lazily, including from const loads
+    mutable std::array<std::atomic<PageTable*>, TABLE_SIZE> directory{}; ///< First-level page table.
+    mutable std::array<std::mutex, LOCK_SHARDS> locks; ///< Locks guarding page installs.
+    mutable std::atomic<size_t> page_count{0}; ///< Number of present pages.
+    std::atomic<size_t> copied_page_count{0}; ///< Number of shared pages copied on store.
     uint32_t initial_address; ///< Initial address read from the disassembled file.
-    MemoryLayout layout; ///< Memory layout.
+    uint32_t tohost_address = 0; ///< Address of the tohost symbol, 0 if absent.
+    std::shared_ptr<const SymbolIndex> symbols; ///< Symbols of the loaded ELF file.
+    MemoryLayout layout{}; ///< Memory layout.
+    Bus bus; ///< Memory-mapped devices.
+};
+
+/**
+ * @brief Observer of the accesses to selected pages, e.g. debugger watchpoints.
+ */
+class AccessWatcher {
+public:
+    virtual ~AccessWatcher() = default;
+
+    /**
+     * @brief Check whether accesses to a page are reported.
+     *
+     * @param page_number The guest page number.
+     * @return true if the page is watched, false otherwise.
+     */
+    virtual bool watches_page(uint32_t page_number) const = 0;
+
+    /**
+     * @brief Report an access to a watched page, before it is performed.
+     *
+     * @param address Address of the access.
+     * @param size Size of the access in bytes.
+     * @param write Whether the access stores to memory.
+     */
+    virtual void on_access(uint32_t address, uint32_t size, bool write) = 0;
+};
+
+/**
+ * @brief One hart's view of a shared Memory.
+ *
+ * A small direct-mapped software TLB in front of the page table makes the
+ * common access a single compare and an add; everything else goes through an
+ * out-of-line slow path. Stores use their own TLB that only holds pages owned
+ * by the memory, so the first store to a shared page still copies it.
+ * Aligned accesses are single relaxed atomic operations, so racing harts
+ * never see torn words.
+ *
+ * Accesses that miss the TLB and find no page go to the device bus, so
+ * device pages never enter the TLB. Atomic memory operations are not
+ * supported on devices; the CPU checks with is_device() and raises an access
+ * fault before making one.
+ *
+ * Watched pages are kept out of the TLB, so every access to them takes the
+ * slow path, which reports it to the watcher; other pages run at full speed.
+ *
+ * The TLB is not told when another party replaces a page. Ports are flushed
+ * when a run starts, and Memory::make_private() is called before several
+ * harts run at once.
+ */
+class MemoryPort {
+public:
+    static constexpr uint32_t TLB_ENTRIES = 64; ///< Entries in the software TLB.
+
+    /**
+     * @brief Construct a new MemoryPort object.
+     *
+     * @param memory The memory to access.
+     */
+    explicit MemoryPort(Memory& memory) : memory(memory) {}
+
+    /**
+     * @brief Load a byte from memory.
+     *
+     * @param address Address to load from.
+     * @return uint8_t The loaded byte.
+     */
+    uint8_t load_byte(uint32_t address) {
+        return load<uint8_t>(address);
+    }
+
+    /**
+     * @brief Load a half word from memory.
+     *
+     * @param address Address to load from.
+     * @return uint16_t The loaded half word.
+     */
+    uint16_t load_half_word(uint32_t address) {
+        return load<uint16_t>(address);
+    }
+
+    /**
+     * @brief Load a word from memory.
+     *
+     * @param address Address to load from.
+     * @return uint32_t The loaded word.
+     */
+    uint32_t load_word(uint32_t address) {
+        return load<uint32_t>(address);
+    }
+
+    /**
+     * @brief Store a byte in memory.
+     *
+     * @param address Address to store at.
+     * @param value The byte to store.
+     */
+    void store_byte(uint32_t address, uint8_t value) {
+        store<uint8_t>(address, value);
+    }
+
+    /**
+     * @brief Store a half word in memory.
+     *
+     * @param address Address to store at.
+     * @param value The half word to store.
+     */
+    void store_half_word(uint32_t address, uint16_t value) {
+        store<uint16_t>(address, value);
+    }
+
+    /**
+     * @brief Store a word in memory.
+     *
+     * @param address Address to store at.
+     * @param value The word to store.
+     */
+    void store_word(uint32_t address, uint32_t value) {
+        store<uint32_t>(address, value);
+    }
+
+    /**
+     * @brief Atomically replace an aligned word with a function of its value.
+     *
+     * @param address Address of the word, 4-byte aligned.
+     * @param update Computes the new value from the old one.
+     * @return uint32_t The old value.
+     */
+    template <typename Update>
+    uint32_t update_word(uint32_t address, Update update) {
+        notify(address, 4, true);
+        uint32_t* word = reinterpret_cast<uint32_t*>(writable_host(address >> Memory::PAGE_SHIFT) + (address & Memory::PAGE_MASK));
+        uint32_t raw = __atomic_load_n(word, __ATOMIC_RELAXED);
+        uint32_t old_value;
+        do {
+            old_value = Memory::from_little_endian(raw);
+        } while (!__atomic_compare_exchange_n(word, &raw, Memory::from_little_endian(update(old_value)), true,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+        return old_value;
+    }
+
+    /**
+     * @brief Atomically store an aligned word if it still holds a value.
+     *
+     * @param address Address of the word, 4-byte aligned.
+     * @param expected The value the word must hold.
+     * @param value The value to store.
+     * @return true if the word was stored, false otherwise.
+     */
+    bool compare_and_store_word(uint32_t address, uint32_t expected, uint32_t value) {
+        notify(address, 4, true);
+        uint32_t* word = reinterpret_cast<uint32_t*>(writable_host(address >> Memory::PAGE_SHIFT) + (address & Memory::PAGE_MASK));
+        uint32_t raw = Memory::from_little_endian(expected);
+        return __atomic_compare_exchange_n(word, &raw, Memory::from_little_endian(value), false,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * @brief Check whether an address belongs to a device rather than to memory.
+     *
+     * @param address The guest address.
+     * @return true if a device covers the address and no page is present there, false otherwise.
+     */
+    bool is_device(uint32_t address) const;
+
+    /**
+     * @brief Check whether the page holding an address has been loaded or written.
+     *
+     * @param address The guest address.
+     * @return true if the page is present, false if reading it would allocate a zero page or reach a device.
+     */
+    bool is_present(uint32_t address) const;
+
+    /**
+     * @brief Drop every TLB entry.
+     */
+    void flush();
+
+    /**
+     * @brief Get the number of TLB entries refilled after a miss.
+     *
+     * @return uint64_t The refill count.
+     */
+    uint64_t get_refills() const { return refills; }
+
+    /**
+     * @brief Report the accesses to some pages, or stop reporting them.
+     *
+     * @param watcher The observer, or nullptr for none. The TLB is flushed,
+     *                so call again whenever the set of watched pages changes.
+     */
+    void set_watcher(AccessWatcher* watcher) {
+        this->watcher = watcher;
+        flush();
+    }
+
+    /**
+     * @brief Log the pages stored to, or stop logging with nullptr.
+     *
+     * A page is logged when it enters the write TLB, so after a flush every
+     * page stored to is logged at least once, and at no cost to the stores
+     * that hit the TLB.
+     *
+     * @param log Receives page numbers, possibly repeated. The TLB is flushed.
+     */
+    void set_dirty_log(std::vector<uint32_t>* log) {
+        dirty_log = log;
+        flush();
+    }
+
+    /**
+     * @brief Get the memory behind the port.
+     *
+     * @return Memory& The memory.
+     */
+    Memory& get_memory() const { return memory; }
+
+private:
+    /**
+     * @brief Software TLB entry mapping a page number to its host page.
+     */
+    struct TlbEntry {
+        uint32_t tag = UINT32_MAX; ///< Page number, or UINT32_MAX if empty.
+        uint8_t* host = nullptr;   ///< Host address of the page.
+    };
+
+    /**
+     * @brief Load a value through the TLB.
+     *
+     * @param address Address to load from.
+     * @return T The loaded value.
+     */
+    template <typename T>
+    T load(uint32_t address) {
+        const TlbEntry& entry = read_tlb[(address >> Memory::PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+        uint32_t offset = address & Memory::PAGE_MASK;
+        if (entry.tag == (address >> Memory::PAGE_SHIFT) && offset <= Memory::PAGE_SIZE - sizeof(T)) {
+            T value;
+            if ((offset & (sizeof(T) - 1)) == 0) {
+                value = __atomic_load_n(reinterpret_cast<const T*>(entry.host + offset), __ATOMIC_RELAXED);
+            } else {
+                std::memcpy(&value, entry.host + offset, sizeof(T)); // Misaligned accesses need not be atomic
+            }
+            return Memory::from_little_endian(value);
+        }
+        return static_cast<T>(load_slow(address, sizeof(T)));
+    }
+
+    /**
+     * @brief Store a value through the TLB.
+     *
+     * @param address Address to store at.
+     * @param value The value to store.
+     */
+    template <typename T>
+    void store(uint32_t address, T value) {
+        const TlbEntry& entry = write_tlb[(address >> Memory::PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+        uint32_t offset = address & Memory::PAGE_MASK;
+        if (entry.tag == (address >> Memory::PAGE_SHIFT) && offset <= Memory::PAGE_SIZE - sizeof(T)) {
+            value = Memory::from_little_endian(value);
+            if ((offset & (sizeof(T) - 1)) == 0) {
+                __atomic_store_n(reinterpret_cast<T*>(entry.host + offset), value, __ATOMIC_RELAXED);
+            } else {
+                std::memcpy(entry.host + offset, &value, sizeof(T));
+            }
+            return;
+        }
+        store_slow(address, value, sizeof(T));
+    }
+
+    /**
+     * @brief Load a value on a TLB miss or across a page boundary.
+     *
+     * @param address Address to load from.
+     * @param size Size of the access in bytes.
+     * @return uint32_t The loaded value.
+     */
+    uint32_t load_slow(uint32_t address, size_t size);
+
+    /**
+     * @brief Store a value on a TLB miss or across a page boundary.
+     *
+     * @param address Address to store at.
+     * @param value The value to store.
+     * @param size Size of the access in bytes.
+     */
+    void store_slow(uint32_t address, uint32_t value, size_t size);
+
+    /**
+     * @brief Report an access to the watcher if it covers a watched page.
+     *
+     * @param address Address of the access.
+     * @param size Size of the access in bytes.
+     * @param write Whether the access stores to memory.
+     */
+    void notify(uint32_t address, uint32_t size, bool write) {
+        if (watcher && (watcher->watches_page(address >> Memory::PAGE_SHIFT) ||
+                        watcher->watches_page((address + size - 1) >> Memory::PAGE_SHIFT))) {
+            watcher->on_access(address, size, write);
+        }
+    }
+
+    /**
+     * @brief Get a readable host page and refill its TLB entry unless the page is watched.
+     *
+     * @param page_number The guest page number.
+     * @return uint8_t* The host page.
+     */
+    uint8_t* readable_host(uint32_t page_number);
+
+    /**
+     * @brief Get a writable host page and refill both TLB entries unless the page is watched.
+     *
+     * @param page_number The guest page number.
+     * @return uint8_t* The host page.
+     */
+    uint8_t* writable_host(uint32_t page_number);
+
+    Memory& memory; ///< The shared memory.
+    std::array<TlbEntry, TLB_ENTRIES> read_tlb; ///< Software TLB for loads.
+    std::array<TlbEntry, TLB_ENTRIES> write_tlb; ///< Software TLB for stores, only holds writable pages.
+    AccessWatcher* watcher = nullptr; ///< Observer of watched pages, or nullptr.
+    std::vector<uint32_t>* dirty_log = nullptr; ///< Pages stored to, or nullptr.
+    uint64_t refills = 0; ///< TLB entries refilled after a miss.
 };
 
 #endif
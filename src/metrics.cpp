@@ -0,0 +1,299 @@
+#include "metrics.h"
+#include "logger.h"
+#include "machine.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr int REQUEST_TIMEOUT_MS = 1000; ///< How long a scraper may take to send its request.
+constexpr size_t MAX_REQUEST_SIZE = 8192; ///< Longest request header accepted.
+
+/**
+ * @brief Append one metric with a sample per hart.
+ *
+ * @param text The exposition text to append to.
+ * @param name The metric name.
+ * @param type counter or gauge.
+ * @param help The description.
+ * @param values The value of each hart.
+ */
+void append_metric(std::string &text, const char *name, const char *type, const char *help,
+                   const std::vector<double> &values)
+{
+    text += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+    char line[160];
+    for (size_t hart = 0; hart < values.size(); ++hart)
+    {
+        // Counters print exactly, rates to six digits
+        double value = values[hart];
+        std::snprintf(line, sizeof(line), value == std::floor(value) ? "%s{hart=\"%zu\"} %.0f\n" : "%s{hart=\"%zu\"} %.6g\n",
+                      name, hart, value);
+        text += line;
+    }
+}
+
+/**
+ * @brief Write a whole buffer to a socket.
+ *
+ * @param socket The socket.
+ * @param data The bytes to send.
+ * @return true if successful, false otherwise.
+ */
+bool write_all(int socket, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t count = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (count <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(count);
+    }
+    return true;
+}
+} // namespace
+
+constexpr std::chrono::seconds MetricsServer::WINDOW;
+
+/**
+ * @brief Construct a new MetricsServer object and attach counters to every hart.
+ *
+ * @param machine The machine whose harts are observed.
+ * @param interval Time between publishes.
+ */
+MetricsServer::MetricsServer(Machine &machine, std::chrono::milliseconds interval)
+    : machine(machine), interval(interval), counters(machine.get_hart_count()), started(std::chrono::steady_clock::now())
+{
+    for (uint32_t i = 0; i < machine.get_hart_count(); ++i)
+    {
+        machine.get_hart(i).set_metrics(&counters[i]);
+    }
+}
+
+/**
+ * @brief Stop serving and detach the counters from the harts.
+ */
+MetricsServer::~MetricsServer()
+{
+    stop();
+    for (uint32_t i = 0; i < machine.get_hart_count(); ++i)
+    {
+        machine.get_hart(i).set_metrics(nullptr);
+    }
+}
+
+/**
+ * @brief Listen on a port and start serving on a thread of its own.
+ *
+ * @param port TCP port to listen on, on every interface.
+ * @return true if successful, false otherwise.
+ */
+bool MetricsServer::start(uint16_t port)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    int reuse = 1;
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0)
+    {
+        LOG_ERROR("Error: Cannot listen for metrics scrapes on port " + std::to_string(port));
+        if (listener >= 0)
+        {
+            close(listener);
+            listener = -1;
+        }
+        return false;
+    }
+
+    LOG_INFO("Serving metrics on port " + std::to_string(port));
+    thread = std::thread([this]() { serve(); });
+    return true;
+}
+
+/**
+ * @brief Stop serving and wait for the thread.
+ */
+void MetricsServer::stop()
+{
+    stopping.store(true, std::memory_order_relaxed);
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+    if (listener >= 0)
+    {
+        close(listener);
+        listener = -1;
+    }
+}
+
+/**
+ * @brief Publish, sample and answer scrapes until stopped.
+ */
+void MetricsServer::serve()
+{
+    auto next_refresh = std::chrono::steady_clock::now();
+    while (!stopping.load(std::memory_order_relaxed))
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_refresh)
+        {
+            refresh();
+            next_refresh = now + interval;
+        }
+
+        // Wake up for the next refresh even if nobody scrapes
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_refresh - now).count();
+        pollfd ready{listener, POLLIN, 0};
+        if (poll(&ready, 1, static_cast<int>(std::max<long long>(wait, 1))) > 0 && (ready.revents & POLLIN))
+        {
+            int connection = accept(listener, nullptr, nullptr);
+            if (connection >= 0)
+            {
+                answer(connection);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Ask every hart to publish its counters and sample the instruction counts.
+ */
+void MetricsServer::refresh()
+{
+    // The harts publish on their own threads, so this sample shows the
+    // previous publish and the request is answered by the next one
+    Sample sample{std::chrono::steady_clock::now(), {}};
+    for (uint32_t i = 0; i < machine.get_hart_count(); ++i)
+    {
+        sample.instructions.push_back(counters[i].instructions.load(std::memory_order_relaxed));
+        machine.get_hart(i).request_metrics();
+    }
+    samples.push_back(std::move(sample));
+    while (samples.size() > 2 && samples.back().time - samples[1].time >= WINDOW)
+    {
+        samples.pop_front();
+    }
+}
+
+/**
+ * @brief Answer one request on a connected socket, then close it.
+ *
+ * @param socket The connected socket.
+ */
+void MetricsServer::answer(int socket)
+{
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE)
+    {
+        pollfd ready{socket, POLLIN, 0};
+        if (poll(&ready, 1, REQUEST_TIMEOUT_MS) <= 0)
+        {
+            break;
+        }
+        ssize_t count = recv(socket, buffer, sizeof(buffer), 0);
+        if (count <= 0)
+        {
+            break;
+        }
+        request.append(buffer, static_cast<size_t>(count));
+    }
+
+    std::string response;
+    if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET / ", 0) == 0)
+    {
+        std::string body = render();
+        response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                   std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    }
+    else
+    {
+        response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    write_all(socket, response);
+    close(socket);
+}
+
+/**
+ * @brief Format the published counters.
+ *
+ * @return std::string The metrics in the Prometheus text exposition format.
+ */
+std::string MetricsServer::render() const
+{
+    size_t harts = counters.size();
+    auto values = [this, harts](const std::atomic<uint64_t> HartMetrics::*field)
+    {
+        std::vector<double> result(harts);
+        for (size_t i = 0; i < harts; ++i)
+        {
+            result[i] = static_cast<double>((counters[i].*field).load(std::memory_order_relaxed));
+        }
+        return result;
+    };
+
+    // Rates over the samples still in the window
+    std::vector<double> mips(harts, 0.0);
+    if (samples.size() >= 2)
+    {
+        const Sample &oldest = samples.front();
+        const Sample &newest = samples.back();
+        double seconds = std::chrono::duration<double>(newest.time - oldest.time).count();
+        for (size_t i = 0; seconds > 0.0 && i < harts; ++i)
+        {
+            mips[i] = static_cast<double>(newest.instructions[i] - oldest.instructions[i]) / seconds / 1e6;
+        }
+    }
+    std::vector<double> hit_rate(harts, 0.0);
+    std::vector<double> halted(harts, 0.0);
+    for (size_t i = 0; i < harts; ++i)
+    {
+        double hits = static_cast<double>(counters[i].decode_hits.load(std::memory_order_relaxed));
+        double misses = static_cast<double>(counters[i].decode_misses.load(std::memory_order_relaxed));
+        hit_rate[i] = hits + misses > 0.0 ? hits / (hits + misses) : 0.0;
+        halted[i] = counters[i].halted.load(std::memory_order_relaxed) ? 1.0 : 0.0;
+    }
+
+    std::string text;
+    append_metric(text, "phlego_instructions_retired_total", "counter", "Instructions retired.",
+                  values(&HartMetrics::instructions));
+    append_metric(text, "phlego_mips", "gauge", "Million instructions per second over the sliding window.", mips);
+    append_metric(text, "phlego_decode_cache_hits_total", "counter", "Decode cache lookups that hit.",
+                  values(&HartMetrics::decode_hits));
+    append_metric(text, "phlego_decode_cache_misses_total", "counter", "Decode cache lookups that missed.",
+                  values(&HartMetrics::decode_misses));
+    append_metric(text, "phlego_decode_cache_hit_ratio", "gauge", "Decode cache hits per lookup since the start.",
+                  hit_rate);
+    append_metric(text, "phlego_tlb_refills_total", "counter", "Software TLB entries refilled after a miss.",
+                  values(&HartMetrics::tlb_refills));
+    append_metric(text, "phlego_blocks_translated_total", "counter", "Basic blocks translated by the block engine.",
+                  values(&HartMetrics::blocks_translated));
+    append_metric(text, "phlego_code_stores_total", "counter", "Stores to pages holding decoded code.",
+                  values(&HartMetrics::code_stores));
+    append_metric(text, "phlego_decoded_invalidated_total", "counter", "Decoded instructions dropped by stores.",
+                  values(&HartMetrics::entries_invalidated));
+    append_metric(text, "phlego_blocks_invalidated_total", "counter", "Translated blocks dropped by stores.",
+                  values(&HartMetrics::blocks_invalidated));
+    append_metric(text, "phlego_exceptions_total", "counter", "Exceptions taken.", values(&HartMetrics::exceptions));
+    append_metric(text, "phlego_interrupts_total", "counter", "Interrupts taken.", values(&HartMetrics::interrupts));
+    append_metric(text, "phlego_halted", "gauge", "1 once the hart has stopped running.", halted);
+
+    char uptime[160];
+    std::snprintf(uptime, sizeof(uptime),
+                  "# HELP phlego_uptime_seconds Seconds since the metrics server started.\n"
+                  "# TYPE phlego_uptime_seconds gauge\nphlego_uptime_seconds %.3f\n",
+                  std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+    return text + uptime;
+}
@@ -0,0 +1,129 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Machine;
+
+/**
+ * @brief Counters of one hart as last published for the metrics endpoint.
+ *
+ * The hart copies its own counters in where its run loop already leaves
+ * through the run limit, so execution pays nothing per instruction, and the
+ * endpoint only ever reads these copies. Each set fills whole cache lines, so
+ * harts publishing at the same time never write to a shared line.
+ */
+struct alignas(64) HartMetrics
+{
+    std::atomic<uint64_t> instructions{0};        ///< Instructions retired.
+    std::atomic<uint64_t> decode_hits{0};         ///< Decode cache lookups that hit.
+    std::atomic<uint64_t> decode_misses{0};       ///< Decode cache lookups that missed.
+    std::atomic<uint64_t> tlb_refills{0};         ///< Software TLB entries refilled after a miss.
+    std::atomic<uint64_t> blocks_translated{0};   ///< Basic blocks translated by the block engine.
+    std::atomic<uint64_t> code_stores{0};         ///< Stores to pages holding decoded code.
+    std::atomic<uint64_t> entries_invalidated{0}; ///< Decoded instructions dropped by those stores.
+    std::atomic<uint64_t> blocks_invalidated{0};  ///< Translated blocks dropped by those stores.
+    std::atomic<uint64_t> exceptions{0};          ///< Exceptions taken.
+    std::atomic<uint64_t> interrupts{0};          ///< Interrupts taken.
+    std::atomic<bool> halted{false};              ///< The hart has stopped running.
+};
+
+/**
+ * @brief Serves the counters of every hart of a machine in the Prometheus text format.
+ *
+ * A thread of its own asks each hart to publish its counters once per
+ * interval, keeps the instruction counts of the last WINDOW for the MIPS
+ * rate and answers `GET /metrics` on a TCP port. Asking a hart to publish
+ * only lowers its run limit, so a hart is never waited for and a scrape
+ * shows counts at most one interval old.
+ *
+ * The software TLB counts refills rather than hits, since counting hits would
+ * cost every load and store; the hit rate follows from the refills per
+ * instruction.
+ */
+class MetricsServer
+{
+public:
+    static constexpr std::chrono::seconds WINDOW{10}; ///< Span of the sliding MIPS window.
+
+    /**
+     * @brief Construct a new MetricsServer object and attach counters to every hart.
+     *
+     * @param machine The machine whose harts are observed.
+     * @param interval Time between publishes.
+     */
+    explicit MetricsServer(Machine &machine, std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+    /**
+     * @brief Stop serving and detach the counters from the harts.
+     */
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    /**
+     * @brief Listen on a port and start serving on a thread of its own.
+     *
+     * @param port TCP port to listen on, on every interface.
+     * @return true if successful, false otherwise.
+     */
+    bool start(uint16_t port);
+
+    /**
+     * @brief Stop serving and wait for the thread.
+     */
+    void stop();
+
+private:
+    /**
+     * @brief Instruction counts of every hart at one point in time.
+     */
+    struct Sample
+    {
+        std::chrono::steady_clock::time_point time; ///< When the sample was taken.
+        std::vector<uint64_t> instructions;         ///< Instructions retired by hart.
+    };
+
+    /**
+     * @brief Publish, sample and answer scrapes until stopped.
+     */
+    void serve();
+
+    /**
+     * @brief Ask every hart to publish its counters and sample the instruction counts.
+     */
+    void refresh();
+
+    /**
+     * @brief Answer one request on a connected socket, then close it.
+     *
+     * @param socket The connected socket.
+     */
+    void answer(int socket);
+
+    /**
+     * @brief Format the published counters.
+     *
+     * @return std::string The metrics in the Prometheus text exposition format.
+     */
+    std::string render() const;
+
+    Machine &machine;                              ///< The machine observed.
+    std::chrono::milliseconds interval;            ///< Time between publishes.
+    std::vector<HartMetrics> counters;             ///< Published counters by hart.
+    std::deque<Sample> samples;                    ///< Samples of the last WINDOW, oldest first.
+    std::chrono::steady_clock::time_point started; ///< When the server was created.
+    int listener = -1;                             ///< Listening socket.
+    std::atomic<bool> stopping{false};             ///< stop() was called.
+    std::thread thread;                            ///< Serving thread.
+};
+
+#endif
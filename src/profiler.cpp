@@ -0,0 +1,226 @@
+#include "profiler.h"
+#include "isa.h"
+#include "logger.h"
+#include "memory.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+/**
+ * @brief Get the name of the instruction in a decoded record.
+ *
+ * @param decoded The decoded instruction.
+ * @return const char* The mnemonic.
+ */
+const char *Profiler::mnemonic(const DecodedInstruction &decoded)
+{
+    return Isa::mnemonic(decoded.operation);
+}
+
+/**
+ * @brief Find the function symbol covering an address.
+ *
+ * @param address The address.
+ * @return const SymbolIndex::Symbol* The symbol, or nullptr if none covers it.
+ */
+const SymbolIndex::Symbol *Profiler::find_symbol(uint32_t address) const
+{
+    return symbols ? symbols->find_function(address) : nullptr;
+}
+
+/**
+ * @brief Describe an address as symbol+offset, with its source line if known.
+ *
+ * @param address The address.
+ * @return std::string The description, or an empty string without symbols.
+ */
+std::string Profiler::describe(uint32_t address) const
+{
+    const SymbolIndex::Symbol *symbol = find_symbol(address);
+    if (!symbol)
+    {
+        return "";
+    }
+    std::string where = std::string(symbol->name) + "+0x" + Memory::to_hex_string(address - symbol->address);
+    std::string file;
+    uint32_t line;
+    if (symbols->find_line(address, file, line))
+    {
+        where += " " + file + ":" + std::to_string(line);
+    }
+    return where;
+}
+
+/**
+ * @brief Write the sorted text report.
+ *
+ * @param filename Path to the report file.
+ * @param cache The decode cache the slots refer to.
+ * @return true if successful, false otherwise.
+ */
+bool Profiler::write_report(const std::string &filename, const DecodeCache &cache) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open profile report: " + filename);
+        return false;
+    }
+
+    /**
+     * @brief Totals for one instruction address.
+     */
+    struct PcTotals
+    {
+        uint64_t executed = 0;
+        uint64_t taken = 0;
+        const DecodedInstruction *decoded = nullptr;
+    };
+
+    uint64_t total = 0, loads = 0, stores = 0, branches = 0, branches_taken = 0;
+    std::map<std::string, uint64_t> mix;
+    std::map<uint32_t, PcTotals> by_pc;
+    uint32_t slots = std::min<uint32_t>(cache.get_slot_count(), static_cast<uint32_t>(executed.size()));
+    for (uint32_t slot = 0; slot < slots; ++slot)
+    {
+        if (executed[slot] == 0)
+        {
+            continue;
+        }
+
+        const DecodedInstruction &decoded = cache.get_slot_instruction(slot);
+        total += executed[slot];
+        mix[mnemonic(decoded)] += executed[slot];
+        if (decoded.opcode == Opcode::I_TYPE_LOAD)
+            loads += executed[slot];
+        else if (decoded.opcode == Opcode::S_TYPE)
+            stores += executed[slot];
+        else if (decoded.opcode == Opcode::B_TYPE)
+        {
+            branches += executed[slot];
+            branches_taken += taken[slot];
+        }
+
+        // Several slots map to the same PC once code has been invalidated
+        PcTotals &pc_totals = by_pc[cache.get_slot_pc(slot)];
+        pc_totals.executed += executed[slot];
+        pc_totals.taken += taken[slot];
+        pc_totals.decoded = &decoded;
+    }
+
+    auto percent = [total](uint64_t value)
+    { return total ? 100.0 * static_cast<double>(value) / static_cast<double>(total) : 0.0; };
+
+    file << "Instructions executed: " << total << '\n';
+    file << "Loads: " << loads << "  Stores: " << stores << '\n';
+    file << "Branches: " << branches << "  Taken: " << branches_taken << "  Not taken: " << branches - branches_taken << "\n\n";
+
+    std::vector<std::pair<std::string, uint64_t>> sorted_mix(mix.begin(), mix.end());
+    std::stable_sort(sorted_mix.begin(), sorted_mix.end(), [](const auto &a, const auto &b)
+              { return a.second > b.second; });
+    file << "Instruction mix:\n";
+    for (const auto &entry : sorted_mix)
+    {
+        file << "  " << std::left << std::setw(8) << entry.first << std::right << std::setw(14) << entry.second
+             << std::setw(9) << std::fixed << std::setprecision(2) << percent(entry.second) << "%\n";
+    }
+
+    std::vector<std::pair<uint32_t, PcTotals>> hot(by_pc.begin(), by_pc.end());
+    std::stable_sort(hot.begin(), hot.end(), [](const auto &a, const auto &b)
+              { return a.second.executed > b.second.executed; });
+    if (hot.size() > HOT_PC_COUNT)
+    {
+        hot.resize(HOT_PC_COUNT);
+    }
+    file << "\nHot PCs:\n";
+    for (const auto &entry : hot)
+    {
+        file << "  0x" << std::left << std::setw(10) << Memory::to_hex_string(entry.first)
+             << std::setw(8) << mnemonic(*entry.second.decoded) << std::right << std::setw(14) << entry.second.executed
+             << std::setw(9) << std::fixed << std::setprecision(2) << percent(entry.second.executed) << "%";
+        if (entry.second.decoded->opcode == Opcode::B_TYPE)
+        {
+            file << "  taken " << entry.second.taken << "/" << entry.second.executed;
+        }
+        std::string where = describe(entry.first);
+        if (!where.empty())
+        {
+            file << "  " << where;
+        }
+        file << '\n';
+    }
+
+    if (symbols && symbols->get_function_count() != 0)
+    {
+        std::map<std::string, uint64_t> by_symbol;
+        for (const auto &entry : by_pc)
+        {
+            const SymbolIndex::Symbol *symbol = find_symbol(entry.first);
+            by_symbol[symbol ? symbol->name : "[unknown]"] += entry.second.executed;
+        }
+        std::vector<std::pair<std::string, uint64_t>> sorted_symbols(by_symbol.begin(), by_symbol.end());
+        std::stable_sort(sorted_symbols.begin(), sorted_symbols.end(), [](const auto &a, const auto &b)
+                  { return a.second > b.second; });
+        file << "\nFunctions:\n";
+        for (const auto &entry : sorted_symbols)
+        {
+            file << "  " << std::left << std::setw(32) << entry.first << std::right << std::setw(14) << entry.second
+                 << std::setw(9) << std::fixed << std::setprecision(2) << percent(entry.second) << "%\n";
+        }
+    }
+
+    LOG_INFO("Profile report written to: " + filename);
+    return true;
+}
+
+/**
+ * @brief Get the execution count of each folded stack.
+ *
+ * @param cache The decode cache the slots refer to.
+ * @return std::map<std::string, uint64_t> Count by "symbol;mnemonic".
+ */
+std::map<std::string, uint64_t> Profiler::get_folded(const DecodeCache &cache) const
+{
+    std::map<std::string, uint64_t> stacks;
+    uint32_t slots = std::min<uint32_t>(cache.get_slot_count(), static_cast<uint32_t>(executed.size()));
+    for (uint32_t slot = 0; slot < slots; ++slot)
+    {
+        if (executed[slot] == 0)
+        {
+            continue;
+        }
+        const SymbolIndex::Symbol *symbol = find_symbol(cache.get_slot_pc(slot));
+        std::string frame = symbol ? symbol->name : "0x" + Memory::to_hex_string(cache.get_slot_pc(slot));
+        stacks[frame + ";" + mnemonic(cache.get_slot_instruction(slot))] += executed[slot];
+    }
+    return stacks;
+}
+
+/**
+ * @brief Write a folded-stack file for flamegraph tools.
+ *
+ * Each line is "symbol;mnemonic count", so a flame graph shows the time per
+ * guest function split by instruction.
+ *
+ * @param filename Path to the folded-stack file.
+ * @param cache The decode cache the slots refer to.
+ * @return true if successful, false otherwise.
+ */
+bool Profiler::write_folded(const std::string &filename, const DecodeCache &cache) const
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open folded-stack file: " + filename);
+        return false;
+    }
+
+    for (const auto &entry : get_folded(cache))
+    {
+        file << entry.first << ' ' << entry.second << '\n';
+    }
+
+    LOG_INFO("Folded stacks written to: " + filename);
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "decode_cache.h"
+#include "symbol_index.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Instruction-mix and hot-PC profiler.
+ *
+ * Counters are flat arrays indexed by decode cache slot, so counting an
+ * instruction is a single increment. Everything else (per-opcode mix,
+ * load/store counts, per-PC and per-symbol totals) is derived from the slot
+ * counters when the report is written.
+ */
+class Profiler
+{
+public:
+    static constexpr size_t HOT_PC_COUNT = 50; ///< Number of hot PCs in the report.
+
+    /**
+     * @brief Make room for the counters of a slot.
+     *
+     * @param slot The decode cache slot.
+     */
+    void ensure_slot(uint32_t slot)
+    {
+        if (slot >= executed.size())
+        {
+            executed.resize(slot + 1, 0);
+            taken.resize(slot + 1, 0);
+        }
+    }
+
+    /**
+     * @brief Count one execution of an instruction.
+     *
+     * @param slot The decode cache slot of the instruction.
+     */
+    void count(uint32_t slot) { ++executed[slot]; }
+
+    /**
+     * @brief Count one taken branch.
+     *
+     * @param slot The decode cache slot of the branch.
+     */
+    void count_taken(uint32_t slot) { ++taken[slot]; }
+
+    /**
+     * @brief Take function symbols and line information from an ELF file.
+     *
+     * The file is only read when a report is written.
+     *
+     * @param filename Path to the ELF file.
+     */
+    void load_symbols(const std::string &filename) { symbols = std::make_shared<SymbolIndex>(filename); }
+
+    /**
+     * @brief Share the symbols of an already loaded ELF file.
+     *
+     * @param index The symbol index, nullptr for none.
+     */
+    void set_symbols(std::shared_ptr<const SymbolIndex> index) { symbols = std::move(index); }
+
+    /**
+     * @brief Write the sorted text report.
+     *
+     * @param filename Path to the report file.
+     * @param cache The decode cache the slots refer to.
+     * @return true if successful, false otherwise.
+     */
+    bool write_report(const std::string &filename, const DecodeCache &cache) const;
+
+    /**
+     * @brief Get the execution count of each folded stack.
+     *
+     * Counts from several runs can be summed and written as one folded-stack file.
+     *
+     * @param cache The decode cache the slots refer to.
+     * @return std::map<std::string, uint64_t> Count by "symbol;mnemonic".
+     */
+    std::map<std::string, uint64_t> get_folded(const DecodeCache &cache) const;
+
+    /**
+     * @brief Write a folded-stack file for flamegraph tools.
+     *
+     * @param filename Path to the folded-stack file.
+     * @param cache The decode cache the slots refer to.
+     * @return true if successful, false otherwise.
+     */
+    bool write_folded(const std::string &filename, const DecodeCache &cache) const;
+
+    /**
+     * @brief Get the name of the instruction in a decoded record.
+     *
+     * @param decoded The decoded instruction.
+     * @return const char* The mnemonic.
+     */
+    static const char *mnemonic(const DecodedInstruction &decoded);
+
+private:
+    const SymbolIndex::Symbol *find_symbol(uint32_t address) const;
+    std::string describe(uint32_t address) const;
+
+    std::vector<uint64_t> executed;              ///< Executions by slot.
+    std::vector<uint64_t> taken;                 ///< Taken branches by slot.
+    std::shared_ptr<const SymbolIndex> symbols;  ///< Symbols of the program, nullptr if none.
+};
+
+#endif
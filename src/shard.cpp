@@ -0,0 +1,623 @@
+#include "shard.h"
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <numeric>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+
+/**
+ * @brief Read one line from a socket.
+ *
+ * @param socket The socket.
+ * @param input Bytes received earlier and not yet returned; updated.
+ * @param line Receives the line without its newline.
+ * @return true if successful, false once the connection is closed.
+ */
+bool read_line(int socket, std::string &input, std::string &line)
+{
+    size_t end;
+    while ((end = input.find('\n')) == std::string::npos)
+    {
+        char buffer[65536];
+        ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        input.append(buffer, static_cast<size_t>(received));
+    }
+    line.assign(input, 0, end);
+    input.erase(0, end + 1);
+    return true;
+}
+
+/**
+ * @brief Send bytes on a socket.
+ *
+ * @param socket The socket.
+ * @param data The bytes.
+ * @return true if successful, false if the connection dropped.
+ */
+bool write_all(int socket, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t written = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+/**
+ * @brief Split a line at tabs.
+ *
+ * @param line The line.
+ * @return std::vector<std::string> The fields.
+ */
+std::vector<std::string> split_fields(const std::string &line)
+{
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, '\t'))
+    {
+        fields.push_back(field);
+    }
+    if (!line.empty() && line.back() == '\t')
+    {
+        fields.emplace_back();
+    }
+    return fields;
+}
+
+/**
+ * @brief Make text safe to send as one tab-separated field.
+ *
+ * @param text The text.
+ * @return std::string The text with tabs and line breaks replaced by spaces.
+ */
+std::string to_field(std::string text)
+{
+    std::replace_if(text.begin(), text.end(), [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+    return text;
+}
+
+} // namespace
+
+/**
+ * @brief Construct a new ShardWorker object.
+ *
+ * @param thread_count Number of host threads per shard, 0 for one per host core.
+ */
+ShardWorker::ShardWorker(size_t thread_count)
+    : thread_count(thread_count ? thread_count : std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+/**
+ * @brief Accept coordinators one after another and serve their shards.
+ *
+ * @param port TCP port to listen on, on every interface.
+ * @return false, after logging why the port could not be opened.
+ */
+bool ShardWorker::serve(uint16_t port)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    int reuse = 1;
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0)
+    {
+        LOG_ERROR("Error: Cannot listen for coordinators on port " + std::to_string(port));
+        if (listener >= 0)
+        {
+            close(listener);
+        }
+        return false;
+    }
+
+    LOG_INFO("Serving batch shards on port " + std::to_string(port) + " with " + std::to_string(thread_count) + " threads");
+    while (true)
+    {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection >= 0)
+        {
+            serve_connection(connection);
+        }
+    }
+}
+
+/**
+ * @brief Serve one shard on a connected socket, then close it.
+ *
+ * @param socket The connected socket.
+ * @return true if the shard ran and every result was sent, false otherwise.
+ */
+bool ShardWorker::serve_connection(int socket)
+{
+    std::string input;
+    std::string line;
+    bool connected = write_all(socket, "phlego-worker " + std::to_string(PROTOCOL_VERSION) + " " +
+                                           std::to_string(thread_count) + "\n");
+
+    // The whole shard arrives before anything runs
+    Engine engine = Engine::PIPELINE;
+    bool profiling = false;
+    bool complete = false;
+    std::vector<std::pair<size_t, std::string>> lines;
+    while (connected && !complete && read_line(socket, input, line))
+    {
+        if (line == "run")
+        {
+            complete = true;
+        }
+        else if (line == "engine block" || line == "engine pipeline")
+        {
+            engine = line == "engine block" ? Engine::BLOCK : Engine::PIPELINE;
+        }
+        else if (line == "profile")
+        {
+            profiling = true;
+        }
+        else if (line.rfind("job ", 0) == 0)
+        {
+            size_t split = line.find(' ', 4);
+            lines.emplace_back(std::strtoul(line.c_str() + 4, nullptr, 10),
+                               split == std::string::npos ? "" : line.substr(split + 1));
+        }
+    }
+    if (!complete)
+    {
+        LOG_ERROR("Error: Coordinator disconnected before sending its shard");
+        close(socket);
+        return false;
+    }
+
+    BatchRunner shard(engine, 0);
+    std::vector<size_t> indices;
+    std::string rejected;
+    for (const auto &job : lines)
+    {
+        if (shard.add_job(job.second, std::to_string(job.first)))
+        {
+            indices.push_back(job.first);
+        }
+        else
+        {
+            rejected += "result " + std::to_string(job.first) + "\terror\t0\t0\t0\tinvalid job\n";
+        }
+    }
+    connected = write_all(socket, rejected);
+
+    // Results go back as jobs finish, from whichever pool thread ran them
+    std::mutex send_mutex;
+    shard.set_profiling(profiling);
+    shard.set_result_callback([&](size_t local)
+    {
+        const BatchResult &result = shard.get_results()[local];
+        std::string index = std::to_string(indices[local]);
+        std::ostringstream message;
+        for (const auto &entry : result.profile)
+        {
+            message << "profile " << index << '\t' << entry.first << '\t' << entry.second << '\n';
+        }
+        message << "result " << index << '\t' << result.status << '\t' << result.exit_code << '\t'
+                << result.instructions << '\t' << result.seconds << '\t' << to_field(result.error) << '\n';
+        std::lock_guard<std::mutex> lock(send_mutex);
+        connected = connected && write_all(socket, message.str());
+    });
+    shard.run(thread_count);
+
+    connected = connected && write_all(socket, "done\n");
+    close(socket);
+    LOG_INFO("Served a shard of " + std::to_string(lines.size()) + " jobs");
+    return connected;
+}
+
+/**
+ * @brief Construct a new ShardCoordinator object.
+ *
+ * @param batch The batch to split; receives the merged results.
+ * @param engine The execution engine the workers use.
+ */
+ShardCoordinator::ShardCoordinator(BatchRunner &batch, Engine engine)
+    : batch(batch), engine(engine)
+{
+}
+
+/**
+ * @brief Close the worker sockets and reap local workers.
+ */
+ShardCoordinator::~ShardCoordinator()
+{
+    for (Worker &worker : workers)
+    {
+        if (worker.socket >= 0)
+        {
+            close(worker.socket);
+        }
+        if (worker.pid > 0)
+        {
+            waitpid(worker.pid, nullptr, 0);
+        }
+    }
+}
+
+/**
+ * @brief Read the instructions retired by each job from an earlier results file.
+ *
+ * @param filename Path of a results file written by batch or coordinator mode.
+ * @return true if successful, false otherwise.
+ */
+bool ShardCoordinator::load_history(const std::string &filename)
+{
+    std::ifstream file(filename);
+    std::string line;
+    if (!file.is_open() || !std::getline(file, line))
+    {
+        LOG_ERROR("Error: Cannot read history file: " + filename);
+        return false;
+    }
+
+    // Columns are found by name, so files from older versions still work
+    std::vector<std::string> header = split_fields(line);
+    auto column = [&header](const std::string &name)
+    { return static_cast<size_t>(std::find(header.begin(), header.end(), name) - header.begin()); };
+    size_t job = column("job"), elf = column("elf"), status = column("status"), instructions = column("instructions");
+    size_t needed = std::max({job, elf, status, instructions});
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields = split_fields(line);
+        if (needed >= fields.size() || fields[status] == "error")
+        {
+            continue;
+        }
+        history[fields[job] + '\t' + fields[elf]] = std::strtoull(fields[instructions].c_str(), nullptr, 10);
+    }
+    LOG_INFO("Loaded instruction counts of " + std::to_string(history.size()) + " jobs from: " + filename);
+    return true;
+}
+
+/**
+ * @brief Connect to a worker started with --serve-batch.
+ *
+ * @param address The worker as host:port.
+ * @return true if connected, false otherwise.
+ */
+bool ShardCoordinator::add_remote(const std::string &address)
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+    {
+        LOG_ERROR("Error: Worker address must be host:port: " + address);
+        return false;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &found) != 0)
+    {
+        LOG_ERROR("Error: Cannot resolve worker: " + address);
+        return false;
+    }
+    int connection = -1;
+    for (addrinfo *candidate = found; candidate && connection < 0; candidate = candidate->ai_next)
+    {
+        connection = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (connection >= 0 && connect(connection, candidate->ai_addr, candidate->ai_addrlen) != 0)
+        {
+            close(connection);
+            connection = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (connection < 0)
+    {
+        LOG_ERROR("Error: Cannot connect to worker: " + address);
+        return false;
+    }
+
+    Worker worker;
+    worker.name = address;
+    worker.socket = connection;
+    workers.push_back(std::move(worker));
+    return true;
+}
+
+/**
+ * @brief Fork worker processes on this host.
+ *
+ * @param count Number of processes.
+ * @param thread_count Host threads per process, 0 to split the host cores between them.
+ * @return true if successful, false otherwise.
+ */
+bool ShardCoordinator::spawn_local(size_t count, size_t thread_count)
+{
+    if (thread_count == 0)
+    {
+        thread_count = std::max<size_t>(1, std::thread::hardware_concurrency() / count);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        int ends[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0)
+        {
+            LOG_ERROR("Error: Cannot create a socket for a local worker");
+            return false;
+        }
+        // Buffered output would otherwise be written again by the child
+        Logger::flush();
+        std::fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            close(ends[0]);
+            close(ends[1]);
+            LOG_ERROR("Error: Cannot start a local worker");
+            return false;
+        }
+        if (pid == 0)
+        {
+            // The child only keeps its own end, so a lost coordinator reads as end of file
+            close(ends[0]);
+            for (const Worker &worker : workers)
+            {
+                close(worker.socket);
+            }
+            bool served = ShardWorker(thread_count).serve_connection(ends[1]);
+            // _exit skips the destructor that flushes the log at exit
+            Logger::flush();
+            _exit(served ? 0 : 1);
+        }
+
+        close(ends[1]);
+        Worker worker;
+        worker.name = "local" + std::to_string(i);
+        worker.socket = ends[0];
+        worker.pid = pid;
+        workers.push_back(std::move(worker));
+    }
+    return true;
+}
+
+/**
+ * @brief Get the expected cost of each job.
+ *
+ * @return std::vector<double> Expected instructions by job.
+ */
+std::vector<double> ShardCoordinator::estimate_costs() const
+{
+    const std::vector<BatchJob> &jobs = batch.get_jobs();
+    std::vector<double> costs(jobs.size(), 0.0);
+    std::vector<char> known(jobs.size(), 0);
+    double known_total = 0.0;
+    size_t known_count = 0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        auto it = history.find(jobs[i].name + '\t' + jobs[i].elf_path);
+        if (it != history.end())
+        {
+            // The limit may have been lowered since
+            uint64_t instructions = jobs[i].max_instructions ? std::min(it->second, jobs[i].max_instructions) : it->second;
+            costs[i] = static_cast<double>(std::max<uint64_t>(instructions, 1));
+            known[i] = 1;
+            known_total += costs[i];
+            ++known_count;
+        }
+    }
+
+    // New jobs are assumed to be typical, or all alike without any history
+    double typical = known_count ? known_total / static_cast<double>(known_count) : 1.0;
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        if (!known[i])
+        {
+            costs[i] = jobs[i].max_instructions ? std::min(typical, static_cast<double>(jobs[i].max_instructions)) : typical;
+        }
+    }
+    return costs;
+}
+
+/**
+ * @brief Deal the jobs out to the workers.
+ *
+ * @param costs Expected instructions by job.
+ */
+void ShardCoordinator::assign(const std::vector<double> &costs)
+{
+    std::vector<size_t> order(costs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&costs](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+    // Longest first, each to the worker whose threads would be done with it soonest
+    for (size_t index : order)
+    {
+        Worker *best = nullptr;
+        double best_finish = 0.0;
+        for (Worker &worker : workers)
+        {
+            if (worker.thread_count == 0)
+            {
+                continue;
+            }
+            double finish = (worker.cost + costs[index]) / static_cast<double>(worker.thread_count);
+            if (!best || finish < best_finish)
+            {
+                best = &worker;
+                best_finish = finish;
+            }
+        }
+        best->jobs.push_back(index);
+        best->cost += costs[index];
+    }
+}
+
+/**
+ * @brief Send a worker its shard and collect its results.
+ *
+ * @param worker The worker.
+ * @param results Receives the result of each job it reports.
+ * @param reported Set for each job it reports.
+ */
+void ShardCoordinator::drive(Worker &worker, std::vector<BatchResult> &results, std::vector<char> &reported)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::string shard = std::string("engine ") + (engine == Engine::BLOCK ? "block" : "pipeline") + "\n";
+    if (batch.is_profiling())
+    {
+        shard += "profile\n";
+    }
+    for (size_t index : worker.jobs)
+    {
+        shard += "job " + std::to_string(index) + " " + BatchRunner::format_job(batch.get_jobs()[index]) + "\n";
+    }
+    shard += "run\n";
+    if (!write_all(worker.socket, shard))
+    {
+        LOG_ERROR("Error: Lost worker " + worker.name + " while sending its shard");
+        return;
+    }
+
+    // Each index belongs to one worker, so the threads never write the same result
+    std::string line;
+    size_t count = 0;
+    uint64_t instructions = 0;
+    bool done = false;
+    while (!done && read_line(worker.socket, worker.input, line))
+    {
+        size_t split = line.find(' ');
+        std::string kind = line.substr(0, split);
+        if (kind == "done")
+        {
+            done = true;
+            continue;
+        }
+        if (split == std::string::npos)
+        {
+            continue;
+        }
+        std::vector<std::string> fields = split_fields(line.substr(split + 1));
+        size_t index = fields.empty() ? results.size() : std::strtoul(fields[0].c_str(), nullptr, 10);
+        if (index >= results.size())
+        {
+            continue;
+        }
+        if (kind == "profile" && fields.size() == 3)
+        {
+            results[index].profile[fields[1]] += std::strtoull(fields[2].c_str(), nullptr, 10);
+        }
+        else if (kind == "result" && fields.size() == 6)
+        {
+            BatchResult &result = results[index];
+            result.status = fields[1];
+            result.exit_code = static_cast<uint32_t>(std::strtoul(fields[2].c_str(), nullptr, 10));
+            result.instructions = std::strtoull(fields[3].c_str(), nullptr, 10);
+            result.seconds = std::strtod(fields[4].c_str(), nullptr);
+            result.error = fields[5];
+            reported[index] = 1;
+            instructions += result.instructions;
+            ++count;
+            LOG_DEBUG("Job " + batch.get_jobs()[index].name + " finished on " + worker.name + ": " + result.status);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("Worker " + worker.name + " ran " + std::to_string(count) + " of " + std::to_string(worker.jobs.size()) +
+             " jobs, " + std::to_string(instructions) + " instructions (" +
+             std::to_string(static_cast<uint64_t>(worker.cost)) + " expected) in " + std::to_string(seconds) + " s");
+    if (!done)
+    {
+        LOG_ERROR("Error: Lost worker " + worker.name);
+    }
+}
+
+/**
+ * @brief Run every job on the workers and store the results in the batch.
+ *
+ * @return true if at least one worker took part, false otherwise.
+ */
+bool ShardCoordinator::run()
+{
+    // Workers that do not greet with the right protocol are left out
+    bool any = false;
+    for (Worker &worker : workers)
+    {
+        std::string line;
+        std::istringstream greeting(read_line(worker.socket, worker.input, line) ? line : "");
+        std::string tag;
+        int version = 0;
+        greeting >> tag >> version >> worker.thread_count;
+        if (tag != "phlego-worker" || version != ShardWorker::PROTOCOL_VERSION || worker.thread_count == 0)
+        {
+            LOG_ERROR("Error: Worker " + worker.name + " did not answer as a phlego worker");
+            worker.thread_count = 0;
+            continue;
+        }
+        any = true;
+    }
+    if (!any)
+    {
+        LOG_ERROR("Error: No workers to run the batch on");
+        return false;
+    }
+    assign(estimate_costs());
+
+    const std::vector<BatchJob> &jobs = batch.get_jobs();
+    std::vector<BatchResult> results(jobs.size());
+    std::vector<char> reported(jobs.size(), 0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (Worker &worker : workers)
+    {
+        if (!worker.jobs.empty())
+        {
+            threads.emplace_back([this, &worker, &results, &reported] { drive(worker, results, reported); });
+        }
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    // Jobs a lost worker never reported fail rather than vanish from the results
+    for (const Worker &worker : workers)
+    {
+        for (size_t index : worker.jobs)
+        {
+            if (!reported[index])
+            {
+                results[index] = BatchResult();
+                results[index].error = "worker " + worker.name + " disconnected";
+            }
+        }
+    }
+    batch.set_results(std::move(results));
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO("Ran " + std::to_string(jobs.size()) + " jobs on " + std::to_string(threads.size()) + " workers in " +
+             std::to_string(seconds) + " s");
+    return true;
+}
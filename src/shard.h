@@ -0,0 +1,172 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "batch.h"
+#include "machine.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Serves shards of a batch to a coordinator over a socket.
+ *
+ * A worker runs each shard it receives on its own BatchRunner and streams
+ * every result back as soon as the job finishes, so the coordinator sees
+ * progress and keeps the results of a worker that is lost midway.
+ *
+ * The protocol is line based. The worker greets with
+ * `phlego-worker <version> <threads>`. The coordinator sends `engine <name>`,
+ * optionally `profile`, one `job <index> <manifest line>` per job and then
+ * `run`. The worker answers with `profile <index>\t<stack>\t<count>` lines
+ * and one `result <index>\t<status>\t<exit_code>\t<instructions>\t<seconds>\t<error>`
+ * line per job, followed by `done`. Paths in the manifest lines are opened
+ * by the worker, so remote nodes need the same files at the same paths.
+ */
+class ShardWorker
+{
+public:
+    static constexpr int PROTOCOL_VERSION = 1; ///< Version sent in the greeting.
+
+    /**
+     * @brief Construct a new ShardWorker object.
+     *
+     * @param thread_count Number of host threads per shard, 0 for one per host core.
+     */
+    explicit ShardWorker(size_t thread_count);
+
+    /**
+     * @brief Accept coordinators one after another and serve their shards.
+     *
+     * Only returns if the port cannot be opened.
+     *
+     * @param port TCP port to listen on, on every interface.
+     * @return false, after logging why the port could not be opened.
+     */
+    bool serve(uint16_t port);
+
+    /**
+     * @brief Serve one shard on a connected socket, then close it.
+     *
+     * @param socket The connected socket.
+     * @return true if the shard ran and every result was sent, false otherwise.
+     */
+    bool serve_connection(int socket);
+
+private:
+    size_t thread_count; ///< Host threads per shard.
+};
+
+/**
+ * @brief Splits a batch across worker processes and nodes and merges their results.
+ *
+ * Jobs are dealt out by their expected cost rather than by count: the
+ * instructions each job retired in an earlier results file, or the mean of
+ * the known jobs for new ones. The most expensive jobs are placed first,
+ * each on the worker that would finish it soonest given its thread count,
+ * so one long job does not leave the other workers idle at the end.
+ * Within a worker the work-stealing pool evens out the remaining error.
+ *
+ * Jobs whose worker disconnects before reporting them fail with an error
+ * naming the worker.
+ */
+class ShardCoordinator
+{
+public:
+    /**
+     * @brief Construct a new ShardCoordinator object.
+     *
+     * @param batch The batch to split; receives the merged results.
+     * @param engine The execution engine the workers use.
+     */
+    ShardCoordinator(BatchRunner &batch, Engine engine);
+
+    /**
+     * @brief Close the worker sockets and reap local workers.
+     */
+    ~ShardCoordinator();
+
+    ShardCoordinator(const ShardCoordinator &) = delete;
+    ShardCoordinator &operator=(const ShardCoordinator &) = delete;
+
+    /**
+     * @brief Read the instructions retired by each job from an earlier results file.
+     *
+     * @param filename Path of a results file written by batch or coordinator mode.
+     * @return true if successful, false otherwise.
+     */
+    bool load_history(const std::string &filename);
+
+    /**
+     * @brief Connect to a worker started with --serve-batch.
+     *
+     * @param address The worker as host:port.
+     * @return true if connected, false otherwise.
+     */
+    bool add_remote(const std::string &address);
+
+    /**
+     * @brief Fork worker processes on this host.
+     *
+     * Must be called before the process starts other threads.
+     *
+     * @param count Number of processes.
+     * @param thread_count Host threads per process, 0 to split the host cores between them.
+     * @return true if successful, false otherwise.
+     */
+    bool spawn_local(size_t count, size_t thread_count);
+
+    /**
+     * @brief Run every job on the workers and store the results in the batch.
+     *
+     * @return true if at least one worker took part, false otherwise.
+     */
+    bool run();
+
+private:
+    /**
+     * @brief A connected worker.
+     */
+    struct Worker
+    {
+        std::string name;         ///< host:port, or local and an index.
+        int socket = -1;          ///< Connection to the worker.
+        pid_t pid = -1;           ///< Process id of a local worker.
+        size_t thread_count = 0;  ///< Threads the worker runs jobs on.
+        std::vector<size_t> jobs; ///< Indices of the jobs dealt to it.
+        double cost = 0.0;        ///< Expected instructions of those jobs.
+        std::string input;        ///< Bytes received but not yet split into lines.
+    };
+
+    /**
+     * @brief Get the expected cost of each job.
+     *
+     * @return std::vector<double> Expected instructions by job.
+     */
+    std::vector<double> estimate_costs() const;
+
+    /**
+     * @brief Deal the jobs out to the workers.
+     *
+     * @param costs Expected instructions by job.
+     */
+    void assign(const std::vector<double> &costs);
+
+    /**
+     * @brief Send a worker its shard and collect its results.
+     *
+     * @param worker The worker.
+     * @param results Receives the result of each job it reports.
+     * @param reported Set for each job it reports.
+     */
+    void drive(Worker &worker, std::vector<BatchResult> &results, std::vector<char> &reported);
+
+    BatchRunner &batch;                                ///< The batch being split.
+    Engine engine;                                     ///< Engine the workers use.
+    std::vector<Worker> workers;                       ///< Connected workers.
+    std::unordered_map<std::string, uint64_t> history; ///< Instructions by job name and ELF path.
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "snapshot.h"
+#include "logger.h"
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr char SNAPSHOT_MAGIC[8] = {'P', 'H', 'L', 'E', 'G', 'O', 'S', 'N'};
+constexpr uint32_t SNAPSHOT_VERSION = 8;
+
+/**
+ * @brief Fixed header at the start of a snapshot file.
+ *
+ * The hart state follows the header, then the guest page numbers, then the
+ * page contents starting at data_offset.
+ */
+struct SnapshotHeader
+{
+    char magic[8];             ///< SNAPSHOT_MAGIC.
+    uint32_t version;          ///< SNAPSHOT_VERSION.
+    uint32_t page_size;        ///< Memory::PAGE_SIZE of the writer.
+    uint32_t state_size;       ///< Size of the hart state, differs between builds.
+    uint32_t page_count;       ///< Number of stored pages.
+    uint32_t initial_address;  ///< Entry point of the loaded program.
+    uint32_t tohost_address;   ///< Address of tohost, 0 if unused.
+    MemoryLayout layout;       ///< Memory layout of the loaded program.
+    uint64_t data_offset;      ///< File offset of the first page, page aligned.
+};
+
+/**
+ * @brief Round a file offset up to the next page boundary.
+ *
+ * @param offset The offset.
+ * @return uint64_t The aligned offset.
+ */
+uint64_t align_to_page(uint64_t offset)
+{
+    return (offset + Memory::PAGE_MASK) & ~static_cast<uint64_t>(Memory::PAGE_MASK);
+}
+
+} // namespace
+
+/**
+ * @brief Capture the state of a hart that is not running.
+ *
+ * @param cpu The hart; its memory becomes copy-on-write shared with the snapshot.
+ */
+void Snapshot::capture(CPU &cpu)
+{
+    hart.pc = cpu.pc;
+    std::memcpy(hart.registers, cpu.registers, sizeof(hart.registers));
+    std::memcpy(hart.float_registers, cpu.float_registers, sizeof(hart.float_registers));
+    hart.fcsr = cpu.fcsr;
+    hart.mstatus = cpu.mstatus;
+    hart.mie = cpu.mie;
+    hart.mtvec = cpu.mtvec;
+    hart.mscratch = cpu.mscratch;
+    hart.mepc = cpu.mepc;
+    hart.mcause = cpu.mcause;
+    hart.mtval = cpu.mtval;
+    hart.latches = cpu.latches;
+    hart.pipeline_stats = cpu.pipeline_stats;
+    hart.instructions_retired = cpu.instructions_retired;
+    hart.halt_reason = cpu.halt_reason;
+    hart.exit_code = cpu.exit_code;
+    hart.tohost_address = cpu.tohost_address;
+    hart.reservation_address = cpu.reservation_address;
+    hart.reservation_value = cpu.reservation_value;
+    hart.reservation_valid = cpu.reservation_valid;
+
+    image.fork_from(cpu.memory.get_memory());
+    LOG_INFO("Captured snapshot of hart " + std::to_string(cpu.hart_id) + " at pc 0x" + Memory::to_hex_string(hart.pc) +
+             " with " + std::to_string(image.get_page_count()) + " pages");
+}
+
+/**
+ * @brief Load the captured state into a hart that is not running.
+ *
+ * @param cpu The hart to restore into.
+ */
+void Snapshot::restore(CPU &cpu) const
+{
+    cpu.memory.get_memory().load_from_image(image);
+    cpu.memory.flush();
+    cpu.decode_cache.clear();
+
+    cpu.pc = hart.pc;
+    std::memcpy(cpu.registers, hart.registers, sizeof(hart.registers));
+    std::memcpy(cpu.float_registers, hart.float_registers, sizeof(cpu.float_registers));
+    cpu.fcsr = hart.fcsr;
+    cpu.mstatus = hart.mstatus;
+    cpu.mie = hart.mie;
+    cpu.mtvec = hart.mtvec;
+    cpu.mscratch = hart.mscratch;
+    cpu.mepc = hart.mepc;
+    cpu.mcause = hart.mcause;
+    cpu.mtval = hart.mtval;
+    cpu.latches = hart.latches;
+    cpu.pipeline_stats = hart.pipeline_stats;
+    cpu.instructions_retired = hart.instructions_retired;
+    cpu.exit_code = hart.exit_code;
+    cpu.tohost_address = hart.tohost_address;
+    cpu.reservation_address = hart.reservation_address;
+    cpu.reservation_value = hart.reservation_value;
+    cpu.reservation_valid = hart.reservation_valid;
+
+    // Being cut short is not a final halt, the restored hart carries on
+    bool resumable = hart.halt_reason == HaltReason::LIMIT || hart.halt_reason == HaltReason::STOPPED;
+    cpu.halt_reason = resumable ? HaltReason::NONE : hart.halt_reason;
+    cpu.run_limit.store(cpu.is_halted() ? 0 : UINT64_MAX, std::memory_order_relaxed);
+    cpu.set_instruction_limit(cpu.instruction_limit);
+}
+
+/**
+ * @brief Write the snapshot to a file.
+ *
+ * @param filename Path of the snapshot file.
+ * @return true if successful, false otherwise.
+ */
+bool Snapshot::save(const std::string &filename) const
+{
+    static_assert(std::is_trivially_copyable<HartState>::value, "Hart state is written as raw bytes");
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open snapshot file: " + filename);
+        return false;
+    }
+
+    // Collect the present pages in address order
+    std::vector<uint32_t> page_numbers;
+    std::vector<const uint8_t *> pages;
+    for (uint32_t high = 0; high < Memory::TABLE_SIZE; ++high)
+    {
+        const Memory::PageTable *table = image.directory[high].load(std::memory_order_acquire);
+        if (!table)
+        {
+            continue;
+        }
+        for (uint32_t index = 0; index < Memory::TABLE_SIZE; ++index)
+        {
+            const uint8_t *host = table->hosts[index].load(std::memory_order_acquire);
+            if (host)
+            {
+                page_numbers.push_back((high << Memory::TABLE_SHIFT) | index);
+                pages.push_back(host);
+            }
+        }
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.page_size = Memory::PAGE_SIZE;
+    header.state_size = sizeof(HartState);
+    header.page_count = static_cast<uint32_t>(page_numbers.size());
+    header.initial_address = image.initial_address;
+    header.tohost_address = image.tohost_address;
+    header.layout = image.layout;
+    uint64_t index_end = sizeof(header) + sizeof(HartState) + page_numbers.size() * sizeof(uint32_t);
+    header.data_offset = align_to_page(index_end);
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(&hart), sizeof(hart));
+    file.write(reinterpret_cast<const char *>(page_numbers.data()), page_numbers.size() * sizeof(uint32_t));
+    std::vector<char> padding(header.data_offset - index_end, 0);
+    file.write(padding.data(), padding.size());
+    for (const uint8_t *page : pages)
+    {
+        file.write(reinterpret_cast<const char *>(page), Memory::PAGE_SIZE);
+    }
+
+    if (!file)
+    {
+        LOG_ERROR("Error: Failed to write snapshot file: " + filename);
+        return false;
+    }
+    LOG_INFO("Saved snapshot with " + std::to_string(pages.size()) + " pages to: " + filename);
+    return true;
+}
+
+/**
+ * @brief Read a snapshot from a file, mapping its pages lazily.
+ *
+ * @param filename Path of the snapshot file.
+ * @return true if successful, false otherwise.
+ */
+bool Snapshot::load(const std::string &filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0)
+    {
+        LOG_ERROR("Error: Cannot open snapshot file: " + filename);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    // The mapping stays alive as long as any memory still shares one of its pages
+    size_t length = static_cast<size_t>(file_stat.st_size);
+    void *base = length >= sizeof(SnapshotHeader) ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        LOG_ERROR("Error: Cannot map snapshot file: " + filename);
+        return false;
+    }
+    std::shared_ptr<uint8_t> mapping(static_cast<uint8_t *>(base), [length](uint8_t *address) { munmap(address, length); });
+
+    SnapshotHeader header;
+    std::memcpy(&header, mapping.get(), sizeof(header));
+    uint64_t index_end = sizeof(header) + sizeof(HartState) + static_cast<uint64_t>(header.page_count) * sizeof(uint32_t);
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.page_size != Memory::PAGE_SIZE || header.state_size != sizeof(HartState) ||
+        header.data_offset < index_end || (header.data_offset & Memory::PAGE_MASK) != 0 ||
+        header.data_offset + static_cast<uint64_t>(header.page_count) * Memory::PAGE_SIZE > length)
+    {
+        LOG_ERROR("Error: Not a snapshot written by this build: " + filename);
+        return false;
+    }
+
+    std::memcpy(&hart, mapping.get() + sizeof(header), sizeof(hart));
+    const uint8_t *index = mapping.get() + sizeof(header) + sizeof(HartState);
+
+    // Pages are mapped, not read: the host faults them in on first access
+    image.clear();
+    uint8_t *data = mapping.get() + header.data_offset;
+    for (uint32_t i = 0; i < header.page_count; ++i)
+    {
+        uint32_t page_number;
+        std::memcpy(&page_number, index + i * sizeof(uint32_t), sizeof(page_number));
+        image.map_page(page_number << Memory::PAGE_SHIFT, std::shared_ptr<uint8_t>(mapping, data + static_cast<size_t>(i) * Memory::PAGE_SIZE));
+    }
+    image.initial_address = header.initial_address;
+    image.tohost_address = header.tohost_address;
+    image.layout = header.layout;
+
+    LOG_INFO("Loaded snapshot with " + std::to_string(header.page_count) + " pages from: " + filename);
+    return true;
+}
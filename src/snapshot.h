@@ -0,0 +1,93 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "cpu.h"
+#include "memory.h"
+#include <string>
+
+/**
+ * @brief Saved state of one hart and its memory.
+ *
+ * Capturing a hart is an in-process fork: the snapshot takes a
+ * copy-on-write clone of the hart's memory, so the hart can run on while
+ * the snapshot keeps the pages as they were. Restoring maps the same pages
+ * copy-on-write into the target memory, so any number of runs can start
+ * from one snapshot for the cost of their page-table entries.
+ *
+ * Snapshots can be saved to disk. The file holds a fixed header with the
+ * architectural state and pipeline latches, an index of guest page numbers
+ * and then the page contents, each page aligned to the host page size, so
+ * loading maps the file and pages are only read when the guest touches them.
+ * Only pages present in the address space are stored. The file is only
+ * meant to be read by the same build on the same host.
+ */
+class Snapshot
+{
+public:
+    /**
+     * @brief Capture the state of a hart that is not running.
+     *
+     * @param cpu The hart; its memory becomes copy-on-write shared with the snapshot.
+     */
+    void capture(CPU &cpu);
+
+    /**
+     * @brief Load the captured state into a hart that is not running.
+     *
+     * The address space of the hart's memory is replaced. A hart stopped by
+     * the instruction limit or by another hart resumes where it stopped; the
+     * retired instruction count carries on from the snapshot.
+     *
+     * @param cpu The hart to restore into.
+     */
+    void restore(CPU &cpu) const;
+
+    /**
+     * @brief Write the snapshot to a file.
+     *
+     * @param filename Path of the snapshot file.
+     * @return true if successful, false otherwise.
+     */
+    bool save(const std::string &filename) const;
+
+    /**
+     * @brief Read a snapshot from a file, mapping its pages lazily.
+     *
+     * @param filename Path of the snapshot file.
+     * @return true if successful, false otherwise.
+     */
+    bool load(const std::string &filename);
+
+private:
+    /**
+     * @brief Architectural and pipeline state of a hart.
+     */
+    struct HartState
+    {
+        uint32_t pc = 0;                                  ///< Program counter.
+        uint32_t registers[32] = {};                      ///< Integer registers.
+        uint32_t float_registers[32] = {};                ///< Floating-point registers.
+        uint32_t fcsr = 0;                                ///< Floating-point control and status.
+        uint32_t mstatus = 0;                             ///< Machine status.
+        uint32_t mie = 0;                                 ///< Enabled interrupts.
+        uint32_t mtvec = 0;                               ///< Trap handler.
+        uint32_t mscratch = 0;                            ///< Scratch register for the trap handler.
+        uint32_t mepc = 0;                                ///< Address the last trap interrupted.
+        uint32_t mcause = 0;                              ///< Cause of the last trap.
+        uint32_t mtval = 0;                               ///< Faulting address or instruction of the last trap.
+        Pipeline latches;                                 ///< Pipeline latches.
+        PipelineStats pipeline_stats;                     ///< Cycle counts so far.
+        uint64_t instructions_retired = 0;                ///< Instructions retired.
+        HaltReason halt_reason = HaltReason::NONE;        ///< Why the hart stopped.
+        uint32_t exit_code = 0;                           ///< Exit code reported so far.
+        uint32_t tohost_address = 0;                      ///< Address of tohost, 0 if unused.
+        uint32_t reservation_address = 0;                 ///< Address reserved by LR.
+        uint32_t reservation_value = 0;                   ///< Value loaded by LR.
+        bool reservation_valid = false;                   ///< An LR reservation is held.
+    };
+
+    HartState hart;  ///< Saved hart state.
+    Memory image;    ///< Saved pages, shared copy-on-write with every restored memory.
+};
+
+#endif
@@ -0,0 +1,669 @@
+#include "symbol_index.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+constexpr uint32_t SHT_SYMTAB = 2;          ///< Symbol table section type.
+constexpr uint64_t SHF_COMPRESSED = 0x800;  ///< Section holds compressed data.
+constexpr uint8_t STT_FUNC = 2;             ///< Function symbol type.
+
+// DWARF forms that may appear in DWARF 5 directory and file entries
+constexpr uint64_t DW_FORM_block = 0x09;
+constexpr uint64_t DW_FORM_data1 = 0x0b;
+constexpr uint64_t DW_FORM_data2 = 0x05;
+constexpr uint64_t DW_FORM_data4 = 0x06;
+constexpr uint64_t DW_FORM_data8 = 0x07;
+constexpr uint64_t DW_FORM_data16 = 0x1e;
+constexpr uint64_t DW_FORM_line_strp = 0x1f;
+constexpr uint64_t DW_FORM_string = 0x08;
+constexpr uint64_t DW_FORM_strp = 0x0e;
+constexpr uint64_t DW_FORM_udata = 0x0f;
+constexpr uint64_t DW_LNCT_path = 1;
+
+/**
+ * @brief Read a little-endian value from an unaligned address.
+ *
+ * @tparam T The unsigned type to read.
+ * @param data The address.
+ * @return T The value.
+ */
+template <typename T>
+T read_le(const uint8_t *data)
+{
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i)
+    {
+        value |= static_cast<T>(data[i]) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Bounds-checked reader of DWARF data.
+ *
+ * Reading past the end yields zeros and clears ok, so a malformed unit is
+ * detected once at the end instead of after every field.
+ */
+struct DwarfReader
+{
+    const uint8_t *position; ///< Next byte.
+    const uint8_t *end;      ///< End of the readable data.
+    bool ok = true;          ///< Cleared by a read past the end.
+
+    bool has(size_t bytes)
+    {
+        ok = ok && static_cast<size_t>(end - position) >= bytes;
+        return ok;
+    }
+
+    template <typename T>
+    T fixed()
+    {
+        if (!has(sizeof(T)))
+        {
+            return 0;
+        }
+        T value = read_le<T>(position);
+        position += sizeof(T);
+        return value;
+    }
+
+    /**
+     * @brief Read a value of 1 to 8 bytes.
+     */
+    uint64_t sized(size_t bytes)
+    {
+        if (bytes > 8 || !has(bytes))
+        {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i)
+        {
+            value |= static_cast<uint64_t>(position[i]) << (8 * i);
+        }
+        position += bytes;
+        return value;
+    }
+
+    uint64_t uleb()
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0; has(1); shift += 7)
+        {
+            uint8_t byte = *position++;
+            if (shift < 64)
+            {
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            }
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+        }
+        return 0;
+    }
+
+    int64_t sleb()
+    {
+        int64_t value = 0;
+        unsigned shift = 0;
+        uint8_t byte = 0x80;
+        while ((byte & 0x80) && has(1))
+        {
+            byte = *position++;
+            if (shift < 64)
+            {
+                value |= static_cast<int64_t>(static_cast<uint64_t>(byte & 0x7f) << shift);
+            }
+            shift += 7;
+        }
+        if (shift < 64 && (byte & 0x40))
+        {
+            value |= -(static_cast<int64_t>(1) << shift);
+        }
+        return value;
+    }
+
+    const char *string()
+    {
+        const void *terminator = ok ? std::memchr(position, 0, static_cast<size_t>(end - position)) : nullptr;
+        if (!terminator)
+        {
+            ok = false;
+            return "";
+        }
+        const char *text = reinterpret_cast<const char *>(position);
+        position = static_cast<const uint8_t *>(terminator) + 1;
+        return text;
+    }
+
+    void skip(uint64_t bytes)
+    {
+        if (has(static_cast<size_t>(bytes)))
+        {
+            position += bytes;
+        }
+    }
+};
+
+/**
+ * @brief Get a NUL-terminated string from a string section.
+ *
+ * @param data The section contents.
+ * @param size The section size.
+ * @param offset Offset of the string.
+ * @return const char* The string, or nullptr if it is out of bounds or unterminated.
+ */
+const char *string_at(const uint8_t *data, size_t size, uint64_t offset)
+{
+    if (!data || offset >= size || !std::memchr(data + offset, 0, size - offset))
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<const char *>(data + offset);
+}
+
+} // namespace
+
+/**
+ * @brief Construct a new SymbolIndex object without reading the file.
+ *
+ * @param filename Path to the ELF file.
+ */
+SymbolIndex::SymbolIndex(std::string filename) : filename(std::move(filename))
+{
+}
+
+/**
+ * @brief Unmap the file.
+ */
+SymbolIndex::~SymbolIndex()
+{
+    if (mapping)
+    {
+        munmap(mapping, mapping_size);
+    }
+}
+
+/**
+ * @brief Map the file and locate its sections.
+ */
+void SymbolIndex::map_file() const
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size < 52)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        LOG_ERROR("Error: Cannot read symbols from: " + filename);
+        return;
+    }
+    void *address = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+    {
+        LOG_ERROR("Error: Cannot map symbols from: " + filename);
+        return;
+    }
+    mapping = address;
+    mapping_size = static_cast<size_t>(file_stat.st_size);
+
+    const uint8_t *file = static_cast<const uint8_t *>(mapping);
+    if (std::memcmp(file, "\x7f" "ELF", 4) != 0 || (file[4] != 1 && file[4] != 2) || file[5] != 1)
+    {
+        LOG_ERROR("Error: Not a little-endian ELF file: " + filename);
+        return;
+    }
+
+    // ELF32 and ELF64 differ only in the offsets and widths of the fields read here
+    wide = file[4] == 2;
+    if (wide && mapping_size < 64)
+    {
+        return;
+    }
+    uint64_t section_offset = wide ? read_le<uint64_t>(file + 40) : read_le<uint32_t>(file + 32);
+    size_t entry_size = read_le<uint16_t>(file + (wide ? 58 : 46));
+    size_t section_count = read_le<uint16_t>(file + (wide ? 60 : 48));
+    size_t names_index = read_le<uint16_t>(file + (wide ? 62 : 50));
+    if (entry_size < (wide ? 64u : 40u) || section_offset > mapping_size ||
+        section_count > (mapping_size - section_offset) / entry_size)
+    {
+        LOG_ERROR("Error: Invalid section headers in: " + filename);
+        return;
+    }
+
+    struct Header
+    {
+        uint32_t name, type, link;
+        uint64_t flags, offset, size, entry_size;
+    };
+    auto header = [&](size_t index)
+    {
+        const uint8_t *entry = file + section_offset + index * entry_size;
+        Header result;
+        result.name = read_le<uint32_t>(entry);
+        result.type = read_le<uint32_t>(entry + 4);
+        result.flags = wide ? read_le<uint64_t>(entry + 8) : read_le<uint32_t>(entry + 8);
+        result.offset = wide ? read_le<uint64_t>(entry + 24) : read_le<uint32_t>(entry + 16);
+        result.size = wide ? read_le<uint64_t>(entry + 32) : read_le<uint32_t>(entry + 20);
+        result.link = read_le<uint32_t>(entry + (wide ? 40 : 24));
+        result.entry_size = wide ? read_le<uint64_t>(entry + 56) : read_le<uint32_t>(entry + 36);
+        return result;
+    };
+    auto contents = [&](const Header &section)
+    {
+        Section result;
+        if (section.offset <= mapping_size && section.size <= mapping_size - section.offset)
+        {
+            result.data = file + section.offset;
+            result.size = static_cast<size_t>(section.size);
+        }
+        return result;
+    };
+
+    Section names = names_index < section_count ? contents(header(names_index)) : Section();
+    for (size_t i = 0; i < section_count; ++i)
+    {
+        Header section = header(i);
+        if (section.type == SHT_SYMTAB && !symtab.data && section.link < section_count)
+        {
+            symtab = contents(section);
+            symbol_size = static_cast<size_t>(section.entry_size);
+            strtab = contents(header(section.link));
+            if (symbol_size < (wide ? 24u : 16u))
+            {
+                symtab = Section();
+            }
+            continue;
+        }
+
+        // Compressed debug sections are left alone; line information is optional
+        const char *name = string_at(names.data, names.size, section.name);
+        if (!name || (section.flags & SHF_COMPRESSED))
+        {
+            continue;
+        }
+        if (std::strcmp(name, ".debug_line") == 0)
+        {
+            debug_line = contents(section);
+        }
+        else if (std::strcmp(name, ".debug_line_str") == 0)
+        {
+            debug_line_str = contents(section);
+        }
+        else if (std::strcmp(name, ".debug_str") == 0)
+        {
+            debug_str = contents(section);
+        }
+    }
+}
+
+/**
+ * @brief Look up the value of a symbol of any type by name.
+ *
+ * @param name The symbol name.
+ * @param address Receives the symbol value.
+ * @return true if the symbol exists, false otherwise.
+ */
+bool SymbolIndex::find_address(const char *name, uint32_t &address) const
+{
+    std::call_once(mapped, [this] { map_file(); });
+    size_t count = symtab.data ? symtab.size / symbol_size : 0;
+    size_t length = std::strlen(name) + 1;
+    for (size_t i = 1; i < count; ++i)
+    {
+        const uint8_t *entry = symtab.data + i * symbol_size;
+        uint32_t offset = read_le<uint32_t>(entry);
+        if (offset < strtab.size && strtab.size - offset >= length && std::memcmp(strtab.data + offset, name, length) == 0)
+        {
+            address = static_cast<uint32_t>(wide ? read_le<uint64_t>(entry + 8) : read_le<uint32_t>(entry + 4));
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Build the sorted function intervals.
+ */
+void SymbolIndex::build_functions() const
+{
+    std::call_once(mapped, [this] { map_file(); });
+    size_t count = symtab.data ? symtab.size / symbol_size : 0;
+    for (size_t i = 1; i < count; ++i)
+    {
+        const uint8_t *entry = symtab.data + i * symbol_size;
+        uint8_t type = entry[wide ? 4 : 12] & 0xf;
+        const char *name = string_at(strtab.data, strtab.size, read_le<uint32_t>(entry));
+        if (type != STT_FUNC || !name || !*name)
+        {
+            continue;
+        }
+        uint64_t value = wide ? read_le<uint64_t>(entry + 8) : read_le<uint32_t>(entry + 4);
+        uint64_t size = wide ? read_le<uint64_t>(entry + 16) : read_le<uint32_t>(entry + 8);
+        functions.push_back({static_cast<uint32_t>(value), static_cast<uint32_t>(size), name});
+    }
+    std::stable_sort(functions.begin(), functions.end(), [](const Symbol &a, const Symbol &b)
+                     { return a.address < b.address; });
+    LOG_DEBUG("Indexed " + std::to_string(functions.size()) + " function symbols from: " + filename);
+}
+
+/**
+ * @brief Find the function covering an address.
+ *
+ * @param address The address.
+ * @return const Symbol* The function, or nullptr if none covers it.
+ */
+const SymbolIndex::Symbol *SymbolIndex::find_function(uint32_t address) const
+{
+    std::call_once(functions_built, [this] { build_functions(); });
+    auto it = std::upper_bound(functions.begin(), functions.end(), address, [](uint32_t value, const Symbol &symbol)
+                               { return value < symbol.address; });
+    if (it == functions.begin())
+    {
+        return nullptr;
+    }
+    --it;
+    if (it->size != 0 && address - it->address >= it->size)
+    {
+        return nullptr;
+    }
+    return &*it;
+}
+
+/**
+ * @brief Get the number of function symbols.
+ *
+ * @return size_t The count.
+ */
+size_t SymbolIndex::get_function_count() const
+{
+    std::call_once(functions_built, [this] { build_functions(); });
+    return functions.size();
+}
+
+/**
+ * @brief Decode one line number program.
+ *
+ * Handles DWARF 2 to 5 with 32- and 64-bit offsets. Only the address, file
+ * and line registers are tracked; columns and flags are not reported.
+ *
+ * @param data Start of the unit.
+ * @param end End of .debug_line.
+ * @return const uint8_t* Start of the next unit, nullptr if the unit is malformed.
+ */
+const uint8_t *SymbolIndex::decode_line_unit(const uint8_t *data, const uint8_t *end) const
+{
+    DwarfReader reader{data, end};
+    uint64_t length = reader.fixed<uint32_t>();
+    bool offset64 = length == 0xffffffff;
+    if (offset64)
+    {
+        length = reader.fixed<uint64_t>();
+    }
+    if (!reader.ok || length > static_cast<uint64_t>(end - reader.position))
+    {
+        return nullptr;
+    }
+    const uint8_t *unit_end = reader.position + length;
+    reader.end = unit_end;
+
+    uint16_t version = reader.fixed<uint16_t>();
+    if (version < 2 || version > 5)
+    {
+        // Skipped, the next unit may still be readable
+        return unit_end;
+    }
+    if (version >= 5)
+    {
+        reader.fixed<uint8_t>(); // address_size
+        reader.fixed<uint8_t>(); // segment_selector_size
+    }
+    uint64_t header_length = offset64 ? reader.fixed<uint64_t>() : reader.fixed<uint32_t>();
+    if (!reader.ok || header_length > static_cast<uint64_t>(unit_end - reader.position))
+    {
+        return nullptr;
+    }
+    const uint8_t *program = reader.position + header_length;
+    uint8_t minimum_length = reader.fixed<uint8_t>();
+    if (version >= 4)
+    {
+        reader.fixed<uint8_t>(); // maximum_operations_per_instruction
+    }
+    reader.fixed<uint8_t>(); // default_is_stmt
+    int8_t line_base = static_cast<int8_t>(reader.fixed<uint8_t>());
+    uint8_t line_range = reader.fixed<uint8_t>();
+    uint8_t opcode_base = reader.fixed<uint8_t>();
+    std::vector<uint8_t> argument_counts(opcode_base, 0);
+    for (uint8_t i = 1; i < opcode_base; ++i)
+    {
+        argument_counts[i] = reader.fixed<uint8_t>();
+    }
+    if (!reader.ok || line_range == 0 || opcode_base == 0)
+    {
+        return nullptr;
+    }
+
+    // Unit file numbers are mapped to the shared file table; DWARF 5 counts from 0
+    std::vector<uint32_t> unit_files;
+    uint64_t first_file = version >= 5 ? 0 : 1;
+    auto add_file = [this, &unit_files](const char *name)
+    {
+        unit_files.push_back(static_cast<uint32_t>(file_names.size()));
+        file_names.push_back(name ? name : "?");
+    };
+    if (version < 5)
+    {
+        while (reader.ok && *reader.string())
+        {
+        }
+        while (reader.ok)
+        {
+            const char *name = reader.string();
+            if (!*name)
+            {
+                break;
+            }
+            reader.uleb(); // directory
+            reader.uleb(); // modification time
+            reader.uleb(); // length
+            add_file(name);
+        }
+    }
+    else
+    {
+        // Directories then files, each a list of entries described by (content, form) pairs
+        for (int table = 0; table < 2 && reader.ok; ++table)
+        {
+            std::vector<std::pair<uint64_t, uint64_t>> formats(reader.fixed<uint8_t>());
+            for (auto &format : formats)
+            {
+                format.first = reader.uleb();
+                format.second = reader.uleb();
+            }
+            uint64_t count = reader.uleb();
+            for (uint64_t entry = 0; entry < count && reader.ok; ++entry)
+            {
+                const char *path = nullptr;
+                for (const auto &format : formats)
+                {
+                    const char *text = nullptr;
+                    switch (format.second)
+                    {
+                    case DW_FORM_string:
+                        text = reader.string();
+                        break;
+                    case DW_FORM_line_strp:
+                    case DW_FORM_strp:
+                    {
+                        uint64_t offset = offset64 ? reader.fixed<uint64_t>() : reader.fixed<uint32_t>();
+                        const Section &strings = format.second == DW_FORM_line_strp ? debug_line_str : debug_str;
+                        text = string_at(strings.data, strings.size, offset);
+                        break;
+                    }
+                    case DW_FORM_udata:
+                        reader.uleb();
+                        break;
+                    case DW_FORM_data1:
+                    case DW_FORM_data2:
+                    case DW_FORM_data4:
+                    case DW_FORM_data8:
+                        reader.sized(format.second == DW_FORM_data1 ? 1 : format.second == DW_FORM_data2 ? 2 :
+                                     format.second == DW_FORM_data4 ? 4 : 8);
+                        break;
+                    case DW_FORM_data16:
+                        reader.skip(16);
+                        break;
+                    case DW_FORM_block:
+                        reader.skip(reader.uleb());
+                        break;
+                    default:
+                        // Forms that need other sections, e.g. string offsets, cannot be skipped
+                        return nullptr;
+                    }
+                    if (format.first == DW_LNCT_path)
+                    {
+                        path = text;
+                    }
+                }
+                if (table == 1)
+                {
+                    add_file(path);
+                }
+            }
+        }
+    }
+    if (!reader.ok)
+    {
+        return nullptr;
+    }
+
+    uint64_t address = 0;
+    uint64_t file = first_file;
+    int64_t line = 1;
+    auto append = [&](bool end_sequence)
+    {
+        uint32_t file_index = file >= first_file && file - first_file < unit_files.size() ?
+                              unit_files[file - first_file] : UINT32_MAX;
+        lines.push_back({static_cast<uint32_t>(address), file_index,
+                         end_sequence ? 0 : static_cast<uint32_t>(std::max<int64_t>(line, 1))});
+    };
+    reader.position = program;
+    while (reader.ok && reader.position < unit_end)
+    {
+        uint8_t opcode = reader.fixed<uint8_t>();
+        if (opcode >= opcode_base)
+        {
+            uint8_t adjusted = static_cast<uint8_t>(opcode - opcode_base);
+            address += static_cast<uint64_t>(adjusted / line_range) * minimum_length;
+            line += line_base + adjusted % line_range;
+            append(false);
+            continue;
+        }
+        switch (opcode)
+        {
+        case 0:
+        {
+            uint64_t size = reader.uleb();
+            if (size == 0 || size > static_cast<uint64_t>(unit_end - reader.position))
+            {
+                return nullptr;
+            }
+            const uint8_t *next = reader.position + size;
+            uint8_t extended = reader.fixed<uint8_t>();
+            if (extended == 1)
+            {
+                append(true);
+                address = 0;
+                file = first_file;
+                line = 1;
+            }
+            else if (extended == 2)
+            {
+                address = reader.sized(static_cast<size_t>(size - 1));
+            }
+            reader.position = next;
+            break;
+        }
+        case 1:
+            append(false);
+            break;
+        case 2:
+            address += reader.uleb() * minimum_length;
+            break;
+        case 3:
+            line += reader.sleb();
+            break;
+        case 4:
+            file = reader.uleb();
+            break;
+        case 8:
+            address += static_cast<uint64_t>((255 - opcode_base) / line_range) * minimum_length;
+            break;
+        case 9:
+            address += reader.fixed<uint16_t>();
+            break;
+        default:
+            // Column, flags and ISA changes are not tracked
+            for (uint8_t i = 0; i < argument_counts[opcode]; ++i)
+            {
+                reader.uleb();
+            }
+            break;
+        }
+    }
+    return reader.ok ? unit_end : nullptr;
+}
+
+/**
+ * @brief Decode every line number program in .debug_line.
+ */
+void SymbolIndex::build_lines() const
+{
+    std::call_once(mapped, [this] { map_file(); });
+    const uint8_t *unit = debug_line.data;
+    const uint8_t *end = debug_line.data + debug_line.size;
+    while (unit && unit < end)
+    {
+        unit = decode_line_unit(unit, end);
+    }
+
+    // Sequences can be in any order; where one ends at the start of the next, the start wins
+    std::stable_sort(lines.begin(), lines.end(), [](const LineRow &a, const LineRow &b)
+                     { return a.address < b.address || (a.address == b.address && a.line == 0 && b.line != 0); });
+    LOG_DEBUG("Indexed " + std::to_string(lines.size()) + " line rows from: " + filename);
+}
+
+/**
+ * @brief Find the source line of an address in the DWARF line table.
+ *
+ * @param address The address.
+ * @param file Receives the source file name.
+ * @param line Receives the line number.
+ * @return true if the address has line information, false otherwise.
+ */
+bool SymbolIndex::find_line(uint32_t address, std::string &file, uint32_t &line) const
+{
+    std::call_once(lines_built, [this] { build_lines(); });
+    auto it = std::upper_bound(lines.begin(), lines.end(), address, [](uint32_t value, const LineRow &row)
+                               { return value < row.address; });
+    if (it == lines.begin() || (--it)->line == 0)
+    {
+        return false;
+    }
+    file = it->file < file_names.size() ? file_names[it->file] : "?";
+    line = it->line;
+    return true;
+}
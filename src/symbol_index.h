@@ -0,0 +1,154 @@
+#ifndef SYMBOL_INDEX_H
+#define SYMBOL_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Lazily built symbol and line tables of an ELF file.
+ *
+ * Nothing is read when the index is created. The first query maps the file
+ * and reads its section headers; function lookups then build a sorted array
+ * of function intervals and line lookups decode .debug_line, each once, on
+ * first use. Names point into the mapping, so building the tables copies no
+ * strings, and a run that never prints a symbol never pays for them.
+ *
+ * Queries are thread safe, so one index can be shared by every job of a batch.
+ */
+class SymbolIndex
+{
+public:
+    /**
+     * @brief Function symbol from the ELF symbol table.
+     */
+    struct Symbol
+    {
+        uint32_t address; ///< Start address.
+        uint32_t size;    ///< Size in bytes, 0 if unknown.
+        const char *name; ///< Symbol name.
+    };
+
+    /**
+     * @brief Construct a new SymbolIndex object without reading the file.
+     *
+     * @param filename Path to the ELF file.
+     */
+    explicit SymbolIndex(std::string filename);
+
+    /**
+     * @brief Unmap the file.
+     */
+    ~SymbolIndex();
+
+    SymbolIndex(const SymbolIndex &) = delete;
+    SymbolIndex &operator=(const SymbolIndex &) = delete;
+
+    /**
+     * @brief Get the path of the ELF file.
+     *
+     * @return const std::string& The path.
+     */
+    const std::string &get_filename() const { return filename; }
+
+    /**
+     * @brief Look up the value of a symbol of any type by name.
+     *
+     * Scans the symbol table in place and builds no index.
+     *
+     * @param name The symbol name.
+     * @param address Receives the symbol value.
+     * @return true if the symbol exists, false otherwise.
+     */
+    bool find_address(const char *name, uint32_t &address) const;
+
+    /**
+     * @brief Find the function covering an address.
+     *
+     * @param address The address.
+     * @return const Symbol* The function, or nullptr if none covers it.
+     */
+    const Symbol *find_function(uint32_t address) const;
+
+    /**
+     * @brief Get the number of function symbols.
+     *
+     * @return size_t The count.
+     */
+    size_t get_function_count() const;
+
+    /**
+     * @brief Find the source line of an address in the DWARF line table.
+     *
+     * @param address The address.
+     * @param file Receives the source file name.
+     * @param line Receives the line number.
+     * @return true if the address has line information, false otherwise.
+     */
+    bool find_line(uint32_t address, std::string &file, uint32_t &line) const;
+
+private:
+    /**
+     * @brief A section of the mapped file.
+     */
+    struct Section
+    {
+        const uint8_t *data = nullptr; ///< Contents, nullptr if absent.
+        size_t size = 0;               ///< Size in bytes.
+    };
+
+    /**
+     * @brief A row of the line table; rows with line 0 end a sequence.
+     */
+    struct LineRow
+    {
+        uint32_t address; ///< First address of the row.
+        uint32_t file;    ///< Index into file_names.
+        uint32_t line;    ///< Line number, 0 past the end of a sequence.
+    };
+
+    /**
+     * @brief Map the file and locate its sections.
+     */
+    void map_file() const;
+
+    /**
+     * @brief Build the sorted function intervals.
+     */
+    void build_functions() const;
+
+    /**
+     * @brief Decode every line number program in .debug_line.
+     */
+    void build_lines() const;
+
+    /**
+     * @brief Decode one line number program.
+     *
+     * @param data Start of the unit.
+     * @param end End of .debug_line.
+     * @return const uint8_t* Start of the next unit, nullptr if the unit is malformed.
+     */
+    const uint8_t *decode_line_unit(const uint8_t *data, const uint8_t *end) const;
+
+    std::string filename;                      ///< Path to the ELF file.
+    mutable std::once_flag mapped;             ///< Guards map_file.
+    mutable std::once_flag functions_built;    ///< Guards build_functions.
+    mutable std::once_flag lines_built;        ///< Guards build_lines.
+    mutable void *mapping = nullptr;           ///< The mapped file.
+    mutable size_t mapping_size = 0;           ///< Size of the mapping.
+    mutable bool wide = false;                 ///< ELF64 rather than ELF32.
+    mutable Section symtab;                    ///< Symbol table.
+    mutable size_t symbol_size = 0;            ///< Size of one symbol table entry.
+    mutable Section strtab;                    ///< Names of the symbol table.
+    mutable Section debug_line;                ///< DWARF line number programs.
+    mutable Section debug_line_str;            ///< DWARF 5 line table strings.
+    mutable Section debug_str;                 ///< DWARF strings.
+    mutable std::vector<Symbol> functions;     ///< Function symbols sorted by address.
+    mutable std::vector<LineRow> lines;        ///< Line rows sorted by address.
+    mutable std::vector<const char *> file_names; ///< Source files of the line rows.
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+/**
+ * @brief Construct a new WorkStealingPool object.
+ *
+ * @param worker_count Number of host threads, 0 for one per host core.
+ */
+WorkStealingPool::WorkStealingPool(size_t worker_count)
+    : worker_count(worker_count ? worker_count : std::max(1u, std::thread::hardware_concurrency())),
+      queues(this->worker_count)
+{
+}
+
+/**
+ * @brief Take the next task for a worker, stealing if its queue is empty.
+ *
+ * @param worker The worker index.
+ * @param task Receives the task index.
+ * @param stolen Set if the task came from another worker.
+ * @return true if a task was taken, false once every queue is empty.
+ */
+bool WorkStealingPool::next_task(size_t worker, size_t &task, bool &stolen)
+{
+    {
+        Queue &own = queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            stolen = false;
+            return true;
+        }
+    }
+
+    // Tasks never create tasks, so once every queue is empty the run is over
+    for (size_t i = 1; i < worker_count; ++i)
+    {
+        Queue &victim = queues[(worker + i) % worker_count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Deal tasks out to the queues in contiguous ranges.
+ *
+ * @param task_count Number of tasks.
+ */
+void WorkStealingPool::deal(size_t task_count)
+{
+    // Contiguous ranges keep each worker's tasks in manifest order; the owner
+    // works from the back so thieves take from the far end of the range
+    for (size_t worker = 0; worker < worker_count; ++worker)
+    {
+        size_t begin = task_count * worker / worker_count;
+        size_t end = task_count * (worker + 1) / worker_count;
+        for (size_t i = end; i > begin; --i)
+        {
+            queues[worker].tasks.push_back(i - 1);
+        }
+    }
+}
+
+/**
+ * @brief Run a worker loop on worker_count threads, the calling thread being worker 0.
+ *
+ * @param work Called once with each worker index.
+ */
+void WorkStealingPool::start_workers(const std::function<void(size_t)> &work)
+{
+    std::vector<std::thread> threads;
+    threads.reserve(worker_count - 1);
+    for (size_t worker = 1; worker < worker_count; ++worker)
+    {
+        threads.emplace_back(work, worker);
+    }
+    work(0);
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Run tasks 0 to task_count - 1 and wait for all of them.
+ *
+ * @param task_count Number of tasks.
+ * @param task Called once with each task index; must not throw.
+ */
+void WorkStealingPool::run(size_t task_count, const std::function<void(size_t)> &task)
+{
+    deal(task_count);
+
+    // Tasks never create tasks, so once every queue is empty the run is over
+    std::atomic<size_t> steals{0};
+    auto work = [this, &task, &steals](size_t worker)
+    {
+        size_t index;
+        bool stolen;
+        while (next_task(worker, index, stolen))
+        {
+            if (stolen)
+            {
+                steals.fetch_add(1, std::memory_order_relaxed);
+            }
+            task(index);
+        }
+    };
+    start_workers(work);
+    steal_count = steals.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Run tasks 0 to task_count - 1 in slices until each has finished, and wait for all of them.
+ *
+ * @param task_count Number of tasks.
+ * @param slice Called with a task index to run one slice; returns true if the task needs another slice.
+ */
+void WorkStealingPool::run_slices(size_t task_count, const std::function<bool(size_t)> &slice)
+{
+    deal(task_count);
+
+    // A task between slices is in no queue, so empty queues only end the run
+    // once no task is left unfinished
+    std::atomic<size_t> unfinished{task_count};
+    std::atomic<size_t> steals{0};
+    auto work = [this, &slice, &unfinished, &steals](size_t worker)
+    {
+        size_t index;
+        bool stolen;
+        while (unfinished.load(std::memory_order_acquire) != 0)
+        {
+            if (!next_task(worker, index, stolen))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if (stolen)
+            {
+                steals.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (slice(index))
+            {
+                Queue &own = queues[worker];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                own.tasks.push_front(index);
+            }
+            else
+            {
+                unfinished.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        }
+    };
+    start_workers(work);
+    steal_count = steals.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,104 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Fixed set of host threads that run a batch of independent tasks.
+ *
+ * Tasks are dealt out to per-worker queues up front. A worker takes its own
+ * tasks from the back of its queue and, once that is empty, steals from the
+ * front of the other queues, so a few long tasks do not leave the remaining
+ * workers idle. Tasks may also run in slices, going back to a queue after
+ * each, so a fixed set of threads can time-slice more tasks than it has
+ * threads.
+ */
+class WorkStealingPool
+{
+public:
+    /**
+     * @brief Construct a new WorkStealingPool object.
+     *
+     * @param worker_count Number of host threads, 0 for one per host core.
+     */
+    explicit WorkStealingPool(size_t worker_count);
+
+    /**
+     * @brief Run tasks 0 to task_count - 1 and wait for all of them.
+     *
+     * @param task_count Number of tasks.
+     * @param task Called once with each task index; must not throw.
+     */
+    void run(size_t task_count, const std::function<void(size_t)> &task);
+
+    /**
+     * @brief Run tasks 0 to task_count - 1 in slices until each has finished, and wait for all of them.
+     *
+     * A task that needs another slice goes to the far end of the queue of the
+     * worker that ran it, so the tasks of a queue take turns. A slice may
+     * run on any worker, but never on two at once.
+     *
+     * @param task_count Number of tasks.
+     * @param slice Called with a task index to run one slice; returns true if
+     *              the task needs another slice. Must not throw.
+     */
+    void run_slices(size_t task_count, const std::function<bool(size_t)> &slice);
+
+    /**
+     * @brief Get the number of worker threads.
+     *
+     * @return size_t The worker count.
+     */
+    size_t get_worker_count() const { return worker_count; }
+
+    /**
+     * @brief Get the number of tasks taken from another worker's queue by the last run.
+     *
+     * @return size_t The steal count.
+     */
+    size_t get_steal_count() const { return steal_count; }
+
+private:
+    /**
+     * @brief Task queue of one worker.
+     */
+    struct Queue
+    {
+        std::mutex mutex;          ///< Guards the tasks.
+        std::deque<size_t> tasks;  ///< Pending task indices.
+    };
+
+    /**
+     * @brief Take the next task for a worker, stealing if its queue is empty.
+     *
+     * @param worker The worker index.
+     * @param task Receives the task index.
+     * @param stolen Set if the task came from another worker.
+     * @return true if a task was taken, false if every queue is empty.
+     */
+    bool next_task(size_t worker, size_t &task, bool &stolen);
+
+    /**
+     * @brief Deal tasks out to the queues in contiguous ranges.
+     *
+     * @param task_count Number of tasks.
+     */
+    void deal(size_t task_count);
+
+    /**
+     * @brief Run a worker loop on worker_count threads, the calling thread being worker 0.
+     *
+     * @param work Called once with each worker index.
+     */
+    void start_workers(const std::function<void(size_t)> &work);
+
+    size_t worker_count;       ///< Number of worker threads.
+    size_t steal_count = 0;    ///< Steals during the last run.
+    std::vector<Queue> queues; ///< Queue by worker.
+};
+
+#endif
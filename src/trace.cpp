@@ -0,0 +1,500 @@
+#include "trace.h"
+#include "isa.h"
+#include "logger.h"
+#include <cstring>
+#include <type_traits>
+#ifdef PHLEGO_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+
+constexpr char TRACE_MAGIC[8] = {'P', 'H', 'L', 'E', 'G', 'O', 'T', 'R'};
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr uint32_t TRACE_COMPRESSED = 1; ///< Header flag: blocks are deflate streams.
+
+/**
+ * @brief Fixed header at the start of a trace file.
+ */
+struct TraceHeader
+{
+    char magic[8];        ///< TRACE_MAGIC.
+    uint32_t version;     ///< TRACE_VERSION.
+    uint32_t flags;       ///< TRACE_COMPRESSED or 0.
+    uint32_t record_size; ///< sizeof(TraceRecord) of the writer.
+    uint32_t reserved;    ///< Zero.
+};
+
+/**
+ * @brief Header in front of every block of records.
+ */
+struct BlockHeader
+{
+    uint32_t record_count; ///< Records in the block.
+    uint32_t packed_size;  ///< Bytes of packed records.
+    uint32_t stored_size;  ///< Bytes that follow, the packed size unless compressed.
+};
+
+// Flags byte in front of every packed record, followed by the fields it does not rule out
+constexpr uint8_t PACK_NEW_PC = 0x01;          ///< The PC follows; otherwise it is the previous one plus 4.
+constexpr uint8_t PACK_NEW_INSTRUCTION = 0x02; ///< The word follows; otherwise it is the last one seen at this PC.
+constexpr uint8_t PACK_RD = 0x04;              ///< rd and its value follow.
+constexpr uint8_t PACK_READ = 0x08;            ///< A load: the address follows.
+constexpr uint8_t PACK_WRITE = 0x10;           ///< A store: the address follows.
+constexpr uint8_t PACK_VALUE = 0x20;           ///< The memory value follows; a load without it loaded the rd value.
+
+constexpr uint32_t WORD_CACHE_SIZE = 1024;         ///< Instruction words remembered by PC while packing.
+constexpr size_t MAX_PACKED_RECORD = 1 + 4 * 5 + 1; ///< Largest packed record.
+
+static_assert(std::is_trivially_copyable<TraceRecord>::value, "trace records are copied as raw bytes");
+
+/**
+ * @brief Append a little-endian word.
+ *
+ * @param out The output position, advanced past the word.
+ * @param value The word.
+ */
+void put_word(unsigned char *&out, uint32_t value)
+{
+    std::memcpy(out, &value, 4);
+    out += 4;
+}
+
+/**
+ * @brief Pack a block of records.
+ *
+ * The PC and word history restart with every block, so blocks decode
+ * independently.
+ *
+ * @param records The records.
+ * @param count The number of records.
+ * @param packed Receives the packed bytes.
+ * @return size_t The packed size.
+ */
+size_t pack_block(const TraceRecord *records, size_t count, std::vector<unsigned char> &packed)
+{
+    packed.resize(count * MAX_PACKED_RECORD);
+    uint32_t words[WORD_CACHE_SIZE] = {};
+    uint32_t next_pc = 0;
+    unsigned char *out = packed.data();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const TraceRecord &record = records[i];
+        unsigned char *flags = out++;
+        *flags = 0;
+        if (record.pc != next_pc)
+        {
+            *flags |= PACK_NEW_PC;
+            put_word(out, record.pc);
+        }
+        uint32_t &word = words[(record.pc >> 2) % WORD_CACHE_SIZE];
+        if (record.instruction != word)
+        {
+            *flags |= PACK_NEW_INSTRUCTION;
+            put_word(out, record.instruction);
+            word = record.instruction;
+        }
+        if (record.rd != 0)
+        {
+            *flags |= PACK_RD;
+            *out++ = record.rd;
+            put_word(out, record.rd_value);
+        }
+        if (record.flags & (TraceRecord::MEMORY_READ | TraceRecord::MEMORY_WRITE))
+        {
+            *flags |= record.flags & TraceRecord::MEMORY_READ ? PACK_READ : PACK_WRITE;
+            put_word(out, record.memory_address);
+            if (!(record.flags & TraceRecord::MEMORY_READ) || record.rd == 0 || record.memory_value != record.rd_value)
+            {
+                *flags |= PACK_VALUE;
+                put_word(out, record.memory_value);
+            }
+        }
+        next_pc = record.pc + Isa::instruction_length(record.instruction);
+    }
+    return static_cast<size_t>(out - packed.data());
+}
+
+/**
+ * @brief Unpack a block of records.
+ *
+ * @param packed The packed bytes.
+ * @param size The packed size.
+ * @param records Receives the records, already sized to the record count.
+ * @return true if the bytes held exactly that many records, false otherwise.
+ */
+bool unpack_block(const unsigned char *packed, size_t size, std::vector<TraceRecord> &records)
+{
+    uint32_t words[WORD_CACHE_SIZE] = {};
+    uint32_t next_pc = 0;
+    const unsigned char *in = packed;
+    const unsigned char *end = packed + size;
+    auto get_word = [&in, end](uint32_t &value)
+    {
+        if (end - in < 4)
+        {
+            return false;
+        }
+        std::memcpy(&value, in, 4);
+        in += 4;
+        return true;
+    };
+
+    for (TraceRecord &record : records)
+    {
+        if (in == end)
+        {
+            return false;
+        }
+        uint8_t flags = *in++;
+        record = TraceRecord();
+        record.pc = next_pc;
+        if ((flags & PACK_NEW_PC) && !get_word(record.pc))
+        {
+            return false;
+        }
+        uint32_t &word = words[(record.pc >> 2) % WORD_CACHE_SIZE];
+        if ((flags & PACK_NEW_INSTRUCTION) && !get_word(word))
+        {
+            return false;
+        }
+        record.instruction = word;
+        if (flags & PACK_RD)
+        {
+            if (in == end)
+            {
+                return false;
+            }
+            record.rd = *in++;
+            if (!get_word(record.rd_value))
+            {
+                return false;
+            }
+        }
+        if (flags & (PACK_READ | PACK_WRITE))
+        {
+            record.flags = flags & PACK_READ ? TraceRecord::MEMORY_READ : TraceRecord::MEMORY_WRITE;
+            if (!get_word(record.memory_address))
+            {
+                return false;
+            }
+            record.memory_value = record.rd_value;
+            if ((flags & PACK_VALUE) && !get_word(record.memory_value))
+            {
+                return false;
+            }
+        }
+        next_pc = record.pc + Isa::instruction_length(record.instruction);
+    }
+    return in == end;
+}
+
+} // namespace
+
+/**
+ * @brief Flush and close the trace if it is still open.
+ */
+TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+/**
+ * @brief Create the trace file and start the writer thread.
+ *
+ * @param filename Path to the trace file.
+ * @param compress Whether to deflate-compress the blocks.
+ * @return true if successful, false otherwise.
+ */
+bool TraceWriter::open(const std::string &filename, bool compress)
+{
+#ifndef PHLEGO_HAVE_ZLIB
+    if (compress)
+    {
+        LOG_ERROR("Error: Trace compression needs a build with zlib");
+        return false;
+    }
+#endif
+    file.open(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open trace file: " + filename);
+        return false;
+    }
+
+    TraceHeader header = {};
+    std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.flags = compress ? TRACE_COMPRESSED : 0;
+    header.record_size = sizeof(TraceRecord);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+#ifdef PHLEGO_HAVE_ZLIB
+    // The fastest level keeps the writer ahead of the emulation thread
+    if (compress)
+    {
+        deflater = new z_stream();
+        if (deflateInit(deflater, Z_BEST_SPEED) != Z_OK)
+        {
+            LOG_ERROR("Error: Cannot start trace compression");
+            delete deflater;
+            deflater = nullptr;
+            return false;
+        }
+        scratch.resize(deflateBound(deflater, BLOCK_RECORDS * MAX_PACKED_RECORD));
+    }
+#endif
+    for (auto &buffer : buffers)
+    {
+        buffer.resize(BLOCK_RECORDS);
+    }
+    active = 0;
+    cursor = buffers[0].data();
+    buffer_end = cursor + BLOCK_RECORDS;
+    thread = std::thread(&TraceWriter::writer_loop, this);
+    return true;
+}
+
+/**
+ * @brief Hand the active buffer to the writer thread and switch to the other one.
+ */
+void TraceWriter::submit()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // The other buffer is free again once the writer has finished it
+    if (pending_count != 0)
+    {
+        ++waits;
+        condition.wait(lock, [this]
+                       { return pending_count == 0; });
+    }
+    pending_count = static_cast<size_t>(cursor - buffers[active].data());
+    submitted += pending_count;
+    active ^= 1;
+    cursor = buffers[active].data();
+    buffer_end = cursor + BLOCK_RECORDS;
+    condition.notify_all();
+}
+
+/**
+ * @brief Encode and write full buffers until closed.
+ */
+void TraceWriter::writer_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this]
+                       { return pending_count != 0 || stopping; });
+        if (pending_count == 0)
+        {
+            break;
+        }
+
+        // The emulation thread only touches the other buffer until pending_count drops
+        const TraceRecord *records = buffers[active ^ 1].data();
+        size_t count = pending_count;
+        lock.unlock();
+        if (!failed && !write_block(records, count))
+        {
+            failed = true;
+        }
+        lock.lock();
+        pending_count = 0;
+        condition.notify_all();
+    }
+}
+
+/**
+ * @brief Encode and write one block.
+ *
+ * @param records The records.
+ * @param count The number of records.
+ * @return true if successful, false otherwise.
+ */
+bool TraceWriter::write_block(const TraceRecord *records, size_t count)
+{
+    BlockHeader header;
+    header.record_count = static_cast<uint32_t>(count);
+    size_t size = pack_block(records, count, packed);
+    header.packed_size = static_cast<uint32_t>(size);
+    const char *data = reinterpret_cast<const char *>(packed.data());
+
+#ifdef PHLEGO_HAVE_ZLIB
+    // Each block is a complete deflate stream, so blocks decode independently
+    if (deflater)
+    {
+        deflater->next_in = packed.data();
+        deflater->avail_in = static_cast<uInt>(size);
+        deflater->next_out = scratch.data();
+        deflater->avail_out = static_cast<uInt>(scratch.size());
+        int status = deflate(deflater, Z_FINISH);
+        size = deflater->total_out;
+        deflateReset(deflater);
+        if (status != Z_STREAM_END)
+        {
+            LOG_ERROR("Error: Failed to compress trace block");
+            return false;
+        }
+        data = reinterpret_cast<const char *>(scratch.data());
+    }
+#endif
+
+    header.stored_size = static_cast<uint32_t>(size);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(data, static_cast<std::streamsize>(size));
+    if (!file)
+    {
+        LOG_ERROR("Error: Failed to write trace file");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Write the remaining records, stop the writer thread and close the file.
+ *
+ * @return true if every block was written, false otherwise.
+ */
+bool TraceWriter::close()
+{
+    if (!thread.joinable())
+    {
+        return !failed;
+    }
+    if (cursor != buffers[active].data())
+    {
+        submit();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    thread.join();
+
+#ifdef PHLEGO_HAVE_ZLIB
+    if (deflater)
+    {
+        deflateEnd(deflater);
+        delete deflater;
+        deflater = nullptr;
+    }
+#endif
+    file.close();
+    if (!file)
+    {
+        failed = true;
+    }
+    LOG_INFO("Trace written: " + std::to_string(submitted) + " records");
+    return !failed;
+}
+
+/**
+ * @brief Open a trace file and check its header.
+ *
+ * @param filename Path to the trace file.
+ * @return true if successful, false otherwise.
+ */
+bool TraceReader::open(const std::string &filename)
+{
+    file.open(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        LOG_ERROR("Error: Cannot open trace file: " + filename);
+        return false;
+    }
+
+    TraceHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION ||
+        header.record_size != sizeof(TraceRecord))
+    {
+        LOG_ERROR("Error: Not a trace file: " + filename);
+        return false;
+    }
+    compressed = (header.flags & TRACE_COMPRESSED) != 0;
+#ifndef PHLEGO_HAVE_ZLIB
+    if (compressed)
+    {
+        LOG_ERROR("Error: Reading a compressed trace needs a build with zlib: " + filename);
+        return false;
+    }
+#endif
+    return true;
+}
+
+/**
+ * @brief Read the next record.
+ *
+ * @param record Receives the record.
+ * @return true if a record was read, false at the end of the trace or on an error.
+ */
+bool TraceReader::next(TraceRecord &record)
+{
+    if (position == records.size() && !read_block())
+    {
+        return false;
+    }
+    record = records[position++];
+    return true;
+}
+
+/**
+ * @brief Read and decode the next block into the buffer.
+ *
+ * @return true if a block was read, false at the end of the trace or on an error.
+ */
+bool TraceReader::read_block()
+{
+    BlockHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+    {
+        // A clean end of file falls exactly on a block boundary
+        failed = file.gcount() != 0;
+        return false;
+    }
+    if (header.record_count == 0 || header.record_count > TraceWriter::BLOCK_RECORDS ||
+        header.packed_size > header.record_count * MAX_PACKED_RECORD || (!compressed && header.stored_size != header.packed_size))
+    {
+        LOG_ERROR("Error: Damaged trace block");
+        failed = true;
+        return false;
+    }
+
+    packed.resize(header.packed_size);
+    std::vector<unsigned char> &stored = compressed ? scratch : packed;
+    stored.resize(header.stored_size);
+    if (!file.read(reinterpret_cast<char *>(stored.data()), header.stored_size))
+    {
+        LOG_ERROR("Error: Truncated trace block");
+        failed = true;
+        return false;
+    }
+
+#ifdef PHLEGO_HAVE_ZLIB
+    if (compressed)
+    {
+        uLongf packed_size = header.packed_size;
+        if (uncompress(packed.data(), &packed_size, scratch.data(), header.stored_size) != Z_OK ||
+            packed_size != header.packed_size)
+        {
+            LOG_ERROR("Error: Damaged trace block");
+            failed = true;
+            return false;
+        }
+    }
+#endif
+
+    records.resize(header.record_count);
+    position = 0;
+    if (!unpack_block(packed.data(), packed.size(), records))
+    {
+        LOG_ERROR("Error: Damaged trace block");
+        failed = true;
+        return false;
+    }
+    return true;
+}
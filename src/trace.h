@@ -0,0 +1,198 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct z_stream_s;
+
+/**
+ * @brief One retired instruction in a binary trace.
+ *
+ * Records have a fixed size so the emulation thread only copies them into a
+ * buffer; packing and compression happen on the writer thread.
+ */
+struct TraceRecord
+{
+    static constexpr uint8_t MEMORY_READ = 1;  ///< The instruction loaded from memory_address.
+    static constexpr uint8_t MEMORY_WRITE = 2; ///< The instruction stored to memory_address.
+
+    uint32_t pc;             ///< Address of the instruction.
+    uint32_t instruction;    ///< Raw instruction word.
+    uint32_t rd_value;       ///< Value written to rd, if rd is not 0.
+    uint32_t memory_address; ///< Effective address of a load or store.
+    uint32_t memory_value;   ///< Value loaded or stored.
+    uint8_t rd;              ///< Register written, 0 for none.
+    uint8_t flags;           ///< MEMORY_READ and MEMORY_WRITE bits.
+    uint16_t reserved;       ///< Zero.
+};
+
+/**
+ * @brief Writes a binary trace through a double-buffered background thread.
+ *
+ * The file starts with a header and holds blocks of records. Within a
+ * block each record is packed against the ones before it, so a sequential
+ * ALU instruction takes six bytes, and the block is optionally
+ * deflate-compressed on top. The emulation thread fills one buffer while the
+ * writer thread encodes and writes the other, and only waits when a full
+ * buffer is ready before the previous one has been written.
+ */
+class TraceWriter
+{
+public:
+    static constexpr size_t BLOCK_RECORDS = 1 << 16; ///< Records per block and per buffer.
+
+    TraceWriter() = default;
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+
+    /**
+     * @brief Flush and close the trace if it is still open.
+     */
+    ~TraceWriter();
+
+    /**
+     * @brief Create the trace file and start the writer thread.
+     *
+     * @param filename Path to the trace file.
+     * @param compress Whether to deflate-compress the blocks.
+     * @return true if successful, false otherwise.
+     */
+    bool open(const std::string &filename, bool compress);
+
+    /**
+     * @brief Append a record.
+     *
+     * @param record The retired instruction.
+     */
+    void record(const TraceRecord &record)
+    {
+        *cursor++ = record;
+        if (cursor == buffer_end)
+        {
+            submit();
+        }
+    }
+
+    /**
+     * @brief Write the remaining records, stop the writer thread and close the file.
+     *
+     * @return true if every block was written, false otherwise.
+     */
+    bool close();
+
+    /**
+     * @brief Get the number of records appended so far.
+     *
+     * @return uint64_t The record count.
+     */
+    uint64_t get_record_count() const { return submitted + static_cast<uint64_t>(cursor - buffers[active].data()); }
+
+    /**
+     * @brief Get the number of times the emulation thread waited for the writer.
+     *
+     * @return uint64_t The wait count.
+     */
+    uint64_t get_wait_count() const { return waits; }
+
+private:
+    /**
+     * @brief Hand the active buffer to the writer thread and switch to the other one.
+     */
+    void submit();
+
+    /**
+     * @brief Encode and write full buffers until closed.
+     */
+    void writer_loop();
+
+    /**
+     * @brief Encode and write one block.
+     *
+     * @param records The records.
+     * @param count The number of records.
+     * @return true if successful, false otherwise.
+     */
+    bool write_block(const TraceRecord *records, size_t count);
+
+    std::vector<TraceRecord> buffers[2];   ///< The buffer being filled and the one being written.
+    size_t active = 0;                     ///< Index of the buffer being filled.
+    TraceRecord *cursor = nullptr;         ///< Next free record of the active buffer.
+    TraceRecord *buffer_end = nullptr;     ///< End of the active buffer.
+    size_t pending_count = 0;              ///< Records in the buffer handed to the writer, 0 if none.
+    uint64_t submitted = 0;                ///< Records handed to the writer.
+    uint64_t waits = 0;                    ///< Times submit() waited for the writer.
+    bool stopping = false;                 ///< close() was called.
+    bool failed = false;                   ///< A block could not be written.
+    std::ofstream file;                    ///< The trace file.
+    std::vector<unsigned char> packed;     ///< Packed block of the writer thread.
+    std::vector<unsigned char> scratch;    ///< Compressed block of the writer thread.
+    z_stream_s *deflater = nullptr;        ///< Compressor reused for every block, null if raw.
+    std::mutex mutex;                      ///< Guards the hand-over state.
+    std::condition_variable condition;     ///< Signals a hand-over in either direction.
+    std::thread thread;                    ///< The writer thread.
+};
+
+/**
+ * @brief Reads the records of a binary trace back in order.
+ */
+class TraceReader
+{
+public:
+    TraceReader() = default;
+    TraceReader(const TraceReader &) = delete;
+    TraceReader &operator=(const TraceReader &) = delete;
+
+    /**
+     * @brief Open a trace file and check its header.
+     *
+     * @param filename Path to the trace file.
+     * @return true if successful, false otherwise.
+     */
+    bool open(const std::string &filename);
+
+    /**
+     * @brief Read the next record.
+     *
+     * @param record Receives the record.
+     * @return true if a record was read, false at the end of the trace or on an error.
+     */
+    bool next(TraceRecord &record);
+
+    /**
+     * @brief Check whether the trace ended on a damaged or unreadable block.
+     *
+     * @return true if reading failed, false otherwise.
+     */
+    bool has_failed() const { return failed; }
+
+    /**
+     * @brief Check whether the blocks are compressed.
+     *
+     * @return true if deflate-compressed, false if raw.
+     */
+    bool is_compressed() const { return compressed; }
+
+private:
+    /**
+     * @brief Read and decode the next block into the buffer.
+     *
+     * @return true if a block was read, false at the end of the trace or on an error.
+     */
+    bool read_block();
+
+    std::ifstream file;                  ///< The trace file.
+    std::vector<TraceRecord> records;    ///< Records of the current block.
+    std::vector<unsigned char> packed;   ///< Packed bytes of the current block.
+    std::vector<unsigned char> scratch;  ///< Compressed bytes of the current block.
+    size_t position = 0;                 ///< Next record of the current block.
+    bool compressed = false;             ///< Blocks are deflate-compressed.
+    bool failed = false;                 ///< A block could not be read.
+};
+
+#endif
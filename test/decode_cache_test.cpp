@@ -0,0 +1,77 @@
+#include <cstdint>
+#include <cstdio>
+#include "block_engine.h"
+#include "cpu.h"
+#include "isa.h"
+#include "memory.h"
+#include "profiler.h"
+
+namespace {
+
+constexpr uint32_t LOOP = 0x1000;      ///< Address of the test loop.
+constexpr uint32_t LOOP_LENGTH = 3;    ///< Instructions in the test loop.
+constexpr uint64_t ITERATIONS = 20000; ///< Times the loop runs.
+
+/**
+ * @brief Run a loop that flushes the decode cache in every iteration.
+ *
+ * The loop is addi x1, x1, 1; fence.i; j back to the addi.
+ *
+ * @param blocks true to run the block engine, false for the pipelined model.
+ * @param profile true to attach a profiler, which needs a slot per instruction.
+ * @return true if the slots stayed one per instruction of the loop, false otherwise.
+ */
+bool check(bool blocks, bool profile) {
+    Memory memory;
+    memory.store_word(LOOP, Isa::encoding(Operation::ADDI) | 1 << 20 | 1 << 15 | 1 << 7);
+    memory.store_word(LOOP + 4, Isa::encoding(Operation::FENCE_I));
+    // j -8: imm[20|10:1|11|19:12] with imm = -8
+    memory.store_word(LOOP + 8, Isa::encoding(Operation::JAL) | 0xFF9FF000);
+
+    CPU cpu(memory);
+    Profiler profiler;
+    if (profile) {
+        cpu.set_profiler(&profiler);
+    }
+    cpu.set_pc(LOOP);
+    cpu.set_instruction_limit(ITERATIONS * LOOP_LENGTH);
+    if (blocks) {
+        BlockEngine engine(cpu);
+        engine.run();
+    } else {
+        cpu.run();
+    }
+
+    const char* name = blocks ? "block engine" : "pipelined model";
+    uint32_t iterations = cpu.get_register(1);
+    if (iterations + 1 < ITERATIONS) {
+        std::fprintf(stderr, "%s: the loop ran %u times, expected %llu\n", name, iterations,
+                     static_cast<unsigned long long>(ITERATIONS));
+        return false;
+    }
+    uint32_t slots = cpu.get_decode_cache().get_slot_count();
+    if (slots != LOOP_LENGTH) {
+        std::fprintf(stderr, "%s%s: %u decode cache slots for a %u instruction loop\n", name,
+                     profile ? " with a profiler" : "", slots, LOOP_LENGTH);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    unsigned failures = 0;
+    for (bool blocks : {false, true}) {
+        for (bool profile : {false, true}) {
+            failures += !check(blocks, profile);
+        }
+    }
+
+    if (failures) {
+        std::fprintf(stderr, "%u runs grew the decode cache slots\n", failures);
+        return 1;
+    }
+    std::printf("Re-decoded code reuses its decode cache slots\n");
+    return 0;
+}
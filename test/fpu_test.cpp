@@ -0,0 +1,331 @@
+#include <cfenv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "fpu.h"
+
+namespace {
+
+/**
+ * @brief An operation computed both by the emulator and on the host.
+ */
+struct Case {
+    const char* name;                                                 ///< Mnemonic, for failures.
+    int operands;                                                     ///< Operands taken, 1 to 3.
+    bool integer_source;                                              ///< The operand is an integer, not a float.
+    bool integer_result;                                              ///< The result is an integer, not a float.
+    uint32_t (*host)(uint32_t a, uint32_t b, uint32_t c);             ///< Host arithmetic in the current host mode.
+    uint32_t (*emulated)(uint32_t a, uint32_t b, uint32_t c, uint32_t rm, uint32_t& flags); ///< The Fpu call.
+};
+
+/**
+ * @brief A rounding mode under both names.
+ */
+struct Mode {
+    const char* name; ///< Mnemonic, for failures.
+    uint32_t rm;      ///< The RISC-V rounding mode.
+    int host;         ///< The host rounding mode.
+};
+
+/**
+ * @brief Reinterpret register bits as a float.
+ *
+ * @param bits The register bits.
+ * @return float The number.
+ */
+float value(uint32_t bits) {
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+/**
+ * @brief Reinterpret a float as register bits.
+ *
+ * @param value The number.
+ * @return uint32_t The register bits.
+ */
+uint32_t bits(float value) {
+    uint32_t result;
+    std::memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+/**
+ * @brief Convert to an integer the way FCVT.W.S and FCVT.WU.S do, in the current host mode.
+ *
+ * The compiler expands rint() assuming round to nearest, so the rounding
+ * function follows the host mode instead, and the flags its expansion
+ * leaves are replaced with the ones the conversion raises. Out-of-range
+ * values and NaN saturate with only invalid raised.
+ *
+ * @param a The operand.
+ * @param low The smallest integer of the type.
+ * @param high The largest integer of the type.
+ * @return uint32_t The integer.
+ */
+uint32_t host_to_integer(uint32_t a, double low, double high) {
+    double number = value(a);
+    double rounded;
+    switch (std::fegetround()) {
+    case FE_TOWARDZERO:
+        rounded = std::trunc(number);
+        break;
+    case FE_DOWNWARD:
+        rounded = std::floor(number);
+        break;
+    case FE_UPWARD:
+        rounded = std::ceil(number);
+        break;
+    default:
+        rounded = std::nearbyint(number);
+        break;
+    }
+    std::feclearexcept(FE_ALL_EXCEPT);
+    if (std::isnan(rounded) || rounded > high || rounded < low) {
+        std::feraiseexcept(FE_INVALID);
+        return static_cast<uint32_t>(static_cast<int64_t>(std::isnan(rounded) || rounded > high ? high : low));
+    }
+    if (rounded != number) {
+        std::feraiseexcept(FE_INEXACT);
+    }
+    return static_cast<uint32_t>(static_cast<int64_t>(rounded));
+}
+
+/**
+ * @brief Multiply and add with a single rounding, in the current host mode.
+ *
+ * RISC-V raises invalid for infinity times zero even when the addend is a
+ * quiet NaN, which the C library does not.
+ *
+ * @param a The first factor.
+ * @param b The second factor.
+ * @param c The addend.
+ * @return uint32_t The result.
+ */
+uint32_t host_fma(float a, float b, float c) {
+    if ((std::isinf(a) && b == 0) || (a == 0 && std::isinf(b))) {
+        std::feraiseexcept(FE_INVALID);
+    }
+    return bits(std::fma(a, b, c));
+}
+
+const Case CASES[] = {
+    {"fadd.s", 2, false, false, [](uint32_t a, uint32_t b, uint32_t) { return bits(value(a) + value(b)); },
+     [](uint32_t a, uint32_t b, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::add(a, b, rm, flags); }},
+    {"fsub.s", 2, false, false, [](uint32_t a, uint32_t b, uint32_t) { return bits(value(a) - value(b)); },
+     [](uint32_t a, uint32_t b, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::subtract(a, b, rm, flags); }},
+    {"fmul.s", 2, false, false, [](uint32_t a, uint32_t b, uint32_t) { return bits(value(a) * value(b)); },
+     [](uint32_t a, uint32_t b, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::multiply(a, b, rm, flags); }},
+    {"fdiv.s", 2, false, false, [](uint32_t a, uint32_t b, uint32_t) { return bits(value(a) / value(b)); },
+     [](uint32_t a, uint32_t b, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::divide(a, b, rm, flags); }},
+    {"fsqrt.s", 1, false, false, [](uint32_t a, uint32_t, uint32_t) { return bits(std::sqrt(value(a))); },
+     [](uint32_t a, uint32_t, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::square_root(a, rm, flags); }},
+    {"fmadd.s", 3, false, false, [](uint32_t a, uint32_t b, uint32_t c) { return host_fma(value(a), value(b), value(c)); },
+     [](uint32_t a, uint32_t b, uint32_t c, uint32_t rm, uint32_t& flags) {
+         return Fpu::fused_multiply_add(a, b, c, false, false, rm, flags);
+     }},
+    {"fnmadd.s", 3, false, false,
+     [](uint32_t a, uint32_t b, uint32_t c) { return host_fma(-value(a), value(b), -value(c)); },
+     [](uint32_t a, uint32_t b, uint32_t c, uint32_t rm, uint32_t& flags) {
+         return Fpu::fused_multiply_add(a, b, c, true, true, rm, flags);
+     }},
+    {"fcvt.w.s", 1, false, true, [](uint32_t a, uint32_t, uint32_t) { return host_to_integer(a, INT32_MIN, INT32_MAX); },
+     [](uint32_t a, uint32_t, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::to_signed(a, rm, flags); }},
+    {"fcvt.wu.s", 1, false, true, [](uint32_t a, uint32_t, uint32_t) { return host_to_integer(a, 0, UINT32_MAX); },
+     [](uint32_t a, uint32_t, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::to_unsigned(a, rm, flags); }},
+    {"fcvt.s.w", 1, true, false, [](uint32_t a, uint32_t, uint32_t) { return bits(static_cast<float>(static_cast<int32_t>(a))); },
+     [](uint32_t a, uint32_t, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::from_signed(a, rm, flags); }},
+    {"fcvt.s.wu", 1, true, false, [](uint32_t a, uint32_t, uint32_t) { return bits(static_cast<float>(a)); },
+     [](uint32_t a, uint32_t, uint32_t, uint32_t rm, uint32_t& flags) { return Fpu::from_unsigned(a, rm, flags); }},
+};
+
+// RMM has no host equivalent
+const Mode MODES[] = {{"rne", Fpu::RNE, FE_TONEAREST},
+                      {"rtz", Fpu::RTZ, FE_TOWARDZERO},
+                      {"rdn", Fpu::RDN, FE_DOWNWARD},
+                      {"rup", Fpu::RUP, FE_UPWARD}};
+
+// Signed zeros, the subnormal and overflow boundaries, the integer range limits and special values
+const uint32_t FLOAT_EDGES[] = {
+    0x00000000, 0x00000001, 0x00000002, 0x00000003, 0x003FFFFF, 0x00400000, 0x007FFFFF, 0x00800000, 0x00800001,
+    0x00FFFFFF, 0x01000000, 0x0C000000, 0x1F800000, 0x33800000, 0x34000000, 0x3EFFFFFF, 0x3F000000, 0x3F000001,
+    0x3F3FFFFF, 0x3F400000, 0x3F7FFFFF, 0x3F800000, 0x3F800001, 0x3FC00000, 0x3FFFFFFF, 0x40000000, 0x4B7FFFFF,
+    0x4B800000, 0x4EFFFFFF, 0x4F000000, 0x4F7FFFFF, 0x4F800000, 0x5F800000, 0x7EFFFFFF, 0x7F000000, 0x7F7FFFFE,
+    0x7F7FFFFF, 0x7F800000, 0x7F800001, 0x7FA00000, 0x7FC00000, 0x7FFFFFFF,
+};
+
+const uint32_t INTEGER_EDGES[] = {
+    0x00000000, 0x00000001, 0x00FFFFFF, 0x01000000, 0x01000001, 0x01000003, 0x7FFFFF7F, 0x7FFFFF80, 0x7FFFFFC0,
+    0x7FFFFFFF, 0x80000000, 0x80000001, 0x80000040, 0xFEFFFFFF, 0xFF000001, 0xFFFFFF7F, 0xFFFFFFFF,
+};
+
+/**
+ * @brief Translate host exception flags to fflags bits.
+ *
+ * @param host The flags fetestexcept() returned.
+ * @return uint32_t The fflags bits.
+ */
+uint32_t fflags(int host) {
+    return (host & FE_INEXACT ? Fpu::NX : 0) | (host & FE_UNDERFLOW ? Fpu::UF : 0) |
+           (host & FE_OVERFLOW ? Fpu::OF : 0) | (host & FE_DIVBYZERO ? Fpu::DZ : 0) |
+           (host & FE_INVALID ? Fpu::NV : 0);
+}
+
+/**
+ * @brief Compute an operation on the host in a rounding mode.
+ *
+ * The operands go through volatile variables so the compiler can neither
+ * fold the arithmetic nor move it out from between the mode changes.
+ *
+ * @param test The operation.
+ * @param mode The rounding mode.
+ * @param operands The operands.
+ * @param flags Receives the fflags bits raised.
+ * @return uint32_t The result.
+ */
+uint32_t reference(const Case& test, const Mode& mode, const uint32_t operands[3], uint32_t& flags) {
+    volatile uint32_t a = operands[0];
+    volatile uint32_t b = operands[1];
+    volatile uint32_t c = operands[2];
+    std::fesetround(mode.host);
+    std::feclearexcept(FE_ALL_EXCEPT);
+    volatile uint32_t result = test.host(a, b, c);
+    flags = fflags(std::fetestexcept(FE_ALL_EXCEPT));
+    std::fesetround(FE_TONEAREST);
+    return result;
+}
+
+/**
+ * @brief Check one operation on one set of operands against the host.
+ *
+ * NaN results only need to be the canonical NaN, which the host does not produce.
+ *
+ * @param test The operation.
+ * @param mode The rounding mode.
+ * @param operands The operands.
+ * @return true if the result and the flags agree, false otherwise.
+ */
+bool check(const Case& test, const Mode& mode, const uint32_t operands[3]) {
+    uint32_t expected_flags = 0;
+    uint32_t expected = reference(test, mode, operands, expected_flags);
+    uint32_t flags = 0;
+    std::feclearexcept(FE_ALL_EXCEPT);
+    uint32_t result = test.emulated(operands[0], operands[1], operands[2], mode.rm, flags);
+
+    bool nan = !test.integer_result && std::isnan(value(expected));
+    if ((nan ? result == Fpu::CANONICAL_NAN : result == expected) && flags == expected_flags) {
+        return true;
+    }
+    std::fprintf(stderr, "%s.%s", test.name, mode.name);
+    for (int i = 0; i < test.operands; ++i) {
+        std::fprintf(stderr, " 0x%08x", operands[i]);
+    }
+    std::fprintf(stderr, ": got 0x%08x flags 0x%02x, expected 0x%08x flags 0x%02x\n", result, flags, expected,
+                 expected_flags);
+    return false;
+}
+
+/**
+ * @brief Draw a random single-precision operand.
+ *
+ * Mixes the edge values, neighbours of the last operand for cancellation,
+ * and random bits, biased towards the exponents next to the subnormal and
+ * overflow boundaries.
+ *
+ * @param random The generator.
+ * @param previous The operand drawn before, for near values.
+ * @return uint32_t The operand.
+ */
+uint32_t float_operand(std::mt19937& random, uint32_t previous) {
+    uint32_t sign = random() & 0x80000000;
+    uint32_t fraction = random() & 0x007FFFFF;
+    switch (random() % 8) {
+    case 0:
+        return sign | FLOAT_EDGES[random() % (sizeof(FLOAT_EDGES) / sizeof(FLOAT_EDGES[0]))];
+    case 1:
+        return (previous ^ 0x80000000) + (random() % 16) - 8;
+    case 2:
+        return sign | (random() % 8) << 23 | fraction;
+    case 3:
+        return sign | (247 + random() % 8) << 23 | fraction;
+    case 4:
+        return sign | (96 + random() % 64) << 23 | fraction;
+    default:
+        return random();
+    }
+}
+
+/**
+ * @brief Draw a random integer operand.
+ *
+ * @param random The generator.
+ * @return uint32_t The operand.
+ */
+uint32_t integer_operand(std::mt19937& random) {
+    switch (random() % 4) {
+    case 0:
+        return INTEGER_EDGES[random() % (sizeof(INTEGER_EDGES) / sizeof(INTEGER_EDGES[0]))];
+    case 1:
+        return random() >> (random() % 32);
+    default:
+        return random();
+    }
+}
+
+} // namespace
+
+int main() {
+    unsigned failures = 0;
+    unsigned long checks = 0;
+
+    // Both signs of every edge value with each other, in every mode
+    std::vector<uint32_t> edges;
+    for (uint32_t edge : FLOAT_EDGES) {
+        edges.push_back(edge);
+        edges.push_back(edge | 0x80000000);
+    }
+    for (const Case& test : CASES) {
+        const std::vector<uint32_t> integers(std::begin(INTEGER_EDGES), std::end(INTEGER_EDGES));
+        const std::vector<uint32_t>& values = test.integer_source ? integers : edges;
+        size_t b_count = test.operands > 1 ? values.size() : 1;
+        size_t c_count = test.operands > 2 ? values.size() : 1;
+        for (const Mode& mode : MODES) {
+            for (size_t i = 0; i < values.size(); ++i) {
+                for (size_t j = 0; j < b_count; ++j) {
+                    for (size_t k = 0; k < c_count && failures < 20; ++k) {
+                        uint32_t operands[3] = {values[i], values[j], values[k]};
+                        failures += !check(test, mode, operands);
+                        ++checks;
+                    }
+                }
+            }
+        }
+    }
+
+    // Then random operands
+    std::mt19937 random(12345);
+    for (const Case& test : CASES) {
+        for (const Mode& mode : MODES) {
+            uint32_t operands[3] = {0, 0, 0};
+            for (int i = 0; i < 200000 && failures < 20; ++i) {
+                for (int j = 0; j < test.operands; ++j) {
+                    operands[j] = test.integer_source ? integer_operand(random)
+                                                      : float_operand(random, operands[j == 0 ? 2 : j - 1]);
+                }
+                failures += !check(test, mode, operands);
+                ++checks;
+            }
+        }
+    }
+
+    if (failures) {
+        std::fprintf(stderr, "%u floating-point results differ from the host\n", failures);
+        return 1;
+    }
+    std::printf("%lu floating-point results agree with the host in every rounding mode\n", checks);
+    return 0;
+}
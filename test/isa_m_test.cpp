@@ -0,0 +1,111 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include "isa.h"
+
+namespace {
+
+/**
+ * @brief Compute an M extension operation the slow way, in 64 and 128 bits.
+ *
+ * Wide arithmetic cannot overflow on 32-bit operands, so only division by
+ * zero needs a case of its own.
+ *
+ * @param operation The M extension operation.
+ * @param a The value of rs1.
+ * @param b The value of rs2.
+ * @return uint32_t The value for rd.
+ */
+uint32_t reference(Operation operation, uint32_t a, uint32_t b) {
+    int64_t sa = static_cast<int32_t>(a);
+    int64_t sb = static_cast<int32_t>(b);
+    switch (operation) {
+    case Operation::MUL:
+        return static_cast<uint32_t>(sa * sb);
+    case Operation::MULH:
+        return static_cast<uint32_t>(static_cast<uint64_t>(sa * sb) >> 32);
+    case Operation::MULHSU:
+        return static_cast<uint32_t>(static_cast<unsigned __int128>(static_cast<__int128>(sa) * b) >> 32);
+    case Operation::MULHU:
+        return static_cast<uint32_t>(static_cast<uint64_t>(a) * b >> 32);
+    case Operation::DIV:
+        return b == 0 ? UINT32_MAX : static_cast<uint32_t>(sa / sb);
+    case Operation::DIVU:
+        return b == 0 ? UINT32_MAX : a / b;
+    case Operation::REM:
+        return b == 0 ? a : static_cast<uint32_t>(sa % sb);
+    case Operation::REMU:
+        return b == 0 ? a : a % b;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Check one operation on one operand pair against an expected value.
+ *
+ * @param operation The operation.
+ * @param a The value of rs1.
+ * @param b The value of rs2.
+ * @param expected The value rd must get.
+ * @return true if the emulator agrees, false otherwise.
+ */
+bool check(Operation operation, uint32_t a, uint32_t b, uint32_t expected) {
+    uint32_t result = Isa::evaluate_alu(operation, a, b);
+    if (result == expected) {
+        return true;
+    }
+    std::fprintf(stderr, "%s 0x%08x, 0x%08x: got 0x%08x, expected 0x%08x\n", Isa::mnemonic(operation), a, b, result,
+                 expected);
+    return false;
+}
+
+} // namespace
+
+int main() {
+    const Operation operations[] = {Operation::MUL,  Operation::MULH, Operation::MULHSU, Operation::MULHU,
+                                    Operation::DIV,  Operation::DIVU, Operation::REM,    Operation::REMU};
+    const uint32_t edges[] = {0, 1, 2, 3, 0x7FFFFFFF, 0x80000000, 0x80000001, 0xFFFFFFFE, 0xFFFFFFFF, 0x0000FFFF,
+                              0xFFFF0000};
+    unsigned failures = 0;
+
+    // The cases the specification defines instead of trapping, and signed times unsigned
+    failures += !check(Operation::DIV, 7, 0, 0xFFFFFFFF);
+    failures += !check(Operation::DIVU, 7, 0, 0xFFFFFFFF);
+    failures += !check(Operation::REM, 7, 0, 7);
+    failures += !check(Operation::REMU, 7, 0, 7);
+    failures += !check(Operation::REM, 0x80000000, 0, 0x80000000);
+    failures += !check(Operation::DIV, 0x80000000, 0xFFFFFFFF, 0x80000000);
+    failures += !check(Operation::REM, 0x80000000, 0xFFFFFFFF, 0);
+    failures += !check(Operation::MULHSU, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF);
+    failures += !check(Operation::MULHSU, 0xFFFFFFFE, 3, 0xFFFFFFFF);
+    failures += !check(Operation::MULHSU, 0x80000000, 0xFFFFFFFF, 0x80000000);
+    failures += !check(Operation::MULHSU, 0xFFFFFFFF, 0, 0);
+
+    // Every pair of edge values, then random pairs biased towards them
+    for (Operation operation : operations) {
+        for (uint32_t a : edges) {
+            for (uint32_t b : edges) {
+                failures += !check(operation, a, b, reference(operation, a, b));
+            }
+        }
+    }
+    std::mt19937 random(12345);
+    auto operand = [&random, &edges]() {
+        uint32_t value = random();
+        return value % 4 == 0 ? edges[random() % (sizeof(edges) / sizeof(edges[0]))] : random();
+    };
+    for (int i = 0; i < 1000000 && failures < 20; ++i) {
+        Operation operation = operations[i % (sizeof(operations) / sizeof(operations[0]))];
+        uint32_t a = operand();
+        uint32_t b = operand();
+        failures += !check(operation, a, b, reference(operation, a, b));
+    }
+
+    if (failures) {
+        std::fprintf(stderr, "%u M extension results differ from the reference\n", failures);
+        return 1;
+    }
+    std::printf("M extension agrees with the reference\n");
+    return 0;
+}
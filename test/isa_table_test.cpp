@@ -0,0 +1,72 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include "cpu.h"
+#include "isa.h"
+
+namespace {
+
+/**
+ * @brief Check that an instruction word decodes and disassembles as an operation.
+ *
+ * @param operation The operation the word encodes.
+ * @param word The instruction word.
+ * @return true if the word round-trips, false otherwise.
+ */
+bool check(Operation operation, uint32_t word) {
+    const char* name = Isa::mnemonic(operation);
+    Operation matched = Isa::match(word);
+    if (matched != operation) {
+        std::fprintf(stderr, "%s 0x%08x: matched %s\n", name, word, Isa::mnemonic(matched));
+        return false;
+    }
+
+    DecodedInstruction decoded{};
+    if (!CPU::try_decode_instruction(word, decoded) || decoded.operation != operation) {
+        std::fprintf(stderr, "%s 0x%08x: decoded as %s\n", name, word, Isa::mnemonic(decoded.operation));
+        return false;
+    }
+
+    // The mnemonic comes first, alone or followed by the operands
+    std::string text = Isa::disassemble(decoded, 0x1000);
+    std::string prefix = name;
+    if (text.compare(0, prefix.size(), prefix) != 0 || (text.size() > prefix.size() && text[prefix.size()] != ' ')) {
+        std::fprintf(stderr, "%s 0x%08x: disassembled as \"%s\"\n", name, word, text.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 random(12345);
+    unsigned failures = 0;
+    unsigned words = 0;
+
+    // Every entry's match value, then with random bits in the fields its format leaves free
+    for (size_t i = 1; i < static_cast<size_t>(Operation::COUNT); ++i) {
+        Operation operation = static_cast<Operation>(i);
+        uint32_t match = Isa::encoding(operation);
+        uint32_t free = ~Isa::format_mask(Isa::format(operation));
+        if ((match & free) != 0) {
+            std::fprintf(stderr, "%s: match 0x%08x sets bits outside its format\n", Isa::mnemonic(operation), match);
+            ++failures;
+            continue;
+        }
+        failures += !check(operation, match);
+        ++words;
+        for (int j = 0; j < 1000 && free != 0; ++j) {
+            failures += !check(operation, match | (random() & free));
+            ++words;
+        }
+    }
+
+    if (failures) {
+        std::fprintf(stderr, "%u ISA table encodings do not round-trip\n", failures);
+        return 1;
+    }
+    std::printf("%u encodings of %zu ISA table entries round-trip\n", words, static_cast<size_t>(Operation::COUNT) - 1);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <map>
+#include <string>
+#include "cpu.h"
+#include "isa.h"
+#include "logger.h"
+#include "trace.h"
+
+namespace {
+
+/**
+ * @brief Get the mnemonic of a raw instruction word.
+ *
+ * @param instruction The raw instruction word.
+ * @return const char* The mnemonic, or "unknown" if it does not decode.
+ */
+const char* mnemonic(uint32_t instruction) {
+    DecodedInstruction decoded;
+    return CPU::try_decode_instruction(instruction, decoded) ? Isa::mnemonic(decoded.operation) : "unknown";
+}
+
+/**
+ * @brief Disassemble a raw instruction word.
+ *
+ * @param instruction The raw instruction word.
+ * @param pc Address of the instruction.
+ * @return std::string The instruction as assembly, or "unknown" if it does not decode.
+ */
+std::string disassemble(uint32_t instruction, uint32_t pc) {
+    DecodedInstruction decoded;
+    return CPU::try_decode_instruction(instruction, decoded) ? Isa::disassemble(decoded, pc) : "unknown";
+}
+
+} // namespace
+
+/**
+ * @brief Decode a binary trace written with --trace-file.
+ *
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return int 0 on success, 1 on bad usage or a damaged trace.
+ */
+int main(int argc, char* argv[]) {
+    std::string path;
+    uint64_t limit = 0;
+    bool summary = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--limit=", 0) == 0) {
+            limit = std::stoull(arg.substr(8));
+        } else if (arg == "--summary") {
+            summary = true;
+        } else if (path.empty() && arg.rfind("--", 0) != 0) {
+            path = arg;
+        } else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty()) {
+        LOG_ERROR("Usage: phlego_trace [--limit=<n>] [--summary] <trace>");
+        return 1;
+    }
+
+    // Decoding is silent, only damaged traces are reported
+    Logger::set_level(LOG_LEVEL_ERROR);
+
+    TraceReader reader;
+    if (!reader.open(path)) {
+        return 1;
+    }
+
+    // One line per record, or the instruction mix with --summary
+    TraceRecord record;
+    uint64_t count = 0, loads = 0, stores = 0;
+    std::map<std::string, uint64_t> mix;
+    while ((limit == 0 || count < limit) && reader.next(record)) {
+        ++count;
+        if (summary) {
+            ++mix[mnemonic(record.instruction)];
+            loads += (record.flags & TraceRecord::MEMORY_READ) != 0;
+            stores += (record.flags & TraceRecord::MEMORY_WRITE) != 0;
+            continue;
+        }
+
+        // Compressed instructions show their half word, like objdump does
+        char line[192];
+        int digits = Isa::instruction_length(record.instruction) * 2;
+        int length = std::snprintf(line, sizeof(line), "0x%08x  %*s%0*x  %-28s", record.pc, 8 - digits, "", digits,
+                                   record.instruction, disassemble(record.instruction, record.pc).c_str());
+        if (record.rd != 0) {
+            length += std::snprintf(line + length, sizeof(line) - length, "  x%-2u = 0x%08x", record.rd, record.rd_value);
+        }
+        if (record.flags & TraceRecord::MEMORY_READ) {
+            length += std::snprintf(line + length, sizeof(line) - length, "  [0x%08x] -> 0x%08x",
+                                    record.memory_address, record.memory_value);
+        } else if (record.flags & TraceRecord::MEMORY_WRITE) {
+            length += std::snprintf(line + length, sizeof(line) - length, "  [0x%08x] <- 0x%08x",
+                                    record.memory_address, record.memory_value);
+        }
+        while (line[length - 1] == ' ') {
+            --length;
+        }
+        line[length++] = '\n';
+        std::fwrite(line, 1, length, stdout);
+    }
+
+    if (summary) {
+        std::printf("Records: %llu  Loads: %llu  Stores: %llu  Compressed: %s\n",
+                    static_cast<unsigned long long>(count), static_cast<unsigned long long>(loads),
+                    static_cast<unsigned long long>(stores), reader.is_compressed() ? "yes" : "no");
+        for (const auto& entry : mix) {
+            std::printf("  %-8s %14llu\n", entry.first.c_str(), static_cast<unsigned long long>(entry.second));
+        }
+    }
+    return reader.has_failed() ? 1 : 0;
+}